@@ -0,0 +1,51 @@
+"""Rules for compiling FHIRPath constraints ahead of time.
+"""
+
+FHIR_PATH_PACKAGE = "@com_google_fhir//cc/google/fhir/fhir_path"
+
+def fhir_path_constraints_cc_library(name, messages, proto_deps, **kwargs):
+    """Generates native implementations of FHIRPath constraints.
+
+    Translates the fhir_path_constraint and fhir_path_message_constraint
+    annotations reachable from the given messages into C++ functions over the
+    generated message classes (see fhir_path_constraint_generator.h). Any binary
+    linking the resulting library evaluates the translated constraints natively
+    in FhirPathValidator; the remaining constraints are interpreted as before.
+
+    Args:
+      name: The name of the generated cc_library.
+      messages: Full names of the root messages, e.g.
+                "google.fhir.r4.core.ContainedResource".
+      proto_deps: The cc_proto_library targets defining the messages.
+      **kwargs: varargs. Passed through to the cc_library.
+    """
+    generator = name + "_generator"
+
+    # Dynamically linked so that the descriptors of all proto_deps are added
+    # to the generated pool, even though the generator does not reference them.
+    native.cc_binary(
+        name = generator,
+        linkstatic = 0,
+        deps = proto_deps + [
+            FHIR_PATH_PACKAGE + ":fhir_path_constraint_generator_main",
+        ],
+    )
+
+    native.genrule(
+        name = "_genrule_" + name,
+        outs = [name + ".cc"],
+        cmd = "$(location :%s) $@ %s" % (generator, " ".join(messages)),
+        tools = [":" + generator],
+    )
+
+    native.cc_library(
+        name = name,
+        srcs = [name + ".cc"],
+        deps = proto_deps + [
+            FHIR_PATH_PACKAGE + ":native_constraint_registry",
+            "@com_google_protobuf//:protobuf",
+        ],
+        # The generated code is only reached through its static registrations.
+        alwayslink = 1,
+        **kwargs
+    )
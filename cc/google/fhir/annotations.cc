@@ -18,24 +18,74 @@
 
 #include "google/protobuf/descriptor.pb.h"
 #include "google/protobuf/message.h"
+#include "google/fhir/descriptor_cache.h"
 #include "proto/annotations.pb.h"
 
 namespace google {
 namespace fhir {
 
+namespace {
+
+using ::google::protobuf::Descriptor;
+
+const bool ReadIsProfile(const Descriptor* descriptor) {
+  // Note ContainedResource is not a true FHIR type, an as such, profiles of
+  // contained resources don't have a fhir_profile_base
+  // TODO: Use an annotation for this.
+  return descriptor->options().ExtensionSize(proto::fhir_profile_base) > 0 ||
+         (descriptor->name() == "ContainedResource" &&
+          (descriptor->full_name() !=
+               "google.fhir.stu3.proto.ContainedResource" &&
+           descriptor->full_name() != "google.fhir.r4.core.ContainedResource" &&
+           descriptor->full_name() !=
+               "google.fhir.r5.proto.ContainedResource"));
+}
+
+DescriptorTraits ReadDescriptorTraits(const Descriptor* descriptor) {
+  const ::google::protobuf::MessageOptions& options = descriptor->options();
+  DescriptorTraits traits;
+  traits.structure_definition_kind =
+      options.GetExtension(proto::structure_definition_kind);
+  traits.fhir_version =
+      descriptor->file()->options().GetExtension(proto::fhir_version);
+  traits.structure_definition_url =
+      options.GetExtension(proto::fhir_structure_definition_url);
+  for (int i = 0; i < options.ExtensionSize(proto::fhir_profile_base); i++) {
+    traits.profile_bases.push_back(
+        options.GetExtension(proto::fhir_profile_base, i));
+  }
+  traits.value_regex = options.GetExtension(proto::value_regex);
+  traits.valueset = options.GetExtension(proto::fhir_valueset_url);
+  traits.fixed_system = options.GetExtension(proto::fhir_fixed_system);
+  traits.is_profile = ReadIsProfile(descriptor);
+  traits.is_choice_type_container = options.GetExtension(proto::is_choice_type);
+  traits.is_reference = options.ExtensionSize(proto::fhir_reference_type) > 0;
+  // TODO: Add a contained-resource specific annotation and read
+  // that instead.
+  traits.is_contained_resource = descriptor->name() == "ContainedResource";
+  return traits;
+}
+
+}  // namespace
+
+const DescriptorTraits& GetDescriptorTraits(
+    const ::google::protobuf::Descriptor* descriptor) {
+  static auto* cache =
+      new DescriptorCache<Descriptor, DescriptorTraits>(&ReadDescriptorTraits);
+  return cache->Get(descriptor);
+}
+
 const std::string& GetStructureDefinitionUrl(
     const ::google::protobuf::Descriptor* descriptor) {
-  return descriptor->options().GetExtension(
-      proto::fhir_structure_definition_url);
+  return GetDescriptorTraits(descriptor).structure_definition_url;
 }
 
 const bool IsProfileOf(const ::google::protobuf::Descriptor* descriptor,
                        const ::google::protobuf::Descriptor* potential_base) {
   const std::string& base_url = GetStructureDefinitionUrl(potential_base);
-  for (int i = 0;
-       i < descriptor->options().ExtensionSize(proto::fhir_profile_base); i++) {
-    if (descriptor->options().GetExtension(proto::fhir_profile_base, i) ==
-        base_url) {
+  for (const std::string& profile_base :
+       GetDescriptorTraits(descriptor).profile_bases) {
+    if (profile_base == base_url) {
       return true;
     }
   }
@@ -43,20 +93,11 @@ const bool IsProfileOf(const ::google::protobuf::Descriptor* descriptor,
 }
 
 const bool IsProfile(const ::google::protobuf::Descriptor* descriptor) {
-  // Note ContainedResource is not a true FHIR type, an as such, profiles of
-  // contained resources don't have a fhir_profile_base
-  // TODO: Use an annotation for this.
-  return descriptor->options().ExtensionSize(proto::fhir_profile_base) > 0 ||
-         (descriptor->name() == "ContainedResource" &&
-          (descriptor->full_name() !=
-               "google.fhir.stu3.proto.ContainedResource" &&
-           descriptor->full_name() != "google.fhir.r4.core.ContainedResource" &&
-           descriptor->full_name() !=
-               "google.fhir.r5.proto.ContainedResource"));
+  return GetDescriptorTraits(descriptor).is_profile;
 }
 
 const bool IsChoiceTypeContainer(const ::google::protobuf::Descriptor* descriptor) {
-  return descriptor->options().GetExtension(proto::is_choice_type);
+  return GetDescriptorTraits(descriptor).is_choice_type_container;
 }
 
 const bool IsChoiceType(const ::google::protobuf::FieldDescriptor* field) {
@@ -65,26 +106,26 @@ const bool IsChoiceType(const ::google::protobuf::FieldDescriptor* field) {
 }
 
 const bool IsPrimitive(const ::google::protobuf::Descriptor* descriptor) {
-  return descriptor->options().GetExtension(proto::structure_definition_kind) ==
+  return GetDescriptorTraits(descriptor).structure_definition_kind ==
          proto::StructureDefinitionKindValue::KIND_PRIMITIVE_TYPE;
 }
 
 const bool IsComplex(const ::google::protobuf::Descriptor* descriptor) {
-  return descriptor->options().GetExtension(proto::structure_definition_kind) ==
+  return GetDescriptorTraits(descriptor).structure_definition_kind ==
          proto::StructureDefinitionKindValue::KIND_COMPLEX_TYPE;
 }
 
 const bool IsResource(const ::google::protobuf::Descriptor* descriptor) {
-  return descriptor->options().GetExtension(proto::structure_definition_kind) ==
+  return GetDescriptorTraits(descriptor).structure_definition_kind ==
          proto::StructureDefinitionKindValue::KIND_RESOURCE;
 }
 
 const bool IsReference(const ::google::protobuf::Descriptor* descriptor) {
-  return descriptor->options().ExtensionSize(proto::fhir_reference_type) > 0;
+  return GetDescriptorTraits(descriptor).is_reference;
 }
 
 const std::string& GetValueset(const ::google::protobuf::Descriptor* descriptor) {
-  return descriptor->options().GetExtension(proto::fhir_valueset_url);
+  return GetDescriptorTraits(descriptor).valueset;
 }
 
 const bool HasValueset(const ::google::protobuf::Descriptor* descriptor) {
@@ -92,7 +133,7 @@ const bool HasValueset(const ::google::protobuf::Descriptor* descriptor) {
 }
 
 const std::string& GetFixedSystem(const ::google::protobuf::Descriptor* descriptor) {
-  return descriptor->options().GetExtension(proto::fhir_fixed_system);
+  return GetDescriptorTraits(descriptor).fixed_system;
 }
 
 const bool HasFixedSystem(const ::google::protobuf::Descriptor* descriptor) {
@@ -111,7 +152,7 @@ const std::string& GetInlinedCodingCode(
 
 const std::string& GetFixedCodingSystem(
     const ::google::protobuf::Descriptor* descriptor) {
-  return descriptor->options().GetExtension(proto::fhir_fixed_system);
+  return GetDescriptorTraits(descriptor).fixed_system;
 }
 
 const bool HasFixedCodingSystem(const ::google::protobuf::Descriptor* descriptor) {
@@ -129,7 +170,7 @@ const bool HasSourceCodeSystem(
 }
 
 const std::string& GetValueRegex(const ::google::protobuf::Descriptor* descriptor) {
-  return descriptor->options().GetExtension(proto::value_regex);
+  return GetDescriptorTraits(descriptor).value_regex;
 }
 
 const bool HasInlinedExtensionUrl(const ::google::protobuf::FieldDescriptor* field) {
@@ -138,7 +179,7 @@ const bool HasInlinedExtensionUrl(const ::google::protobuf::FieldDescriptor* fie
 
 const proto::FhirVersion GetFhirVersion(
     const ::google::protobuf::Descriptor* descriptor) {
-  return descriptor->file()->options().GetExtension(proto::fhir_version);
+  return GetDescriptorTraits(descriptor).fhir_version;
 }
 
 const proto::FhirVersion GetFhirVersion(const ::google::protobuf::Message& message) {
@@ -150,9 +191,7 @@ const bool IsContainedResource(const ::google::protobuf::Message& message) {
 }
 
 const bool IsContainedResource(const ::google::protobuf::Descriptor* descriptor) {
-  // TODO: Add a contained-resource specific annotation and read
-  // that instead.
-  return descriptor->name() == "ContainedResource";
+  return GetDescriptorTraits(descriptor).is_contained_resource;
 }
 
 }  // namespace fhir
@@ -16,6 +16,7 @@
 #define GOOGLE_FHIR_ANNOTATIONS_H_
 
 #include <string>
+#include <vector>
 
 #include "google/protobuf/descriptor.pb.h"
 #include "google/protobuf/descriptor.h"
@@ -25,6 +26,29 @@
 namespace google {
 namespace fhir {
 
+// The FHIR annotations of a message type that are looked up on hot paths,
+// e.g. for every field that is parsed, printed or validated.
+struct DescriptorTraits {
+  proto::StructureDefinitionKindValue structure_definition_kind;
+  proto::FhirVersion fhir_version;
+  std::string structure_definition_url;
+  std::vector<std::string> profile_bases;
+  std::string value_regex;
+  std::string valueset;
+  std::string fixed_system;
+  bool is_profile;
+  bool is_choice_type_container;
+  bool is_reference;
+  bool is_contained_resource;
+};
+
+// Returns the FHIR annotations of the given message type. These are read from
+// the descriptor's options the first time a descriptor is seen and cached for
+// the lifetime of the process; later lookups take no locks. The functions
+// below that take a Descriptor are answered from this cache.
+const DescriptorTraits& GetDescriptorTraits(
+    const ::google::protobuf::Descriptor* descriptor);
+
 const std::string& GetStructureDefinitionUrl(
     const ::google::protobuf::Descriptor* descriptor);
 
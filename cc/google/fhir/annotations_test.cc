@@ -0,0 +1,231 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "google/fhir/annotations.h"
+
+#include <string>
+#include <vector>
+
+#include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/descriptor.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/container/flat_hash_set.h"
+#include "proto/annotations.pb.h"
+#include "proto/r4/core/datatypes.pb.h"
+#include "proto/r4/core/resources/bundle_and_contained_resource.pb.h"
+#include "proto/r4/core/resources/observation.pb.h"
+#include "proto/r4/core/resources/patient.pb.h"
+#include "proto/r4/uscore.pb.h"
+#include "proto/stu3/datatypes.pb.h"
+#include "proto/stu3/resources.pb.h"
+#include "proto/stu3/uscore.pb.h"
+#include "testdata/r4/profiles/test.pb.h"
+
+namespace google {
+namespace fhir {
+
+namespace {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::MessageOptions;
+using ::testing::ElementsAre;
+
+// Returns the given descriptors and every message type they reference,
+// through their fields or as nested types.
+std::vector<const Descriptor*> ReachableDescriptors(
+    const std::vector<const Descriptor*>& roots) {
+  std::vector<const Descriptor*> descriptors;
+  absl::flat_hash_set<const Descriptor*> seen;
+  std::vector<const Descriptor*> pending = roots;
+  while (!pending.empty()) {
+    const Descriptor* descriptor = pending.back();
+    pending.pop_back();
+    if (!seen.insert(descriptor).second) {
+      continue;
+    }
+    descriptors.push_back(descriptor);
+    for (int i = 0; i < descriptor->field_count(); i++) {
+      if (descriptor->field(i)->message_type() != nullptr) {
+        pending.push_back(descriptor->field(i)->message_type());
+      }
+    }
+    for (int i = 0; i < descriptor->nested_type_count(); i++) {
+      pending.push_back(descriptor->nested_type(i));
+    }
+  }
+  return descriptors;
+}
+
+// Checks the cached traits of the descriptor against its options, and the
+// annotation helpers against the traits.
+void ExpectTraitsMatchOptions(const Descriptor* descriptor) {
+  SCOPED_TRACE(descriptor->full_name());
+  const MessageOptions& options = descriptor->options();
+  const DescriptorTraits& traits = GetDescriptorTraits(descriptor);
+  EXPECT_EQ(&traits, &GetDescriptorTraits(descriptor));
+
+  EXPECT_EQ(traits.structure_definition_kind,
+            options.GetExtension(proto::structure_definition_kind));
+  EXPECT_EQ(traits.fhir_version,
+            descriptor->file()->options().GetExtension(proto::fhir_version));
+  EXPECT_EQ(traits.structure_definition_url,
+            options.GetExtension(proto::fhir_structure_definition_url));
+  ASSERT_EQ(traits.profile_bases.size(),
+            options.ExtensionSize(proto::fhir_profile_base));
+  for (int i = 0; i < traits.profile_bases.size(); i++) {
+    EXPECT_EQ(traits.profile_bases[i],
+              options.GetExtension(proto::fhir_profile_base, i));
+  }
+  EXPECT_EQ(traits.value_regex, options.GetExtension(proto::value_regex));
+  EXPECT_EQ(traits.valueset, options.GetExtension(proto::fhir_valueset_url));
+  EXPECT_EQ(traits.fixed_system,
+            options.GetExtension(proto::fhir_fixed_system));
+  EXPECT_EQ(traits.is_choice_type_container,
+            options.GetExtension(proto::is_choice_type));
+  EXPECT_EQ(traits.is_reference,
+            options.ExtensionSize(proto::fhir_reference_type) > 0);
+  EXPECT_EQ(traits.is_contained_resource,
+            descriptor->name() == "ContainedResource");
+  if (!traits.is_contained_resource) {
+    EXPECT_EQ(traits.is_profile, !traits.profile_bases.empty());
+  }
+
+  EXPECT_EQ(GetStructureDefinitionUrl(descriptor),
+            traits.structure_definition_url);
+  EXPECT_EQ(GetFhirVersion(descriptor), traits.fhir_version);
+  EXPECT_EQ(IsProfile(descriptor), traits.is_profile);
+  EXPECT_EQ(IsChoiceTypeContainer(descriptor),
+            traits.is_choice_type_container);
+  EXPECT_EQ(IsPrimitive(descriptor),
+            traits.structure_definition_kind ==
+                proto::StructureDefinitionKindValue::KIND_PRIMITIVE_TYPE);
+  EXPECT_EQ(IsComplex(descriptor),
+            traits.structure_definition_kind ==
+                proto::StructureDefinitionKindValue::KIND_COMPLEX_TYPE);
+  EXPECT_EQ(IsResource(descriptor),
+            traits.structure_definition_kind ==
+                proto::StructureDefinitionKindValue::KIND_RESOURCE);
+  EXPECT_EQ(IsReference(descriptor), traits.is_reference);
+  EXPECT_EQ(GetValueset(descriptor), traits.valueset);
+  EXPECT_EQ(HasValueset(descriptor), !traits.valueset.empty());
+  EXPECT_EQ(GetFixedSystem(descriptor), traits.fixed_system);
+  EXPECT_EQ(GetFixedCodingSystem(descriptor), traits.fixed_system);
+  EXPECT_EQ(GetValueRegex(descriptor), traits.value_regex);
+  EXPECT_EQ(IsContainedResource(descriptor), traits.is_contained_resource);
+  for (const std::string& base : traits.profile_bases) {
+    EXPECT_FALSE(base.empty());
+  }
+}
+
+TEST(AnnotationsTest, DescriptorTraitsMatchOptionsR4) {
+  const std::vector<const Descriptor*> descriptors = ReachableDescriptors(
+      {r4::core::ContainedResource::descriptor(),
+       r4::uscore::USCorePatientProfile::descriptor(),
+       r4::testing::Bundle::descriptor()});
+  EXPECT_GT(descriptors.size(), 1000);
+  for (const Descriptor* descriptor : descriptors) {
+    ExpectTraitsMatchOptions(descriptor);
+  }
+}
+
+TEST(AnnotationsTest, DescriptorTraitsMatchOptionsStu3) {
+  const std::vector<const Descriptor*> descriptors = ReachableDescriptors(
+      {stu3::proto::ContainedResource::descriptor(),
+       stu3::uscore::UsCorePatient::descriptor()});
+  EXPECT_GT(descriptors.size(), 1000);
+  for (const Descriptor* descriptor : descriptors) {
+    ExpectTraitsMatchOptions(descriptor);
+  }
+}
+
+TEST(AnnotationsTest, DescriptorTraitsOfPrimitiveTypes) {
+  const DescriptorTraits& r4_string =
+      GetDescriptorTraits(r4::core::String::descriptor());
+  EXPECT_EQ(r4_string.structure_definition_kind,
+            proto::StructureDefinitionKindValue::KIND_PRIMITIVE_TYPE);
+  EXPECT_EQ(r4_string.fhir_version, proto::R4);
+  EXPECT_EQ(r4_string.structure_definition_url,
+            "http://hl7.org/fhir/StructureDefinition/string");
+  EXPECT_FALSE(r4_string.value_regex.empty());
+  EXPECT_FALSE(r4_string.is_profile);
+
+  const DescriptorTraits& stu3_decimal =
+      GetDescriptorTraits(stu3::proto::Decimal::descriptor());
+  EXPECT_EQ(stu3_decimal.structure_definition_kind,
+            proto::StructureDefinitionKindValue::KIND_PRIMITIVE_TYPE);
+  EXPECT_EQ(stu3_decimal.fhir_version, proto::STU3);
+  EXPECT_FALSE(stu3_decimal.value_regex.empty());
+
+  // Codes bound to a value set are primitives of their own.
+  const DescriptorTraits& gender =
+      GetDescriptorTraits(r4::core::Patient::GenderCode::descriptor());
+  EXPECT_EQ(gender.structure_definition_kind,
+            proto::StructureDefinitionKindValue::KIND_PRIMITIVE_TYPE);
+  EXPECT_FALSE(gender.valueset.empty());
+}
+
+TEST(AnnotationsTest, DescriptorTraitsOfComplexTypesAndResources) {
+  EXPECT_TRUE(GetDescriptorTraits(r4::core::Reference::descriptor())
+                  .is_reference);
+  EXPECT_TRUE(GetDescriptorTraits(r4::core::Observation::ValueX::descriptor())
+                  .is_choice_type_container);
+
+  const DescriptorTraits& patient =
+      GetDescriptorTraits(r4::core::Patient::descriptor());
+  EXPECT_EQ(patient.structure_definition_kind,
+            proto::StructureDefinitionKindValue::KIND_RESOURCE);
+  EXPECT_FALSE(patient.is_profile);
+  EXPECT_THAT(patient.profile_bases, ElementsAre());
+
+  for (const Descriptor* descriptor :
+       {r4::core::ContainedResource::descriptor(),
+        stu3::proto::ContainedResource::descriptor()}) {
+    const DescriptorTraits& traits = GetDescriptorTraits(descriptor);
+    EXPECT_TRUE(traits.is_contained_resource) << descriptor->full_name();
+    EXPECT_FALSE(traits.is_profile) << descriptor->full_name();
+  }
+}
+
+TEST(AnnotationsTest, DescriptorTraitsOfProfiles) {
+  const DescriptorTraits& r4_patient =
+      GetDescriptorTraits(r4::uscore::USCorePatientProfile::descriptor());
+  EXPECT_TRUE(r4_patient.is_profile);
+  EXPECT_EQ(r4_patient.fhir_version, proto::R4);
+  EXPECT_THAT(r4_patient.profile_bases,
+              ElementsAre("http://hl7.org/fhir/StructureDefinition/Patient"));
+  EXPECT_TRUE(IsProfileOf<r4::core::Patient>(
+      r4::uscore::USCorePatientProfile::descriptor()));
+
+  const DescriptorTraits& stu3_patient =
+      GetDescriptorTraits(stu3::uscore::UsCorePatient::descriptor());
+  EXPECT_TRUE(stu3_patient.is_profile);
+  EXPECT_EQ(stu3_patient.fhir_version, proto::STU3);
+  EXPECT_TRUE(IsProfileOf<stu3::proto::Patient>(
+      stu3::uscore::UsCorePatient::descriptor()));
+
+  const DescriptorTraits& bundle =
+      GetDescriptorTraits(r4::testing::Bundle::descriptor());
+  EXPECT_TRUE(bundle.is_profile);
+  EXPECT_EQ(bundle.structure_definition_url,
+            "http://test/url/base/StructureDefinition/Bundle");
+  EXPECT_THAT(bundle.profile_bases,
+              ElementsAre("http://hl7.org/fhir/StructureDefinition/Bundle"));
+  EXPECT_TRUE(IsProfileOf<r4::core::Bundle>(r4::testing::Bundle::descriptor()));
+}
+
+}  // namespace
+
+}  // namespace fhir
+}  // namespace google
@@ -0,0 +1,260 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "google/fhir/base64.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <array>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+namespace google {
+namespace fhir {
+
+namespace {
+
+constexpr char kAlphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// The values of base64 characters, or one of the following for the others.
+constexpr int8_t kInvalid = -1;
+constexpr int8_t kWhitespace = -2;
+
+constexpr std::array<int8_t, 256> MakeDecodeTable() {
+  std::array<int8_t, 256> table{};
+  for (int c = 0; c < 256; c++) {
+    table[c] = kInvalid;
+  }
+  for (int value = 0; value < 64; value++) {
+    table[static_cast<uint8_t>(kAlphabet[value])] = value;
+  }
+  // As absl::ascii_isspace.
+  for (char c : {' ', '\t', '\n', '\v', '\f', '\r'}) {
+    table[static_cast<uint8_t>(c)] = kWhitespace;
+  }
+  return table;
+}
+
+constexpr std::array<int8_t, 256> kDecodeTable = MakeDecodeTable();
+
+// As absl::Base64Unescape, "." is accepted for padding along with "=".
+bool IsPadding(char c) { return c == '=' || c == '.'; }
+
+#if defined(__SSSE3__)
+
+// Encodes the first 12 of the 16 bytes at src into 16 characters at dst, by
+// spreading each 3 bytes over 4 bytes of 6 bits each and then mapping those to
+// the alphabet with a lookup of the offset for each range of values.
+void EncodeBlock(const uint8_t* src, char* dst) {
+  __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+  in = _mm_shuffle_epi8(
+      in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+  const __m128i high = _mm_mulhi_epu16(
+      _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)),
+      _mm_set1_epi32(0x04000040));
+  const __m128i low = _mm_mullo_epi16(
+      _mm_and_si128(in, _mm_set1_epi32(0x003f03f0)),
+      _mm_set1_epi32(0x01000010));
+  const __m128i indices = _mm_or_si128(high, low);
+
+  // 0 for 26-51, 1-12 for 52-63 and 13 for 0-25.
+  __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+  range = _mm_or_si128(
+      range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices),
+                           _mm_set1_epi8(13)));
+  const __m128i offsets = _mm_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  _mm_storeu_si128(
+      reinterpret_cast<__m128i*>(dst),
+      _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range)));
+}
+
+// Decodes the 16 characters at src into 12 bytes at dst, which must have room
+// for 16. Returns false, without writing, if any of the characters is not in
+// the alphabet, e.g. whitespace or padding.
+bool DecodeBlock(const char* src, uint8_t* dst) {
+  const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+  const __m128i high_nibbles =
+      _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0f));
+  const __m128i low_nibbles = _mm_and_si128(in, _mm_set1_epi8(0x0f));
+
+  // A character is valid if the bits for its low and high nibbles do not
+  // overlap.
+  const __m128i low_bits = _mm_shuffle_epi8(
+      _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                    0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a),
+      low_nibbles);
+  const __m128i high_bits = _mm_shuffle_epi8(
+      _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10,
+                    0x10, 0x10, 0x10, 0x10, 0x10, 0x10),
+      high_nibbles);
+  if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(low_bits, high_bits),
+                                       _mm_setzero_si128())) != 0) {
+    return false;
+  }
+
+  // Maps characters to their values by the offset for their high nibble,
+  // which is the same for all characters with that nibble but "/".
+  const __m128i is_slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+  const __m128i offsets = _mm_shuffle_epi8(
+      _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0),
+      _mm_add_epi8(is_slash, high_nibbles));
+  const __m128i values = _mm_add_epi8(in, offsets);
+
+  // Packs each 4 values of 6 bits into 3 bytes.
+  const __m128i pairs =
+      _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+  const __m128i triples = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+  _mm_storeu_si128(
+      reinterpret_cast<__m128i*>(dst),
+      _mm_shuffle_epi8(triples, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14,
+                                              13, 12, -1, -1, -1, -1)));
+  return true;
+}
+
+#endif
+
+// Encodes size bytes from src into (size + 2) / 3 * 4 characters at dst.
+void Encode(const uint8_t* src, size_t size, char* dst) {
+  size_t i = 0;
+#if defined(__SSSE3__)
+  // Each block reads 16 bytes but only encodes 12.
+  for (; size - i >= 16; i += 12, dst += 16) {
+    EncodeBlock(src + i, dst);
+  }
+#endif
+  for (; size - i >= 3; i += 3, dst += 4) {
+    const uint32_t triple = (src[i] << 16) | (src[i + 1] << 8) | src[i + 2];
+    dst[0] = kAlphabet[triple >> 18];
+    dst[1] = kAlphabet[(triple >> 12) & 0x3f];
+    dst[2] = kAlphabet[(triple >> 6) & 0x3f];
+    dst[3] = kAlphabet[triple & 0x3f];
+  }
+  if (i < size) {
+    const uint32_t triple =
+        (src[i] << 16) | (i + 1 < size ? src[i + 1] << 8 : 0);
+    dst[0] = kAlphabet[triple >> 18];
+    dst[1] = kAlphabet[(triple >> 12) & 0x3f];
+    dst[2] = i + 1 < size ? kAlphabet[(triple >> 6) & 0x3f] : '=';
+    dst[3] = '=';
+  }
+}
+
+}  // namespace
+
+void AppendBase64(absl::string_view data, std::string* output, size_t stride,
+                  absl::string_view separator) {
+  const size_t encoded_size = (data.size() + 2) / 3 * 4;
+  const size_t separators =
+      stride > 0 && encoded_size > 0 ? (encoded_size - 1) / stride : 0;
+  const size_t begin = output->size();
+  output->resize(begin + encoded_size + separators * separator.size());
+  char* const out = &(*output)[begin];
+
+  // The encoding is written at the end of the output, and then each line of
+  // it moved forward to make room for the separators before it. Lines never
+  // overlap the parts of the encoding that have yet to be moved.
+  char* const encoded = out + separators * separator.size();
+  Encode(reinterpret_cast<const uint8_t*>(data.data()), data.size(), encoded);
+  for (size_t line = 0; line < separators; line++) {
+    char* const line_out = out + line * (stride + separator.size());
+    memmove(line_out, encoded + line * stride, stride);
+    memcpy(line_out + stride, separator.data(), separator.size());
+  }
+}
+
+bool Base64Decode(absl::string_view encoded, std::string* output) {
+  // Room for the SIMD path to write 16 bytes for every 12 it decodes.
+  output->resize(encoded.size() / 4 * 3 + 16);
+  uint8_t* const out = reinterpret_cast<uint8_t*>(&(*output)[0]);
+  size_t written = 0;
+
+  // The values of the characters of the current group of four decoded so far.
+  uint32_t group = 0;
+  int group_size = 0;
+  size_t i = 0;
+  for (; i < encoded.size(); i++) {
+#if defined(__SSSE3__)
+    if (group_size == 0) {
+      while (encoded.size() - i >= 16 &&
+             DecodeBlock(encoded.data() + i, out + written)) {
+        i += 16;
+        written += 12;
+      }
+      if (i == encoded.size()) {
+        break;
+      }
+    }
+#endif
+    const int8_t value = kDecodeTable[static_cast<uint8_t>(encoded[i])];
+    if (value >= 0) {
+      group = (group << 6) | value;
+      if (++group_size == 4) {
+        out[written++] = group >> 16;
+        out[written++] = group >> 8;
+        out[written++] = group;
+        group = 0;
+        group_size = 0;
+      }
+    } else if (value == kWhitespace) {
+      continue;
+    } else if (IsPadding(encoded[i])) {
+      break;
+    } else {
+      return false;
+    }
+  }
+
+  // A final group of 2 or 3 characters stands for 1 or 2 bytes, and may be
+  // padded to 4 characters.
+  size_t expected_padding = 0;
+  switch (group_size) {
+    case 0:
+      break;
+    case 1:
+      return false;
+    case 2:
+      out[written++] = group >> 4;
+      expected_padding = 2;
+      break;
+    case 3:
+      out[written++] = group >> 10;
+      out[written++] = group >> 2;
+      expected_padding = 1;
+      break;
+  }
+  size_t padding = 0;
+  for (; i < encoded.size(); i++) {
+    if (IsPadding(encoded[i])) {
+      padding++;
+    } else if (kDecodeTable[static_cast<uint8_t>(encoded[i])] != kWhitespace) {
+      return false;
+    }
+  }
+  if (padding != 0 && padding != expected_padding) {
+    return false;
+  }
+  output->resize(written);
+  return true;
+}
+
+}  // namespace fhir
+}  // namespace google
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GOOGLE_FHIR_BASE64_H_
+#define GOOGLE_FHIR_BASE64_H_
+
+#include <stddef.h>
+
+#include <string>
+
+#include "absl/strings/string_view.h"
+
+namespace google {
+namespace fhir {
+
+// Base64 encoding and decoding for base64Binary primitives, which carry most
+// of the bytes of Binary, Attachment and DocumentReference content. With SSSE3
+// (and so on every SSE4 or AVX target), 12 bytes are encoded to 16 characters,
+// and 16 characters decoded to 12 bytes, at a time; otherwise a table-driven
+// scalar loop is used. The output is the same either way.
+
+// Appends the standard, padded base64 encoding of data to output. If stride is
+// positive, separator is inserted after every stride characters of the
+// encoding, except at its end, as described by the separator-stride extension
+// of base64Binary.
+void AppendBase64(absl::string_view data, std::string* output,
+                  size_t stride = 0, absl::string_view separator = "");
+
+// Decodes standard base64 into output, with the same rules as
+// absl::Base64Unescape: whitespace, such as separators, is skipped anywhere,
+// and padding is optional but must be complete if present. Returns false if
+// encoded is not valid base64.
+bool Base64Decode(absl::string_view encoded, std::string* output);
+
+}  // namespace fhir
+}  // namespace google
+
+#endif  // GOOGLE_FHIR_BASE64_H_
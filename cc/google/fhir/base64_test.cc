@@ -0,0 +1,119 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "google/fhir/base64.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "absl/strings/escaping.h"
+
+namespace google {
+namespace fhir {
+
+namespace {
+
+std::string Encode(absl::string_view data, size_t stride = 0,
+                   absl::string_view separator = "") {
+  std::string output;
+  AppendBase64(data, &output, stride, separator);
+  return output;
+}
+
+// Bytes of every value, long enough to cover several SIMD blocks and a tail.
+std::string TestData(int size) {
+  std::string data;
+  for (int i = 0; i < size; i++) {
+    data.push_back(static_cast<char>(i * 37 + 11));
+  }
+  return data;
+}
+
+TEST(Base64Test, EncodesKnownValues) {
+  EXPECT_EQ(Encode(""), "");
+  EXPECT_EQ(Encode("f"), "Zg==");
+  EXPECT_EQ(Encode("fo"), "Zm8=");
+  EXPECT_EQ(Encode("foo"), "Zm9v");
+  EXPECT_EQ(Encode("foobar"), "Zm9vYmFy");
+
+  std::string output = "prefix";
+  AppendBase64("foo", &output);
+  EXPECT_EQ(output, "prefixZm9v");
+}
+
+TEST(Base64Test, EncodesAsAbsl) {
+  for (int size = 0; size < 300; size++) {
+    const std::string data = TestData(size);
+    EXPECT_EQ(Encode(data), absl::Base64Escape(data)) << size;
+  }
+}
+
+TEST(Base64Test, InsertsSeparators) {
+  EXPECT_EQ(Encode("foobar", 4, " "), "Zm9v YmFy");
+  EXPECT_EQ(Encode("foobarf", 4, "  "), "Zm9v  YmFy  Zg==");
+  EXPECT_EQ(Encode("foobar", 3, "\n"), "Zm9\nvYm\nFy");
+  EXPECT_EQ(Encode("foobar", 8, " "), "Zm9vYmFy");
+  EXPECT_EQ(Encode("", 4, " "), "");
+
+  const std::string encoded = absl::Base64Escape(TestData(200));
+  std::string expected;
+  for (size_t i = 0; i < encoded.size(); i += 76) {
+    expected += encoded.substr(i, 76);
+    if (i + 76 < encoded.size()) {
+      expected += "\r\n";
+    }
+  }
+  EXPECT_EQ(Encode(TestData(200), 76, "\r\n"), expected);
+}
+
+TEST(Base64Test, DecodesAsEncoded) {
+  for (int size = 0; size < 300; size++) {
+    const std::string data = TestData(size);
+    std::string decoded;
+    ASSERT_TRUE(Base64Decode(Encode(data), &decoded)) << size;
+    EXPECT_EQ(decoded, data) << size;
+    ASSERT_TRUE(Base64Decode(Encode(data, 5, " "), &decoded)) << size;
+    EXPECT_EQ(decoded, data) << size;
+  }
+}
+
+TEST(Base64Test, DecodesPaddingAndWhitespace) {
+  std::string decoded;
+  for (const char* encoded : {"Zm8=", "Zm8", "Zm8.", " Z m\n8 = "}) {
+    ASSERT_TRUE(Base64Decode(encoded, &decoded)) << encoded;
+    EXPECT_EQ(decoded, "fo") << encoded;
+  }
+  for (const char* encoded : {"Zg==", "Zg", "Zg\t=\t="}) {
+    ASSERT_TRUE(Base64Decode(encoded, &decoded)) << encoded;
+    EXPECT_EQ(decoded, "f") << encoded;
+  }
+  ASSERT_TRUE(Base64Decode("", &decoded));
+  EXPECT_EQ(decoded, "");
+}
+
+TEST(Base64Test, RejectsInvalidInput) {
+  std::string decoded;
+  for (const char* encoded :
+       {"Zm9v!", "Z", "Zm9vY", "Zg=", "Zm8==", "Zm9v=", "Zg==Zg==",
+        "Zm9-Zm9vZm9vZm9vZm9v"}) {
+    EXPECT_FALSE(Base64Decode(encoded, &decoded)) << encoded;
+  }
+}
+
+}  // namespace
+
+}  // namespace fhir
+}  // namespace google
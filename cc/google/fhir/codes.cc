@@ -14,14 +14,18 @@
 
 #include "google/fhir/codes.h"
 
-#include <unordered_map>
+#include <algorithm>
+#include <string>
+#include <vector>
 
 #include "google/protobuf/descriptor.pb.h"
 #include "google/protobuf/descriptor.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/ascii.h"
-#include "absl/synchronization/mutex.h"
+#include "absl/strings/string_view.h"
 #include "google/fhir/annotations.h"
+#include "google/fhir/descriptor_cache.h"
 #include "google/fhir/fhir_types.h"
 #include "google/fhir/proto_util.h"
 #include "google/fhir/util.h"
@@ -37,7 +41,6 @@ using ::google::protobuf::EnumValueDescriptor;
 using ::google::protobuf::FieldDescriptor;
 using ::google::protobuf::Message;
 using ::google::protobuf::Reflection;
-using std::unordered_map;
 
 namespace codes_internal {
 
@@ -54,7 +57,9 @@ std::string TitleCaseToUpperUnderscores(const std::string& src) {
 
 }  // namespace codes_internal
 
-std::string EnumValueToCodeString(const EnumValueDescriptor* enum_value) {
+namespace {
+
+std::string ComputeCodeString(const EnumValueDescriptor* enum_value) {
   if (enum_value->options().HasExtension(
           ::google::fhir::proto::fhir_original_code)) {
     return enum_value->options().GetExtension(
@@ -68,27 +73,10 @@ std::string EnumValueToCodeString(const EnumValueDescriptor* enum_value) {
   return code_string;
 }
 
-absl::StatusOr<const EnumValueDescriptor*> CodeStringToEnumValue(
-    const std::string& code_string, const EnumDescriptor* target_enum_type) {
-  // Map from (target_enum_type->full_name() x code_string) -> result
-  // for previous runs.
-  static auto* memos = new unordered_map<
-      std::string, unordered_map<std::string, const EnumValueDescriptor*>>();
-  static absl::Mutex memos_mutex;
-
-  // Check for memoized result.  Note we lock the mutex, in case something tries
-  // to read this map while it is being written to.
-  memos_mutex.ReaderLock();
-  const auto memos_for_enum_type = memos->find(target_enum_type->full_name());
-  if (memos_for_enum_type != memos->end()) {
-    const auto enum_result = memos_for_enum_type->second.find(code_string);
-    if (enum_result != memos_for_enum_type->second.end()) {
-      memos_mutex.ReaderUnlock();
-      return enum_result->second;
-    }
-  }
-  memos_mutex.ReaderUnlock();
-
+// Returns the value of the enum that the code string denotes, or nullptr if
+// there is none.
+const EnumValueDescriptor* FindEnumValueForCode(
+    absl::string_view code_string, const EnumDescriptor* target_enum_type) {
   // Try to find the Enum value by name (with some common substitutions).
   std::string enum_case_code_string = absl::AsciiStrToUpper(code_string);
   std::replace(enum_case_code_string.begin(), enum_case_code_string.end(), '-',
@@ -96,8 +84,6 @@ absl::StatusOr<const EnumValueDescriptor*> CodeStringToEnumValue(
   const EnumValueDescriptor* target_enum_value =
       target_enum_type->FindValueByName(enum_case_code_string);
   if (target_enum_value != nullptr) {
-    absl::MutexLock lock(&memos_mutex);
-    (*memos)[target_enum_type->full_name()][code_string] = target_enum_value;
     return target_enum_value;
   }
 
@@ -110,11 +96,72 @@ absl::StatusOr<const EnumValueDescriptor*> CodeStringToEnumValue(
             ::google::fhir::proto::fhir_original_code) &&
         target_value->options().GetExtension(
             ::google::fhir::proto::fhir_original_code) == code_string) {
-      absl::MutexLock lock(&memos_mutex);
-      (*memos)[target_enum_type->full_name()][code_string] = target_value;
       return target_value;
     }
   }
+  return nullptr;
+}
+
+// The code strings of the values of an enum type, in both directions.
+struct EnumCodeTable {
+  // The code string of each value, by the index of the value.
+  std::vector<std::string> code_strings;
+
+  // The value that each of the code strings denotes.
+  absl::flat_hash_map<std::string, const EnumValueDescriptor*> values;
+};
+
+EnumCodeTable BuildEnumCodeTable(const EnumDescriptor* enum_type) {
+  EnumCodeTable table;
+  table.code_strings.reserve(enum_type->value_count());
+  for (int i = 0; i < enum_type->value_count(); i++) {
+    table.code_strings.push_back(ComputeCodeString(enum_type->value(i)));
+  }
+  // The code string of a value may denote another value, e.g. if a renamed
+  // value's original code matches the name of another value, so each code
+  // string is resolved as any other input would be.
+  for (const std::string& code_string : table.code_strings) {
+    const EnumValueDescriptor* value =
+        FindEnumValueForCode(code_string, enum_type);
+    if (value != nullptr) {
+      table.values.emplace(code_string, value);
+    }
+  }
+  return table;
+}
+
+const EnumCodeTable& GetEnumCodeTable(const EnumDescriptor* enum_type) {
+  static auto* cache =
+      new DescriptorCache<EnumDescriptor, EnumCodeTable>(&BuildEnumCodeTable);
+  return cache->Get(enum_type);
+}
+
+}  // namespace
+
+absl::string_view EnumValueToCodeStringView(
+    const EnumValueDescriptor* enum_value) {
+  return GetEnumCodeTable(enum_value->type())
+      .code_strings[enum_value->index()];
+}
+
+std::string EnumValueToCodeString(const EnumValueDescriptor* enum_value) {
+  return std::string(EnumValueToCodeStringView(enum_value));
+}
+
+absl::StatusOr<const EnumValueDescriptor*> CodeStringToEnumValue(
+    const std::string& code_string, const EnumDescriptor* target_enum_type) {
+  // Code strings as they are printed are looked up in the enum's table; others,
+  // e.g. in a different case, are resolved from the enum's values.
+  const EnumCodeTable& table = GetEnumCodeTable(target_enum_type);
+  auto iter = table.values.find(code_string);
+  if (iter != table.values.end()) {
+    return iter->second;
+  }
+  const EnumValueDescriptor* target_enum_value =
+      FindEnumValueForCode(code_string, target_enum_type);
+  if (target_enum_value != nullptr) {
+    return target_enum_value;
+  }
 
   return InvalidArgumentError(
       absl::StrCat("Failed to convert `", code_string, "` to ",
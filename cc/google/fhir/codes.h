@@ -19,6 +19,7 @@
 #include "google/protobuf/message.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
 #include "google/fhir/status/status.h"
 #include "google/fhir/status/statusor.h"
 
@@ -37,6 +38,11 @@ absl::StatusOr<const ::google::protobuf::EnumValueDescriptor*> CodeStringToEnumV
 std::string EnumValueToCodeString(
     const ::google::protobuf::EnumValueDescriptor* enum_value);
 
+// Like EnumValueToCodeString, but returns a view of a code string that is
+// computed once per enum type and kept for the lifetime of the process.
+absl::string_view EnumValueToCodeStringView(
+    const ::google::protobuf::EnumValueDescriptor* enum_value);
+
 absl::StatusOr<std::string> GetCodeAsString(const ::google::protobuf::Message& code);
 
 absl::Status CopyCoding(const ::google::protobuf::Message& source,
@@ -62,7 +68,7 @@ absl::StatusOr<typename TypedResourceTypeCode::Value> GetCodeForResourceType(
 template <typename TypedContainedResource>
 absl::StatusOr<const ::google::protobuf::Descriptor*> GetDescriptorForResourceType(
     const ::google::protobuf::EnumValueDescriptor* code) {
-  const std::string code_string = EnumValueToCodeString(code);
+  const absl::string_view code_string = EnumValueToCodeStringView(code);
   const ::google::protobuf::OneofDescriptor* resource_oneof =
       TypedContainedResource::descriptor()->FindOneofByName("oneof_resource");
   if (resource_oneof == nullptr) {
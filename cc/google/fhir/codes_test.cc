@@ -167,6 +167,31 @@ TEST(CodesTest, EnumValueToCodeString) {
                   r4::core::QuestionnaireItemOperatorCode::GREATER_THAN)));
 }
 
+TEST(CodesTest, CodeStringToEnumValueRoundTrip) {
+  const auto* enum_descriptor =
+      r4::core::QuestionnaireItemOperatorCode::Value_descriptor();
+  for (int i = 0; i < enum_descriptor->value_count(); i++) {
+    const auto* value = enum_descriptor->value(i);
+    EXPECT_EQ(EnumValueToCodeStringView(value), EnumValueToCodeString(value));
+    auto result = CodeStringToEnumValue(EnumValueToCodeString(value),
+                                        enum_descriptor);
+    ASSERT_TRUE(result.ok()) << result.status();
+    EXPECT_EQ(result.value(), value);
+  }
+}
+
+TEST(CodesTest, CodeStringToEnumValueIgnoresCase) {
+  const auto* enum_descriptor =
+      r4::core::AdministrativeGenderCode::Value_descriptor();
+  for (const std::string& code_string : {"female", "Female", "FEMALE"}) {
+    auto result = CodeStringToEnumValue(code_string, enum_descriptor);
+    ASSERT_TRUE(result.ok()) << code_string;
+    EXPECT_EQ(result.value()->number(),
+              r4::core::AdministrativeGenderCode::FEMALE);
+  }
+  EXPECT_FALSE(CodeStringToEnumValue("femme", enum_descriptor).ok());
+}
+
 }  // namespace
 
 }  // namespace fhir
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GOOGLE_FHIR_DESCRIPTOR_CACHE_H_
+#define GOOGLE_FHIR_DESCRIPTOR_CACHE_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <memory>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/hash/hash.h"
+#include "absl/memory/memory.h"
+#include "absl/synchronization/mutex.h"
+
+namespace google {
+namespace fhir {
+
+// An insert-only cache of values computed from descriptors, e.g. of
+// ::google::protobuf::Descriptor or ::google::protobuf::EnumDescriptor, by the
+// given function the first time each descriptor is looked up. Values are never
+// removed, as descriptors of generated messages live as long as the process.
+//
+// Slots of the table are claimed with a compare-and-swap, so lookups of
+// descriptors that have been seen before only perform atomic loads. If two
+// threads compute the value of the same descriptor concurrently, one of the
+// values is discarded. Descriptors that do not fit into the table, of which
+// there should be none in practice, are kept in an overflow map guarded by a
+// mutex.
+//
+// Instances are meant to be function-local statics that are never destroyed.
+template <typename Key, typename Value>
+class DescriptorCache {
+ public:
+  using ComputeFunction = Value (*)(const Key*);
+
+  explicit DescriptorCache(ComputeFunction compute) : compute_(compute) {}
+
+  DescriptorCache(const DescriptorCache&) = delete;
+  DescriptorCache& operator=(const DescriptorCache&) = delete;
+
+  const Value& Get(const Key* key) {
+    size_t slot = absl::Hash<const Key*>()(key) & (kSlots - 1);
+    Entry* new_entry = nullptr;
+    for (int probe = 0; probe < kMaxProbes; probe++) {
+      Entry* entry = slots_[slot].load(std::memory_order_acquire);
+      if (entry == nullptr) {
+        if (new_entry == nullptr) {
+          new_entry = new Entry{key, compute_(key)};
+        }
+        if (slots_[slot].compare_exchange_strong(entry, new_entry,
+                                                 std::memory_order_acq_rel)) {
+          return new_entry->value;
+        }
+        // Another thread claimed the slot first; entry now holds its entry.
+      }
+      if (entry->key == key) {
+        delete new_entry;
+        return entry->value;
+      }
+      slot = (slot + 1) & (kSlots - 1);
+    }
+
+    delete new_entry;
+    absl::MutexLock lock(&overflow_mutex_);
+    std::unique_ptr<Entry>& entry = overflow_[key];
+    if (entry == nullptr) {
+      entry = absl::WrapUnique(new Entry{key, compute_(key)});
+    }
+    return entry->value;
+  }
+
+ private:
+  struct Entry {
+    const Key* key;
+    Value value;
+  };
+
+  // Enough for several FHIR versions and their profiles, including nested
+  // message types.
+  static constexpr size_t kSlots = 1 << 14;
+  static constexpr int kMaxProbes = 64;
+
+  const ComputeFunction compute_;
+  std::atomic<Entry*> slots_[kSlots] = {};
+  absl::Mutex overflow_mutex_;
+  absl::flat_hash_map<const Key*, std::unique_ptr<Entry>> overflow_
+      ABSL_GUARDED_BY(overflow_mutex_);
+};
+
+}  // namespace fhir
+}  // namespace google
+
+#endif  // GOOGLE_FHIR_DESCRIPTOR_CACHE_H_
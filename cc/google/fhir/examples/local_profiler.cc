@@ -14,10 +14,13 @@
 
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
 
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
 #include "absl/time/time.h"
+#include "google/fhir/mapped_file.h"
 #include "google/fhir/r4/json_format.h"
 #include "google/fhir/r4/profiles.h"
 #include "examples/profiles/demo.pb.h"
@@ -33,28 +36,31 @@ void ConvertToProfile(const absl::TimeZone time_zone, std::string dir) {
   std::cout << "Converting Synthea " << R::descriptor()->name() << " to "
             << P::descriptor()->name() << std::endl;
 
-  std::ifstream read_stream;
   std::cout << dir << std::endl;
-  read_stream.open(
-      absl::StrCat(dir, "/", R::descriptor()->name(), ".fhir.ndjson"));
+  const std::unique_ptr<google::fhir::MappedFile> input =
+      google::fhir::MappedFile::Open(
+          absl::StrCat(dir, "/", R::descriptor()->name(), ".fhir.ndjson"))
+          .value();
 
   std::ofstream write_stream;
   write_stream.open(absl::StrCat(dir, "/", P::descriptor()->name(), ".ndjson"));
 
-  std::string line;
-  while (!read_stream.eof()) {
-    std::getline(read_stream, line);
-    if (!line.length()) continue;
-    R raw = google::fhir::r4::JsonFhirStringToProto<Patient>(line, time_zone)
+  const absl::Status result = google::fhir::ForEachNdjsonRecord(
+      input->contents(), google::fhir::RecordFileOptions(),
+      [&](absl::string_view line) -> absl::Status {
+        R raw =
+            google::fhir::r4::JsonFhirStringToProto<Patient>(line, time_zone)
                 .value();
-    P profiled;
-    auto status = ConvertToProfileLenientR4(raw, &profiled);
-    CHECK(status.ok()) << status.message();
-    write_stream << google::fhir::r4::PrintFhirToJsonStringForAnalytics(
-                        profiled)
-                        .value();
-    write_stream << "\n";
-  }
+        P profiled;
+        auto status = ConvertToProfileLenientR4(raw, &profiled);
+        CHECK(status.ok()) << status.message();
+        write_stream << google::fhir::r4::PrintFhirToJsonStringForAnalytics(
+                            profiled)
+                            .value();
+        write_stream << "\n";
+        return absl::OkStatus();
+      });
+  CHECK(result.ok()) << result.message();
 }
 
 int main(int argc, char** argv) {
@@ -0,0 +1,318 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "google/fhir/fhir_path/antlr_fhir_path_parser.h"
+
+#include <string>
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "google/fhir/fhir_path/FhirPathLexer.h"
+#include "google/fhir/fhir_path/FhirPathParser.h"
+#include "google/fhir/status/status.h"
+
+namespace google {
+namespace fhir {
+namespace fhir_path {
+namespace internal {
+
+namespace {
+
+using ::absl::InvalidArgumentError;
+using ::antlr4::ANTLRInputStream;
+using ::antlr4::BaseErrorListener;
+using ::antlr4::CommonTokenStream;
+using ::antlr_parser::FhirPathLexer;
+using ::antlr_parser::FhirPathParser;
+
+// ANTLR listener that records the first syntax error.
+class ErrorListener : public BaseErrorListener {
+ public:
+  void syntaxError(antlr4::Recognizer* recognizer,
+                   antlr4::Token* offending_symbol, size_t line,
+                   size_t position_in_line, const std::string& message,
+                   std::exception_ptr e) override {
+    if (status_.ok()) {
+      status_ = InvalidArgumentError(absl::StrCat(
+          "Syntax error at position ", position_in_line, ": ", message));
+    }
+  }
+
+  const absl::Status& status() const { return status_; }
+
+ private:
+  absl::Status status_;
+};
+
+std::string IdentifierName(FhirPathParser::IdentifierContext* identifier) {
+  std::string text = identifier->getText();
+  if (identifier->DELIMITEDIDENTIFIER() != nullptr) {
+    return text.substr(1, text.size() - 2);
+  }
+  return text;
+}
+
+std::unique_ptr<AstNode> MakeNode(AstNode::Kind kind) {
+  return absl::make_unique<AstNode>(kind);
+}
+
+absl::StatusOr<std::unique_ptr<AstNode>> ConvertExpression(
+    FhirPathParser::ExpressionContext* ctx);
+
+absl::StatusOr<std::unique_ptr<AstNode>> ConvertInvocation(
+    FhirPathParser::InvocationContext* ctx) {
+  if (auto member =
+          dynamic_cast<FhirPathParser::MemberInvocationContext*>(ctx)) {
+    auto node = MakeNode(AstNode::kMemberInvocation);
+    node->name = IdentifierName(member->identifier());
+    return std::move(node);
+  }
+
+  if (auto function =
+          dynamic_cast<FhirPathParser::FunctionInvocationContext*>(ctx)) {
+    auto node = MakeNode(AstNode::kFunctionInvocation);
+    node->name = IdentifierName(function->function()->identifier());
+    FhirPathParser::ParamListContext* params =
+        function->function()->paramList();
+    if (params != nullptr) {
+      for (FhirPathParser::ExpressionContext* param : params->expression()) {
+        FHIR_ASSIGN_OR_RETURN(std::unique_ptr<AstNode> child,
+                              ConvertExpression(param));
+        node->children.push_back(std::move(child));
+      }
+    }
+    return std::move(node);
+  }
+
+  if (dynamic_cast<FhirPathParser::ThisInvocationContext*>(ctx)) {
+    return MakeNode(AstNode::kThisInvocation);
+  }
+  if (dynamic_cast<FhirPathParser::IndexInvocationContext*>(ctx)) {
+    return MakeNode(AstNode::kIndexInvocation);
+  }
+  if (dynamic_cast<FhirPathParser::TotalInvocationContext*>(ctx)) {
+    return MakeNode(AstNode::kTotalInvocation);
+  }
+
+  return InvalidArgumentError(
+      absl::StrCat("Unexpected invocation: ", ctx->getText()));
+}
+
+absl::StatusOr<std::unique_ptr<AstNode>> ConvertLiteral(
+    FhirPathParser::LiteralContext* ctx) {
+  std::unique_ptr<AstNode> node;
+  if (dynamic_cast<FhirPathParser::NullLiteralContext*>(ctx)) {
+    node = MakeNode(AstNode::kNullLiteral);
+  } else if (dynamic_cast<FhirPathParser::BooleanLiteralContext*>(ctx)) {
+    node = MakeNode(AstNode::kBooleanLiteral);
+  } else if (dynamic_cast<FhirPathParser::StringLiteralContext*>(ctx)) {
+    node = MakeNode(AstNode::kStringLiteral);
+  } else if (dynamic_cast<FhirPathParser::NumberLiteralContext*>(ctx)) {
+    node = MakeNode(AstNode::kNumberLiteral);
+  } else if (dynamic_cast<FhirPathParser::DateLiteralContext*>(ctx)) {
+    node = MakeNode(AstNode::kDateLiteral);
+  } else if (dynamic_cast<FhirPathParser::DateTimeLiteralContext*>(ctx)) {
+    node = MakeNode(AstNode::kDateTimeLiteral);
+  } else if (dynamic_cast<FhirPathParser::TimeLiteralContext*>(ctx)) {
+    node = MakeNode(AstNode::kTimeLiteral);
+  } else if (auto quantity =
+                 dynamic_cast<FhirPathParser::QuantityLiteralContext*>(ctx)) {
+    node = MakeNode(AstNode::kQuantityLiteral);
+    node->text = quantity->quantity()->NUMBER()->getText();
+    if (quantity->quantity()->unit() != nullptr) {
+      node->name = quantity->quantity()->unit()->getText();
+    }
+    return std::move(node);
+  } else {
+    return InvalidArgumentError(
+        absl::StrCat("Unexpected literal: ", ctx->getText()));
+  }
+
+  node->text = ctx->getText();
+  return std::move(node);
+}
+
+absl::StatusOr<std::unique_ptr<AstNode>> ConvertTerm(
+    FhirPathParser::TermContext* ctx) {
+  if (auto invocation =
+          dynamic_cast<FhirPathParser::InvocationTermContext*>(ctx)) {
+    return ConvertInvocation(invocation->invocation());
+  }
+
+  if (auto literal = dynamic_cast<FhirPathParser::LiteralTermContext*>(ctx)) {
+    return ConvertLiteral(literal->literal());
+  }
+
+  if (auto constant =
+          dynamic_cast<FhirPathParser::ExternalConstantTermContext*>(ctx)) {
+    FhirPathParser::ExternalConstantContext* external_constant =
+        constant->externalConstant();
+    auto node = MakeNode(AstNode::kExternalConstant);
+    if (external_constant->identifier() != nullptr) {
+      node->name = IdentifierName(external_constant->identifier());
+    } else {
+      std::string text = external_constant->STRING()->getText();
+      node->name = text.substr(1, text.size() - 2);
+    }
+    return std::move(node);
+  }
+
+  if (auto parenthesized =
+          dynamic_cast<FhirPathParser::ParenthesizedTermContext*>(ctx)) {
+    return ConvertExpression(parenthesized->expression());
+  }
+
+  return InvalidArgumentError(
+      absl::StrCat("Unexpected term: ", ctx->getText()));
+}
+
+absl::StatusOr<std::unique_ptr<AstNode>> ConvertBinaryExpression(
+    FhirPathParser::ExpressionContext* ctx,
+    FhirPathParser::ExpressionContext* left,
+    FhirPathParser::ExpressionContext* right) {
+  auto node = MakeNode(AstNode::kBinaryExpression);
+  node->op = ctx->children[1]->getText();
+  FHIR_ASSIGN_OR_RETURN(std::unique_ptr<AstNode> left_node,
+                        ConvertExpression(left));
+  FHIR_ASSIGN_OR_RETURN(std::unique_ptr<AstNode> right_node,
+                        ConvertExpression(right));
+  node->children.push_back(std::move(left_node));
+  node->children.push_back(std::move(right_node));
+  return std::move(node);
+}
+
+// Labeled binary alternatives of the expression rule; each has exactly two
+// expression operands with the operator token between them.
+template <typename... Contexts>
+struct BinaryContexts;
+
+template <>
+struct BinaryContexts<> {
+  static absl::StatusOr<std::unique_ptr<AstNode>> Convert(
+      FhirPathParser::ExpressionContext* ctx) {
+    return InvalidArgumentError(
+        absl::StrCat("Unexpected expression: ", ctx->getText()));
+  }
+};
+
+template <typename Context, typename... Contexts>
+struct BinaryContexts<Context, Contexts...> {
+  static absl::StatusOr<std::unique_ptr<AstNode>> Convert(
+      FhirPathParser::ExpressionContext* ctx) {
+    if (auto binary = dynamic_cast<Context*>(ctx)) {
+      return ConvertBinaryExpression(ctx, binary->expression(0),
+                                     binary->expression(1));
+    }
+    return BinaryContexts<Contexts...>::Convert(ctx);
+  }
+};
+
+absl::StatusOr<std::unique_ptr<AstNode>> ConvertExpression(
+    FhirPathParser::ExpressionContext* ctx) {
+  if (auto term = dynamic_cast<FhirPathParser::TermExpressionContext*>(ctx)) {
+    return ConvertTerm(term->term());
+  }
+
+  if (auto invocation =
+          dynamic_cast<FhirPathParser::InvocationExpressionContext*>(ctx)) {
+    auto node = MakeNode(AstNode::kInvocationExpression);
+    FHIR_ASSIGN_OR_RETURN(std::unique_ptr<AstNode> target,
+                          ConvertExpression(invocation->expression()));
+    FHIR_ASSIGN_OR_RETURN(std::unique_ptr<AstNode> member,
+                          ConvertInvocation(invocation->invocation()));
+    node->children.push_back(std::move(target));
+    node->children.push_back(std::move(member));
+    return std::move(node);
+  }
+
+  if (auto indexer =
+          dynamic_cast<FhirPathParser::IndexerExpressionContext*>(ctx)) {
+    auto node = MakeNode(AstNode::kIndexerExpression);
+    FHIR_ASSIGN_OR_RETURN(std::unique_ptr<AstNode> collection,
+                          ConvertExpression(indexer->expression(0)));
+    FHIR_ASSIGN_OR_RETURN(std::unique_ptr<AstNode> index,
+                          ConvertExpression(indexer->expression(1)));
+    node->children.push_back(std::move(collection));
+    node->children.push_back(std::move(index));
+    return std::move(node);
+  }
+
+  if (auto polarity =
+          dynamic_cast<FhirPathParser::PolarityExpressionContext*>(ctx)) {
+    auto node = MakeNode(AstNode::kPolarityExpression);
+    node->op = polarity->children[0]->getText();
+    FHIR_ASSIGN_OR_RETURN(std::unique_ptr<AstNode> operand,
+                          ConvertExpression(polarity->expression()));
+    node->children.push_back(std::move(operand));
+    return std::move(node);
+  }
+
+  if (auto type = dynamic_cast<FhirPathParser::TypeExpressionContext*>(ctx)) {
+    auto node = MakeNode(AstNode::kTypeExpression);
+    node->op = type->children[1]->getText();
+    node->name = absl::StrJoin(
+        type->typeSpecifier()->qualifiedIdentifier()->identifier(), ".",
+        [](std::string* out, FhirPathParser::IdentifierContext* identifier) {
+          out->append(IdentifierName(identifier));
+        });
+    FHIR_ASSIGN_OR_RETURN(std::unique_ptr<AstNode> operand,
+                          ConvertExpression(type->expression()));
+    node->children.push_back(std::move(operand));
+    return std::move(node);
+  }
+
+  return BinaryContexts<FhirPathParser::MultiplicativeExpressionContext,
+                        FhirPathParser::AdditiveExpressionContext,
+                        FhirPathParser::UnionExpressionContext,
+                        FhirPathParser::InequalityExpressionContext,
+                        FhirPathParser::EqualityExpressionContext,
+                        FhirPathParser::MembershipExpressionContext,
+                        FhirPathParser::AndExpressionContext,
+                        FhirPathParser::OrExpressionContext,
+                        FhirPathParser::ImpliesExpressionContext>::Convert(ctx);
+}
+
+}  // namespace
+
+absl::StatusOr<std::unique_ptr<AstNode>> ParseFhirPathWithAntlr(
+    absl::string_view fhir_path) {
+  ANTLRInputStream input{std::string(fhir_path)};
+  FhirPathLexer lexer(&input);
+  CommonTokenStream tokens(&lexer);
+  FhirPathParser parser(&tokens);
+
+  ErrorListener error_listener;
+  lexer.addErrorListener(&error_listener);
+  parser.addErrorListener(&error_listener);
+  FhirPathParser::ExpressionContext* expression = parser.expression();
+  FHIR_RETURN_IF_ERROR(error_listener.status());
+
+  // The expression rule does not end with EOF, so ANTLR stops quietly at the
+  // first token that cannot continue the expression.
+  if (tokens.LA(1) != antlr4::Token::EOF) {
+    return InvalidArgumentError(absl::StrCat(
+        "Syntax error at position ", tokens.LT(1)->getCharPositionInLine(),
+        ": extraneous input '", tokens.LT(1)->getText(), "'"));
+  }
+
+  return ConvertExpression(expression);
+}
+
+}  // namespace internal
+}  // namespace fhir_path
+}  // namespace fhir
+}  // namespace google
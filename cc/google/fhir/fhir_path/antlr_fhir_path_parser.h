@@ -0,0 +1,43 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GOOGLE_FHIR_FHIR_PATH_ANTLR_FHIR_PATH_PARSER_H_
+#define GOOGLE_FHIR_FHIR_PATH_ANTLR_FHIR_PATH_PARSER_H_
+
+#include <memory>
+
+#include "absl/strings/string_view.h"
+#include "google/fhir/fhir_path/fhir_path_parser.h"
+#include "google/fhir/status/statusor.h"
+
+namespace google {
+namespace fhir {
+namespace fhir_path {
+namespace internal {
+
+// Parses a FHIRPath expression with the parser ANTLR generates from
+// FhirPath.g4 and converts the parse tree into an AstNode tree.
+//
+// This is the reference implementation of the grammar. It is only used to
+// check ParseFhirPath against and to measure it; expressions are compiled with
+// ParseFhirPath.
+absl::StatusOr<std::unique_ptr<AstNode>> ParseFhirPathWithAntlr(
+    absl::string_view fhir_path);
+
+}  // namespace internal
+}  // namespace fhir_path
+}  // namespace fhir
+}  // namespace google
+
+#endif  // GOOGLE_FHIR_FHIR_PATH_ANTLR_FHIR_PATH_PARSER_H_
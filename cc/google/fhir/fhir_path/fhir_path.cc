@@ -15,12 +15,21 @@
 #include "google/fhir/fhir_path/fhir_path.h"
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
 #include <iterator>
+#include <tuple>
 #include <utility>
 
 #include "google/protobuf/any.pb.h"
 #include "google/protobuf/descriptor.h"
 #include "google/protobuf/util/message_differencer.h"
+#include "absl/base/call_once.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/container/node_hash_map.h"
+#include "absl/hash/hash.h"
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
 #include "absl/strings/escaping.h"
@@ -29,16 +38,19 @@
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_replace.h"
 #include "absl/strings/strip.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/time/civil_time.h"
 #include "absl/time/time.h"
 #include "absl/types/optional.h"
 #include "google/fhir/annotations.h"
-#include "google/fhir/fhir_path/FhirPathBaseVisitor.h"
-#include "google/fhir/fhir_path/FhirPathLexer.h"
-#include "google/fhir/fhir_path/FhirPathParser.h"
+#include "google/fhir/codes.h"
+#include "google/fhir/fhir_path/fhir_path_parser.h"
 #include "google/fhir/fhir_path/fhir_path_types.h"
 #include "google/fhir/fhir_path/utils.h"
+#include "google/fhir/fhir_types.h"
+#include "google/fhir/parallel.h"
 #include "google/fhir/proto_util.h"
+#include "google/fhir/references.h"
 #include "google/fhir/status/status.h"
 #include "google/fhir/status/statusor.h"
 #include "google/fhir/util.h"
@@ -53,22 +65,17 @@ using ::absl::InternalError;
 using ::absl::InvalidArgumentError;
 using ::absl::NotFoundError;
 using ::absl::UnimplementedError;
-using ::antlr4::ANTLRInputStream;
-using ::antlr4::BaseErrorListener;
-using ::antlr4::CommonTokenStream;
-using ::antlr4::tree::TerminalNode;
-using ::antlr_parser::FhirPathBaseVisitor;
-using ::antlr_parser::FhirPathLexer;
-using ::antlr_parser::FhirPathParser;
 using ::google::fhir::AreSameMessageType;
 using ::google::fhir::JsonPrimitive;
 using ::google::fhir::r4::core::Boolean;
 using ::google::fhir::r4::core::Integer;
 using ::google::fhir::r4::core::String;
+using internal::AstNode;
 using internal::ExpressionNode;
 using ::google::protobuf::Descriptor;
 using ::google::protobuf::FieldDescriptor;
 using ::google::protobuf::Message;
+using ::google::protobuf::Reflection;
 using ::google::protobuf::util::MessageDifferencer;
 
 namespace internal {
@@ -166,6 +173,29 @@ absl::StatusOr<std::string> MessagesToString(
   return MessageToString(messages[0]);
 }
 
+// Returns the string representation of a System.String or FHIR primitive, as
+// returned by toString().
+absl::StatusOr<std::string> PrimitiveToString(
+    const PrimitiveHandler* primitive_handler, const Message& message) {
+  if (IsSystemString(message)) {
+    std::string value;
+    return GetPrimitiveStringValue(message, &value);
+  }
+
+  if (!IsPrimitive(message.GetDescriptor())) {
+    return InvalidArgumentError(absl::StrCat(
+        "Expected a primitive, not ", message.GetDescriptor()->full_name()));
+  }
+
+  FHIR_ASSIGN_OR_RETURN(JsonPrimitive json_primitive,
+                        primitive_handler->WrapPrimitiveProto(message));
+  std::string json_string = json_primitive.value;
+  if (absl::StartsWith(json_string, "\"")) {
+    json_string = json_string.substr(1, json_string.size() - 2);
+  }
+  return json_string;
+}
+
 // Converts decimal or integer container messages to a double value.
 static absl::Status MessageToDouble(const PrimitiveHandler* primitive_handler,
                                     const Message& message, double* value) {
@@ -233,6 +263,19 @@ std::vector<const google::protobuf::Message*> WorkspaceMessage::Ancestry() const
   return stack;
 }
 
+const ReferenceResolver* WorkSpace::GetReferenceResolver() {
+  if (reference_resolver_ == nullptr && parent_ != nullptr) {
+    // Shares the parent's resolver, so that a Bundle is indexed only once.
+    return parent_->GetReferenceResolver();
+  }
+  if (reference_resolver_ == nullptr) {
+    bundle_reference_resolver_ = absl::make_unique<BundleReferenceResolver>(
+        *BottomMessageContext().Root());
+    reference_resolver_ = bundle_reference_resolver_.get();
+  }
+  return reference_resolver_;
+}
+
 // Expression node that returns literals wrapped in the corresponding
 // protbuf wrapper
 class Literal : public ExpressionNode {
@@ -326,6 +369,246 @@ class ResourceReference : public ExpressionNode {
   const Descriptor* ReturnType() const override { return nullptr; }
 };
 
+// Expression node for a reference to a parameter of the expression, whose
+// values are bound with each evaluation.
+class ParameterReference : public ExpressionNode {
+ public:
+  ParameterReference(const std::string& name, const Descriptor* descriptor)
+      : name_(name), descriptor_(descriptor) {}
+
+  absl::Status Evaluate(WorkSpace* work_space,
+                        std::vector<WorkspaceMessage>* results) const override {
+    const ParameterBindings* bindings = work_space->GetParameterBindings();
+    const std::vector<const Message*>* values = nullptr;
+    if (bindings != nullptr) {
+      const auto binding = bindings->find(name_);
+      if (binding != bindings->end()) {
+        values = &binding->second;
+      }
+    }
+    if (values == nullptr) {
+      return InvalidArgumentError(
+          absl::StrCat("No value is bound to parameter %", name_));
+    }
+
+    for (const Message* value : *values) {
+      if (descriptor_ != nullptr &&
+          !AreSameMessageType(value->GetDescriptor(), descriptor_)) {
+        return InvalidArgumentError(absl::StrCat(
+            "Parameter %", name_, " is declared as ", descriptor_->full_name(),
+            " but bound to ", value->GetDescriptor()->full_name()));
+      }
+      results->push_back(WorkspaceMessage(value));
+    }
+    return absl::OkStatus();
+  }
+
+  const Descriptor* ReturnType() const override { return descriptor_; }
+
+ private:
+  const std::string name_;
+  const Descriptor* descriptor_;
+};
+
+// Returns true if the given name refers to one of the external constants
+// defined by FHIRPath and FHIR rather than a parameter of the expression.
+bool IsPredefinedConstant(absl::string_view name) {
+  return name == "ucum" || name == "sct" || name == "loinc" ||
+         name == "context" || name == "resource" || name == "rootResource" ||
+         absl::StartsWith(name, "vs-") || absl::StartsWith(name, "ext-");
+}
+
+// Instruments a node of an expression compiled for profiling. Evaluations are
+// recorded in the workspace's profile, if any, under the node's index in the
+// expression tree.
+class ProfiledNode : public ExpressionNode {
+ public:
+  ProfiledNode(int index, std::shared_ptr<ExpressionNode> node)
+      : index_(index), node_(std::move(node)) {}
+
+  absl::Status Evaluate(WorkSpace* work_space,
+                        std::vector<WorkspaceMessage>* results) const override {
+    ExpressionProfile* profile = work_space->GetProfile();
+    if (profile == nullptr) {
+      return node_->Evaluate(work_space, results);
+    }
+
+    const size_t results_before = results->size();
+    const size_t temporaries_before = work_space->TemporaryCount();
+    const absl::Time start = absl::Now();
+    absl::Status status = node_->Evaluate(work_space, results);
+
+    NodeProfile& node_profile = profile->nodes_[index_];
+    node_profile.wall_time += absl::Now() - start;
+    node_profile.invocations++;
+    node_profile.output_size += results->size() - results_before;
+    node_profile.temporaries +=
+        work_space->TemporaryCount() - temporaries_before;
+    return status;
+  }
+
+  const Descriptor* ReturnType() const override { return node_->ReturnType(); }
+
+  const std::shared_ptr<ExpressionNode>& Node() const { return node_; }
+
+ private:
+  const int index_;
+  const std::shared_ptr<ExpressionNode> node_;
+};
+
+// Returns the node instrumented by the given node if it is a ProfiledNode, so
+// compile time optimizations can inspect the nodes they are given regardless
+// of profiling.
+std::shared_ptr<ExpressionNode> Uninstrumented(
+    const std::shared_ptr<ExpressionNode>& node) {
+  auto profiled = std::dynamic_pointer_cast<ProfiledNode>(node);
+  return profiled != nullptr ? profiled->Node() : node;
+}
+
+// Records the structure of an expression as it is compiled for profiling.
+class ProfileBuilder {
+ public:
+  // Adds a node for the part of the expression about to be compiled, as an
+  // operand of the node currently being compiled. Returns the node's index.
+  int Begin(std::string label) {
+    const int index = nodes_.size();
+    if (!compiling_.empty()) {
+      nodes_[compiling_.back()].children.push_back(index);
+    }
+    nodes_.emplace_back();
+    nodes_.back().label = std::move(label);
+    compiling_.push_back(index);
+    return index;
+  }
+
+  // Completes the node most recently passed to Begin.
+  void End(const Descriptor* return_type) {
+    nodes_[compiling_.back()].return_type = return_type;
+    compiling_.pop_back();
+  }
+
+  std::vector<NodeProfile> TakeNodes() { return std::move(nodes_); }
+
+ private:
+  std::vector<NodeProfile> nodes_;
+  std::vector<int> compiling_;
+};
+
+// Paths of the fields of the message an expression is evaluated against, in
+// the format of ReadSet::paths().
+using FieldPaths = std::vector<std::string>;
+
+bool IsWithinPath(absl::string_view path, absl::string_view prefix) {
+  return prefix.empty() ||
+         (absl::StartsWith(path, prefix) &&
+          (path.size() == prefix.size() || path[prefix.size()] == '.'));
+}
+
+// Records the fields an expression reads as it is compiled, see ReadSet.
+//
+// Each node is assigned the paths of the fields its results may be taken
+// from. Invoking a member of a node's results extends those paths without
+// reading the results themselves, and functions such as where() pass them
+// on; other nodes read the results of their operands, adding their paths to
+// the read set.
+class ReadSetBuilder {
+ public:
+  // Starts a node for the part of the expression about to be compiled, as an
+  // operand of the node currently being compiled.
+  void Begin() { operands_.emplace_back(); }
+
+  // Returns the paths assigned to the operands of the node currently being
+  // compiled, in the order they were compiled.
+  const std::vector<FieldPaths>& Operands() const { return operands_.back(); }
+
+  // Completes the node most recently passed to Begin, assigning it the given
+  // paths.
+  void End(FieldPaths paths) {
+    operands_.pop_back();
+    if (operands_.empty()) {
+      // The results of the whole expression are read by its caller.
+      Read(paths);
+    } else {
+      operands_.back().push_back(std::move(paths));
+    }
+  }
+
+  void Read(const FieldPaths& paths) {
+    read_.insert(read_.end(), paths.begin(), paths.end());
+  }
+
+  void ReadUnbounded() { unbounded_ = true; }
+
+  ReadSet Build() {
+    std::sort(read_.begin(), read_.end());
+    ReadSet read_set;
+    read_set.unbounded_ = unbounded_;
+    // Sorting places fields right after the fields they are within.
+    for (std::string& path : read_) {
+      if (read_set.paths_.empty() ||
+          !IsWithinPath(path, read_set.paths_.back())) {
+        read_set.paths_.push_back(std::move(path));
+      }
+    }
+    return read_set;
+  }
+
+ private:
+  std::vector<std::vector<FieldPaths>> operands_;
+  FieldPaths read_;
+  bool unbounded_ = false;
+};
+
+// The instrumented copy of a compiled expression used for profiling, built
+// the first time a profiled evaluation is requested.
+struct ProfiledPlan {
+  ProfiledPlan(const Descriptor* descriptor,
+               const ExpressionParameters& parameters)
+      : descriptor(descriptor), parameters(parameters) {}
+
+  const Descriptor* const descriptor;
+  const ExpressionParameters parameters;
+
+  absl::once_flag once;
+  absl::Status status;
+  std::shared_ptr<const ExpressionNode> root;
+  std::vector<NodeProfile> nodes;
+};
+
+// Describes the part of an expression a syntax tree node stands for, without
+// its operands.
+std::string ProfileLabel(const AstNode& node) {
+  switch (node.kind) {
+    case AstNode::kInvocationExpression:
+      return absl::StrCat(".", ProfileLabel(*node.children[1]));
+    case AstNode::kIndexerExpression:
+      return "[]";
+    case AstNode::kPolarityExpression:
+    case AstNode::kBinaryExpression:
+      return node.op;
+    case AstNode::kTypeExpression:
+      return absl::StrCat(node.op, " ", node.name);
+    case AstNode::kMemberInvocation:
+      return node.name;
+    case AstNode::kFunctionInvocation:
+      return absl::StrCat(node.name, "()");
+    case AstNode::kThisInvocation:
+      return "$this";
+    case AstNode::kIndexInvocation:
+      return "$index";
+    case AstNode::kTotalInvocation:
+      return "$total";
+    case AstNode::kNullLiteral:
+      return "{}";
+    case AstNode::kQuantityLiteral:
+      return absl::StrCat(node.text, " ", node.name);
+    case AstNode::kExternalConstant:
+      return absl::StrCat("%", node.name);
+    default:
+      return node.text;
+  }
+}
+
 // Implements the InvocationTerm from the FHIRPath grammar,
 // producing a term from the root context message.
 class InvokeTermNode : public ExpressionNode {
@@ -367,6 +650,8 @@ class InvokeTermNode : public ExpressionNode {
     return field_ != nullptr ? field_->message_type() : nullptr;
   }
 
+  const FieldDescriptor* field() const { return field_; }
+
  private:
   const FieldDescriptor* field_;
   const std::string field_name_;
@@ -428,6 +713,8 @@ class InvokeExpressionNode : public ExpressionNode {
     return field_ != nullptr ? field_->message_type() : nullptr;
   }
 
+  const FieldDescriptor* field() const { return field_; }
+
  private:
   const std::shared_ptr<ExpressionNode> child_expression_;
   // Null if the child_expression_ may evaluate to a collection that contains
@@ -436,44 +723,53 @@ class InvokeExpressionNode : public ExpressionNode {
   const std::string field_name_;
 };
 
+class FhirPathCompiler;
+
+// Returns the name of the type given as a function parameter, e.g. the
+// parameter of ofType(). Type specifiers are parsed as member invocations, so
+// "FHIR.Patient" is the member "Patient" invoked on the member "FHIR".
+absl::StatusOr<std::string> TypeSpecifierName(const AstNode& param) {
+  if (param.kind == AstNode::kMemberInvocation) {
+    return param.name;
+  }
+
+  if (param.kind == AstNode::kInvocationExpression &&
+      param.children[1]->kind == AstNode::kMemberInvocation) {
+    FHIR_ASSIGN_OR_RETURN(std::string qualifier,
+                          TypeSpecifierName(*param.children[0]));
+    return absl::StrCat(qualifier, ".", param.children[1]->name);
+  }
+
+  return InvalidArgumentError("Expected a type specifier.");
+}
+
 class FunctionNode : public ExpressionNode {
  public:
   template <class T>
   absl::StatusOr<T*> static Create(
       const std::shared_ptr<ExpressionNode>& child_expression,
-      const std::vector<FhirPathParser::ExpressionContext*>& params,
-      FhirPathBaseVisitor* base_context_visitor,
-      FhirPathBaseVisitor* child_context_visitor) {
-    FHIR_ASSIGN_OR_RETURN(
-        std::vector<std::shared_ptr<ExpressionNode>> compiled_params,
-        T::CompileParams(params, base_context_visitor, child_context_visitor));
+      const std::vector<const AstNode*>& params,
+      FhirPathCompiler* base_context_compiler,
+      FhirPathCompiler* child_context_compiler) {
+    FHIR_ASSIGN_OR_RETURN(std::vector<std::shared_ptr<ExpressionNode>>
+                              compiled_params,
+                          T::CompileParams(params, base_context_compiler,
+                                           child_context_compiler));
     FHIR_RETURN_IF_ERROR(T::ValidateParams(compiled_params));
     return new T(child_expression, compiled_params);
   }
 
   static absl::StatusOr<std::vector<std::shared_ptr<ExpressionNode>>>
-  CompileParams(const std::vector<FhirPathParser::ExpressionContext*>& params,
-                FhirPathBaseVisitor* base_context_visitor,
-                FhirPathBaseVisitor*) {
-    return CompileParams(params, base_context_visitor);
+  CompileParams(const std::vector<const AstNode*>& params,
+                FhirPathCompiler* base_context_compiler,
+                FhirPathCompiler*) {
+    return CompileParams(params, base_context_compiler);
   }
 
+  // Compiles each of the parameters with the given compiler.
   static absl::StatusOr<std::vector<std::shared_ptr<ExpressionNode>>>
-  CompileParams(const std::vector<FhirPathParser::ExpressionContext*>& params,
-                FhirPathBaseVisitor* visitor) {
-    std::vector<std::shared_ptr<ExpressionNode>> compiled_params;
-
-    for (auto it = params.begin(); it != params.end(); ++it) {
-      antlrcpp::Any param_any = (*it)->accept(visitor);
-      if (param_any.isNull()) {
-        return InvalidArgumentError("Failed to compile parameter.");
-      }
-      compiled_params.push_back(
-          param_any.as<std::shared_ptr<ExpressionNode>>());
-    }
-
-    return compiled_params;
-  }
+  CompileParams(const std::vector<const AstNode*>& params,
+                FhirPathCompiler* compiler);
 
   // This is the default implementation. FunctionNodes's that need to validate
   // params at compile time should overwrite this definition with their own.
@@ -1052,30 +1348,15 @@ class ToStringFunction : public ZeroParameterFunctionNode {
       return absl::OkStatus();
     }
 
-    const WorkspaceMessage& child = child_results[0];
-
-    if (IsSystemString(*child.Message())) {
-      FHIR_ASSIGN_OR_RETURN(std::string value, MessageToString(child));
-      Message* result = work_space->GetPrimitiveHandler()->NewString(value);
-      work_space->DeleteWhenFinished(result);
-      results->push_back(WorkspaceMessage(result));
-      return absl::OkStatus();
-    }
-
-    if (!IsPrimitive(child.Message()->GetDescriptor())) {
+    const Message& child = *child_results[0].Message();
+    if (!IsSystemString(child) && !IsPrimitive(child.GetDescriptor())) {
       return absl::OkStatus();
     }
 
-    FHIR_ASSIGN_OR_RETURN(JsonPrimitive json_primitive,
-                          work_space->GetPrimitiveHandler()->WrapPrimitiveProto(
-                              *child.Message()));
-    std::string json_string = json_primitive.value;
-
-    if (absl::StartsWith(json_string, "\"")) {
-      json_string = json_string.substr(1, json_string.size() - 2);
-    }
-
-    Message* result = work_space->GetPrimitiveHandler()->NewString(json_string);
+    FHIR_ASSIGN_OR_RETURN(
+        std::string value,
+        PrimitiveToString(work_space->GetPrimitiveHandler(), child));
+    Message* result = work_space->GetPrimitiveHandler()->NewString(value);
     work_space->DeleteWhenFinished(result);
     results->push_back(WorkspaceMessage(result));
     return absl::OkStatus();
@@ -1564,6 +1845,312 @@ class IndexerExpression : public BinaryOperator {
   const PrimitiveHandler* primitive_handler_;
 };
 
+// The text of a FHIR primitive's JSON representation, excluding surrounding
+// quotes, along with whether or not that representation is quoted.
+//
+// Two primitives, possibly of different types, have equal JSON representations
+// if and only if their PrimitiveText values are equal. This allows primitives
+// to be compared and hashed without printing them in the common cases.
+struct PrimitiveText {
+  bool quoted;
+  absl::string_view text;
+
+  bool operator==(const PrimitiveText& other) const {
+    return quoted == other.quoted && text == other.text;
+  }
+};
+
+// Returns the PrimitiveText of the provided FHIR primitive. The scratch string
+// provides backing storage for the text when it cannot be referenced directly
+// from the message, and must outlive the returned value.
+absl::StatusOr<PrimitiveText> GetPrimitiveText(
+    const PrimitiveHandler* primitive_handler, const Message& message,
+    std::string* scratch) {
+  const Descriptor* descriptor = message.GetDescriptor();
+  const google::protobuf::Reflection* reflection = message.GetReflection();
+  const FieldDescriptor* value_field = descriptor->FindFieldByName("value");
+
+  // Primitives without a value (e.g. those only containing extensions) are
+  // handled by the general case below.
+  if (value_field != nullptr && !value_field->is_repeated() &&
+      reflection->HasField(message, value_field)) {
+    switch (value_field->cpp_type()) {
+      case FieldDescriptor::CPPTYPE_STRING:
+        if (value_field->type() == FieldDescriptor::TYPE_BYTES) {
+          break;
+        }
+        // Decimals are stored as strings to preserve their precision but are
+        // printed as JSON numbers.
+        return PrimitiveText{
+            !IsDecimal(descriptor),
+            reflection->GetStringReference(message, value_field, scratch)};
+      case FieldDescriptor::CPPTYPE_ENUM:
+        return PrimitiveText{true,
+                             EnumValueToCodeStringView(
+                                 reflection->GetEnum(message, value_field))};
+      case FieldDescriptor::CPPTYPE_INT32:
+        *scratch = absl::StrCat(reflection->GetInt32(message, value_field));
+        return PrimitiveText{false, *scratch};
+      case FieldDescriptor::CPPTYPE_UINT32:
+        *scratch = absl::StrCat(reflection->GetUInt32(message, value_field));
+        return PrimitiveText{false, *scratch};
+      case FieldDescriptor::CPPTYPE_BOOL:
+        return PrimitiveText{false, reflection->GetBool(message, value_field)
+                                        ? "true"
+                                        : "false"};
+      default:
+        break;
+    }
+  }
+
+  FHIR_ASSIGN_OR_RETURN(JsonPrimitive json_primitive,
+                        primitive_handler->WrapPrimitiveProto(message));
+  *scratch = std::move(json_primitive.value);
+  absl::string_view text(*scratch);
+  bool quoted = absl::ConsumePrefix(&text, "\"") &&
+                absl::ConsumeSuffix(&text, "\"");
+  return PrimitiveText{quoted, text};
+}
+
+// Returns the field compared first when testing messages of the given type for
+// equality. For Codings and Identifiers this is the field most likely to
+// differ between two values, so unequal values are rejected early.
+const FieldDescriptor* DiscriminatingField(const Descriptor* descriptor) {
+  if (IsCoding(descriptor)) {
+    return descriptor->FindFieldByName("code");
+  }
+  if (IsIdentifier(descriptor)) {
+    return descriptor->FindFieldByName("value");
+  }
+  return nullptr;
+}
+
+bool StructurallyEqual(const Message& left, const Message& right);
+
+// Returns true if the values of the given field, which must be set in both
+// messages, are equal. For repeated fields the element at index is compared.
+bool FieldValuesEqual(const Message& left, const Message& right,
+                      const FieldDescriptor* field, int index) {
+  const google::protobuf::Reflection* reflection = left.GetReflection();
+  const bool repeated = field->is_repeated();
+  switch (field->cpp_type()) {
+    case FieldDescriptor::CPPTYPE_INT32:
+      return repeated ? reflection->GetRepeatedInt32(left, field, index) ==
+                            reflection->GetRepeatedInt32(right, field, index)
+                      : reflection->GetInt32(left, field) ==
+                            reflection->GetInt32(right, field);
+    case FieldDescriptor::CPPTYPE_INT64:
+      return repeated ? reflection->GetRepeatedInt64(left, field, index) ==
+                            reflection->GetRepeatedInt64(right, field, index)
+                      : reflection->GetInt64(left, field) ==
+                            reflection->GetInt64(right, field);
+    case FieldDescriptor::CPPTYPE_UINT32:
+      return repeated ? reflection->GetRepeatedUInt32(left, field, index) ==
+                            reflection->GetRepeatedUInt32(right, field, index)
+                      : reflection->GetUInt32(left, field) ==
+                            reflection->GetUInt32(right, field);
+    case FieldDescriptor::CPPTYPE_UINT64:
+      return repeated ? reflection->GetRepeatedUInt64(left, field, index) ==
+                            reflection->GetRepeatedUInt64(right, field, index)
+                      : reflection->GetUInt64(left, field) ==
+                            reflection->GetUInt64(right, field);
+    case FieldDescriptor::CPPTYPE_DOUBLE:
+      return repeated ? reflection->GetRepeatedDouble(left, field, index) ==
+                            reflection->GetRepeatedDouble(right, field, index)
+                      : reflection->GetDouble(left, field) ==
+                            reflection->GetDouble(right, field);
+    case FieldDescriptor::CPPTYPE_FLOAT:
+      return repeated ? reflection->GetRepeatedFloat(left, field, index) ==
+                            reflection->GetRepeatedFloat(right, field, index)
+                      : reflection->GetFloat(left, field) ==
+                            reflection->GetFloat(right, field);
+    case FieldDescriptor::CPPTYPE_BOOL:
+      return repeated ? reflection->GetRepeatedBool(left, field, index) ==
+                            reflection->GetRepeatedBool(right, field, index)
+                      : reflection->GetBool(left, field) ==
+                            reflection->GetBool(right, field);
+    case FieldDescriptor::CPPTYPE_ENUM:
+      return repeated ? reflection->GetRepeatedEnumValue(left, field, index) ==
+                            reflection->GetRepeatedEnumValue(right, field,
+                                                             index)
+                      : reflection->GetEnumValue(left, field) ==
+                            reflection->GetEnumValue(right, field);
+    case FieldDescriptor::CPPTYPE_STRING: {
+      std::string left_scratch;
+      std::string right_scratch;
+      return repeated ? reflection->GetRepeatedStringReference(
+                            left, field, index, &left_scratch) ==
+                            reflection->GetRepeatedStringReference(
+                                right, field, index, &right_scratch)
+                      : reflection->GetStringReference(left, field,
+                                                       &left_scratch) ==
+                            reflection->GetStringReference(right, field,
+                                                           &right_scratch);
+    }
+    case FieldDescriptor::CPPTYPE_MESSAGE:
+      return repeated
+                 ? StructurallyEqual(
+                       reflection->GetRepeatedMessage(left, field, index),
+                       reflection->GetRepeatedMessage(right, field, index))
+                 : StructurallyEqual(reflection->GetMessage(left, field),
+                                     reflection->GetMessage(right, field));
+  }
+  return false;
+}
+
+// Returns true if the given field is set to equal values in both messages.
+bool FieldsEqual(const Message& left, const Message& right,
+                 const FieldDescriptor* field) {
+  const google::protobuf::Reflection* reflection = left.GetReflection();
+  if (field->is_repeated()) {
+    const int size = reflection->FieldSize(left, field);
+    if (size != reflection->FieldSize(right, field)) {
+      return false;
+    }
+    for (int i = 0; i < size; i++) {
+      if (!FieldValuesEqual(left, right, field, i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  if (reflection->HasField(left, field) != reflection->HasField(right, field)) {
+    return false;
+  }
+  return !reflection->HasField(left, field) ||
+         FieldValuesEqual(left, right, field, -1);
+}
+
+// Returns true if the two messages, which must be of the same type, have the
+// same fields set to equal values. This is equivalent to
+// MessageDifferencer::Equals for FHIR protos, which use neither maps nor
+// unknown fields, without its per-comparison setup cost.
+bool StructurallyEqual(const Message& left, const Message& right) {
+  if (&left == &right) {
+    return true;
+  }
+
+  const FieldDescriptor* discriminating_field =
+      DiscriminatingField(left.GetDescriptor());
+  if (discriminating_field != nullptr &&
+      !FieldsEqual(left, right, discriminating_field)) {
+    return false;
+  }
+
+  const google::protobuf::Reflection* reflection = left.GetReflection();
+  std::vector<const FieldDescriptor*> left_fields;
+  std::vector<const FieldDescriptor*> right_fields;
+  reflection->ListFields(left, &left_fields);
+  reflection->ListFields(right, &right_fields);
+  if (left_fields != right_fields) {
+    return false;
+  }
+
+  for (const FieldDescriptor* field : left_fields) {
+    if (field != discriminating_field && !FieldsEqual(left, right, field)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t MessageHash(const PrimitiveHandler* primitive_handler,
+                   const Message& message);
+
+// Returns a hash of the values of the given field. Messages are hashed with
+// MessageHash so nested primitives hash consistently with equality.
+size_t FieldHash(const PrimitiveHandler* primitive_handler,
+                 const Message& message, const FieldDescriptor* field) {
+  const google::protobuf::Reflection* reflection = message.GetReflection();
+  size_t hash = absl::Hash<int>()(field->number());
+  auto combine = [&hash](size_t value_hash) {
+    hash = absl::Hash<std::pair<size_t, size_t>>()({hash, value_hash});
+  };
+
+  const int size = field->is_repeated() ? reflection->FieldSize(message, field)
+                                        : 1;
+  for (int i = 0; i < size; i++) {
+    const int index = field->is_repeated() ? i : -1;
+    switch (field->cpp_type()) {
+      case FieldDescriptor::CPPTYPE_MESSAGE:
+        combine(MessageHash(
+            primitive_handler,
+            index < 0 ? reflection->GetMessage(message, field)
+                      : reflection->GetRepeatedMessage(message, field, index)));
+        break;
+      case FieldDescriptor::CPPTYPE_STRING: {
+        std::string scratch;
+        combine(absl::Hash<absl::string_view>()(
+            index < 0 ? reflection->GetStringReference(message, field, &scratch)
+                      : reflection->GetRepeatedStringReference(
+                            message, field, index, &scratch)));
+        break;
+      }
+      case FieldDescriptor::CPPTYPE_ENUM:
+        combine(absl::Hash<int>()(
+            index < 0
+                ? reflection->GetEnumValue(message, field)
+                : reflection->GetRepeatedEnumValue(message, field, index)));
+        break;
+      case FieldDescriptor::CPPTYPE_INT64:
+        combine(absl::Hash<int64_t>()(
+            index < 0 ? reflection->GetInt64(message, field)
+                      : reflection->GetRepeatedInt64(message, field, index)));
+        break;
+      default:
+        // Remaining scalar types are rare in FHIR protos. Leaving them out of
+        // the hash only costs collisions, not correctness.
+        break;
+    }
+  }
+  return hash;
+}
+
+// Returns a structural hash of the message that is consistent with
+// EqualsOperator::AreEqual. That is, messages that are equal according to
+// AreEqual, including primitives of different types, have the same hash.
+size_t MessageHash(const PrimitiveHandler* primitive_handler,
+                   const Message& message) {
+  const Descriptor* descriptor = message.GetDescriptor();
+  if (IsPrimitive(descriptor)) {
+    std::string scratch;
+    absl::StatusOr<PrimitiveText> text =
+        GetPrimitiveText(primitive_handler, message, &scratch);
+    if (!text.ok()) {
+      return 0;
+    }
+    return absl::Hash<std::pair<bool, absl::string_view>>()(
+        {text.value().quoted, text.value().text});
+  }
+
+  size_t hash = absl::Hash<absl::string_view>()(descriptor->full_name());
+  const google::protobuf::Reflection* reflection = message.GetReflection();
+
+  // Codings and Identifiers are hashed on their identifying fields only, which
+  // is consistent with equality and avoids hashing display text, periods, etc.
+  std::vector<const FieldDescriptor*> fields;
+  if (IsCoding(descriptor)) {
+    fields = {descriptor->FindFieldByName("system"),
+              descriptor->FindFieldByName("code")};
+  } else if (IsIdentifier(descriptor)) {
+    fields = {descriptor->FindFieldByName("system"),
+              descriptor->FindFieldByName("value")};
+  } else {
+    reflection->ListFields(message, &fields);
+  }
+
+  for (const FieldDescriptor* field : fields) {
+    if (field == nullptr || (!field->is_repeated() &&
+                             !reflection->HasField(message, field))) {
+      continue;
+    }
+    hash = absl::Hash<std::pair<size_t, size_t>>()(
+        {hash, FieldHash(primitive_handler, message, field)});
+  }
+  return hash;
+}
+
 class EqualsOperator : public BinaryOperator {
  public:
   absl::Status EvaluateOperator(
@@ -1601,21 +2188,28 @@ class EqualsOperator : public BinaryOperator {
   static bool AreEqual(const PrimitiveHandler* primitive_handler,
                        const Message& left, const Message& right) {
     if (AreSameMessageType(left, right)) {
-      return MessageDifferencer::Equals(left, right);
+      return StructurallyEqual(left, right);
     } else {
       // When dealing with different types we might be comparing a
       // primitive type (like an enum) to a literal string, which is
-      // supported. Therefore we simply convert both to string form
-      // and consider them unequal if either is not a string.
-      absl::StatusOr<JsonPrimitive> left_primitive =
-          primitive_handler->WrapPrimitiveProto(left);
-      absl::StatusOr<JsonPrimitive> right_primitive =
-          primitive_handler->WrapPrimitiveProto(right);
-
+      // supported. Therefore we compare the JSON representations of both
+      // and consider them unequal if either is not a primitive.
+      //
       // Comparisons between primitives and non-primitives are valid
       // in FHIRPath and should simply return false rather than an error.
-      return left_primitive.ok() && right_primitive.ok() &&
-             left_primitive.value().value == right_primitive.value().value;
+      if (!IsPrimitive(left.GetDescriptor()) ||
+          !IsPrimitive(right.GetDescriptor())) {
+        return false;
+      }
+
+      std::string left_scratch;
+      std::string right_scratch;
+      absl::StatusOr<PrimitiveText> left_text =
+          GetPrimitiveText(primitive_handler, left, &left_scratch);
+      absl::StatusOr<PrimitiveText> right_text =
+          GetPrimitiveText(primitive_handler, right, &right_scratch);
+      return left_text.ok() && right_text.ok() &&
+             left_text.value() == right_text.value();
     }
   }
 
@@ -1653,17 +2247,23 @@ struct ProtoPtrHash {
       return 0;
     }
 
-    // TODO: This will crash on a non-STU3 or R4 primitive.
-    // That's probably ok for now but we should fix this to never crash ASAP.
-    if (IsPrimitive(message->GetDescriptor())) {
-      return std::hash<std::string>{}(
-          primitive_handler->WrapPrimitiveProto(*message).value().value);
-    }
-
-    return std::hash<std::string>{}(message->SerializeAsString());
+    return MessageHash(primitive_handler, *message);
   }
 };
 
+// A set of messages, compared using FHIRPath equality, used to implement the
+// collection operators as hash joins.
+using MessageSet = std::unordered_set<WorkspaceMessage, ProtoPtrHash,
+                                      ProtoPtrSameTypeAndEqual>;
+
+// Returns an empty MessageSet sized to hold the given number of messages.
+MessageSet NewMessageSet(const PrimitiveHandler* primitive_handler,
+                         size_t expected_size) {
+  return MessageSet(std::max<size_t>(expected_size, kDefaultSetBucketCount),
+                    ProtoPtrHash(primitive_handler),
+                    ProtoPtrSameTypeAndEqual(primitive_handler));
+}
+
 class UnionOperator : public BinaryOperator {
  public:
   UnionOperator(std::shared_ptr<ExpressionNode> left,
@@ -1674,13 +2274,17 @@ class UnionOperator : public BinaryOperator {
       const std::vector<WorkspaceMessage>& left_results,
       const std::vector<WorkspaceMessage>& right_results, WorkSpace* work_space,
       std::vector<WorkspaceMessage>* out_results) const override {
-    std::unordered_set<WorkspaceMessage, ProtoPtrHash, ProtoPtrSameTypeAndEqual>
-        results(kDefaultSetBucketCount,
-                ProtoPtrHash(work_space->GetPrimitiveHandler()),
-                ProtoPtrSameTypeAndEqual(work_space->GetPrimitiveHandler()));
-    results.insert(left_results.begin(), left_results.end());
-    results.insert(right_results.begin(), right_results.end());
-    out_results->insert(out_results->begin(), results.begin(), results.end());
+    MessageSet results =
+        NewMessageSet(work_space->GetPrimitiveHandler(),
+                      left_results.size() + right_results.size());
+    for (const std::vector<WorkspaceMessage>* operand :
+         {&left_results, &right_results}) {
+      for (const WorkspaceMessage& message : *operand) {
+        if (results.insert(message).second) {
+          out_results->push_back(message);
+        }
+      }
+    }
     return absl::OkStatus();
   }
 
@@ -1714,14 +2318,18 @@ class IsDistinctFunction : public ZeroParameterFunctionNode {
     std::vector<WorkspaceMessage> child_results;
     FHIR_RETURN_IF_ERROR(child_->Evaluate(work_space, &child_results));
 
-    std::unordered_set<WorkspaceMessage, ProtoPtrHash, ProtoPtrSameTypeAndEqual>
-        child_results_set(
-            child_results.begin(), child_results.end(), kDefaultSetBucketCount,
-            ProtoPtrHash(work_space->GetPrimitiveHandler()),
-            ProtoPtrSameTypeAndEqual(work_space->GetPrimitiveHandler()));
+    MessageSet child_results_set =
+        NewMessageSet(work_space->GetPrimitiveHandler(), child_results.size());
+    bool is_distinct = true;
+    for (const WorkspaceMessage& message : child_results) {
+      if (!child_results_set.insert(message).second) {
+        is_distinct = false;
+        break;
+      }
+    }
 
-    Message* result = work_space->GetPrimitiveHandler()->NewBoolean(
-        child_results_set.size() == child_results.size());
+    Message* result =
+        work_space->GetPrimitiveHandler()->NewBoolean(is_distinct);
     work_space->DeleteWhenFinished(result);
     results->push_back(WorkspaceMessage(result));
     return absl::OkStatus();
@@ -1745,12 +2353,13 @@ class DistinctFunction : public ZeroParameterFunctionNode {
     std::vector<WorkspaceMessage> child_results;
     FHIR_RETURN_IF_ERROR(child_->Evaluate(work_space, &child_results));
 
-    std::unordered_set<WorkspaceMessage, ProtoPtrHash, ProtoPtrSameTypeAndEqual>
-        result_set(child_results.begin(), child_results.end(),
-                   kDefaultSetBucketCount,
-                   ProtoPtrHash(work_space->GetPrimitiveHandler()),
-                   ProtoPtrSameTypeAndEqual(work_space->GetPrimitiveHandler()));
-    results->insert(results->begin(), result_set.begin(), result_set.end());
+    MessageSet result_set =
+        NewMessageSet(work_space->GetPrimitiveHandler(), child_results.size());
+    for (const WorkspaceMessage& message : child_results) {
+      if (result_set.insert(message).second) {
+        results->push_back(message);
+      }
+    }
     return absl::OkStatus();
   }
 
@@ -1797,16 +2406,16 @@ class CombineFunction : public SingleParameterFunctionNode {
 // Factory method for creating FHIRPath's union() function.
 absl::StatusOr<ExpressionNode*> static CreateUnionFunction(
     const std::shared_ptr<ExpressionNode>& child_expression,
-    const std::vector<FhirPathParser::ExpressionContext*>& params,
-    FhirPathBaseVisitor* base_context_visitor,
-    FhirPathBaseVisitor* child_context_visitor) {
+    const std::vector<const AstNode*>& params,
+    FhirPathCompiler* base_context_compiler,
+    FhirPathCompiler* child_context_compiler) {
   if (params.size() != 1) {
     return InvalidArgumentError("union() requires exactly one argument.");
   }
 
   FHIR_ASSIGN_OR_RETURN(
       std::vector<std::shared_ptr<ExpressionNode>> compiled_params,
-      FunctionNode::CompileParams(params, base_context_visitor));
+      FunctionNode::CompileParams(params, base_context_compiler));
 
   return new UnionOperator(child_expression, compiled_params[0]);
 }
@@ -1824,10 +2433,10 @@ class WhereFunction : public FunctionNode {
   }
 
   static absl::StatusOr<std::vector<std::shared_ptr<ExpressionNode>>>
-  CompileParams(const std::vector<FhirPathParser::ExpressionContext*>& params,
-                FhirPathBaseVisitor*,
-                FhirPathBaseVisitor* child_context_visitor) {
-    return FunctionNode::CompileParams(params, child_context_visitor);
+  CompileParams(const std::vector<const AstNode*>& params,
+                FhirPathCompiler*,
+                FhirPathCompiler* child_context_compiler) {
+    return FunctionNode::CompileParams(params, child_context_compiler);
   }
 
   WhereFunction(const std::shared_ptr<ExpressionNode>& child,
@@ -1842,16 +2451,9 @@ class WhereFunction : public FunctionNode {
     FHIR_RETURN_IF_ERROR(child_->Evaluate(work_space, &child_results));
 
     for (const WorkspaceMessage& message : child_results) {
-      std::vector<WorkspaceMessage> param_results;
-      WorkSpace expression_work_space(work_space->GetPrimitiveHandler(),
-                                      work_space->MessageContextStack(),
-                                      message);
-      FHIR_RETURN_IF_ERROR(
-          params_[0]->Evaluate(&expression_work_space, &param_results));
-      FHIR_ASSIGN_OR_RETURN(
-          absl::StatusOr<absl::optional<bool>> allowed,
-          (BooleanOrEmpty(work_space->GetPrimitiveHandler(), param_results)));
-      if (allowed.value().value_or(false)) {
+      FHIR_ASSIGN_OR_RETURN(bool allowed,
+                            MeetsCriteria(work_space, *params_[0], message));
+      if (allowed) {
         results->push_back(message);
       }
     }
@@ -1859,15 +2461,34 @@ class WhereFunction : public FunctionNode {
     return absl::OkStatus();
   }
 
+  // Returns true if the criteria evaluates to true with the given message as
+  // its context.
+  static absl::StatusOr<bool> MeetsCriteria(WorkSpace* work_space,
+                                            const ExpressionNode& criteria,
+                                            const WorkspaceMessage& message) {
+    std::vector<WorkspaceMessage> param_results;
+    WorkSpace expression_work_space(work_space, message);
+    FHIR_RETURN_IF_ERROR(
+        criteria.Evaluate(&expression_work_space, &param_results));
+    FHIR_ASSIGN_OR_RETURN(
+        absl::optional<bool> allowed,
+        BooleanOrEmpty(work_space->GetPrimitiveHandler(), param_results));
+    return allowed.value_or(false);
+  }
+
+  const std::shared_ptr<ExpressionNode>& Criteria() const {
+    return params_[0];
+  }
+
   const Descriptor* ReturnType() const override { return child_->ReturnType(); }
 };
 
 // Factory method for creating FHIRPath's anyTrue() function.
 absl::StatusOr<FunctionNode*> static CreateAnyTrueFunction(
     const std::shared_ptr<ExpressionNode>& child_expression,
-    const std::vector<FhirPathParser::ExpressionContext*>& params,
-    FhirPathBaseVisitor* base_context_visitor,
-    FhirPathBaseVisitor* child_context_visitor) {
+    const std::vector<const AstNode*>& params,
+    FhirPathCompiler* base_context_compiler,
+    FhirPathCompiler* child_context_compiler) {
   if (!params.empty()) {
     return InvalidArgumentError("anyTrue() requires zero arguments.");
   }
@@ -1882,9 +2503,9 @@ absl::StatusOr<FunctionNode*> static CreateAnyTrueFunction(
 // Factory method for creating FHIRPath's anyFalse() function.
 absl::StatusOr<FunctionNode*> static CreateAnyFalseFunction(
     const std::shared_ptr<ExpressionNode>& child_expression,
-    const std::vector<FhirPathParser::ExpressionContext*>& params,
-    FhirPathBaseVisitor* base_context_visitor,
-    FhirPathBaseVisitor* child_context_visitor) {
+    const std::vector<const AstNode*>& params,
+    FhirPathCompiler* base_context_compiler,
+    FhirPathCompiler* child_context_compiler) {
   if (!params.empty()) {
     return InvalidArgumentError("anyFalse() requires zero arguments.");
   }
@@ -1909,10 +2530,10 @@ class AllFunction : public FunctionNode {
   }
 
   static absl::StatusOr<std::vector<std::shared_ptr<ExpressionNode>>>
-  CompileParams(const std::vector<FhirPathParser::ExpressionContext*>& params,
-                FhirPathBaseVisitor*,
-                FhirPathBaseVisitor* child_context_visitor) {
-    return FunctionNode::CompileParams(params, child_context_visitor);
+  CompileParams(const std::vector<const AstNode*>& params,
+                FhirPathCompiler*,
+                FhirPathCompiler* child_context_compiler) {
+    return FunctionNode::CompileParams(params, child_context_compiler);
   }
 
   AllFunction(
@@ -1945,9 +2566,7 @@ class AllFunction : public FunctionNode {
       const std::vector<WorkspaceMessage>& child_results) const {
     for (const WorkspaceMessage& message : child_results) {
       std::vector<WorkspaceMessage> param_results;
-      WorkSpace expression_work_space(work_space->GetPrimitiveHandler(),
-                                      work_space->MessageContextStack(),
-                                      message);
+      WorkSpace expression_work_space(work_space, message);
       FHIR_RETURN_IF_ERROR(
           params_[0]->Evaluate(&expression_work_space, &param_results));
       FHIR_ASSIGN_OR_RETURN(
@@ -2006,10 +2625,10 @@ class SelectFunction : public FunctionNode {
   }
 
   static absl::StatusOr<std::vector<std::shared_ptr<ExpressionNode>>>
-  CompileParams(const std::vector<FhirPathParser::ExpressionContext*>& params,
-                FhirPathBaseVisitor*,
-                FhirPathBaseVisitor* child_context_visitor) {
-    return FunctionNode::CompileParams(params, child_context_visitor);
+  CompileParams(const std::vector<const AstNode*>& params,
+                FhirPathCompiler*,
+                FhirPathCompiler* child_context_compiler) {
+    return FunctionNode::CompileParams(params, child_context_compiler);
   }
 
   SelectFunction(const std::shared_ptr<ExpressionNode>& child,
@@ -2042,36 +2661,23 @@ class SelectFunction : public FunctionNode {
 class IifFunction : public FunctionNode {
  public:
   static absl::StatusOr<std::vector<std::shared_ptr<ExpressionNode>>>
-  CompileParams(const std::vector<FhirPathParser::ExpressionContext*>& params,
-                FhirPathBaseVisitor* base_context_visitor,
-                FhirPathBaseVisitor* child_context_visitor) {
+  CompileParams(const std::vector<const AstNode*>& params,
+                FhirPathCompiler* base_context_compiler,
+                FhirPathCompiler* child_context_compiler) {
     if (params.size() < 2 || params.size() > 3) {
       return InvalidArgumentError("iif() requires 2 or 3 arugments.");
     }
 
-    std::vector<std::shared_ptr<ExpressionNode>> compiled_params;
-
-    antlrcpp::Any criterion = params[0]->accept(child_context_visitor);
-    if (criterion.isNull()) {
-      return InvalidArgumentError("Failed to compile parameter.");
-    }
-    compiled_params.push_back(criterion.as<std::shared_ptr<ExpressionNode>>());
-
-    antlrcpp::Any true_result = params[1]->accept(base_context_visitor);
-    if (true_result.isNull()) {
-      return InvalidArgumentError("Failed to compile parameter.");
-    }
-    compiled_params.push_back(
-        true_result.as<std::shared_ptr<ExpressionNode>>());
+    FHIR_ASSIGN_OR_RETURN(
+        std::vector<std::shared_ptr<ExpressionNode>> compiled_params,
+        FunctionNode::CompileParams({params[0]}, child_context_compiler));
 
-    if (params.size() > 2) {
-      antlrcpp::Any otherwise_result = params[2]->accept(base_context_visitor);
-      if (otherwise_result.isNull()) {
-        return InvalidArgumentError("Failed to compile parameter.");
-      }
-      compiled_params.push_back(
-          otherwise_result.as<std::shared_ptr<ExpressionNode>>());
-    }
+    FHIR_ASSIGN_OR_RETURN(
+        std::vector<std::shared_ptr<ExpressionNode>> results,
+        FunctionNode::CompileParams({params.begin() + 1, params.end()},
+                                    base_context_compiler));
+    compiled_params.insert(compiled_params.end(), results.begin(),
+                           results.end());
 
     return compiled_params;
   }
@@ -2099,8 +2705,7 @@ class IifFunction : public FunctionNode {
     const WorkspaceMessage& child = child_results[0];
 
     std::vector<WorkspaceMessage> param_results;
-    WorkSpace expression_work_space(work_space->GetPrimitiveHandler(),
-                                    work_space->MessageContextStack(), child);
+    WorkSpace expression_work_space(work_space, child);
     FHIR_RETURN_IF_ERROR(
         params_[0]->Evaluate(&expression_work_space, &param_results));
     FHIR_ASSIGN_OR_RETURN(
@@ -2123,9 +2728,9 @@ class IifFunction : public FunctionNode {
 template <typename T>
 absl::StatusOr<ExpressionNode*> static CreateConvertsToFunction(
     const std::shared_ptr<ExpressionNode>& child_expression,
-    const std::vector<FhirPathParser::ExpressionContext*>& params,
-    FhirPathBaseVisitor* base_context_visitor,
-    FhirPathBaseVisitor* child_context_visitor) {
+    const std::vector<const AstNode*>& params,
+    FhirPathCompiler* base_context_compiler,
+    FhirPathCompiler* child_context_compiler) {
   if (!params.empty()) {
     return InvalidArgumentError("convertsTo*() requires zero arguments.");
   }
@@ -2149,20 +2754,10 @@ absl::StatusOr<ExpressionNode*> static CreateConvertsToFunction(
 // TODO: Handle type inheritance correctly. For example, a Patient
 // resource is a DomainResource, but this function, as is, will filter out the
 // Patient if ofType(DomainResource) is used.
+//
+// See CreateOfTypeFunction for the factory method used by the compiler.
 class OfTypeFunction : public ExpressionNode {
  public:
-  absl::StatusOr<OfTypeFunction*> static Create(
-      const std::shared_ptr<ExpressionNode>& child_expression,
-      const std::vector<FhirPathParser::ExpressionContext*>& params,
-      FhirPathBaseVisitor* base_context_visitor,
-      FhirPathBaseVisitor* child_context_visitor) {
-    if (params.size() != 1) {
-      return InvalidArgumentError("ofType() requires a single argument.");
-    }
-
-    return new OfTypeFunction(child_expression, params[0]->getText());
-  }
-
   OfTypeFunction(const std::shared_ptr<ExpressionNode>& child,
              std::string type_name)
       : child_(child), type_name_(type_name) {}
@@ -2206,14 +2801,15 @@ class IsFunction : public ExpressionNode {
  public:
   absl::StatusOr<IsFunction*> static Create(
       const std::shared_ptr<ExpressionNode>& child_expression,
-      const std::vector<FhirPathParser::ExpressionContext*>& params,
-      FhirPathBaseVisitor* base_context_visitor,
-      FhirPathBaseVisitor* child_context_visitor) {
+      const std::vector<const AstNode*>& params,
+      FhirPathCompiler* base_context_compiler,
+      FhirPathCompiler* child_context_compiler) {
     if (params.size() != 1) {
       return InvalidArgumentError("is() requires a single argument.");
     }
 
-    return new IsFunction(child_expression, params[0]->getText());
+    FHIR_ASSIGN_OR_RETURN(std::string type_name, TypeSpecifierName(*params[0]));
+    return new IsFunction(child_expression, type_name);
   }
 
   IsFunction(const std::shared_ptr<ExpressionNode>& child,
@@ -2246,6 +2842,10 @@ class IsFunction : public ExpressionNode {
     return Boolean::GetDescriptor();
   }
 
+  const std::shared_ptr<ExpressionNode>& Child() const { return child_; }
+
+  const std::string& TypeName() const { return type_name_; }
+
  private:
   const std::shared_ptr<ExpressionNode> child_;
   const std::string type_name_;
@@ -2266,14 +2866,15 @@ class AsFunction : public ExpressionNode {
  public:
   absl::StatusOr<AsFunction*> static Create(
       const std::shared_ptr<ExpressionNode>& child_expression,
-      const std::vector<FhirPathParser::ExpressionContext*>& params,
-      FhirPathBaseVisitor* base_context_visitor,
-      FhirPathBaseVisitor* child_context_visitor) {
+      const std::vector<const AstNode*>& params,
+      FhirPathCompiler* base_context_compiler,
+      FhirPathCompiler* child_context_compiler) {
     if (params.size() != 1) {
       return InvalidArgumentError("as() requires a single argument.");
     }
 
-    return new AsFunction(child_expression, params[0]->getText());
+    FHIR_ASSIGN_OR_RETURN(std::string type_name, TypeSpecifierName(*params[0]));
+    return new AsFunction(child_expression, type_name);
   }
 
   AsFunction(const std::shared_ptr<ExpressionNode>& child,
@@ -2309,6 +2910,42 @@ class AsFunction : public ExpressionNode {
   const std::string type_name_;
 };
 
+// Implements resolve(), which returns the resources that the references in
+// its input collection point to. The references may be Reference elements or
+// URIs; those that cannot be resolved are skipped.
+class ResolveFunction : public ZeroParameterFunctionNode {
+ public:
+  ResolveFunction(const std::shared_ptr<ExpressionNode>& child,
+                  const std::vector<std::shared_ptr<ExpressionNode>>& params)
+      : ZeroParameterFunctionNode(child, params) {}
+
+  absl::Status Evaluate(WorkSpace* work_space,
+                        std::vector<WorkspaceMessage>* results) const override {
+    std::vector<WorkspaceMessage> child_results;
+    FHIR_RETURN_IF_ERROR(child_->Evaluate(work_space, &child_results));
+
+    const ReferenceResolver* resolver = work_space->GetReferenceResolver();
+    for (const WorkspaceMessage& child : child_results) {
+      absl::StatusOr<std::string> reference =
+          IsReference(child.Message()->GetDescriptor())
+              ? ReferenceProtoToString(*child.Message())
+              : MessageToString(child);
+      if (!reference.ok()) {
+        continue;
+      }
+
+      const Message* resource = resolver->Resolve(reference.value());
+      if (resource != nullptr) {
+        results->push_back(WorkspaceMessage(resource));
+      }
+    }
+
+    return absl::OkStatus();
+  }
+
+  const Descriptor* ReturnType() const override { return nullptr; }
+};
+
 class ChildrenFunction : public ZeroParameterFunctionNode {
  public:
   ChildrenFunction(const std::shared_ptr<ExpressionNode>& child,
@@ -2320,13 +2957,15 @@ class ChildrenFunction : public ZeroParameterFunctionNode {
     std::vector<WorkspaceMessage> child_results;
     FHIR_RETURN_IF_ERROR(child_->Evaluate(work_space, &child_results));
 
+    std::function<Message*(const Descriptor*)> message_factory =
+        MakeWorkSpaceMessageFactory(work_space);
     for (const WorkspaceMessage& child : child_results) {
       const Descriptor* descriptor = child.Message()->GetDescriptor();
       for (int i = 0; i < descriptor->field_count(); i++) {
         std::vector<const Message*> messages;
-        FHIR_RETURN_IF_ERROR(
-            RetrieveField(*child.Message(), *descriptor->field(i),
-                          MakeWorkSpaceMessageFactory(work_space), &messages));
+        FHIR_RETURN_IF_ERROR(RetrieveField(*child.Message(),
+                                           *descriptor->field(i),
+                                           message_factory, &messages));
         for (const Message* message : messages) {
             results->push_back(WorkspaceMessage(child, message));
         }
@@ -2341,42 +2980,408 @@ class ChildrenFunction : public ZeroParameterFunctionNode {
   }
 };
 
-class DescendantsFunction : public ZeroParameterFunctionNode {
+// Determines which branches of a message tree may contain a message of a given
+// FHIRPath type. This allows expressions such as descendants().ofType(X) to
+// skip entire subtrees that cannot contain an X rather than materializing every
+// descendant and filtering afterwards.
+//
+// Reachability is computed lazily, once per message type, and cached for the
+// lifetime of the filter. This class is thread safe.
+class DescendantTypeFilter {
  public:
-  DescendantsFunction(
-      const std::shared_ptr<ExpressionNode>& child,
-      const std::vector<std::shared_ptr<ExpressionNode>>& params)
-      : ZeroParameterFunctionNode(child, params) {}
+  explicit DescendantTypeFilter(const std::string& type_name)
+      : type_name_(type_name) {}
+
+  // Returns true if messages of the given type are of the filtered type.
+  bool Matches(const Descriptor* descriptor) const {
+    return absl::EqualsIgnoreCase(descriptor->name(), type_name_);
+  }
+
+  // Returns the fields of the given message type that may lead, directly or
+  // transitively, to a message of the filtered type.
+  const std::vector<const FieldDescriptor*>& FieldsToTraverse(
+      const Descriptor* descriptor) const {
+    {
+      absl::ReaderMutexLock lock(&mutex_);
+      auto it = fields_to_traverse_.find(descriptor);
+      if (it != fields_to_traverse_.end()) {
+        return it->second;
+      }
+    }
+
+    absl::MutexLock lock(&mutex_);
+    IndexReachableTypes(descriptor);
+    return fields_to_traverse_.at(descriptor);
+  }
+
+  const std::string& type_name() const { return type_name_; }
+
+ private:
+  // Appends the types of the messages RetrieveField may produce for the given
+  // field to value_types. Returns false if the types cannot be determined
+  // statically, as is the case for contained resources packed in Any protos.
+  static bool FieldValueTypes(const FieldDescriptor* field,
+                              std::vector<const Descriptor*>* value_types) {
+    const Descriptor* type = field->message_type();
+    if (type == nullptr) {
+      return true;
+    }
+
+    if (IsMessageType<google::protobuf::Any>(type)) {
+      return false;
+    }
+
+    if (IsChoiceType(field) || IsContainedResource(type)) {
+      for (int i = 0; i < type->field_count(); i++) {
+        if (type->field(i)->message_type() != nullptr) {
+          value_types->push_back(type->field(i)->message_type());
+        }
+      }
+      return true;
+    }
+
+    value_types->push_back(type);
+    return true;
+  }
+
+  // Computes the fields to traverse for root and every message type reachable
+  // from it that has not already been indexed.
+  void IndexReachableTypes(const Descriptor* root) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    if (fields_to_traverse_.contains(root)) {
+      return;
+    }
+
+    // Discover the unindexed types reachable from root, recording the reverse
+    // edges between them so reachability can be propagated back to parents.
+    std::vector<const Descriptor*> discovered = {root};
+    absl::flat_hash_set<const Descriptor*> visited = {root};
+    absl::flat_hash_map<const Descriptor*, std::vector<const Descriptor*>>
+        parents;
+    std::vector<const Descriptor*> newly_reaching;
+    for (size_t i = 0; i < discovered.size(); i++) {
+      const Descriptor* descriptor = discovered[i];
+      // descendants() does not descend into primitives.
+      if (IsPrimitive(descriptor)) {
+        continue;
+      }
+
+      for (int j = 0; j < descriptor->field_count(); j++) {
+        std::vector<const Descriptor*> value_types;
+        bool reaches =
+            !FieldValueTypes(descriptor->field(j), &value_types);
+        for (const Descriptor* value_type : value_types) {
+          reaches = reaches || Matches(value_type) ||
+                    reaches_target_.contains(value_type);
+          parents[value_type].push_back(descriptor);
+          if (!fields_to_traverse_.contains(value_type) &&
+              visited.insert(value_type).second) {
+            discovered.push_back(value_type);
+          }
+        }
+
+        if (reaches && reaches_target_.insert(descriptor).second) {
+          newly_reaching.push_back(descriptor);
+        }
+      }
+    }
+
+    while (!newly_reaching.empty()) {
+      const Descriptor* descriptor = newly_reaching.back();
+      newly_reaching.pop_back();
+      for (const Descriptor* parent : parents[descriptor]) {
+        if (reaches_target_.insert(parent).second) {
+          newly_reaching.push_back(parent);
+        }
+      }
+    }
+
+    for (const Descriptor* descriptor : discovered) {
+      std::vector<const FieldDescriptor*>& fields =
+          fields_to_traverse_[descriptor];
+      if (IsPrimitive(descriptor) || !reaches_target_.contains(descriptor)) {
+        continue;
+      }
+
+      for (int j = 0; j < descriptor->field_count(); j++) {
+        std::vector<const Descriptor*> value_types;
+        bool traverse = !FieldValueTypes(descriptor->field(j), &value_types);
+        for (const Descriptor* value_type : value_types) {
+          traverse = traverse || Matches(value_type) ||
+                     reaches_target_.contains(value_type);
+        }
+
+        if (traverse) {
+          fields.push_back(descriptor->field(j));
+        }
+      }
+    }
+  }
+
+  const std::string type_name_;
+
+  mutable absl::Mutex mutex_;
+  // Message types that may contain a message of the filtered type.
+  mutable absl::flat_hash_set<const Descriptor*> reaches_target_;
+  // Node-based so that references returned by FieldsToTraverse remain valid
+  // as additional types are indexed.
+  mutable absl::node_hash_map<const Descriptor*,
+                              std::vector<const FieldDescriptor*>>
+      fields_to_traverse_;
+};
+
+// Implements the FHIRPath .descendants() function.
+class DescendantsFunction : public ZeroParameterFunctionNode {
+ public:
+  DescendantsFunction(
+      const std::shared_ptr<ExpressionNode>& child,
+      const std::vector<std::shared_ptr<ExpressionNode>>& params)
+      : ZeroParameterFunctionNode(child, params) {}
 
   absl::Status Evaluate(WorkSpace* work_space,
                         std::vector<WorkspaceMessage>* results) const override {
+    return VisitDescendants(work_space, nullptr,
+                            [results](const WorkspaceMessage& descendant) {
+                              results->push_back(descendant);
+                              return absl::OkStatus();
+                            });
+  }
+
+  // Invokes the visitor on each descendant, in pre-order, of the messages
+  // produced by this function's child expression. If a type_filter is
+  // provided, only descendants of the filtered type are visited and subtrees
+  // that cannot contain such a descendant are not traversed.
+  absl::Status VisitDescendants(
+      WorkSpace* work_space, const DescendantTypeFilter* type_filter,
+      const std::function<absl::Status(const WorkspaceMessage&)>& visitor)
+      const {
     std::vector<WorkspaceMessage> child_results;
     FHIR_RETURN_IF_ERROR(child_->Evaluate(work_space, &child_results));
 
+    std::function<Message*(const Descriptor*)> message_factory =
+        MakeWorkSpaceMessageFactory(work_space);
     for (const WorkspaceMessage& child : child_results) {
-      FHIR_RETURN_IF_ERROR(AppendDescendants(child, work_space, results));
+      FHIR_RETURN_IF_ERROR(
+          AppendDescendants(child, message_factory, type_filter, visitor));
     }
 
     return absl::OkStatus();
   }
 
-  absl::Status AppendDescendants(const WorkspaceMessage& parent,
-                                 WorkSpace* work_space,
-                                 std::vector<WorkspaceMessage>* results) const {
+  const Descriptor* ReturnType() const override { return nullptr; }
+
+ private:
+  absl::Status AppendDescendants(
+      const WorkspaceMessage& parent,
+      const std::function<Message*(const Descriptor*)>& message_factory,
+      const DescendantTypeFilter* type_filter,
+      const std::function<absl::Status(const WorkspaceMessage&)>& visitor)
+      const {
     const Descriptor* descriptor = parent.Message()->GetDescriptor();
     if (IsPrimitive(descriptor)) {
       return absl::OkStatus();
     }
 
-    for (int i = 0; i < descriptor->field_count(); i++) {
+    auto append_field = [&](const FieldDescriptor* field) -> absl::Status {
       std::vector<const Message*> messages;
-      FHIR_RETURN_IF_ERROR(
-          RetrieveField(*parent.Message(), *descriptor->field(i),
-                        MakeWorkSpaceMessageFactory(work_space), &messages));
+      FHIR_RETURN_IF_ERROR(RetrieveField(*parent.Message(), *field,
+                                         message_factory, &messages));
       for (const Message* message : messages) {
         WorkspaceMessage child(parent, message);
-        results->push_back(child);
-        FHIR_RETURN_IF_ERROR(AppendDescendants(child, work_space, results));
+        if (type_filter == nullptr ||
+            type_filter->Matches(message->GetDescriptor())) {
+          FHIR_RETURN_IF_ERROR(visitor(child));
+        }
+        FHIR_RETURN_IF_ERROR(
+            AppendDescendants(child, message_factory, type_filter, visitor));
+      }
+      return absl::OkStatus();
+    };
+
+    if (type_filter != nullptr) {
+      for (const FieldDescriptor* field :
+           type_filter->FieldsToTraverse(descriptor)) {
+        FHIR_RETURN_IF_ERROR(append_field(field));
+      }
+      return absl::OkStatus();
+    }
+
+    for (int i = 0; i < descriptor->field_count(); i++) {
+      FHIR_RETURN_IF_ERROR(append_field(descriptor->field(i)));
+    }
+
+    return absl::OkStatus();
+  }
+};
+
+// Implements descendants().ofType(X), and the equivalent
+// descendants().where($this is X), by only walking the branches of each
+// message that can contain an X.
+class DescendantsOfTypeFunction : public ExpressionNode {
+ public:
+  DescendantsOfTypeFunction(
+      const std::shared_ptr<DescendantsFunction>& descendants,
+      const std::string& type_name)
+      : descendants_(descendants), type_filter_(type_name) {}
+
+  absl::Status Evaluate(WorkSpace* work_space,
+                        std::vector<WorkspaceMessage>* results) const override {
+    return descendants_->VisitDescendants(
+        work_space, &type_filter_,
+        [results](const WorkspaceMessage& descendant) {
+          results->push_back(descendant);
+          return absl::OkStatus();
+        });
+  }
+
+  const Descriptor* ReturnType() const override {
+    // TODO: Fetch the descriptor based on the filtered type name.
+    return nullptr;
+  }
+
+ private:
+  const std::shared_ptr<DescendantsFunction> descendants_;
+  const DescendantTypeFilter type_filter_;
+};
+
+// Implements descendants().where(criteria) by evaluating the criteria as each
+// descendant is visited rather than first materializing all descendants.
+class DescendantsWhereFunction : public ExpressionNode {
+ public:
+  DescendantsWhereFunction(
+      const std::shared_ptr<DescendantsFunction>& descendants,
+      const std::shared_ptr<ExpressionNode>& criteria)
+      : descendants_(descendants), criteria_(criteria) {}
+
+  absl::Status Evaluate(WorkSpace* work_space,
+                        std::vector<WorkspaceMessage>* results) const override {
+    return descendants_->VisitDescendants(
+        work_space, nullptr,
+        [&](const WorkspaceMessage& descendant) -> absl::Status {
+          FHIR_ASSIGN_OR_RETURN(
+              bool allowed,
+              WhereFunction::MeetsCriteria(work_space, *criteria_, descendant));
+          if (allowed) {
+            results->push_back(descendant);
+          }
+          return absl::OkStatus();
+        });
+  }
+
+  const Descriptor* ReturnType() const override { return nullptr; }
+
+ private:
+  const std::shared_ptr<DescendantsFunction> descendants_;
+  const std::shared_ptr<ExpressionNode> criteria_;
+};
+
+// Factory method for creating FHIRPath's ofType() function. When invoked on
+// descendants() the type filter is pushed into the traversal.
+absl::StatusOr<ExpressionNode*> static CreateOfTypeFunction(
+    const std::shared_ptr<ExpressionNode>& child_expression,
+    const std::vector<const AstNode*>& params,
+    FhirPathCompiler* base_context_compiler,
+    FhirPathCompiler* child_context_compiler) {
+  if (params.size() != 1) {
+    return InvalidArgumentError("ofType() requires a single argument.");
+  }
+
+  FHIR_ASSIGN_OR_RETURN(std::string type_name, TypeSpecifierName(*params[0]));
+
+  auto descendants = std::dynamic_pointer_cast<DescendantsFunction>(
+      Uninstrumented(child_expression));
+  if (descendants != nullptr) {
+    return new DescendantsOfTypeFunction(descendants, type_name);
+  }
+
+  return new OfTypeFunction(child_expression, type_name);
+}
+
+// Factory method for creating FHIRPath's where() function. When invoked on
+// descendants() the criteria is evaluated during the traversal, and criteria
+// of the form "$this is X" are compiled as descendants().ofType(X).
+absl::StatusOr<ExpressionNode*> static CreateWhereFunction(
+    const std::shared_ptr<ExpressionNode>& child_expression,
+    const std::vector<const AstNode*>& params,
+    FhirPathCompiler* base_context_compiler,
+    FhirPathCompiler* child_context_compiler) {
+  FHIR_ASSIGN_OR_RETURN(
+      WhereFunction * where,
+      FunctionNode::Create<WhereFunction>(child_expression, params,
+                                          base_context_compiler,
+                                          child_context_compiler));
+  std::unique_ptr<WhereFunction> where_owner(where);
+
+  auto descendants = std::dynamic_pointer_cast<DescendantsFunction>(
+      Uninstrumented(child_expression));
+  if (descendants == nullptr) {
+    return where_owner.release();
+  }
+
+  std::shared_ptr<ExpressionNode> criteria = where->Criteria();
+  auto is_function =
+      std::dynamic_pointer_cast<IsFunction>(Uninstrumented(criteria));
+  if (is_function != nullptr &&
+      std::dynamic_pointer_cast<ThisReference>(
+          Uninstrumented(is_function->Child()))) {
+    return new DescendantsOfTypeFunction(descendants,
+                                         is_function->TypeName());
+  }
+
+  return new DescendantsWhereFunction(descendants, criteria);
+}
+
+// Implements the FHIRPath .repeat() function.
+//
+// The projection is repeatedly applied to the items it produces, adding each
+// item to the result, until no new items are found. Items are considered new
+// if they are not equal to any item already in the result.
+class RepeatFunction : public FunctionNode {
+ public:
+  static absl::Status ValidateParams(
+      const std::vector<std::shared_ptr<ExpressionNode>>& params) {
+    if (params.size() != 1) {
+      return InvalidArgumentError("Function requires exactly one argument.");
+    }
+
+    return absl::OkStatus();
+  }
+
+  static absl::StatusOr<std::vector<std::shared_ptr<ExpressionNode>>>
+  CompileParams(const std::vector<const AstNode*>& params,
+                FhirPathCompiler*,
+                FhirPathCompiler* child_context_compiler) {
+    return FunctionNode::CompileParams(params, child_context_compiler);
+  }
+
+  RepeatFunction(const std::shared_ptr<ExpressionNode>& child,
+                 const std::vector<std::shared_ptr<ExpressionNode>>& params)
+      : FunctionNode(child, params) {
+    FHIR_DCHECK_OK(ValidateParams(params));
+  }
+
+  absl::Status Evaluate(WorkSpace* work_space,
+                        std::vector<WorkspaceMessage>* results) const override {
+    std::vector<WorkspaceMessage> pending;
+    FHIR_RETURN_IF_ERROR(child_->Evaluate(work_space, &pending));
+
+    MessageSet seen =
+        NewMessageSet(work_space->GetPrimitiveHandler(), pending.size());
+    while (!pending.empty()) {
+      WorkspaceMessage message = pending.back();
+      pending.pop_back();
+
+      std::vector<WorkspaceMessage> projected;
+      work_space->PushMessageContext(message);
+      absl::Status status = params_[0]->Evaluate(work_space, &projected);
+      work_space->PopMessageContext();
+      FHIR_RETURN_IF_ERROR(status);
+
+      for (const WorkspaceMessage& item : projected) {
+        if (seen.insert(item).second) {
+          results->push_back(item);
+          pending.push_back(item);
+        }
       }
     }
 
@@ -2400,15 +3405,12 @@ class IntersectFunction : public SingleParameterFunctionNode {
     std::vector<WorkspaceMessage> child_results;
     FHIR_RETURN_IF_ERROR(child_->Evaluate(work_space, &child_results));
 
-    std::unordered_set<WorkspaceMessage, ProtoPtrHash, ProtoPtrSameTypeAndEqual>
-        child_set(child_results.begin(), child_results.end(),
-                  kDefaultSetBucketCount,
-                  ProtoPtrHash(work_space->GetPrimitiveHandler()),
-                  ProtoPtrSameTypeAndEqual(work_space->GetPrimitiveHandler()));
+    MessageSet child_set =
+        NewMessageSet(work_space->GetPrimitiveHandler(), child_results.size());
+    child_set.insert(child_results.begin(), child_results.end());
 
     for (const auto& elem : first_param) {
-      if (child_set.count(elem) > 0) {
-        child_set.erase(elem);
+      if (child_set.erase(elem) > 0) {
         results->push_back(elem);
       }
     }
@@ -2432,6 +3434,89 @@ class IntersectFunction : public SingleParameterFunctionNode {
   }
 };
 
+// Implements the FHIRPath subsetOf() and supersetOf() functions.
+//
+// Membership of one collection in the other is tested with a hash join, so
+// evaluation is linear in the total size of both collections.
+class SubsetOfFunction : public SingleParameterFunctionNode {
+ public:
+  SubsetOfFunction(const std::shared_ptr<ExpressionNode>& child,
+                   const std::vector<std::shared_ptr<ExpressionNode>>& params,
+                   bool superset = false)
+      : SingleParameterFunctionNode(child, params), superset_(superset) {}
+
+  absl::Status Evaluate(WorkSpace* work_space,
+                        const std::vector<WorkspaceMessage>& first_param,
+                        std::vector<WorkspaceMessage>* results) const override {
+    std::vector<WorkspaceMessage> child_results;
+    FHIR_RETURN_IF_ERROR(child_->Evaluate(work_space, &child_results));
+
+    const std::vector<WorkspaceMessage>& subset =
+        superset_ ? first_param : child_results;
+    const std::vector<WorkspaceMessage>& superset =
+        superset_ ? child_results : first_param;
+
+    MessageSet superset_set =
+        NewMessageSet(work_space->GetPrimitiveHandler(), superset.size());
+    superset_set.insert(superset.begin(), superset.end());
+
+    bool is_subset = std::all_of(subset.begin(), subset.end(),
+                                 [&superset_set](const WorkspaceMessage& elem) {
+                                   return superset_set.count(elem) > 0;
+                                 });
+
+    Message* result = work_space->GetPrimitiveHandler()->NewBoolean(is_subset);
+    work_space->DeleteWhenFinished(result);
+    results->push_back(WorkspaceMessage(result));
+    return absl::OkStatus();
+  }
+
+  const Descriptor* ReturnType() const override {
+    return Boolean::descriptor();
+  }
+
+ private:
+  const bool superset_;
+};
+
+class SupersetOfFunction : public SubsetOfFunction {
+ public:
+  SupersetOfFunction(const std::shared_ptr<ExpressionNode>& child,
+                     const std::vector<std::shared_ptr<ExpressionNode>>& params)
+      : SubsetOfFunction(child, params, /*superset=*/true) {}
+};
+
+// Implements the FHIRPath exclude() function, returning the elements of the
+// input collection that are not in the parameter collection. Unlike the other
+// set operations, order and duplicates within the input are preserved.
+class ExcludeFunction : public SingleParameterFunctionNode {
+ public:
+  ExcludeFunction(const std::shared_ptr<ExpressionNode>& child,
+                  const std::vector<std::shared_ptr<ExpressionNode>>& params)
+      : SingleParameterFunctionNode(child, params) {}
+
+  absl::Status Evaluate(WorkSpace* work_space,
+                        const std::vector<WorkspaceMessage>& first_param,
+                        std::vector<WorkspaceMessage>* results) const override {
+    std::vector<WorkspaceMessage> child_results;
+    FHIR_RETURN_IF_ERROR(child_->Evaluate(work_space, &child_results));
+
+    MessageSet excluded =
+        NewMessageSet(work_space->GetPrimitiveHandler(), first_param.size());
+    excluded.insert(first_param.begin(), first_param.end());
+
+    for (const WorkspaceMessage& elem : child_results) {
+      if (excluded.count(elem) == 0) {
+        results->push_back(elem);
+      }
+    }
+
+    return absl::OkStatus();
+  }
+
+  const Descriptor* ReturnType() const override { return child_->ReturnType(); }
+};
+
 class ComparisonOperator : public BinaryOperator {
  public:
   // Types of comparisons supported by this operator.
@@ -3076,496 +4161,499 @@ class ContainsOperator : public BinaryOperator {
   }
 };
 
-// Produces a shared pointer explicitly of ExpressionNode rather
-// than a subclass to work well with ANTLR's "Any" semantics.
-inline std::shared_ptr<ExpressionNode> ToAny(
-    std::shared_ptr<ExpressionNode> node) {
-  return node;
-}
-
-// Internal structure that defines an invocation. This is used
-// at points when visiting the AST that do not have enough context
-// to produce an ExpressionNode (e.g., they do not see the type of
-// the calling object), and is a placeholder for a higher-level
-// visitor to transform into an ExpressionNode
-struct InvocationDefinition {
-  InvocationDefinition(const std::string& name, const bool is_function)
-      : name(name), is_function(is_function) {}
-
-  InvocationDefinition(
-      const std::string& name, const bool is_function,
-      const std::vector<FhirPathParser::ExpressionContext*>& params)
-      : name(name), is_function(is_function), params(params) {}
-
-  const std::string name;
-
-  // Indicates it is a function invocation rather than a member lookup.
-  const bool is_function;
-
-  const std::vector<FhirPathParser::ExpressionContext*> params;
-};
-
 absl::StatusOr<ExpressionNode*> UnimplementedFunction(
-    std::shared_ptr<ExpressionNode>,
-    const std::vector<FhirPathParser::ExpressionContext*>&,
-    FhirPathBaseVisitor*, FhirPathBaseVisitor*) {
+    std::shared_ptr<ExpressionNode>, const std::vector<const AstNode*>&,
+    FhirPathCompiler*, FhirPathCompiler*) {
   return UnimplementedError("Function is not yet supported.");
 }
 
-// ANTLR Visitor implementation to translate the AST
-// into ExpressionNodes that can run the expression over
-// given protocol buffers.
-//
-// Note that the return value of antlrcpp::Any assumes returned values
-// have copy constructors, which means we cannot use std::unique_ptr even
-// if that's the most logical choice. Therefore we'll use std:shared_ptr
-// more frequently here, but the costs in this case are negligible.
-class FhirPathCompilerVisitor : public FhirPathBaseVisitor {
- public:
-  FhirPathCompilerVisitor(const Descriptor* descriptor,
-                          const PrimitiveHandler* primitive_handler)
-      : error_listener_(this),
-        descriptor_stack_({descriptor}),
-        primitive_handler_(primitive_handler) {}
-
-  FhirPathCompilerVisitor(
+// Compiles the syntax tree of a FHIRPath expression into ExpressionNodes that
+// can run the expression over given protocol buffers.
+class FhirPathCompiler {
+ public:
+  // The parameters, if not null, must outlive the compiler.
+  FhirPathCompiler(const Descriptor* descriptor,
+                   const PrimitiveHandler* primitive_handler,
+                   const ExpressionParameters* parameters = nullptr)
+      : descriptor_stack_({descriptor}),
+        primitive_handler_(primitive_handler),
+        parameters_(parameters) {}
+
+  FhirPathCompiler(
       const std::vector<const Descriptor*>& descriptor_stack_history,
-      const Descriptor* descriptor, const PrimitiveHandler* primitive_handler)
-      : error_listener_(this),
-        descriptor_stack_(descriptor_stack_history),
-        primitive_handler_(primitive_handler) {
+      const Descriptor* descriptor, const PrimitiveHandler* primitive_handler,
+      const ExpressionParameters* parameters)
+      : descriptor_stack_(descriptor_stack_history),
+        primitive_handler_(primitive_handler),
+        parameters_(parameters) {
     descriptor_stack_.push_back(descriptor);
   }
 
-  antlrcpp::Any visitInvocationExpression(
-      FhirPathParser::InvocationExpressionContext* node) override {
-    antlrcpp::Any expression = node->children[0]->accept(this);
+  // Instruments every compiled node for profiling and records the structure
+  // of the expression in the given builder, which must outlive the compiler.
+  void EnableProfiling(ProfileBuilder* profile_builder) {
+    profile_builder_ = profile_builder;
+  }
 
-    // This could be a simple member name or a parameterized function...
-    antlrcpp::Any invocation = node->children[2]->accept(this);
+  // Records the fields read by the compiled expression in the given builder,
+  // which must outlive the compiler. The expression is compiled for the
+  // results of the fields at the given paths.
+  void TrackReadSet(ReadSetBuilder* read_set_builder,
+                    FieldPaths context_paths) {
+    read_set_builder_ = read_set_builder;
+    context_paths_ = std::move(context_paths);
+  }
 
-    if (!GetError().ok()) {
-      return nullptr;
+  absl::StatusOr<std::shared_ptr<ExpressionNode>> Compile(
+      const AstNode& node) {
+    if (read_set_builder_ == nullptr) {
+      return CompileInstrumented(node);
     }
 
-    auto definition = invocation.as<std::shared_ptr<InvocationDefinition>>();
-
-    std::shared_ptr<ExpressionNode> expr =
-        expression.as<std::shared_ptr<ExpressionNode>>();
-
-    if (definition->is_function) {
-      auto function_node =
-          createFunction(definition->name, expr, definition->params);
+    read_set_builder_->Begin();
+    absl::StatusOr<std::shared_ptr<ExpressionNode>> result =
+        CompileInstrumented(node);
+    read_set_builder_->End(result.ok()
+                               ? ResultPaths(node, *Uninstrumented(*result))
+                               : FieldPaths());
+    return result;
+  }
 
-      if (function_node == nullptr || !GetError().ok()) {
-        return nullptr;
-      } else {
-        return ToAny(function_node);
+ private:
+  absl::StatusOr<std::shared_ptr<ExpressionNode>> CompileInstrumented(
+      const AstNode& node) {
+    if (profile_builder_ == nullptr) {
+      return CompileNode(node);
+    }
+
+    const int index = profile_builder_->Begin(ProfileLabel(node));
+    absl::StatusOr<std::shared_ptr<ExpressionNode>> result = CompileNode(node);
+    profile_builder_->End(result.ok() ? result.value()->ReturnType()
+                                      : nullptr);
+    FHIR_RETURN_IF_ERROR(result.status());
+    return std::make_shared<ProfiledNode>(index, result.value());
+  }
+
+  // Returns the paths of the fields the results of the given node may be taken
+  // from, and records the paths of the fields the node reads as a whole.
+  FieldPaths ResultPaths(const AstNode& node, const ExpressionNode& compiled) {
+    const std::vector<FieldPaths>& operands = read_set_builder_->Operands();
+    switch (node.kind) {
+      case AstNode::kMemberInvocation: {
+        auto term = dynamic_cast<const InvokeTermNode*>(&compiled);
+        return MemberPaths(context_paths_,
+                           term != nullptr ? term->field() : nullptr);
       }
-    } else {
-      const Descriptor* descriptor = expr->ReturnType();
-
-      // If we know the return type of the expression, and the return type
-      // doesn't have the referenced field, set an error and return.
-      if (descriptor != nullptr && !HasFieldWithJsonName(descriptor,
-                                                         definition->name)) {
-        SetError(NotFoundError(
-            absl::StrCat("Unable to find field ", definition->name)));
-        return nullptr;
+      case AstNode::kInvocationExpression: {
+        const AstNode& invocation = *node.children[1];
+        if (invocation.kind == AstNode::kFunctionInvocation) {
+          return FunctionPaths(
+              invocation.name, operands[0],
+              std::vector<FieldPaths>(operands.begin() + 1, operands.end()));
+        }
+        auto member = dynamic_cast<const InvokeExpressionNode*>(&compiled);
+        return MemberPaths(operands[0],
+                           member != nullptr ? member->field() : nullptr);
       }
-
-      const FieldDescriptor* field =
-          descriptor != nullptr &&
-                  !IsMessageType<google::protobuf::Any>(descriptor)
-              ? FindFieldByJsonName(descriptor, definition->name)
-              : nullptr;
-      return ToAny(std::make_shared<InvokeExpressionNode>(expression, field,
-                                                          definition->name));
+      case AstNode::kFunctionInvocation:
+        return FunctionPaths(node.name, context_paths_, operands);
+      case AstNode::kThisInvocation:
+        return context_paths_;
+      case AstNode::kIndexerExpression:
+        read_set_builder_->Read(operands[1]);
+        return operands[0];
+      case AstNode::kTypeExpression:
+        if (node.op == "as") {
+          return operands[0];
+        }
+        break;
+      case AstNode::kBinaryExpression:
+        if (node.op == "|") {
+          return ReadAll(operands);
+        }
+        break;
+      case AstNode::kExternalConstant:
+        if (node.name == "context") {
+          return {""};
+        }
+        if (node.name == "resource" || node.name == "rootResource") {
+          read_set_builder_->ReadUnbounded();
+        }
+        break;
+      default:
+        break;
     }
-  }
 
-  antlrcpp::Any visitInvocationTerm(
-      FhirPathParser::InvocationTermContext* ctx) override {
-    antlrcpp::Any invocation = visitChildren(ctx);
+    ReadAll(operands);
+    return FieldPaths();
+  }
 
-    if (!GetError().ok()) {
-      return nullptr;
+  // Returns the paths of the given field within each of the given fields.
+  FieldPaths MemberPaths(const FieldPaths& parents,
+                         const FieldDescriptor* field) {
+    // The field is looked up at evaluation time.
+    if (field == nullptr) {
+      read_set_builder_->Read(parents);
+      return FieldPaths();
+    }
+
+    FieldPaths paths;
+    paths.reserve(parents.size());
+    for (const std::string& parent : parents) {
+      paths.push_back(parent.empty()
+                          ? field->name()
+                          : absl::StrCat(parent, ".", field->name()));
+    }
+
+    // The values of choice types and contained resources are unwrapped during
+    // evaluation, so their members do not correspond to fields of the proto.
+    const Descriptor* type = field->message_type();
+    if (type == nullptr || IsChoiceType(field) || IsContainedResource(type) ||
+        IsMessageType<google::protobuf::Any>(type)) {
+      read_set_builder_->Read(paths);
+      return FieldPaths();
+    }
+    return paths;
+  }
+
+  // Returns the paths of the results of the given function invoked on the
+  // results of the fields at the given input paths.
+  FieldPaths FunctionPaths(const std::string& function_name,
+                           const FieldPaths& input,
+                           const std::vector<FieldPaths>& params) {
+    // Functions that return a subset of their input without reading it as a
+    // whole.
+    static const absl::flat_hash_set<std::string>* filters =
+        new absl::flat_hash_set<std::string>({"where", "first", "last", "tail",
+                                              "skip", "take", "single",
+                                              "ofType", "as", "trace"});
+    if (filters->contains(function_name)) {
+      ReadAll(params);
+      return input;
+    }
+
+    if (function_name == "select") {
+      // The number of results depends on the input even when the projection
+      // reads none of its fields, e.g. select(true).
+      read_set_builder_->Read(input);
+      FieldPaths paths;
+      for (const FieldPaths& param : params) {
+        paths.insert(paths.end(), param.begin(), param.end());
+      }
+      return paths;
+    }
+
+    if (function_name == "resolve") {
+      read_set_builder_->ReadUnbounded();
+    }
+
+    read_set_builder_->Read(input);
+    FieldPaths paths = ReadAll(params);
+    if (function_name == "combine" || function_name == "union") {
+      paths.insert(paths.end(), input.begin(), input.end());
+      return paths;
+    }
+    return FieldPaths();
+  }
+
+  // Reads the results of the given operands as a whole and returns all of
+  // their paths.
+  FieldPaths ReadAll(const std::vector<FieldPaths>& operands) {
+    FieldPaths paths;
+    for (const FieldPaths& operand : operands) {
+      read_set_builder_->Read(operand);
+      paths.insert(paths.end(), operand.begin(), operand.end());
+    }
+    return paths;
+  }
+
+  absl::StatusOr<std::shared_ptr<ExpressionNode>> CompileNode(
+      const AstNode& node) {
+    switch (node.kind) {
+      case AstNode::kInvocationExpression:
+        return CompileInvocationExpression(node);
+      case AstNode::kIndexerExpression:
+        return CompileIndexerExpression(node);
+      case AstNode::kPolarityExpression:
+        return CompilePolarityExpression(node);
+      case AstNode::kBinaryExpression:
+        return CompileBinaryExpression(node);
+      case AstNode::kTypeExpression:
+        return CompileTypeExpression(node);
+      case AstNode::kMemberInvocation:
+      case AstNode::kFunctionInvocation:
+        return CompileInvocationTerm(node);
+      case AstNode::kThisInvocation:
+        return std::make_shared<ThisReference>(descriptor_stack_.back());
+      case AstNode::kIndexInvocation:
+        // TODO: Add support for $index.
+        return UnimplementedError("$index is not implemented");
+      case AstNode::kTotalInvocation:
+        // TODO: Add support for $total.
+        return UnimplementedError("$total is not implemented");
+      case AstNode::kNullLiteral:
+        return std::make_shared<EmptyLiteral>();
+      case AstNode::kBooleanLiteral:
+        return CompileBooleanLiteral(node);
+      case AstNode::kStringLiteral:
+        return CompileStringLiteral(node);
+      case AstNode::kNumberLiteral:
+        return CompileNumberLiteral(node);
+      case AstNode::kDateTimeLiteral:
+        return ParseDateTime(node.text);
+      case AstNode::kDateLiteral:
+        // TODO: Add support for Date literals.
+        return UnimplementedError("Date literals are not yet supported.");
+      case AstNode::kTimeLiteral:
+        // TODO: Add spport for time literals.
+        return UnimplementedError("Time literals are not yet supported.");
+      case AstNode::kQuantityLiteral:
+        // TODO: Add support for Quantity literals.
+        return UnimplementedError("Quantity literals are not yet supported.");
+      case AstNode::kExternalConstant:
+        return CompileExternalConstant(node);
     }
 
-    if (invocation.is<std::shared_ptr<ExpressionNode>>()) {
-      return invocation;
-    }
+    return InternalError(
+        absl::StrCat("Unknown syntax tree node: ", node.DebugString()));
+  }
 
-    auto definition = invocation.as<std::shared_ptr<InvocationDefinition>>();
+  absl::StatusOr<std::shared_ptr<ExpressionNode>> CompileInvocationExpression(
+      const AstNode& node) {
+    FHIR_ASSIGN_OR_RETURN(std::shared_ptr<ExpressionNode> expr,
+                          Compile(*node.children[0]));
 
-    if (definition->is_function) {
-      auto function_node = createFunction(
-          definition->name,
-          std::make_shared<ThisReference>(descriptor_stack_.back()),
-          definition->params);
+    // This could be a simple member name or a parameterized function...
+    const AstNode& invocation = *node.children[1];
 
-      return function_node == nullptr || !GetError().ok()
-                 ? nullptr
-                 : ToAny(function_node);
+    if (invocation.kind == AstNode::kFunctionInvocation) {
+      return CreateFunction(invocation.name, expr, invocation.children);
     }
 
-    const Descriptor* descriptor = descriptor_stack_.back();
+    if (invocation.kind != AstNode::kMemberInvocation) {
+      return InvalidArgumentError(
+          absl::StrCat("Unexpected invocation: ", invocation.DebugString()));
+    }
+
+    const Descriptor* descriptor = expr->ReturnType();
 
     // If we know the return type of the expression, and the return type
     // doesn't have the referenced field, set an error and return.
-    if (descriptor != nullptr && !HasFieldWithJsonName(descriptor,
-                                                       definition->name)) {
-      SetError(NotFoundError(
-          absl::StrCat("Unable to find field ", definition->name)));
-      return nullptr;
+    if (descriptor != nullptr &&
+        !HasFieldWithJsonName(descriptor, invocation.name)) {
+      return NotFoundError(
+          absl::StrCat("Unable to find field ", invocation.name));
     }
 
     const FieldDescriptor* field =
         descriptor != nullptr &&
                 !IsMessageType<google::protobuf::Any>(descriptor)
-            ? FindFieldByJsonName(descriptor, definition->name)
+            ? FindFieldByJsonName(descriptor, invocation.name)
             : nullptr;
-    return ToAny(std::make_shared<InvokeTermNode>(field, definition->name));
+    return std::make_shared<InvokeExpressionNode>(expr, field,
+                                                  invocation.name);
   }
 
-  antlrcpp::Any visitIndexerExpression(
-      FhirPathParser::IndexerExpressionContext* ctx) override {
-    antlrcpp::Any left_any = ctx->children[0]->accept(this);
-    antlrcpp::Any right_any = ctx->children[2]->accept(this);
-
-    if (!GetError().ok()) {
-      return nullptr;
+  absl::StatusOr<std::shared_ptr<ExpressionNode>> CompileInvocationTerm(
+      const AstNode& node) {
+    if (node.kind == AstNode::kFunctionInvocation) {
+      return CreateFunction(
+          node.name, std::make_shared<ThisReference>(descriptor_stack_.back()),
+          node.children);
     }
 
-    auto left = left_any.as<std::shared_ptr<ExpressionNode>>();
-    auto right = right_any.as<std::shared_ptr<ExpressionNode>>();
-
-    return ToAny(
-        std::make_shared<IndexerExpression>(primitive_handler_, left, right));
-  }
-
-  antlrcpp::Any visitUnionExpression(
-      FhirPathParser::UnionExpressionContext* ctx) override {
-    antlrcpp::Any left_any = ctx->children[0]->accept(this);
-    antlrcpp::Any right_any = ctx->children[2]->accept(this);
+    const Descriptor* descriptor = descriptor_stack_.back();
 
-    if (!GetError().ok()) {
-      return nullptr;
+    // If we know the return type of the expression, and the return type
+    // doesn't have the referenced field, set an error and return.
+    if (descriptor != nullptr && !HasFieldWithJsonName(descriptor, node.name)) {
+      return NotFoundError(absl::StrCat("Unable to find field ", node.name));
     }
 
-    auto left = left_any.as<std::shared_ptr<ExpressionNode>>();
-    auto right = right_any.as<std::shared_ptr<ExpressionNode>>();
-
-    return ToAny(std::make_shared<UnionOperator>(left, right));
+    const FieldDescriptor* field =
+        descriptor != nullptr &&
+                !IsMessageType<google::protobuf::Any>(descriptor)
+            ? FindFieldByJsonName(descriptor, node.name)
+            : nullptr;
+    return std::make_shared<InvokeTermNode>(field, node.name);
   }
 
-  antlrcpp::Any visitAdditiveExpression(
-      FhirPathParser::AdditiveExpressionContext* ctx) override {
-    antlrcpp::Any left_any = ctx->children[0]->accept(this);
-    std::string op = ctx->children[1]->getText();
-    antlrcpp::Any right_any = ctx->children[2]->accept(this);
-
-    if (!GetError().ok()) {
-      return nullptr;
-    }
+  absl::StatusOr<std::shared_ptr<ExpressionNode>> CompileIndexerExpression(
+      const AstNode& node) {
+    FHIR_ASSIGN_OR_RETURN(std::shared_ptr<ExpressionNode> left,
+                          Compile(*node.children[0]));
+    FHIR_ASSIGN_OR_RETURN(std::shared_ptr<ExpressionNode> right,
+                          Compile(*node.children[1]));
 
-    auto left = left_any.as<std::shared_ptr<ExpressionNode>>();
-    auto right = right_any.as<std::shared_ptr<ExpressionNode>>();
-
-    if (op == "+") {
-      return ToAny(std::make_shared<AdditionOperator>(left, right));
-    }
-
-    if (op == "&") {
-      return ToAny(std::make_shared<StrCatOperator>(left, right));
-    }
-
-    if (op == "-") {
-      // TODO: Support "-"
-      SetError(UnimplementedError("'-' operator is not supported yet."));
-      return nullptr;
-    }
-
-    // FhirPath.g4 does not define any additional additive operators.
-    SetError(InternalError(absl::StrCat("Unknown additive operator: ", op)));
-    return nullptr;
+    return std::make_shared<IndexerExpression>(primitive_handler_, left,
+                                               right);
   }
 
-  antlrcpp::Any visitPolarityExpression(
-      FhirPathParser::PolarityExpressionContext* ctx) override {
-    std::string op = ctx->children[0]->getText();
-    antlrcpp::Any operand_any = ctx->children[1]->accept(this);
-
-    if (!GetError().ok()) {
-      return nullptr;
-    }
+  absl::StatusOr<std::shared_ptr<ExpressionNode>> CompilePolarityExpression(
+      const AstNode& node) {
+    FHIR_ASSIGN_OR_RETURN(std::shared_ptr<ExpressionNode> operand,
+                          Compile(*node.children[0]));
 
-    auto operand = operand_any.as<std::shared_ptr<ExpressionNode>>();
-
-    if (op == "+") {
-      return ToAny(std::make_shared<PolarityOperator>(
-          PolarityOperator::kPositive, operand));
+    if (node.op == "+") {
+      return std::make_shared<PolarityOperator>(PolarityOperator::kPositive,
+                                                operand);
     }
 
-    if (op == "-") {
-      return ToAny(std::make_shared<PolarityOperator>(
-          PolarityOperator::kNegative, operand));
+    if (node.op == "-") {
+      return std::make_shared<PolarityOperator>(PolarityOperator::kNegative,
+                                                operand);
     }
 
     // FhirPath.g4 does not define any additional polarity operators.
-    SetError(InternalError(absl::StrCat("Unknown polarity operator: ", op)));
-    return nullptr;
+    return InternalError(
+        absl::StrCat("Unknown polarity operator: ", node.op));
   }
 
-  antlrcpp::Any visitTypeExpression(
-      FhirPathParser::TypeExpressionContext* ctx) override {
-    antlrcpp::Any left_any = ctx->children[0]->accept(this);
-    std::string op = ctx->children[1]->getText();
-    std::string type = ctx->children[2]->getText();
-
-    if (!GetError().ok()) {
-      return nullptr;
-    }
-
-    auto left = left_any.as<std::shared_ptr<ExpressionNode>>();
+  absl::StatusOr<std::shared_ptr<ExpressionNode>> CompileTypeExpression(
+      const AstNode& node) {
+    FHIR_ASSIGN_OR_RETURN(std::shared_ptr<ExpressionNode> left,
+                          Compile(*node.children[0]));
 
-    if (op == "is") {
-      return ToAny(std::make_shared<IsFunction>(left, type));
+    if (node.op == "is") {
+      return std::make_shared<IsFunction>(left, node.name);
     }
 
-    if (op == "as") {
-      return ToAny(std::make_shared<AsFunction>(left, type));
+    if (node.op == "as") {
+      return std::make_shared<AsFunction>(left, node.name);
     }
 
     // FhirPath.g4 does not define any additional type operators.
-    SetError(InternalError(absl::StrCat("Unknown type operator: ", op)));
-    return nullptr;
+    return InternalError(absl::StrCat("Unknown type operator: ", node.op));
   }
 
-  antlrcpp::Any visitEqualityExpression(
-      FhirPathParser::EqualityExpressionContext* ctx) override {
-    antlrcpp::Any left_any = ctx->children[0]->accept(this);
-    std::string op = ctx->children[1]->getText();
-    antlrcpp::Any right_any = ctx->children[2]->accept(this);
+  absl::StatusOr<std::shared_ptr<ExpressionNode>> CompileBinaryExpression(
+      const AstNode& node) {
+    FHIR_ASSIGN_OR_RETURN(std::shared_ptr<ExpressionNode> left,
+                          Compile(*node.children[0]));
+    FHIR_ASSIGN_OR_RETURN(std::shared_ptr<ExpressionNode> right,
+                          Compile(*node.children[1]));
+    const std::string& op = node.op;
 
-    if (!GetError().ok()) {
-      return nullptr;
+    // Additive operators.
+    if (op == "+") {
+      return std::make_shared<AdditionOperator>(left, right);
+    }
+    if (op == "&") {
+      return std::make_shared<StrCatOperator>(left, right);
     }
 
-    auto left = left_any.as<std::shared_ptr<ExpressionNode>>();
-    auto right = right_any.as<std::shared_ptr<ExpressionNode>>();
+    if (op == "|") {
+      return std::make_shared<UnionOperator>(left, right);
+    }
 
+    // Equality operators.
     if (op == "=") {
-      return ToAny(std::make_shared<EqualsOperator>(left, right));
+      return std::make_shared<EqualsOperator>(left, right);
     }
     if (op == "!=") {
       // Negate the equals function to implement !=
       auto equals_op = std::make_shared<EqualsOperator>(left, right);
-      return ToAny(std::make_shared<NotFunction>(equals_op));
+      return std::make_shared<NotFunction>(equals_op);
     }
-
     if (op == "~" || op == "!~") {
-      SetError(
-          UnimplementedError("'~' and '!~' operators are not yet supported"));
-      return nullptr;
-    }
-
-    // FhirPath.g4 does not define any additional equality operators.
-    SetError(InternalError(absl::StrCat("Unknown equality operator: ", op)));
-    return nullptr;
-  }
-
-  antlrcpp::Any visitInequalityExpression(
-      FhirPathParser::InequalityExpressionContext* ctx) override {
-    antlrcpp::Any left_any = ctx->children[0]->accept(this);
-    std::string op = ctx->children[1]->getText();
-    antlrcpp::Any right_any = ctx->children[2]->accept(this);
-
-    if (!GetError().ok()) {
-      return nullptr;
+      return UnimplementedError(
+          "'~' and '!~' operators are not yet supported");
     }
 
-    auto left = left_any.as<std::shared_ptr<ExpressionNode>>();
-    auto right = right_any.as<std::shared_ptr<ExpressionNode>>();
-
-    ComparisonOperator::ComparisonType op_type;
-
+    // Inequality operators.
     if (op == "<") {
-      op_type = ComparisonOperator::kLessThan;
-    } else if (op == ">") {
-      op_type = ComparisonOperator::kGreaterThan;
-    } else if (op == "<=") {
-      op_type = ComparisonOperator::kLessThanEqualTo;
-    } else if (op == ">=") {
-      op_type = ComparisonOperator::kGreaterThanEqualTo;
-    } else {
-      SetError(
-          InternalError(absl::StrCat("Unknown comparison operator: ", op)));
-      return nullptr;
+      return std::make_shared<ComparisonOperator>(
+          left, right, ComparisonOperator::kLessThan);
     }
-
-    return ToAny(std::make_shared<ComparisonOperator>(left, right, op_type));
-  }
-
-  antlrcpp::Any visitMembershipExpression(
-      FhirPathParser::MembershipExpressionContext* ctx) override {
-    antlrcpp::Any left_any = ctx->children[0]->accept(this);
-    std::string op = ctx->children[1]->getText();
-    antlrcpp::Any right_any = ctx->children[2]->accept(this);
-
-    if (!GetError().ok()) {
-      return nullptr;
+    if (op == ">") {
+      return std::make_shared<ComparisonOperator>(
+          left, right, ComparisonOperator::kGreaterThan);
+    }
+    if (op == "<=") {
+      return std::make_shared<ComparisonOperator>(
+          left, right, ComparisonOperator::kLessThanEqualTo);
+    }
+    if (op == ">=") {
+      return std::make_shared<ComparisonOperator>(
+          left, right, ComparisonOperator::kGreaterThanEqualTo);
     }
 
-    auto left = left_any.as<std::shared_ptr<ExpressionNode>>();
-    auto right = right_any.as<std::shared_ptr<ExpressionNode>>();
-
+    // Membership operators.
     if (op == "in") {
-      return ToAny(std::make_shared<ContainsOperator>(right, left));
-    } else if (op == "contains") {
-      return ToAny(std::make_shared<ContainsOperator>(left, right));
+      return std::make_shared<ContainsOperator>(right, left);
     }
-
-    SetError(InternalError(absl::StrCat("Unknown membership operator: ", op)));
-    return nullptr;
-  }
-
-  antlrcpp::Any visitMemberInvocation(
-      FhirPathParser::MemberInvocationContext* ctx) override {
-    std::string text = ctx->identifier()->IDENTIFIER()->getSymbol()->getText();
-    return std::make_shared<InvocationDefinition>(text, false);
-  }
-
-  antlrcpp::Any visitFunctionInvocation(
-      FhirPathParser::FunctionInvocationContext* ctx) override {
-    if (!GetError().ok()) {
-      return nullptr;
+    if (op == "contains") {
+      return std::make_shared<ContainsOperator>(left, right);
     }
 
-    std::string text = ctx->function()->identifier()->getText();
-    std::vector<FhirPathParser::ExpressionContext*> params;
-    if (ctx->function()->paramList()) {
-      params = ctx->function()->paramList()->expression();
+    // Boolean operators.
+    if (op == "and") {
+      return std::make_shared<AndOperator>(left, right);
     }
-
-    return std::make_shared<InvocationDefinition>(text, true, params);
-  }
-
-  antlrcpp::Any visitImpliesExpression(
-      FhirPathParser::ImpliesExpressionContext* ctx) override {
-    antlrcpp::Any left_any = ctx->children[0]->accept(this);
-    antlrcpp::Any right_any = ctx->children[2]->accept(this);
-
-    if (!GetError().ok()) {
-      return nullptr;
+    if (op == "or") {
+      return std::make_shared<OrOperator>(left, right);
     }
-
-    auto left = left_any.as<std::shared_ptr<ExpressionNode>>();
-    auto right = right_any.as<std::shared_ptr<ExpressionNode>>();
-
-    return ToAny(std::make_shared<ImpliesOperator>(left, right));
-  }
-
-  antlrcpp::Any visitOrExpression(
-      FhirPathParser::OrExpressionContext* ctx) override {
-    antlrcpp::Any left_any = ctx->children[0]->accept(this);
-    std::string op = ctx->children[1]->getText();
-    antlrcpp::Any right_any = ctx->children[2]->accept(this);
-
-    if (!GetError().ok()) {
-      return nullptr;
+    if (op == "xor") {
+      return std::make_shared<XorOperator>(left, right);
     }
-
-    auto left = left_any.as<std::shared_ptr<ExpressionNode>>();
-    auto right = right_any.as<std::shared_ptr<ExpressionNode>>();
-
-    return op == "or"
-        ? ToAny(std::make_shared<OrOperator>(left, right))
-        : ToAny(std::make_shared<XorOperator>(left, right));
-  }
-
-  antlrcpp::Any visitAndExpression(
-      FhirPathParser::AndExpressionContext* ctx) override {
-    antlrcpp::Any left_any = ctx->children[0]->accept(this);
-    antlrcpp::Any right_any = ctx->children[2]->accept(this);
-
-    if (!GetError().ok()) {
-      return nullptr;
+    if (op == "implies") {
+      return std::make_shared<ImpliesOperator>(left, right);
     }
 
-    auto left = left_any.as<std::shared_ptr<ExpressionNode>>();
-    auto right = right_any.as<std::shared_ptr<ExpressionNode>>();
-
-    return ToAny(std::make_shared<AndOperator>(left, right));
-  }
-
-  antlrcpp::Any visitParenthesizedTerm(
-      FhirPathParser::ParenthesizedTermContext* ctx) override {
-    // Simply propagate the value of the parenthesized term.
-    return ctx->children[1]->accept(this);
-  }
-
-  antlrcpp::Any visitThisInvocation(
-      FhirPathParser::ThisInvocationContext* ctx) override {
-    return ToAny(std::make_shared<ThisReference>(descriptor_stack_.back()));
-  }
-
-  antlrcpp::Any visitTotalInvocation(
-      FhirPathParser::TotalInvocationContext* ctx) override {
-    // TODO: Add support for $total.
-    SetError(UnimplementedError("$total is not implemented"));
-    return nullptr;
-  }
+    // TODO: Support "-" and the multiplicative operators.
+    if (op == "-" || op == "*" || op == "/" || op == "div" || op == "mod") {
+      return UnimplementedError(
+          absl::StrCat("'", op, "' operator is not supported yet."));
+    }
 
-  antlrcpp::Any visitIndexInvocation(
-      FhirPathParser::IndexInvocationContext* ctx) override {
-    // TODO: Add support for $index.
-    SetError(UnimplementedError("$index is not implemented"));
-    return nullptr;
+    return InternalError(absl::StrCat("Unknown binary operator: ", op));
   }
 
-  antlrcpp::Any visitExternalConstant(
-      FhirPathParser::ExternalConstantContext* ctx) override {
-    std::string name = ctx->children[1]->getText();
+  absl::StatusOr<std::shared_ptr<ExpressionNode>> CompileExternalConstant(
+      const AstNode& node) {
+    const std::string& name = node.name;
     const PrimitiveHandler* primitive_handler = primitive_handler_;
     if (name == "ucum") {
-      return ToAny(std::make_shared<Literal>(
+      return std::make_shared<Literal>(
           primitive_handler_->StringDescriptor(), [primitive_handler]() {
             return primitive_handler->NewString("http://unitsofmeasure.org");
-          }));
+          });
     } else if (name == "sct") {
-      return ToAny(std::make_shared<Literal>(
+      return std::make_shared<Literal>(
           primitive_handler_->StringDescriptor(), [primitive_handler]() {
             return primitive_handler->NewString("http://snomed.info/sct");
-          }));
+          });
     } else if (name == "loinc") {
-      return ToAny(std::make_shared<Literal>(
+      return std::make_shared<Literal>(
           primitive_handler_->StringDescriptor(), [primitive_handler]() {
             return primitive_handler->NewString("http://loinc.org");
-          }));
+          });
     } else if (name == "context") {
-      return ToAny(
-          std::make_shared<ContextReference>(descriptor_stack_.front()));
+      return std::make_shared<ContextReference>(descriptor_stack_.front());
     } else if (name == "resource") {
-      return ToAny(std::make_shared<ResourceReference>());
+      return std::make_shared<ResourceReference>();
     } else if (name == "rootResource") {
       // TODO: Add suport for %rootResource
-      SetError(UnimplementedError("%rootResource is not implemented"));
+      return UnimplementedError("%rootResource is not implemented");
     } else if (absl::StartsWith(name, "vs-")) {
       // TODO: Add support for %vs-[name]
-      SetError(UnimplementedError("%vs-[name] is not implemented"));
+      return UnimplementedError("%vs-[name] is not implemented");
     } else if (absl::StartsWith(name, "ext-")) {
       // TODO: Add support for %ext-[name]
-      SetError(UnimplementedError("%ext-[name] is not implemented"));
-    } else {
-      SetError(
-          NotFoundError(absl::StrCat("Unknown external constant: ", name)));
+      return UnimplementedError("%ext-[name] is not implemented");
     }
 
-    return nullptr;
+    if (parameters_ != nullptr) {
+      auto parameter = parameters_->find(name);
+      if (parameter != parameters_->end()) {
+        return std::make_shared<ParameterReference>(name, parameter->second);
+      }
+    }
+
+    return NotFoundError(absl::StrCat("Unknown external constant: ", name));
   }
 
-  absl::StatusOr<std::shared_ptr<Literal>> ParseDateTime(
+  absl::StatusOr<std::shared_ptr<ExpressionNode>> ParseDateTime(
       absl::string_view text) {
     std::string date_time_str;
     std::string subseconds_str;
@@ -3593,48 +4681,34 @@ class FhirPathCompilerVisitor : public FhirPathBaseVisitor {
         });
   }
 
-  antlrcpp::Any visitDateTimeLiteral(
-      FhirPathParser::DateTimeLiteralContext* ctx) override {
-    absl::StatusOr<std::shared_ptr<Literal>> status_or_date_time_literal =
-        ParseDateTime(ctx->getText());
-    if (status_or_date_time_literal.ok()) {
-      return ToAny(status_or_date_time_literal.value());
-    } else {
-      SetError(status_or_date_time_literal.status());
-      return nullptr;
-    }
-  }
-
-  antlrcpp::Any visitNumberLiteral(
-      FhirPathParser::NumberLiteralContext* ctx) override {
-    const std::string& text = ctx->getText();
+  absl::StatusOr<std::shared_ptr<ExpressionNode>> CompileNumberLiteral(
+      const AstNode& node) {
+    const std::string& text = node.text;
     const PrimitiveHandler* primitive_handler = primitive_handler_;
     // Determine if the number is an integer or decimal, propagating
     // decimal types in string form to preserve precision.
     if (text.find(".") != std::string::npos) {
-      return ToAny(std::make_shared<Literal>(
+      return std::make_shared<Literal>(
           primitive_handler_->DecimalDescriptor(), [primitive_handler, text]() {
             return primitive_handler->NewDecimal(text);
-          }));
+          });
     } else {
       int32_t value;
       if (!absl::SimpleAtoi(text, &value)) {
-        SetError(
-            InvalidArgumentError(absl::StrCat("Malformed integer ", text)));
-        return nullptr;
+        return InvalidArgumentError(absl::StrCat("Malformed integer ", text));
       }
 
-      return ToAny(std::make_shared<Literal>(
+      return std::make_shared<Literal>(
           primitive_handler_->IntegerDescriptor(),
           [primitive_handler, value]() {
             return primitive_handler->NewInteger(value);
-          }));
+          });
     }
   }
 
-  antlrcpp::Any visitStringLiteral(
-      FhirPathParser::StringLiteralContext* ctx) override {
-    const std::string& text = ctx->getText();
+  absl::StatusOr<std::shared_ptr<ExpressionNode>> CompileStringLiteral(
+      const AstNode& node) {
+    const std::string& text = node.text;
     const PrimitiveHandler* primitive_handler = primitive_handler_;
     // The lexer keeps the quotes around string literals,
     // so we remove them here. The following assert simply reflects
@@ -3647,208 +4721,345 @@ class FhirPathCompilerVisitor : public FhirPathBaseVisitor {
     // grammar rules (FhirPath.g4) which are enforced by the parser. In
     // addition, CUnescape does not handle escaped forward slashes.
     absl::CUnescape(trimmed, &unescaped);
-    return ToAny(std::make_shared<Literal>(
+    return std::make_shared<Literal>(
         primitive_handler_->StringDescriptor(),
         [primitive_handler, unescaped]() {
           return primitive_handler->NewString(unescaped);
-        }));
+        });
   }
 
-  antlrcpp::Any visitBooleanLiteral(
-      FhirPathParser::BooleanLiteralContext* ctx) override {
-    const bool value = ctx->getText() == "true";
+  absl::StatusOr<std::shared_ptr<ExpressionNode>> CompileBooleanLiteral(
+      const AstNode& node) {
+    const bool value = node.text == "true";
     const PrimitiveHandler* primitive_handler = primitive_handler_;
 
-    return ToAny(std::make_shared<Literal>(
+    return std::make_shared<Literal>(
         primitive_handler_->BooleanDescriptor(), [primitive_handler, value]() {
           return primitive_handler->NewBoolean(value);
-        }));
-  }
-
-  antlrcpp::Any visitNullLiteral(
-      FhirPathParser::NullLiteralContext* ctx) override {
-    return ToAny(std::make_shared<EmptyLiteral>());
+        });
   }
 
-  antlrcpp::Any visitTerminal(TerminalNode* node) override {
-    switch (node->getSymbol()->getType()) {
-      case FhirPathLexer::DATE:
-        // TODO: Add support for Date literals.
-        SetError(UnimplementedError("Date literals are not yet supported."));
-        return nullptr;
-
-      case FhirPathLexer::TIME:
-        // TODO: Add spport for time literals.
-        SetError(UnimplementedError("Time literals are not yet supported."));
-        return nullptr;
+  typedef std::function<StatusOr<ExpressionNode*>(
+      std::shared_ptr<ExpressionNode>, const std::vector<const AstNode*>&,
+      FhirPathCompiler*, FhirPathCompiler*)>
+      FunctionFactory;
 
-      default:
-        SetError(InternalError(absl::StrCat("Unknown terminal type: ",
-                                            node->getSymbol()->getText())));
-        return nullptr;
-    }
+  // The table is shared by all compilers, including the child context
+  // compilers created for every function invocation, so it is built once.
+  static const absl::flat_hash_map<std::string, FunctionFactory>&
+  FunctionMap() {
+    static const absl::flat_hash_map<std::string, FunctionFactory>*
+        function_map = new absl::flat_hash_map<std::string, FunctionFactory>({
+          {"exists", FunctionNode::Create<ExistsFunction>},
+          {"not", FunctionNode::Create<NotFunction>},
+          {"hasValue", FunctionNode::Create<HasValueFunction>},
+          {"startsWith", FunctionNode::Create<StartsWithFunction>},
+          {"contains", FunctionNode::Create<ContainsFunction>},
+          {"empty", FunctionNode::Create<EmptyFunction>},
+          {"first", FunctionNode::Create<FirstFunction>},
+          {"tail", FunctionNode::Create<TailFunction>},
+          {"trace", FunctionNode::Create<TraceFunction>},
+          {"toInteger", FunctionNode::Create<ToIntegerFunction>},
+          {"count", FunctionNode::Create<CountFunction>},
+          {"combine", FunctionNode::Create<CombineFunction>},
+          {"distinct", FunctionNode::Create<DistinctFunction>},
+          {"matches", FunctionNode::Create<MatchesFunction>},
+          {"replaceMatches", FunctionNode::Create<ReplaceMatchesFunction>},
+          {"length", FunctionNode::Create<LengthFunction>},
+          {"isDistinct", FunctionNode::Create<IsDistinctFunction>},
+          {"intersect", FunctionNode::Create<IntersectFunction>},
+          {"where", CreateWhereFunction},
+          {"select", FunctionNode::Create<SelectFunction>},
+          {"all", FunctionNode::Create<AllFunction>},
+          {"toString", FunctionNode::Create<ToStringFunction>},
+          {"iif", FunctionNode::Create<IifFunction>},
+          {"is", IsFunction::Create},
+          {"as", AsFunction::Create},
+          {"ofType", CreateOfTypeFunction},
+          {"children", FunctionNode::Create<ChildrenFunction>},
+          {"resolve", FunctionNode::Create<ResolveFunction>},
+          {"descendants", FunctionNode::Create<DescendantsFunction>},
+          {"allTrue", FunctionNode::Create<AllTrueFunction>},
+          {"anyTrue", CreateAnyTrueFunction},
+          {"allFalse", FunctionNode::Create<AllFalseFunction>},
+          {"anyFalse", CreateAnyFalseFunction},
+          {"subsetOf", FunctionNode::Create<SubsetOfFunction>},
+          {"supersetOf", FunctionNode::Create<SupersetOfFunction>},
+          {"repeat", FunctionNode::Create<RepeatFunction>},
+          {"single", FunctionNode::Create<SingleFunction>},
+          {"last", FunctionNode::Create<LastFunction>},
+          {"skip", FunctionNode::Create<SkipFunction>},
+          {"take", FunctionNode::Create<TakeFunction>},
+          {"exclude", FunctionNode::Create<ExcludeFunction>},
+          {"union", CreateUnionFunction},
+          {"convertsToBoolean", CreateConvertsToFunction<ToBooleanFunction>},
+          {"toBoolean", FunctionNode::Create<ToBooleanFunction>},
+          {"convertsToInteger", CreateConvertsToFunction<ToIntegerFunction>},
+          {"convertsToDate", UnimplementedFunction},
+          {"toDate", UnimplementedFunction},
+          {"convertsToDateTime", UnimplementedFunction},
+          {"toDateTime", UnimplementedFunction},
+          {"convertsToDecimal", UnimplementedFunction},
+          {"toDecimal", UnimplementedFunction},
+          {"convertsToQuantity", UnimplementedFunction},
+          {"toQuantity", UnimplementedFunction},
+          {"convertsToString", CreateConvertsToFunction<ToStringFunction>},
+          {"convertsToTime", UnimplementedFunction},
+          {"toTime", UnimplementedFunction},
+          {"indexOf", FunctionNode::Create<IndexOfFunction>},
+          {"substring", UnimplementedFunction},
+          {"upper", FunctionNode::Create<UpperFunction>},
+          {"lower", FunctionNode::Create<LowerFunction>},
+          {"replace", FunctionNode::Create<ReplaceFunction>},
+          {"endsWith", FunctionNode::Create<EndsWithFunction>},
+          {"toChars", UnimplementedFunction},
+          {"today", UnimplementedFunction},
+          {"now", UnimplementedFunction},
+          {"getValue", UnimplementedFunction},
+          {"elementDefinition", UnimplementedFunction},
+          {"slice", UnimplementedFunction},
+          {"checkModifiers", UnimplementedFunction},
+          {"memberOf", UnimplementedFunction},
+          {"subsumes", UnimplementedFunction},
+          {"subsumedBy", UnimplementedFunction},
+        });
+    return *function_map;
   }
 
-  antlrcpp::Any visitErrorNode(antlr4::tree::ErrorNode* node) override {
-    SetError(InternalError(
-        absl::StrCat("Unknown error encountered: ", node->toString())));
-    return nullptr;
+  // Returns an ExpressionNode that implements the specified FHIRPath function.
+  absl::StatusOr<std::shared_ptr<ExpressionNode>> CreateFunction(
+      const std::string& function_name,
+      std::shared_ptr<ExpressionNode> child_expression,
+      const std::vector<std::unique_ptr<AstNode>>& param_nodes) {
+    const absl::flat_hash_map<std::string, FunctionFactory>& function_map =
+        FunctionMap();
+    auto function_factory = function_map.find(function_name);
+    if (function_factory == function_map.end()) {
+      return NotFoundError(
+          absl::StrCat("The function ", function_name, " does not exist."));
+    }
+
+    std::vector<const AstNode*> params;
+    params.reserve(param_nodes.size());
+    for (const std::unique_ptr<AstNode>& param : param_nodes) {
+      params.push_back(param.get());
+    }
+
+    // Some functions accept parameters that are expressions evaluated using
+    // the child expression's result as context, not the base context of the
+    // FHIRPath expression. In order to compile such parameters, we need to
+    // compile it with the child expression's type and not the base type of the
+    // current compiler. Therefore, both the current compiler and a compiler
+    // with the child expression as the context are provided. The function
+    // factory will use whichever compiler (or both) is needed to compile the
+    // function invocation.
+    FhirPathCompiler child_context_compiler(descriptor_stack_,
+                                            child_expression->ReturnType(),
+                                            primitive_handler_, parameters_);
+    child_context_compiler.EnableProfiling(profile_builder_);
+    if (read_set_builder_ != nullptr) {
+      // The child expression is the first operand of an invocation
+      // expression; functions invoked as terms apply to the context.
+      const std::vector<FieldPaths>& operands = read_set_builder_->Operands();
+      child_context_compiler.TrackReadSet(
+          read_set_builder_,
+          operands.empty() ? context_paths_ : operands.front());
+    }
+    absl::StatusOr<ExpressionNode*> result = function_factory->second(
+        child_expression, params, this, &child_context_compiler);
+    if (!result.ok()) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Failed to compile call to ", function_name,
+                       "(): ", result.status().message()));
+    }
+
+    return std::shared_ptr<ExpressionNode>(result.value());
   }
 
-  antlrcpp::Any defaultResult() override { return nullptr; }
-
-  absl::Status GetError() { return error_; }
+  std::vector<const Descriptor*> descriptor_stack_;
+  const PrimitiveHandler* primitive_handler_;
+  const ExpressionParameters* parameters_;
+  ProfileBuilder* profile_builder_ = nullptr;
+  ReadSetBuilder* read_set_builder_ = nullptr;
+  // The paths of the fields the context of the expression is taken from.
+  FieldPaths context_paths_ = {""};
+};
 
-  BaseErrorListener* GetErrorListener() { return &error_listener_; }
+absl::StatusOr<std::vector<std::shared_ptr<ExpressionNode>>>
+FunctionNode::CompileParams(const std::vector<const AstNode*>& params,
+                            FhirPathCompiler* compiler) {
+  std::vector<std::shared_ptr<ExpressionNode>> compiled_params;
+  compiled_params.reserve(params.size());
 
- private:
-  typedef std::function<StatusOr<ExpressionNode*>(
-      std::shared_ptr<ExpressionNode>,
-      const std::vector<FhirPathParser::ExpressionContext*>&,
-      FhirPathBaseVisitor*, FhirPathBaseVisitor*)>
-      FunctionFactory;
+  for (const AstNode* param : params) {
+    FHIR_ASSIGN_OR_RETURN(std::shared_ptr<ExpressionNode> compiled_param,
+                          compiler->Compile(*param));
+    compiled_params.push_back(std::move(compiled_param));
+  }
 
-  std::map<std::string, FunctionFactory> function_map_{
-      {"exists", FunctionNode::Create<ExistsFunction>},
-      {"not", FunctionNode::Create<NotFunction>},
-      {"hasValue", FunctionNode::Create<HasValueFunction>},
-      {"startsWith", FunctionNode::Create<StartsWithFunction>},
-      {"contains", FunctionNode::Create<ContainsFunction>},
-      {"empty", FunctionNode::Create<EmptyFunction>},
-      {"first", FunctionNode::Create<FirstFunction>},
-      {"tail", FunctionNode::Create<TailFunction>},
-      {"trace", FunctionNode::Create<TraceFunction>},
-      {"toInteger", FunctionNode::Create<ToIntegerFunction>},
-      {"count", FunctionNode::Create<CountFunction>},
-      {"combine", FunctionNode::Create<CombineFunction>},
-      {"distinct", FunctionNode::Create<DistinctFunction>},
-      {"matches", FunctionNode::Create<MatchesFunction>},
-      {"replaceMatches", FunctionNode::Create<ReplaceMatchesFunction>},
-      {"length", FunctionNode::Create<LengthFunction>},
-      {"isDistinct", FunctionNode::Create<IsDistinctFunction>},
-      {"intersect", FunctionNode::Create<IntersectFunction>},
-      {"where", FunctionNode::Create<WhereFunction>},
-      {"select", FunctionNode::Create<SelectFunction>},
-      {"all", FunctionNode::Create<AllFunction>},
-      {"toString", FunctionNode::Create<ToStringFunction>},
-      {"iif", FunctionNode::Create<IifFunction>},
-      {"is", IsFunction::Create},
-      {"as", AsFunction::Create},
-      {"ofType", OfTypeFunction::Create},
-      {"children", FunctionNode::Create<ChildrenFunction>},
-      {"descendants", FunctionNode::Create<DescendantsFunction>},
-      {"allTrue", FunctionNode::Create<AllTrueFunction>},
-      {"anyTrue", CreateAnyTrueFunction},
-      {"allFalse", FunctionNode::Create<AllFalseFunction>},
-      {"anyFalse", CreateAnyFalseFunction},
-      {"subsetOf", UnimplementedFunction},
-      {"supersetOf", UnimplementedFunction},
-      {"repeat", UnimplementedFunction},
-      {"single", FunctionNode::Create<SingleFunction>},
-      {"last", FunctionNode::Create<LastFunction>},
-      {"skip", FunctionNode::Create<SkipFunction>},
-      {"take", FunctionNode::Create<TakeFunction>},
-      {"exclude", UnimplementedFunction},
-      {"union", CreateUnionFunction},
-      {"convertsToBoolean", CreateConvertsToFunction<ToBooleanFunction>},
-      {"toBoolean", FunctionNode::Create<ToBooleanFunction>},
-      {"convertsToInteger", CreateConvertsToFunction<ToIntegerFunction>},
-      {"convertsToDate", UnimplementedFunction},
-      {"toDate", UnimplementedFunction},
-      {"convertsToDateTime", UnimplementedFunction},
-      {"toDateTime", UnimplementedFunction},
-      {"convertsToDecimal", UnimplementedFunction},
-      {"toDecimal", UnimplementedFunction},
-      {"convertsToQuantity", UnimplementedFunction},
-      {"toQuantity", UnimplementedFunction},
-      {"convertsToString", CreateConvertsToFunction<ToStringFunction>},
-      {"convertsToTime", UnimplementedFunction},
-      {"toTime", UnimplementedFunction},
-      {"indexOf", FunctionNode::Create<IndexOfFunction>},
-      {"substring", UnimplementedFunction},
-      {"upper", FunctionNode::Create<UpperFunction>},
-      {"lower", FunctionNode::Create<LowerFunction>},
-      {"replace", FunctionNode::Create<ReplaceFunction>},
-      {"endsWith", FunctionNode::Create<EndsWithFunction>},
-      {"toChars", UnimplementedFunction},
-      {"today", UnimplementedFunction},
-      {"now", UnimplementedFunction},
-      {"getValue", UnimplementedFunction},
-      {"elementDefinition", UnimplementedFunction},
-      {"slice", UnimplementedFunction},
-      {"checkModifiers", UnimplementedFunction},
-      {"memberOf", UnimplementedFunction},
-      {"subsumes", UnimplementedFunction},
-      {"subsumedBy", UnimplementedFunction},
-  };
+  return compiled_params;
+}
 
-  // Returns an ExpressionNode that implements the specified FHIRPath function.
-  std::shared_ptr<ExpressionNode> createFunction(
-      const std::string& function_name,
-      std::shared_ptr<ExpressionNode> child_expression,
-      const std::vector<FhirPathParser::ExpressionContext*>& params) {
-    std::map<std::string, FunctionFactory>::iterator function_factory =
-        function_map_.find(function_name);
-    if (function_factory != function_map_.end()) {
-      // Some functions accept parameters that are expressions evaluated using
-      // the child expression's result as context, not the base context of the
-      // FHIRPath expression. In order to compile such parameters, we need to
-      // visit it with the child expression's type and not the base type of the
-      // current visitor. Therefore, both the current visitor and a visitor with
-      // the child expression as the context are provided. The function factory
-      // will use whichever visitor (or both) is needed to compile the function
-      // invocation.
-      FhirPathCompilerVisitor child_context_visitor(
-          descriptor_stack_, child_expression->ReturnType(),
-          primitive_handler_);
-      absl::StatusOr<ExpressionNode*> result = function_factory->second(
-          child_expression, params, this, &child_context_visitor);
-      if (!result.ok()) {
-        this->SetError(absl::InvalidArgumentError(absl::StrCat(
-            "Failed to compile call to ", function_name,
-            "(): ", result.status().message(),
-            !child_context_visitor.GetError().ok()
-                ? absl::StrCat("; ", child_context_visitor.GetError().message())
-                : "")));
-        return std::shared_ptr<ExpressionNode>(nullptr);
+// Process-wide cache of compiled expressions used by
+// CompiledExpression::CompileCached.
+//
+// Entries are spread over a fixed number of shards, each guarded by its own
+// reader/writer lock, so concurrent lookups of different expressions rarely
+// contend and lookups of the same expression only take a shared lock.
+class CompiledExpressionCache {
+ public:
+  static CompiledExpressionCache* GetInstance() {
+    static CompiledExpressionCache* cache = new CompiledExpressionCache();
+    return cache;
+  }
+
+  absl::StatusOr<CompiledExpression> Compile(
+      const Descriptor* descriptor, const PrimitiveHandler* primitive_handler,
+      const std::string& fhir_path) {
+    Key key(descriptor, primitive_handler, fhir_path);
+    Shard& shard = shards_[absl::Hash<Key>()(key) % kShardCount];
+
+    {
+      absl::ReaderMutexLock lock(&shard.mutex);
+      auto iter = shard.entries.find(key);
+      if (iter != shard.entries.end()) {
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return iter->second;
       }
+    }
 
-      return std::shared_ptr<ExpressionNode>(result.value());
-    } else {
-      SetError(NotFoundError(
-          absl::StrCat("The function ", function_name, " does not exist.")));
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    // Compile outside of the lock; if another thread compiles the same
+    // expression concurrently the first result to be inserted wins.
+    absl::StatusOr<CompiledExpression> result =
+        CompiledExpression::Compile(descriptor, primitive_handler, fhir_path);
 
-      return std::shared_ptr<ExpressionNode>(nullptr);
+    absl::MutexLock lock(&shard.mutex);
+    auto inserted = shard.entries.try_emplace(key, result);
+    if (!inserted.second) {
+      return inserted.first->second;
     }
-  }
 
-  // ANTLR listener to report syntax errors.
-  class FhirPathErrorListener : public BaseErrorListener {
-   public:
-    explicit FhirPathErrorListener(FhirPathCompilerVisitor* visitor)
-        : visitor_(visitor) {}
+    shard.insertion_order.push_back(std::move(key));
+    if (shard.insertion_order.size() > kMaxEntriesPerShard) {
+      shard.entries.erase(shard.insertion_order.front());
+      shard.insertion_order.pop_front();
+    }
+    return result;
+  }
 
-    void syntaxError(antlr4::Recognizer* recognizer,
-                     antlr4::Token* offending_symbol, size_t line,
-                     size_t position_in_line, const std::string& message,
-                     std::exception_ptr e) override {
-      visitor_->SetError(absl::InvalidArgumentError(message));
+  CompiledExpression::CacheStats GetStats() {
+    CompiledExpression::CacheStats stats;
+    stats.hits = hits_.load(std::memory_order_relaxed);
+    stats.misses = misses_.load(std::memory_order_relaxed);
+    for (Shard& shard : shards_) {
+      absl::ReaderMutexLock lock(&shard.mutex);
+      stats.size += shard.entries.size();
     }
+    return stats;
+  }
+
+ private:
+  static constexpr int kShardCount = 16;
+  static constexpr int kMaxEntriesPerShard = 1024;
+
+  using Key =
+      std::tuple<const Descriptor*, const PrimitiveHandler*, std::string>;
 
-   private:
-    FhirPathCompilerVisitor* visitor_;
+  struct Shard {
+    absl::Mutex mutex;
+    absl::flat_hash_map<Key, absl::StatusOr<CompiledExpression>> entries
+        ABSL_GUARDED_BY(mutex);
+    std::deque<Key> insertion_order ABSL_GUARDED_BY(mutex);
   };
 
-  void SetError(const absl::Status& error) { error_ = error; }
+  CompiledExpressionCache() = default;
 
-  FhirPathErrorListener error_listener_;
-  std::vector<const Descriptor*> descriptor_stack_;
-  absl::Status error_;
-  const PrimitiveHandler* primitive_handler_;
+  Shard shards_[kShardCount];
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
 };
 
 }  // namespace internal
 
+void BundleReferenceResolver::BuildIndex() const {
+  static const char kBundleUrl[] =
+      "http://hl7.org/fhir/StructureDefinition/Bundle";
+  if (GetStructureDefinitionUrl(bundle_.GetDescriptor()) == kBundleUrl) {
+    index_ = absl::make_unique<BundleIndex>(bundle_);
+  }
+}
+
+const Message* BundleReferenceResolver::Resolve(
+    absl::string_view reference) const {
+  absl::call_once(index_once_, &BundleReferenceResolver::BuildIndex, this);
+  return index_ == nullptr ? nullptr : index_->Find(reference);
+}
+
+bool ReadSet::IsAffectedBy(absl::string_view changed_path) const {
+  if (unbounded_) {
+    return true;
+  }
+
+  // A change affects the fields within the changed field as well as the
+  // fields that contain it.
+  auto affected = std::lower_bound(paths_.begin(), paths_.end(), changed_path);
+  if (affected != paths_.end() &&
+      internal::IsWithinPath(*affected, changed_path)) {
+    return true;
+  }
+  return std::any_of(paths_.begin(), affected, [&](const std::string& path) {
+    return internal::IsWithinPath(changed_path, path);
+  });
+}
+
+bool ReadSet::IsAffectedBy(
+    const std::vector<std::string>& changed_paths) const {
+  return std::any_of(
+      changed_paths.begin(), changed_paths.end(),
+      [this](const std::string& path) { return IsAffectedBy(path); });
+}
+
+namespace {
+
+void AppendChangedFieldPaths(
+    const Message& before, const Message& after, const std::string& path,
+    MessageDifferencer* differencer,
+    std::vector<std::string>* changed_paths) {
+  const Descriptor* descriptor = before.GetDescriptor();
+  const Reflection* before_reflection = before.GetReflection();
+  const Reflection* after_reflection = after.GetReflection();
+  for (int i = 0; i < descriptor->field_count(); i++) {
+    const FieldDescriptor* field = descriptor->field(i);
+    const std::string field_path =
+        path.empty() ? field->name() : absl::StrCat(path, ".", field->name());
+
+    if (!field->is_repeated() &&
+        field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE &&
+        before_reflection->HasField(before, field) &&
+        after_reflection->HasField(after, field)) {
+      AppendChangedFieldPaths(before_reflection->GetMessage(before, field),
+                              after_reflection->GetMessage(after, field),
+                              field_path, differencer, changed_paths);
+      continue;
+    }
+
+    if (!differencer->CompareWithFields(before, after, {field}, {field})) {
+      changed_paths->push_back(field_path);
+    }
+  }
+}
+
+}  // namespace
+
+std::vector<std::string> ChangedFieldPaths(const Message& before,
+                                           const Message& after) {
+  MessageDifferencer differencer;
+  std::vector<std::string> changed_paths;
+  AppendChangedFieldPaths(before, after, "", &differencer, &changed_paths);
+  return changed_paths;
+}
+
 EvaluationResult::EvaluationResult(EvaluationResult&& result)
     : work_space_(std::move(result.work_space_)) {}
 
@@ -3907,12 +5118,16 @@ absl::StatusOr<std::string> EvaluationResult::GetString() const {
 CompiledExpression::CompiledExpression(CompiledExpression&& other)
     : fhir_path_(std::move(other.fhir_path_)),
       root_expression_(std::move(other.root_expression_)),
-      primitive_handler_(other.primitive_handler_) {}
+      primitive_handler_(other.primitive_handler_),
+      read_set_(std::move(other.read_set_)),
+      profiled_plan_(std::move(other.profiled_plan_)) {}
 
 CompiledExpression& CompiledExpression::operator=(CompiledExpression&& other) {
   fhir_path_ = std::move(other.fhir_path_);
   root_expression_ = std::move(other.root_expression_);
   primitive_handler_ = other.primitive_handler_;
+  read_set_ = std::move(other.read_set_);
+  profiled_plan_ = std::move(other.profiled_plan_);
 
   return *this;
 }
@@ -3920,46 +5135,78 @@ CompiledExpression& CompiledExpression::operator=(CompiledExpression&& other) {
 CompiledExpression::CompiledExpression(const CompiledExpression& other)
     : fhir_path_(other.fhir_path_),
       root_expression_(other.root_expression_),
-      primitive_handler_(other.primitive_handler_) {}
+      primitive_handler_(other.primitive_handler_),
+      read_set_(other.read_set_),
+      profiled_plan_(other.profiled_plan_) {}
 
 CompiledExpression& CompiledExpression::operator=(
     const CompiledExpression& other) {
   fhir_path_ = other.fhir_path_;
   root_expression_ = other.root_expression_;
   primitive_handler_ = other.primitive_handler_;
+  read_set_ = other.read_set_;
+  profiled_plan_ = other.profiled_plan_;
 
   return *this;
 }
 
 const std::string& CompiledExpression::fhir_path() const { return fhir_path_; }
 
+const ReadSet& CompiledExpression::read_set() const { return *read_set_; }
+
 CompiledExpression::CompiledExpression(
     const std::string& fhir_path,
     std::shared_ptr<internal::ExpressionNode> root_expression,
-    const PrimitiveHandler* primitive_handler)
+    const PrimitiveHandler* primitive_handler,
+    std::shared_ptr<const ReadSet> read_set,
+    std::shared_ptr<internal::ProfiledPlan> profiled_plan)
     : fhir_path_(fhir_path),
       root_expression_(root_expression),
-      primitive_handler_(primitive_handler) {}
+      primitive_handler_(primitive_handler),
+      read_set_(std::move(read_set)),
+      profiled_plan_(std::move(profiled_plan)) {}
 
 absl::StatusOr<CompiledExpression> CompiledExpression::Compile(
     const Descriptor* descriptor, const PrimitiveHandler* primitive_handler,
     const std::string& fhir_path) {
-  ANTLRInputStream input(fhir_path);
-  FhirPathLexer lexer(&input);
-  CommonTokenStream tokens(&lexer);
-  FhirPathParser parser(&tokens);
-
-  internal::FhirPathCompilerVisitor visitor(descriptor, primitive_handler);
-  parser.addErrorListener(visitor.GetErrorListener());
-  lexer.addErrorListener(visitor.GetErrorListener());
-  antlrcpp::Any result = visitor.visit(parser.expression());
-
-  if (result.isNotNull() && visitor.GetError().ok()) {
-    auto root_node = result.as<std::shared_ptr<internal::ExpressionNode>>();
-    return CompiledExpression(fhir_path, root_node, primitive_handler);
-  } else {
-    return visitor.GetError();
+  return Compile(descriptor, primitive_handler, fhir_path,
+                 ExpressionParameters());
+}
+
+absl::StatusOr<CompiledExpression> CompiledExpression::Compile(
+    const Descriptor* descriptor, const PrimitiveHandler* primitive_handler,
+    const std::string& fhir_path, const ExpressionParameters& parameters) {
+  for (const auto& parameter : parameters) {
+    if (internal::IsPredefinedConstant(parameter.first)) {
+      return InvalidArgumentError(absl::StrCat(
+          "Parameter %", parameter.first, " shadows a predefined constant."));
+    }
   }
+
+  FHIR_ASSIGN_OR_RETURN(std::unique_ptr<internal::AstNode> syntax_tree,
+                        internal::ParseFhirPath(fhir_path));
+
+  internal::FhirPathCompiler compiler(descriptor, primitive_handler,
+                                      &parameters);
+  internal::ReadSetBuilder read_set_builder;
+  compiler.TrackReadSet(&read_set_builder, {""});
+  FHIR_ASSIGN_OR_RETURN(std::shared_ptr<internal::ExpressionNode> root_node,
+                        compiler.Compile(*syntax_tree));
+  return CompiledExpression(
+      fhir_path, root_node, primitive_handler,
+      std::make_shared<const ReadSet>(read_set_builder.Build()),
+      std::make_shared<internal::ProfiledPlan>(descriptor, parameters));
+}
+
+absl::StatusOr<CompiledExpression> CompiledExpression::CompileCached(
+    const Descriptor* descriptor, const PrimitiveHandler* primitive_handler,
+    const std::string& fhir_path) {
+  return internal::CompiledExpressionCache::GetInstance()->Compile(
+      descriptor, primitive_handler, fhir_path);
+}
+
+CompiledExpression::CacheStats CompiledExpression::GetCacheStats() {
+  return internal::CompiledExpressionCache::GetInstance()->GetStats();
 }
 
 absl::StatusOr<EvaluationResult> CompiledExpression::Evaluate(
@@ -3969,13 +5216,218 @@ absl::StatusOr<EvaluationResult> CompiledExpression::Evaluate(
 
 absl::StatusOr<EvaluationResult> CompiledExpression::Evaluate(
     const internal::WorkspaceMessage& message) const {
+  static const ParameterBindings* no_bindings = new ParameterBindings();
+  return Evaluate(message, *no_bindings);
+}
+
+absl::StatusOr<EvaluationResult> CompiledExpression::Evaluate(
+    const Message& message, const ParameterBindings& parameter_bindings) const {
+  return Evaluate(internal::WorkspaceMessage(&message), parameter_bindings);
+}
+
+absl::StatusOr<EvaluationResult> CompiledExpression::Evaluate(
+    const internal::WorkspaceMessage& message,
+    const ParameterBindings& parameter_bindings) const {
+  return Evaluate(*root_expression_, message, parameter_bindings, nullptr,
+                  nullptr);
+}
+
+absl::StatusOr<EvaluationResult> CompiledExpression::Evaluate(
+    const Message& message, const ParameterBindings& parameter_bindings,
+    const ReferenceResolver& reference_resolver) const {
+  return Evaluate(internal::WorkspaceMessage(&message), parameter_bindings,
+                  reference_resolver);
+}
+
+absl::StatusOr<EvaluationResult> CompiledExpression::Evaluate(
+    const internal::WorkspaceMessage& message,
+    const ParameterBindings& parameter_bindings,
+    const ReferenceResolver& reference_resolver) const {
+  return Evaluate(*root_expression_, message, parameter_bindings,
+                  &reference_resolver, nullptr);
+}
+
+absl::StatusOr<EvaluationResult> CompiledExpression::Evaluate(
+    const Message& message, const ParameterBindings& parameter_bindings,
+    ExpressionProfile* profile) const {
+  if (profile == nullptr) {
+    return Evaluate(message, parameter_bindings);
+  }
+
+  internal::ProfiledPlan* plan = profiled_plan_.get();
+  absl::call_once(plan->once, [this, plan]() {
+    absl::StatusOr<std::unique_ptr<internal::AstNode>> syntax_tree =
+        internal::ParseFhirPath(fhir_path_);
+    if (!syntax_tree.ok()) {
+      plan->status = syntax_tree.status();
+      return;
+    }
+
+    internal::ProfileBuilder profile_builder;
+    internal::FhirPathCompiler compiler(plan->descriptor, primitive_handler_,
+                                        &plan->parameters);
+    compiler.EnableProfiling(&profile_builder);
+    absl::StatusOr<std::shared_ptr<ExpressionNode>> root =
+        compiler.Compile(*syntax_tree.value());
+    if (!root.ok()) {
+      plan->status = root.status();
+      return;
+    }
+    plan->root = root.value();
+    plan->nodes = profile_builder.TakeNodes();
+  });
+  FHIR_RETURN_IF_ERROR(plan->status);
+
+  if (profile->nodes_.empty()) {
+    profile->fhir_path_ = fhir_path_;
+    profile->nodes_ = plan->nodes;
+  } else if (profile->fhir_path_ != fhir_path_ ||
+             profile->nodes_.size() != plan->nodes.size()) {
+    return InvalidArgumentError(
+        absl::StrCat("Profile of \"", profile->fhir_path_,
+                     "\" cannot record evaluations of \"", fhir_path_, "\""));
+  }
+
+  return Evaluate(*plan->root, internal::WorkspaceMessage(&message),
+                  parameter_bindings, nullptr, profile);
+}
+
+namespace {
+
+// Converts the single result of an evaluation to the value type of a
+// ResultColumn.
+template <typename T>
+absl::StatusOr<T> ToColumnValue(const PrimitiveHandler* primitive_handler,
+                                const Message& message);
+
+template <>
+absl::StatusOr<bool> ToColumnValue<bool>(
+    const PrimitiveHandler* primitive_handler, const Message& message) {
+  return primitive_handler->GetBooleanValue(message);
+}
+
+template <>
+absl::StatusOr<int32_t> ToColumnValue<int32_t>(
+    const PrimitiveHandler* primitive_handler, const Message& message) {
+  return primitive_handler->GetIntegerValue(message);
+}
+
+template <>
+absl::StatusOr<std::string> ToColumnValue<std::string>(
+    const PrimitiveHandler* primitive_handler, const Message& message) {
+  return internal::PrimitiveToString(primitive_handler, message);
+}
+
+// Threads evaluate batches in shards of a multiple of this many rows, so that
+// no two threads write to the same byte of a validity bitmap or word of a
+// std::vector<bool>.
+constexpr size_t kBatchShardRows = 64;
+
+}  // namespace
+
+template <typename T>
+void CompiledExpression::EvaluateBatch(
+    absl::Span<const Message* const> messages, ResultColumn<T>* column,
+    const BatchOptions& options) const {
+  column->validity.assign((messages.size() + 7) / 8, 0);
+  column->values.assign(messages.size(), T());
+  column->error_count = 0;
+  column->first_error = absl::OkStatus();
+
+  absl::Mutex mutex;
+  size_t first_error_row = messages.size();
+  const size_t num_blocks =
+      (messages.size() + kBatchShardRows - 1) / kBatchShardRows;
+  ParallelFor(num_blocks, options.num_threads, [&](size_t begin, size_t end) {
+    static const ParameterBindings* no_bindings = new ParameterBindings();
+    const size_t end_row = std::min(end * kBatchShardRows, messages.size());
+    int64_t error_count = 0;
+    size_t error_row = end_row;
+    absl::Status error;
+    auto record_error = [&](size_t row, const absl::Status& status) {
+      if (error_count++ == 0) {
+        error_row = row;
+        error = status;
+      }
+    };
+
+    internal::WorkSpace work_space(primitive_handler_,
+                                   messages[begin * kBatchShardRows]);
+    work_space.SetParameterBindings(no_bindings);
+    std::vector<internal::WorkspaceMessage> results;
+    for (size_t row = begin * kBatchShardRows; row < end_row; ++row) {
+      work_space.Reset(internal::WorkspaceMessage(messages[row]));
+      results.clear();
+      absl::Status status = root_expression_->Evaluate(&work_space, &results);
+      if (!status.ok()) {
+        record_error(row, status);
+        continue;
+      }
+      if (results.empty()) {
+        continue;
+      }
+      if (results.size() > 1) {
+        record_error(row,
+                     InvalidArgumentError(
+                         "Result collection must contain exactly one element"));
+        continue;
+      }
+
+      absl::StatusOr<T> value =
+          ToColumnValue<T>(primitive_handler_, *results[0].Message());
+      if (!value.ok()) {
+        record_error(row, value.status());
+        continue;
+      }
+      column->values[row] = std::move(value).value();
+      column->validity[row / 8] |= 1 << (row % 8);
+    }
+
+    if (error_count > 0) {
+      absl::MutexLock lock(&mutex);
+      column->error_count += error_count;
+      if (error_row < first_error_row) {
+        first_error_row = error_row;
+        column->first_error = error;
+      }
+    }
+  });
+}
+
+void CompiledExpression::EvaluateBatch(
+    absl::Span<const Message* const> messages, ResultColumn<bool>* column,
+    const BatchOptions& options) const {
+  EvaluateBatch<bool>(messages, column, options);
+}
+
+void CompiledExpression::EvaluateBatch(
+    absl::Span<const Message* const> messages, ResultColumn<int32_t>* column,
+    const BatchOptions& options) const {
+  EvaluateBatch<int32_t>(messages, column, options);
+}
+
+void CompiledExpression::EvaluateBatch(
+    absl::Span<const Message* const> messages,
+    ResultColumn<std::string>* column, const BatchOptions& options) const {
+  EvaluateBatch<std::string>(messages, column, options);
+}
+
+absl::StatusOr<EvaluationResult> CompiledExpression::Evaluate(
+    const internal::ExpressionNode& root_expression,
+    const internal::WorkspaceMessage& message,
+    const ParameterBindings& parameter_bindings,
+    const ReferenceResolver* reference_resolver,
+    ExpressionProfile* profile) const {
   std::vector<internal::WorkspaceMessage> message_context_stack;
   auto work_space = absl::make_unique<internal::WorkSpace>(
       primitive_handler_, message_context_stack, message);
+  work_space->SetParameterBindings(&parameter_bindings);
+  work_space->SetReferenceResolver(reference_resolver);
+  work_space->SetProfile(profile);
 
   std::vector<internal::WorkspaceMessage> workspace_results;
   FHIR_RETURN_IF_ERROR(
-      root_expression_->Evaluate(work_space.get(), &workspace_results));
+      root_expression.Evaluate(work_space.get(), &workspace_results));
 
   std::vector<const Message*> results;
   results.reserve(workspace_results.size());
@@ -3988,6 +5440,43 @@ absl::StatusOr<EvaluationResult> CompiledExpression::Evaluate(
   return EvaluationResult(std::move(work_space));
 }
 
+namespace {
+
+void AppendExplanation(const std::vector<NodeProfile>& nodes, int index,
+                       int depth, std::string* out) {
+  const NodeProfile& node = nodes[index];
+  int64_t input_size = 0;
+  absl::Duration operand_time;
+  for (int child : node.children) {
+    input_size += nodes[child].output_size;
+    operand_time += nodes[child].wall_time;
+  }
+
+  absl::StrAppend(
+      out, std::string(depth * 2, ' '), node.label, " -> ",
+      node.return_type != nullptr ? node.return_type->full_name() : "?",
+      ": calls=", node.invocations, " in=", input_size,
+      " out=", node.output_size, " temporaries=", node.temporaries,
+      " time=", absl::FormatDuration(node.wall_time),
+      " self=", absl::FormatDuration(node.wall_time - operand_time), "\n");
+
+  for (int child : node.children) {
+    AppendExplanation(nodes, child, depth + 1, out);
+  }
+}
+
+}  // namespace
+
+std::string ExpressionProfile::Explain() const {
+  if (nodes_.empty()) {
+    return "";
+  }
+
+  std::string explanation = absl::StrCat(fhir_path_, "\n");
+  AppendExplanation(nodes_, 0, 1, &explanation);
+  return explanation;
+}
+
 }  // namespace fhir_path
 }  // namespace fhir
 }  // namespace google
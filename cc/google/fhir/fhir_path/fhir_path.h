@@ -15,18 +15,82 @@
 #ifndef GOOGLE_FHIR_FHIR_PATH_FHIR_PATH_H_
 #define GOOGLE_FHIR_FHIR_PATH_FHIR_PATH_H_
 
+#include <memory>
+
 #include "google/protobuf/message.h"
+#include "absl/base/call_once.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "google/fhir/annotations.h"
 #include "google/fhir/primitive_handler.h"
 #include "google/fhir/status/statusor.h"
+#include "google/fhir/util.h"
 
 namespace google {
 namespace fhir {
 namespace fhir_path {
 
+// The parameters of a FHIRPath expression, keyed by name without the leading
+// '%'. Each parameter is mapped to the type of the values it will be bound to,
+// or nullptr if the type is not known at compile time.
+using ExpressionParameters =
+    absl::flat_hash_map<std::string, const ::google::protobuf::Descriptor*>;
+
+// The values bound to the parameters of a FHIRPath expression for a single
+// evaluation, keyed by name without the leading '%'. Each parameter is bound to
+// a collection of messages, which must outlive the evaluation result.
+using ParameterBindings =
+    absl::flat_hash_map<std::string,
+                        std::vector<const ::google::protobuf::Message*>>;
+
+class ExpressionProfile;
+
+// Locates the resources that references point to, for the FHIRPath resolve()
+// function. Implementations must be thread safe.
+class ReferenceResolver {
+ public:
+  virtual ~ReferenceResolver() {}
+
+  // Returns the resource identified by the given reference, e.g. "Patient/123"
+  // or "urn:uuid:...", or nullptr if it cannot be found. The resource must
+  // outlive the results of the evaluations it is resolved in.
+  virtual const ::google::protobuf::Message* Resolve(
+      absl::string_view reference) const = 0;
+};
+
+// Resolves references to the resources of a Bundle, identified either by the
+// fullUrl of their entry or by their type and id, e.g. "Patient/123". Version
+// specific references resolve to the resource of the same type and id.
+//
+// The Bundle is indexed on the first call to Resolve, so a single instance
+// should serve every expression evaluated against the same Bundle. Messages
+// other than Bundles resolve no references. The Bundle must outlive the
+// resolver.
+class BundleReferenceResolver : public ReferenceResolver {
+ public:
+  explicit BundleReferenceResolver(const ::google::protobuf::Message& bundle)
+      : bundle_(bundle) {}
+
+  const ::google::protobuf::Message* Resolve(
+      absl::string_view reference) const override;
+
+ private:
+  void BuildIndex() const;
+
+  const ::google::protobuf::Message& bundle_;
+  mutable absl::once_flag index_once_;
+  mutable std::unique_ptr<BundleIndex> index_;
+};
 
 namespace internal {
 
+class ProfiledNode;
+struct ProfiledPlan;
+class ReadSetBuilder;
+
 // Represents a single value encountered during FHIRPath evaluation, including
 // necessary context about the value's ancestry to determine the resource
 // it was derived from (where possible.)
@@ -51,6 +115,12 @@ class WorkspaceMessage {
   // Returns the Message wrapped by this class.
   const ::google::protobuf::Message* Message() const { return result_; }
 
+  // Returns the outermost ancestor of the wrapped message, or the message
+  // itself if it has no known ancestors.
+  const ::google::protobuf::Message* Root() const {
+    return ancestry_stack_.empty() ? result_ : ancestry_stack_.front();
+  }
+
   // Finds the nearest message of type Resource for the message wrapped by this
   // class.
   //
@@ -102,6 +172,67 @@ class WorkSpace {
     message_context_stack_.push_back(message_context);
   }
 
+  // Creates a workspace for evaluating a function's argument, e.g. the
+  // criteria of where(), against message_context. The parent's message
+  // context stack is placed below message_context, and its parameter
+  // bindings, profile and reference resolver are used. The parent must
+  // outlive the workspace.
+  WorkSpace(WorkSpace* parent, const WorkspaceMessage& message_context)
+      : message_context_stack_(parent->message_context_stack_),
+        primitive_handler_(parent->primitive_handler_),
+        parameter_bindings_(parent->parameter_bindings_),
+        profile_(parent->profile_),
+        parent_(parent) {
+    message_context_stack_.push_back(message_context);
+  }
+
+  // Prepares the workspace for another evaluation against the given message,
+  // deleting the temporary data of the previous one. This keeps the capacity
+  // the workspace has allocated, so workspaces that evaluate many messages in
+  // turn should be reset rather than recreated.
+  void Reset(const WorkspaceMessage& message_context) {
+    messages_.clear();
+    message_context_stack_.clear();
+    message_context_stack_.push_back(message_context);
+    to_delete_.clear();
+    // A resolver for the previous message's Bundle must not outlive it.
+    if (reference_resolver_ == bundle_reference_resolver_.get()) {
+      reference_resolver_ = nullptr;
+    }
+    bundle_reference_resolver_.reset();
+  }
+
+  // Sets the values bound to the parameters of the expression being evaluated.
+  // The bindings must outlive the workspace.
+  void SetParameterBindings(const ParameterBindings* parameter_bindings) {
+    parameter_bindings_ = parameter_bindings;
+  }
+
+  // Gets the values bound to the parameters of the expression being evaluated,
+  // or nullptr if no values were bound.
+  const ParameterBindings* GetParameterBindings() {
+    return parameter_bindings_;
+  }
+
+  // Sets the profile that evaluation statistics are recorded in, if any. The
+  // profile must outlive the workspace.
+  void SetProfile(ExpressionProfile* profile) { profile_ = profile; }
+
+  // Gets the profile that evaluation statistics are recorded in, or nullptr if
+  // the evaluation is not profiled.
+  ExpressionProfile* GetProfile() { return profile_; }
+
+  // Sets the resolver used by resolve(). The resolver must outlive the
+  // workspace.
+  void SetReferenceResolver(const ReferenceResolver* reference_resolver) {
+    reference_resolver_ = reference_resolver;
+  }
+
+  // Gets the resolver used by resolve(). Unless one was set, this is the
+  // parent's resolver, if any, or else resolves references against the Bundle
+  // the expression is evaluated in, which is indexed on first use.
+  const ReferenceResolver* GetReferenceResolver();
+
   // Gets the message context the FHIRPath expression is evaluated against.
   const WorkspaceMessage MessageContext() {
     return message_context_stack_.back();
@@ -153,6 +284,9 @@ class WorkSpace {
     to_delete_.push_back(std::unique_ptr<::google::protobuf::Message>(message));
   }
 
+  // Returns the number of messages marked with DeleteWhenFinished so far.
+  size_t TemporaryCount() const { return to_delete_.size(); }
+
   const PrimitiveHandler* GetPrimitiveHandler() {
     return primitive_handler_;
   }
@@ -165,6 +299,17 @@ class WorkSpace {
   std::vector<std::unique_ptr<::google::protobuf::Message>> to_delete_;
 
   const PrimitiveHandler* primitive_handler_;
+
+  const ParameterBindings* parameter_bindings_ = nullptr;
+
+  ExpressionProfile* profile_ = nullptr;
+
+  const ReferenceResolver* reference_resolver_ = nullptr;
+
+  std::unique_ptr<ReferenceResolver> bundle_reference_resolver_;
+
+  // The workspace this one evaluates a function argument for, if any.
+  WorkSpace* const parent_ = nullptr;
 };
 
 // Abstract base class of "compiled" FHIRPath expressions. In this
@@ -196,6 +341,11 @@ class ExpressionNode {
   virtual const ::google::protobuf::Descriptor* ReturnType() const = 0;
 };
 
+// Returns true if the field at the given path is, or is within, the field at
+// the given prefix. Paths are in the format of ReadSet::paths(), where the
+// empty path is the whole message.
+bool IsWithinPath(absl::string_view path, absl::string_view prefix);
+
 }  // namespace internal
 
 // The result of a successful evaluation of a CompiledExpression,
@@ -272,6 +422,133 @@ class EvaluationResult {
   std::unique_ptr<internal::WorkSpace> work_space_;
 };
 
+// Statistics of a single node of a compiled FHIRPath expression, accumulated
+// over the evaluations recorded in an ExpressionProfile.
+struct NodeProfile {
+  // Describes the part of the expression the node evaluates, e.g. ".where()"
+  // or "=".
+  std::string label;
+
+  // The type inferred for the node's results at compile time, or nullptr if
+  // unknown.
+  const ::google::protobuf::Descriptor* return_type = nullptr;
+
+  // The indices of the node's operands in ExpressionProfile::nodes().
+  std::vector<int> children;
+
+  int64_t invocations = 0;
+
+  // The total size of the collections the node produced.
+  int64_t output_size = 0;
+
+  // The number of messages the node and its operands allocated.
+  int64_t temporaries = 0;
+
+  // Time spent evaluating the node, including its operands.
+  absl::Duration wall_time;
+};
+
+// Per-node statistics of the evaluations of a compiled expression. Pass an
+// instance to CompiledExpression::Evaluate to record an evaluation; the
+// statistics of repeated evaluations of the same expression accumulate.
+//
+// This class is not thread safe.
+class ExpressionProfile {
+ public:
+  // Returns the profiled nodes in pre-order; the root of the expression is
+  // the first node.
+  const std::vector<NodeProfile>& nodes() const { return nodes_; }
+
+  // Returns a rendering of the compiled expression tree, one node per line,
+  // annotated with the node's return type and statistics.
+  std::string Explain() const;
+
+ private:
+  friend class CompiledExpression;
+  friend class internal::ProfiledNode;
+
+  std::string fhir_path_;
+  std::vector<NodeProfile> nodes_;
+};
+
+// The fields of a message that the result of a compiled expression evaluated
+// against it may depend on, as determined when the expression is compiled.
+//
+// Fields are identified by their path from that message, made of the names of
+// the proto fields as in the paths of a google.protobuf.FieldMask, e.g.
+// "name.given". A path covers all fields within it; the empty path covers the
+// whole message.
+class ReadSet {
+ public:
+  // Returns true if the result may depend on data that is not covered by
+  // paths, such as the resource the message is part of or the resources it
+  // references, so that any change may affect it.
+  bool IsUnbounded() const { return unbounded_; }
+
+  // Returns the paths of the fields read, in lexicographical order. No path is
+  // within another.
+  const std::vector<std::string>& paths() const { return paths_; }
+
+  // Returns true if changing the field at the given path, or any field within
+  // it, may change the result.
+  bool IsAffectedBy(absl::string_view changed_path) const;
+
+  // Returns true if changing any of the fields at the given paths may change
+  // the result.
+  bool IsAffectedBy(const std::vector<std::string>& changed_paths) const;
+
+ private:
+  friend class internal::ReadSetBuilder;
+
+  bool unbounded_ = false;
+  std::vector<std::string> paths_;
+};
+
+// Returns the paths of the fields that differ between two messages of the same
+// type, in the format of ReadSet::paths(). Nested messages set in both are
+// compared field by field; other fields, including repeated fields, are
+// reported as a whole.
+std::vector<std::string> ChangedFieldPaths(
+    const ::google::protobuf::Message& before,
+    const ::google::protobuf::Message& after);
+
+// The scalar results of evaluating an expression against a batch of messages,
+// stored column-wise (see CompiledExpression::EvaluateBatch). Row i holds the
+// result for the i-th message of the batch.
+//
+// T is bool for Booleans, int32_t for Integers, or std::string for any FHIR
+// primitive, in the representation returned by toString(). Rows for which the
+// evaluation yields an empty collection are null, as are rows for which it
+// fails or does not yield a single value of that type.
+template <typename T>
+struct ResultColumn {
+  size_t size() const { return values.size(); }
+
+  // Returns true if the given row holds no value.
+  bool IsNull(size_t row) const {
+    return (validity[row / 8] & (1 << (row % 8))) == 0;
+  }
+
+  // Bit i % 8 of byte i / 8 is set if row i holds a value, as in the validity
+  // bitmaps of Apache Arrow.
+  std::vector<uint8_t> validity;
+
+  // The value of each row. Null rows hold T().
+  std::vector<T> values;
+
+  // The number of rows for which the evaluation failed or did not yield a
+  // single value of type T, and the status of the first of them.
+  int64_t error_count = 0;
+  absl::Status first_error;
+};
+
+// Options of CompiledExpression::EvaluateBatch.
+struct BatchOptions {
+  // The number of threads the batch is split across. The calling thread
+  // evaluates the whole batch if this is 1 or less.
+  int num_threads = 1;
+};
+
 // Represents a FHIRPath expression that has been "compiled" to run efficiently
 // against a given protobuf message type.
 //
@@ -289,12 +566,50 @@ class CompiledExpression {
   // Returns the FHIRPath string used to compile this expression.
   const std::string& fhir_path() const;
 
+  // Returns the fields of the messages the expression is evaluated against
+  // that its result may depend on. Callers that keep the results of
+  // evaluations of a message may use it to re-evaluate only the expressions
+  // affected by an update of the message.
+  const ReadSet& read_set() const;
+
   // Compiles a FHIRPath expression into a structure that will efficiently
   // execute that expression.
   static absl::StatusOr<CompiledExpression> Compile(
       const ::google::protobuf::Descriptor* descriptor,
       const PrimitiveHandler* primitive_handler, const std::string& fhir_path);
 
+  // Compiles a FHIRPath expression that references the given parameters as
+  // external constants, e.g. "code.coding.where(code = %code)". Values are
+  // bound to the parameters with each call to Evaluate, so a single compiled
+  // expression can serve any value.
+  //
+  // Parameters may not shadow the constants predefined by FHIRPath, such as
+  // %context or %ucum.
+  static absl::StatusOr<CompiledExpression> Compile(
+      const ::google::protobuf::Descriptor* descriptor,
+      const PrimitiveHandler* primitive_handler, const std::string& fhir_path,
+      const ExpressionParameters& parameters);
+
+  // Like Compile, but shares the result across the process. Compiling the same
+  // expression for the same descriptor and primitive handler again returns a
+  // copy of the earlier result (or error) that shares its compiled node graph.
+  //
+  // The cache is thread safe and bounded in size; the least recently added
+  // expressions are dropped once it is full.
+  static absl::StatusOr<CompiledExpression> CompileCached(
+      const ::google::protobuf::Descriptor* descriptor,
+      const PrimitiveHandler* primitive_handler, const std::string& fhir_path);
+
+  // Counters of the cache used by CompileCached.
+  struct CacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    // The number of expressions currently cached.
+    size_t size = 0;
+  };
+
+  static CacheStats GetCacheStats();
+
   // Evaluates the compiled expression against the given message.
   absl::StatusOr<EvaluationResult> Evaluate(
       const ::google::protobuf::Message& message) const;
@@ -307,15 +622,95 @@ class CompiledExpression {
   absl::StatusOr<EvaluationResult> Evaluate(
       const internal::WorkspaceMessage& message) const;
 
+  // Evaluates the compiled expression against the given message, with the
+  // given values bound to the parameters the expression was compiled with.
+  //
+  // Returns an InvalidArgumentError if a parameter the expression references
+  // is unbound, or bound to a value of a different type than declared.
+  absl::StatusOr<EvaluationResult> Evaluate(
+      const ::google::protobuf::Message& message,
+      const ParameterBindings& parameter_bindings) const;
+
+  absl::StatusOr<EvaluationResult> Evaluate(
+      const internal::WorkspaceMessage& message,
+      const ParameterBindings& parameter_bindings) const;
+
+  // Evaluates the compiled expression against the given message, looking up
+  // the references followed by resolve() with the given resolver.
+  //
+  // The overloads without a resolver only resolve references to resources in
+  // the Bundle the expression is evaluated in, and index that Bundle anew for
+  // every evaluation. Pass a BundleReferenceResolver to share the index
+  // across evaluations.
+  absl::StatusOr<EvaluationResult> Evaluate(
+      const ::google::protobuf::Message& message,
+      const ParameterBindings& parameter_bindings,
+      const ReferenceResolver& reference_resolver) const;
+
+  absl::StatusOr<EvaluationResult> Evaluate(
+      const internal::WorkspaceMessage& message,
+      const ParameterBindings& parameter_bindings,
+      const ReferenceResolver& reference_resolver) const;
+
+  // Evaluates the compiled expression against each of the given messages and
+  // stores the results in the rows of the given column, which is resized to
+  // the size of the batch. None of the messages may be null.
+  //
+  // Unlike a call to Evaluate for each message, this reuses a single workspace
+  // per thread for all of its messages and creates no EvaluationResults, so
+  // the overhead per message is a small fraction of that of Evaluate.
+  void EvaluateBatch(
+      absl::Span<const ::google::protobuf::Message* const> messages,
+      ResultColumn<bool>* column,
+      const BatchOptions& options = BatchOptions()) const;
+
+  void EvaluateBatch(
+      absl::Span<const ::google::protobuf::Message* const> messages,
+      ResultColumn<int32_t>* column,
+      const BatchOptions& options = BatchOptions()) const;
+
+  void EvaluateBatch(
+      absl::Span<const ::google::protobuf::Message* const> messages,
+      ResultColumn<std::string>* column,
+      const BatchOptions& options = BatchOptions()) const;
+
+  // Evaluates the compiled expression against the given message and records
+  // per-node statistics in the given profile.
+  //
+  // Profiling requires an instrumented copy of the compiled expression, which
+  // is built on first use and shared by all copies of this expression.
+  // Returns an InvalidArgumentError if the profile holds statistics of a
+  // different expression.
+  absl::StatusOr<EvaluationResult> Evaluate(
+      const ::google::protobuf::Message& message,
+      const ParameterBindings& parameter_bindings,
+      ExpressionProfile* profile) const;
+
  private:
   explicit CompiledExpression(
       const std::string& fhir_path,
       std::shared_ptr<internal::ExpressionNode> root_expression,
-      const PrimitiveHandler* primitive_handler_);
+      const PrimitiveHandler* primitive_handler_,
+      std::shared_ptr<const ReadSet> read_set,
+      std::shared_ptr<internal::ProfiledPlan> profiled_plan);
+
+  template <typename T>
+  void EvaluateBatch(
+      absl::Span<const ::google::protobuf::Message* const> messages,
+      ResultColumn<T>* column, const BatchOptions& options) const;
+
+  absl::StatusOr<EvaluationResult> Evaluate(
+      const internal::ExpressionNode& root_expression,
+      const internal::WorkspaceMessage& message,
+      const ParameterBindings& parameter_bindings,
+      const ReferenceResolver* reference_resolver,
+      ExpressionProfile* profile) const;
 
   std::string fhir_path_;
   std::shared_ptr<const internal::ExpressionNode> root_expression_;
   const PrimitiveHandler* primitive_handler_;
+  std::shared_ptr<const ReadSet> read_set_;
+  std::shared_ptr<internal::ProfiledPlan> profiled_plan_;
 };
 
 }  // namespace fhir_path
@@ -0,0 +1,99 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures how long it takes to parse and compile typical FHIRPath
+// constraints, comparing the hand-written parser with the ANTLR generated one.
+//
+// Usage: fhir_path_compile_benchmark [iterations]
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "absl/strings/numbers.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "google/fhir/fhir_path/antlr_fhir_path_parser.h"
+#include "google/fhir/fhir_path/fhir_path.h"
+#include "google/fhir/fhir_path/fhir_path_parser.h"
+#include "google/fhir/r4/primitive_handler.h"
+#include "proto/r4/core/resources/patient.pb.h"
+
+namespace {
+
+using ::google::fhir::fhir_path::CompiledExpression;
+using ::google::fhir::fhir_path::internal::ParseFhirPath;
+using ::google::fhir::fhir_path::internal::ParseFhirPathWithAntlr;
+
+const std::vector<std::string>& Expressions() {
+  static const std::vector<std::string>* expressions =
+      new std::vector<std::string>({
+          "name.exists() or telecom.exists() or address.exists() or "
+          "identifier.exists()",
+          "contact.all(name.exists() or telecom.exists() or "
+          "address.exists() or organization.exists())",
+          "hasValue() or (children().count() > id.count())",
+          "extension.exists() != value.exists()",
+          "link.all(other.exists())",
+          "name.given.where($this = 'Peter').exists() implies "
+          "gender = 'male'",
+          "communication.where(preferred = true).count() <= 1",
+          "identifier.where(system = 'urn:oid:1.2.36.146.595.217.0.1')"
+          ".value.startsWith('12')",
+      });
+  return *expressions;
+}
+
+template <typename Function>
+void Run(const std::string& label, int iterations, Function function) {
+  const absl::Time start = absl::Now();
+  int expressions = 0;
+  for (int i = 0; i < iterations; ++i) {
+    for (const std::string& expression : Expressions()) {
+      if (!function(expression)) {
+        std::cerr << label << " failed on: " << expression << std::endl;
+        return;
+      }
+      ++expressions;
+    }
+  }
+  const absl::Duration elapsed = absl::Now() - start;
+  std::cout << label << ": "
+            << absl::ToDoubleMicroseconds(elapsed) / expressions
+            << " us/expression" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int iterations = 1000;
+  if (argc > 1 && !absl::SimpleAtoi(argv[1], &iterations)) {
+    std::cerr << "Usage: " << argv[0] << " [iterations]" << std::endl;
+    return 1;
+  }
+
+  Run("ANTLR parser", iterations, [](const std::string& expression) {
+    return ParseFhirPathWithAntlr(expression).ok();
+  });
+  Run("Hand-written parser", iterations, [](const std::string& expression) {
+    return ParseFhirPath(expression).ok();
+  });
+  Run("Compile", iterations, [](const std::string& expression) {
+    return CompiledExpression::Compile(
+               google::fhir::r4::core::Patient::descriptor(),
+               google::fhir::r4::R4PrimitiveHandler::GetInstance(), expression)
+        .ok();
+  });
+  return 0;
+}
@@ -0,0 +1,501 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "google/fhir/fhir_path/fhir_path_constraint_generator.h"
+
+#include <deque>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_replace.h"
+#include "absl/strings/strip.h"
+#include "google/fhir/annotations.h"
+#include "google/fhir/fhir_path/fhir_path_parser.h"
+#include "google/fhir/fhir_path/utils.h"
+#include "google/fhir/status/status.h"
+#include "google/fhir/status/statusor.h"
+#include "proto/annotations.pb.h"
+
+namespace google {
+namespace fhir {
+namespace fhir_path {
+
+using ::absl::UnimplementedError;
+using ::google::fhir::fhir_path::internal::AstNode;
+using ::google::fhir::fhir_path::internal::FindFieldByJsonName;
+using ::google::fhir::fhir_path::internal::ParseFhirPath;
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::FieldDescriptor;
+
+namespace {
+
+// A FHIRPath constraint on messages of a given type.
+struct Constraint {
+  const Descriptor* descriptor;
+  std::string fhir_path;
+};
+
+// Returns the constraints on the given messages and on every message reachable
+// from their fields. Field constraints apply to messages of the field's type,
+// as in FhirPathValidator.
+std::vector<Constraint> CollectConstraints(
+    const std::vector<const Descriptor*>& messages) {
+  std::vector<Constraint> constraints;
+  absl::flat_hash_set<std::pair<const Descriptor*, std::string>> seen;
+  auto add_constraint = [&](const Descriptor* descriptor,
+                            const std::string& fhir_path) {
+    if (seen.insert({descriptor, fhir_path}).second) {
+      constraints.push_back({descriptor, fhir_path});
+    }
+  };
+
+  absl::flat_hash_set<const Descriptor*> visited;
+  std::deque<const Descriptor*> queue(messages.begin(), messages.end());
+  while (!queue.empty()) {
+    const Descriptor* descriptor = queue.front();
+    queue.pop_front();
+    if (!visited.insert(descriptor).second) {
+      continue;
+    }
+
+    for (int i = 0; i < descriptor->options().ExtensionSize(
+                            proto::fhir_path_message_constraint);
+         ++i) {
+      add_constraint(descriptor,
+                     descriptor->options().GetExtension(
+                         proto::fhir_path_message_constraint, i));
+    }
+
+    for (int i = 0; i < descriptor->field_count(); ++i) {
+      const FieldDescriptor* field = descriptor->field(i);
+      const Descriptor* field_type = field->message_type();
+      if (field_type == nullptr) {
+        continue;
+      }
+      for (int j = 0;
+           j < field->options().ExtensionSize(proto::fhir_path_constraint);
+           ++j) {
+        add_constraint(field_type, field->options().GetExtension(
+                                       proto::fhir_path_constraint, j));
+      }
+      queue.push_back(field_type);
+    }
+  }
+  return constraints;
+}
+
+// Returns the name protoc gives to the accessors of the field.
+std::string AccessorName(const FieldDescriptor* field) {
+  static const auto* keywords = new absl::flat_hash_set<std::string>({
+      "alignas",   "alignof",   "and",          "and_eq",     "asm",
+      "auto",      "bitand",    "bitor",        "bool",       "break",
+      "case",      "catch",     "char",         "class",      "compl",
+      "const",     "constexpr", "const_cast",   "continue",   "decltype",
+      "default",   "delete",    "do",           "double",     "dynamic_cast",
+      "else",      "enum",      "explicit",     "export",     "extern",
+      "false",     "float",     "for",          "friend",     "goto",
+      "if",        "inline",    "int",          "long",       "mutable",
+      "namespace", "new",       "noexcept",     "not",        "not_eq",
+      "nullptr",   "operator",  "or",           "or_eq",      "private",
+      "protected", "public",    "register",     "reinterpret_cast",
+      "return",    "short",     "signed",       "sizeof",     "static",
+      "static_assert",          "static_cast",  "struct",     "switch",
+      "template",  "this",      "thread_local", "throw",      "true",
+      "try",       "typedef",   "typeid",       "typename",   "union",
+      "unsigned",  "using",     "virtual",      "void",       "volatile",
+      "wchar_t",   "while",     "xor",          "xor_eq",
+  });
+  std::string name = absl::AsciiStrToLower(field->name());
+  if (keywords->contains(name)) {
+    absl::StrAppend(&name, "_");
+  }
+  return name;
+}
+
+// Translates FHIRPath constraints into C++ functions over the generated
+// message classes.
+class ConstraintTranslator {
+ public:
+  // Appends a function named function_name to the source, which takes a
+  // message of the constraint's type and returns true if it satisfies the
+  // constraint. Returns an UnimplementedError, and appends nothing, if the
+  // constraint is outside of the supported subset of FHIRPath.
+  absl::Status Translate(const Constraint& constraint,
+                         const std::string& function_name) {
+    FHIR_ASSIGN_OR_RETURN(std::unique_ptr<AstNode> ast,
+                          ParseFhirPath(constraint.fhir_path));
+
+    helpers_.clear();
+    std::set<std::string> headers;
+    std::swap(headers, headers_);
+    absl::StatusOr<std::string> expression =
+        TranslateBoolean(*ast, constraint.descriptor, "m0");
+    std::swap(headers, headers_);
+    if (!expression.ok()) {
+      return expression.status();
+    }
+    headers_.insert(headers.begin(), headers.end());
+
+    const std::string class_name = ClassName(constraint.descriptor);
+    absl::StrAppend(&source_, helpers_, "// ",
+                    constraint.descriptor->full_name(), ": \"",
+                    absl::CEscape(constraint.fhir_path), "\"\n",
+                    "bool ", function_name,
+                    "(const ::google::protobuf::Message& message) {\n",
+                    "  const ", class_name, "& m0 = static_cast<const ",
+                    class_name, "&>(message);\n", "  return ",
+                    expression.value(), ";\n}\n\n");
+    return absl::OkStatus();
+  }
+
+  // Returns the fully qualified name of the class generated for the message
+  // type, recording the header that declares it.
+  std::string ClassName(const Descriptor* descriptor) {
+    headers_.insert(absl::StrCat(
+        absl::StripSuffix(descriptor->file()->name(), ".proto"), ".pb.h"));
+
+    std::string name = descriptor->name();
+    for (const Descriptor* parent = descriptor->containing_type();
+         parent != nullptr; parent = parent->containing_type()) {
+      name = absl::StrCat(parent->name(), "_", name);
+    }
+    const std::string& package = descriptor->file()->package();
+    return package.empty()
+               ? absl::StrCat("::", name)
+               : absl::StrCat("::", absl::StrReplaceAll(package, {{".", "::"}}),
+                              "::", name);
+  }
+
+  // The translated functions.
+  const std::string& source() const { return source_; }
+
+  // The headers of the classes used by the translated functions.
+  const std::set<std::string>& headers() const { return headers_; }
+
+ private:
+  enum class PathFunction { kExists, kAll, kCount };
+
+  // Returns a C++ expression of type bool equivalent to the FHIRPath
+  // expression evaluated on the message named var of the given type.
+  absl::StatusOr<std::string> TranslateBoolean(const AstNode& node,
+                                               const Descriptor* descriptor,
+                                               const std::string& var) {
+    switch (node.kind) {
+      case AstNode::kBooleanLiteral:
+        return node.text;
+
+      case AstNode::kBinaryExpression: {
+        if (node.op == "=" || node.op == "!=" || node.op == "<" ||
+            node.op == "<=" || node.op == ">" || node.op == ">=") {
+          return TranslateComparison(node, descriptor, var);
+        }
+        FHIR_ASSIGN_OR_RETURN(
+            std::string left,
+            TranslateBoolean(*node.children[0], descriptor, var));
+        FHIR_ASSIGN_OR_RETURN(
+            std::string right,
+            TranslateBoolean(*node.children[1], descriptor, var));
+        if (node.op == "and") {
+          return absl::StrCat("(", left, " && ", right, ")");
+        }
+        if (node.op == "or") {
+          return absl::StrCat("(", left, " || ", right, ")");
+        }
+        if (node.op == "xor") {
+          return absl::StrCat("(", left, " != ", right, ")");
+        }
+        if (node.op == "implies") {
+          return absl::StrCat("(!", left, " || ", right, ")");
+        }
+        return UnimplementedError(
+            absl::StrCat("Unsupported operator ", node.op));
+      }
+
+      case AstNode::kInvocationExpression: {
+        const AstNode& function = *node.children[1];
+        if (function.kind != AstNode::kFunctionInvocation) {
+          break;
+        }
+        if (function.name == "not" && function.children.empty()) {
+          FHIR_ASSIGN_OR_RETURN(
+              std::string operand,
+              TranslateBoolean(*node.children[0], descriptor, var));
+          return absl::StrCat("!", operand);
+        }
+        if (function.name == "exists" && function.children.size() <= 1) {
+          return TranslatePathFunction(
+              *node.children[0], descriptor, var, PathFunction::kExists,
+              function.children.empty() ? nullptr : function.children[0].get());
+        }
+        if (function.name == "empty" && function.children.empty()) {
+          FHIR_ASSIGN_OR_RETURN(
+              std::string exists,
+              TranslatePathFunction(*node.children[0], descriptor, var,
+                                    PathFunction::kExists, nullptr));
+          return absl::StrCat("!", exists);
+        }
+        if (function.name == "all" && function.children.size() == 1) {
+          return TranslatePathFunction(*node.children[0], descriptor, var,
+                                       PathFunction::kAll,
+                                       function.children[0].get());
+        }
+        return UnimplementedError(
+            absl::StrCat("Unsupported function ", function.name, "()"));
+      }
+
+      default:
+        break;
+    }
+    return UnimplementedError(
+        absl::StrCat("Unsupported expression ", node.DebugString()));
+  }
+
+  // Translates one of the comparison operators, whose operands are either
+  // count() and an integer or two boolean expressions.
+  absl::StatusOr<std::string> TranslateComparison(const AstNode& node,
+                                                  const Descriptor* descriptor,
+                                                  const std::string& var) {
+    const std::string op = node.op == "=" ? "==" : node.op;
+    const AstNode& left = *node.children[0];
+    const AstNode& right = *node.children[1];
+
+    int value;
+    if (left.kind == AstNode::kInvocationExpression &&
+        left.children[1]->kind == AstNode::kFunctionInvocation &&
+        left.children[1]->name == "count" &&
+        left.children[1]->children.empty() &&
+        right.kind == AstNode::kNumberLiteral &&
+        absl::SimpleAtoi(right.text, &value)) {
+      FHIR_ASSIGN_OR_RETURN(
+          std::string count,
+          TranslatePathFunction(*left.children[0], descriptor, var,
+                                PathFunction::kCount, nullptr));
+      return absl::StrCat("(", count, " ", op, " ", value, ")");
+    }
+
+    if (op != "==" && op != "!=") {
+      return UnimplementedError(
+          absl::StrCat("Unsupported comparison ", node.DebugString()));
+    }
+    FHIR_ASSIGN_OR_RETURN(std::string left_bool,
+                          TranslateBoolean(left, descriptor, var));
+    FHIR_ASSIGN_OR_RETURN(std::string right_bool,
+                          TranslateBoolean(right, descriptor, var));
+    return absl::StrCat("(", left_bool, " ", op, " ", right_bool, ")");
+  }
+
+  // Returns the fields accessed by a path of member invocations on messages of
+  // the given type.
+  absl::StatusOr<std::vector<const FieldDescriptor*>> TranslatePath(
+      const AstNode& node, const Descriptor* descriptor) {
+    std::vector<const FieldDescriptor*> path;
+    const AstNode* member = &node;
+    if (node.kind == AstNode::kInvocationExpression) {
+      FHIR_ASSIGN_OR_RETURN(path, TranslatePath(*node.children[0], descriptor));
+      descriptor = path.back()->message_type();
+      member = node.children[1].get();
+    }
+    if (member->kind != AstNode::kMemberInvocation) {
+      return UnimplementedError(
+          absl::StrCat("Unsupported path ", node.DebugString()));
+    }
+
+    // The interpreter maps "value" on primitives to the primitive itself and
+    // looks through choice types and contained resources.
+    if (IsPrimitive(descriptor) || IsChoiceTypeContainer(descriptor) ||
+        IsContainedResource(descriptor)) {
+      return UnimplementedError(absl::StrCat("Unsupported member access on ",
+                                             descriptor->full_name()));
+    }
+    const FieldDescriptor* field =
+        FindFieldByJsonName(descriptor, member->name);
+    if (field == nullptr || field->message_type() == nullptr ||
+        IsChoiceType(field) || IsContainedResource(field->message_type()) ||
+        field->message_type()->full_name() == "google.protobuf.Any") {
+      return UnimplementedError(absl::StrCat("Unsupported member ",
+                                             member->name, " of ",
+                                             descriptor->full_name()));
+    }
+    path.push_back(field);
+    return path;
+  }
+
+  // Generates a helper function that applies exists(), all() or count() to
+  // the path on its argument and returns a C++ expression calling it with the
+  // message named var.
+  absl::StatusOr<std::string> TranslatePathFunction(
+      const AstNode& path_node, const Descriptor* descriptor,
+      const std::string& var, PathFunction function, const AstNode* criteria) {
+    FHIR_ASSIGN_OR_RETURN(std::vector<const FieldDescriptor*> path,
+                          TranslatePath(path_node, descriptor));
+
+    // A single field without criteria needs no helper.
+    if (path.size() == 1 && criteria == nullptr) {
+      const std::string accessor = AccessorName(path[0]);
+      if (function == PathFunction::kCount) {
+        return path[0]->is_repeated()
+                   ? absl::StrCat(var, ".", accessor, "_size()")
+                   : absl::StrCat("(", var, ".has_", accessor, "() ? 1 : 0)");
+      }
+      return path[0]->is_repeated()
+                 ? absl::StrCat("(", var, ".", accessor, "_size() > 0)")
+                 : absl::StrCat(var, ".has_", accessor, "()");
+    }
+
+    // Criteria are evaluated on each element of the collection, so every
+    // field of the path is iterated. Otherwise only the presence or number of
+    // values of the last field is needed.
+    const int iterated =
+        static_cast<int>(path.size()) - (criteria != nullptr ? 0 : 1);
+    std::string body;
+    std::string indent = "  ";
+    for (int i = 0; i < iterated; ++i) {
+      const std::string accessor = AccessorName(path[i]);
+      const std::string parent = absl::StrCat("m", i);
+      const std::string element = absl::StrCat("m", i + 1);
+      if (path[i]->is_repeated()) {
+        absl::StrAppend(&body, indent, "for (const auto& ", element, " : ",
+                        parent, ".", accessor, "()) {\n");
+      } else {
+        absl::StrAppend(&body, indent, "if (", parent, ".has_", accessor,
+                        "()) {\n", indent, "  const auto& ", element, " = ",
+                        parent, ".", accessor, "();\n");
+      }
+      indent += "  ";
+    }
+
+    const std::string last = absl::StrCat("m", iterated);
+    const std::string accessor = AccessorName(path.back());
+    std::string result_type = "bool";
+    std::string result = function == PathFunction::kAll ? "true" : "false";
+    if (criteria != nullptr) {
+      FHIR_ASSIGN_OR_RETURN(
+          std::string satisfied,
+          TranslateBoolean(*criteria, path.back()->message_type(), last));
+      absl::StrAppend(&body, indent,
+                      function == PathFunction::kAll
+                          ? absl::StrCat("if (!", satisfied, ") return false;")
+                          : absl::StrCat("if (", satisfied, ") return true;"),
+                      "\n");
+    } else if (function == PathFunction::kCount) {
+      result_type = "int";
+      result = "count";
+      absl::StrAppend(&body, indent,
+                      path.back()->is_repeated()
+                          ? absl::StrCat("count += ", last, ".", accessor,
+                                         "_size();")
+                          : absl::StrCat("if (", last, ".has_", accessor,
+                                         "()) ++count;"),
+                      "\n");
+    } else {
+      absl::StrAppend(&body, indent,
+                      path.back()->is_repeated()
+                          ? absl::StrCat("if (", last, ".", accessor,
+                                         "_size() > 0) return true;")
+                          : absl::StrCat("if (", last, ".has_", accessor,
+                                         "()) return true;"),
+                      "\n");
+    }
+    for (int i = 0; i < iterated; ++i) {
+      indent.resize(indent.size() - 2);
+      absl::StrAppend(&body, indent, "}\n");
+    }
+
+    const std::string name = absl::StrCat("Helper", helper_count_++);
+    const std::string declarations =
+        function == PathFunction::kCount ? "  int count = 0;\n" : "";
+    absl::StrAppend(&helpers_, result_type, " ", name, "(const ",
+                    ClassName(descriptor), "& m0) {\n", declarations, body,
+                    "  return ", result, ";\n}\n\n");
+    return absl::StrCat(name, "(", var, ")");
+  }
+
+  // Helper functions of the constraint being translated.
+  std::string helpers_;
+  int helper_count_ = 0;
+  std::string source_;
+  std::set<std::string> headers_;
+};
+
+}  // namespace
+
+std::string GenerateNativeConstraints(
+    const std::vector<const Descriptor*>& messages) {
+  std::vector<Constraint> constraints = CollectConstraints(messages);
+
+  ConstraintTranslator translator;
+  std::string registrations;
+  std::string skipped;
+  int translated = 0;
+  for (const Constraint& constraint : constraints) {
+    const std::string function_name = absl::StrCat("Constraint", translated);
+    absl::Status status = translator.Translate(constraint, function_name);
+    if (!status.ok()) {
+      absl::StrAppend(&skipped, "//   ", constraint.descriptor->full_name(),
+                      ": \"", absl::CEscape(constraint.fhir_path),
+                      "\"\n//     ", status.message(), "\n");
+      continue;
+    }
+    absl::StrAppend(&registrations, "const bool kRegistered", translated,
+                    " = RegisterNativeConstraint(\n    ",
+                    translator.ClassName(constraint.descriptor),
+                    "::default_instance(),\n    \"",
+                    absl::CEscape(constraint.fhir_path), "\", &",
+                    function_name, ");\n");
+    ++translated;
+  }
+
+  std::vector<std::string> roots;
+  for (const Descriptor* message : messages) {
+    roots.push_back(message->full_name());
+  }
+
+  std::string source = absl::StrCat(
+      "// Generated by fhir_path_constraint_generator. DO NOT EDIT.\n//\n",
+      "// Native implementations of the FHIRPath constraints reachable from:\n",
+      "//   ", absl::StrJoin(roots, ", "), "\n//\n// Translated ", translated,
+      " of ", constraints.size(), " constraints.");
+  if (!skipped.empty()) {
+    absl::StrAppend(&source, " The following are left to the interpreter:\n",
+                    skipped);
+  } else {
+    absl::StrAppend(&source, "\n");
+  }
+
+  absl::StrAppend(&source, "\n#include \"google/protobuf/message.h\"\n",
+                  "#include "
+                  "\"google/fhir/fhir_path/native_constraint_registry.h\"\n");
+  for (const std::string& header : translator.headers()) {
+    absl::StrAppend(&source, "#include \"", header, "\"\n");
+  }
+  absl::StrAppend(
+      &source, "\nnamespace {\n\n",
+      "using ::google::fhir::fhir_path::RegisterNativeConstraint;\n\n",
+      translator.source(), registrations, "\n}  // namespace\n");
+  return source;
+}
+
+}  // namespace fhir_path
+}  // namespace fhir
+}  // namespace google
@@ -0,0 +1,55 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GOOGLE_FHIR_FHIR_PATH_FHIR_PATH_CONSTRAINT_GENERATOR_H_
+#define GOOGLE_FHIR_FHIR_PATH_FHIR_PATH_CONSTRAINT_GENERATOR_H_
+
+#include <string>
+#include <vector>
+
+#include "google/protobuf/descriptor.h"
+
+namespace google {
+namespace fhir {
+namespace fhir_path {
+
+// Generates a C++ source file with native implementations of the FHIRPath
+// constraints (the fhir_path_constraint and fhir_path_message_constraint
+// annotations) on the given messages and on every message reachable from their
+// fields. The implementations read fields through the generated accessors of
+// the message classes and register themselves with the native constraint
+// registry (see native_constraint_registry.h), so that a FhirPathValidator in a
+// binary the file is linked into evaluates them without the interpreter.
+//
+// Only the following subset of FHIRPath is translated:
+//   - boolean literals, and, or, xor, implies and not()
+//   - exists(), empty(), exists(criteria) and all(criteria) on paths of
+//     member invocations
+//   - count() on paths of member invocations compared with an integer
+//   - = and != between two expressions of this subset
+// Paths may not access the members of FHIR primitives, choice types or
+// contained resources, as the interpreter unwraps those. Constraints outside
+// of the subset are listed in a comment at the top of the generated file and
+// are left to the interpreter.
+//
+// Use the fhir_path_constraints_cc_library rule in bazel/fhir_path.bzl rather
+// than calling this directly.
+std::string GenerateNativeConstraints(
+    const std::vector<const ::google::protobuf::Descriptor*>& messages);
+
+}  // namespace fhir_path
+}  // namespace fhir
+}  // namespace google
+
+#endif  // GOOGLE_FHIR_FHIR_PATH_FHIR_PATH_CONSTRAINT_GENERATOR_H_
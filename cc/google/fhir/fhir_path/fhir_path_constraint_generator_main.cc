@@ -0,0 +1,60 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Writes native implementations of the FHIRPath constraints reachable from the
+// given messages to a C++ source file (see fhir_path_constraint_generator.h).
+// The messages are looked up in the generated pool, so the cc_proto_library
+// targets defining them must be linked in.
+//
+// Usage: fhir_path_constraint_generator <output.cc> <message full name>...
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "google/protobuf/descriptor.h"
+#include "google/fhir/fhir_path/fhir_path_constraint_generator.h"
+
+using ::google::fhir::fhir_path::GenerateNativeConstraints;
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::DescriptorPool;
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " <output.cc> <message full name>..."
+              << std::endl;
+    return 1;
+  }
+
+  std::vector<const Descriptor*> messages;
+  for (int i = 2; i < argc; ++i) {
+    const Descriptor* descriptor =
+        DescriptorPool::generated_pool()->FindMessageTypeByName(argv[i]);
+    if (descriptor == nullptr) {
+      std::cerr << "Unknown message " << argv[i]
+                << "; is its cc_proto_library a dependency?" << std::endl;
+      return 1;
+    }
+    messages.push_back(descriptor);
+  }
+
+  std::ofstream output(argv[1]);
+  output << GenerateNativeConstraints(messages);
+  output.close();
+  if (!output) {
+    std::cerr << "Failed to write " << argv[1] << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,67 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "google/fhir/fhir_path/fhir_path_constraint_generator.h"
+
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "proto/r4/core/datatypes.pb.h"
+
+namespace google {
+namespace fhir {
+namespace fhir_path {
+namespace {
+
+using ::testing::HasSubstr;
+using ::testing::Not;
+
+TEST(FhirPathConstraintGeneratorTest, TranslatesSupportedConstraints) {
+  const std::string source =
+      GenerateNativeConstraints({r4::core::Ratio::descriptor()});
+
+  EXPECT_THAT(source, HasSubstr("#include \"proto/r4/core/datatypes.pb.h\""));
+  EXPECT_THAT(source, HasSubstr("return ((!m0.has_numerator() != "
+                                "m0.has_denominator()) && "
+                                "(m0.has_numerator() || "
+                                "(m0.extension_size() > 0)));"));
+  EXPECT_THAT(source,
+              HasSubstr("RegisterNativeConstraint(\n"
+                        "    ::google::fhir::r4::core::Ratio::"
+                        "default_instance(),\n"
+                        "    \"(numerator.empty() xor denominator.exists()) "
+                        "and (numerator.exists() or extension.exists())\""));
+
+  // Constraints on types reachable from the root are translated too.
+  EXPECT_THAT(source, HasSubstr("::google::fhir::r4::core::Quantity::"
+                                "default_instance(),\n"
+                                "    \"code.empty() or system.exists()\""));
+}
+
+TEST(FhirPathConstraintGeneratorTest, LeavesUnsupportedConstraints) {
+  const std::string source =
+      GenerateNativeConstraints({r4::core::Period::descriptor()});
+
+  EXPECT_THAT(source, HasSubstr("//   google.fhir.r4.core.Period: "
+                                "\"start.hasValue().not() or "
+                                "end.hasValue().not() or (start <= end)\"\n"
+                                "//     Unsupported function hasValue()"));
+  EXPECT_THAT(source, Not(HasSubstr("r4::core::Period::default_instance()")));
+}
+
+}  // namespace
+}  // namespace fhir_path
+}  // namespace fhir
+}  // namespace google
@@ -0,0 +1,752 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "google/fhir/fhir_path/fhir_path_parser.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
+#include "google/fhir/status/status.h"
+
+namespace google {
+namespace fhir {
+namespace fhir_path {
+namespace internal {
+
+namespace {
+
+using ::absl::InvalidArgumentError;
+
+enum TokenType {
+  kEndOfInput,
+  kIdentifier,
+  kDelimitedIdentifier,
+  kString,
+  kNumber,
+  kDate,
+  kDateTime,
+  kTime,
+  // Punctuation, operators and keywords. The token text identifies which.
+  kSymbol,
+};
+
+struct Token {
+  TokenType type;
+  absl::string_view text;
+  // Offset of the token in the expression, for error messages.
+  size_t position;
+};
+
+// Keywords are the literal tokens of FhirPath.g4 that would otherwise lex as
+// identifiers. As in the ANTLR generated lexer, they are never IDENTIFIER
+// tokens, although the grammar permits a few of them as identifiers.
+bool IsKeyword(absl::string_view text) {
+  static const absl::flat_hash_set<absl::string_view>* keywords =
+      new absl::flat_hash_set<absl::string_view>(
+          {"true", "false", "and", "or", "xor", "implies", "div", "mod", "is",
+           "as", "in", "contains", "year", "month", "week", "day", "hour",
+           "minute", "second", "millisecond", "years", "months", "weeks",
+           "days", "hours", "minutes", "seconds", "milliseconds"});
+  return keywords->contains(text);
+}
+
+bool IsDateTimePrecision(absl::string_view text) {
+  static const absl::flat_hash_set<absl::string_view>* precisions =
+      new absl::flat_hash_set<absl::string_view>(
+          {"year", "month", "week", "day", "hour", "minute", "second",
+           "millisecond", "years", "months", "weeks", "days", "hours",
+           "minutes", "seconds", "milliseconds"});
+  return precisions->contains(text);
+}
+
+// Splits a FHIRPath expression into tokens, following the lexical rules of
+// FhirPath.g4. Whitespace and comments are dropped.
+class Lexer {
+ public:
+  explicit Lexer(absl::string_view input) : input_(input) {}
+
+  absl::StatusOr<std::vector<Token>> Tokenize() {
+    std::vector<Token> tokens;
+    // Most tokens are at least two characters once whitespace is removed.
+    tokens.reserve(input_.size() / 2 + 1);
+
+    while (true) {
+      SkipWhitespaceAndComments();
+      if (pos_ >= input_.size()) {
+        tokens.push_back({kEndOfInput, absl::string_view(), pos_});
+        return tokens;
+      }
+
+      const size_t start = pos_;
+      FHIR_ASSIGN_OR_RETURN(TokenType type, NextToken());
+      tokens.push_back({type, input_.substr(start, pos_ - start), start});
+    }
+  }
+
+ private:
+  char CharAt(size_t pos) const {
+    return pos < input_.size() ? input_[pos] : '\0';
+  }
+
+  bool DigitsAt(size_t pos, size_t count) const {
+    for (size_t i = 0; i < count; ++i) {
+      if (!absl::ascii_isdigit(CharAt(pos + i))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // The Match* functions return the length of the longest match of the
+  // corresponding fragment of FhirPath.g4 starting at pos, or zero if there is
+  // no match.
+
+  // [0-9][0-9][0-9][0-9] ('-'[0-9][0-9] ('-'[0-9][0-9])?)?
+  size_t MatchDateFormat(size_t pos) const {
+    if (!DigitsAt(pos, 4)) {
+      return 0;
+    }
+    size_t length = 4;
+    for (int i = 0; i < 2; ++i) {
+      if (CharAt(pos + length) != '-' || !DigitsAt(pos + length + 1, 2)) {
+        break;
+      }
+      length += 3;
+    }
+    return length;
+  }
+
+  // [0-9][0-9] (':'[0-9][0-9] (':'[0-9][0-9] ('.'[0-9]+)?)?)?
+  size_t MatchTimeFormat(size_t pos) const {
+    if (!DigitsAt(pos, 2)) {
+      return 0;
+    }
+    size_t length = 2;
+    for (int i = 0; i < 2; ++i) {
+      if (CharAt(pos + length) != ':' || !DigitsAt(pos + length + 1, 2)) {
+        return length;
+      }
+      length += 3;
+    }
+    if (CharAt(pos + length) == '.' && DigitsAt(pos + length + 1, 1)) {
+      length += 2;
+      while (absl::ascii_isdigit(CharAt(pos + length))) {
+        ++length;
+      }
+    }
+    return length;
+  }
+
+  // ('Z' | ('+' | '-') [0-9][0-9]':'[0-9][0-9])
+  size_t MatchTimeZoneOffsetFormat(size_t pos) const {
+    if (CharAt(pos) == 'Z') {
+      return 1;
+    }
+    if ((CharAt(pos) == '+' || CharAt(pos) == '-') && DigitsAt(pos + 1, 2) &&
+        CharAt(pos + 3) == ':' && DigitsAt(pos + 4, 2)) {
+      return 6;
+    }
+    return 0;
+  }
+
+  void SkipWhitespaceAndComments() {
+    while (pos_ < input_.size()) {
+      const char c = input_[pos_];
+      if (c == ' ' || c == '\r' || c == '\n' || c == '\t') {
+        ++pos_;
+      } else if (c == '/' && CharAt(pos_ + 1) == '/') {
+        size_t end = input_.find_first_of("\r\n", pos_);
+        pos_ = end == absl::string_view::npos ? input_.size() : end;
+      } else if (c == '/' && CharAt(pos_ + 1) == '*') {
+        size_t end = input_.find("*/", pos_ + 2);
+        if (end == absl::string_view::npos) {
+          // Not a comment; lexed as the division operator.
+          return;
+        }
+        pos_ = end + 2;
+      } else {
+        return;
+      }
+    }
+  }
+
+  // Advances past a quoted string or delimited identifier starting at pos_.
+  absl::Status ConsumeQuoted(char quote) {
+    const size_t start = pos_;
+    for (++pos_; pos_ < input_.size(); ++pos_) {
+      if (input_[pos_] == '\\') {
+        ++pos_;
+      } else if (input_[pos_] == quote) {
+        ++pos_;
+        return absl::OkStatus();
+      }
+    }
+    return InvalidArgumentError(
+        absl::StrCat("Syntax error at position ", start, ": unterminated ",
+                     quote == '\'' ? "string" : "delimited identifier"));
+  }
+
+  // Advances past the token starting at pos_ and returns its type.
+  absl::StatusOr<TokenType> NextToken() {
+    const char c = input_[pos_];
+
+    if (absl::ascii_isalpha(c) || c == '_') {
+      const size_t start = pos_;
+      while (absl::ascii_isalnum(CharAt(pos_)) || CharAt(pos_) == '_') {
+        ++pos_;
+      }
+      return IsKeyword(input_.substr(start, pos_ - start)) ? kSymbol
+                                                           : kIdentifier;
+    }
+
+    if (absl::ascii_isdigit(c)) {
+      while (absl::ascii_isdigit(CharAt(pos_))) {
+        ++pos_;
+      }
+      if (CharAt(pos_) == '.' && absl::ascii_isdigit(CharAt(pos_ + 1))) {
+        ++pos_;
+        while (absl::ascii_isdigit(CharAt(pos_))) {
+          ++pos_;
+        }
+      }
+      return kNumber;
+    }
+
+    switch (c) {
+      case '\'':
+        FHIR_RETURN_IF_ERROR(ConsumeQuoted('\''));
+        return kString;
+      case '`':
+        FHIR_RETURN_IF_ERROR(ConsumeQuoted('`'));
+        return kDelimitedIdentifier;
+      case '@':
+        return ConsumeDateOrTime();
+      case '$':
+        for (absl::string_view name : {"$this", "$index", "$total"}) {
+          if (input_.substr(pos_, name.size()) == name) {
+            pos_ += name.size();
+            return kSymbol;
+          }
+        }
+        break;
+      case '<':
+      case '>':
+        pos_ += CharAt(pos_ + 1) == '=' ? 2 : 1;
+        return kSymbol;
+      case '!':
+        if (CharAt(pos_ + 1) == '=' || CharAt(pos_ + 1) == '~') {
+          pos_ += 2;
+          return kSymbol;
+        }
+        break;
+      case '.':
+      case '[':
+      case ']':
+      case '(':
+      case ')':
+      case '{':
+      case '}':
+      case '+':
+      case '-':
+      case '*':
+      case '/':
+      case '&':
+      case '|':
+      case '=':
+      case '~':
+      case '%':
+      case ',':
+        ++pos_;
+        return kSymbol;
+      default:
+        break;
+    }
+
+    return InvalidArgumentError(absl::StrCat(
+        "Syntax error at position ", pos_, ": unexpected character '",
+        input_.substr(pos_, 1), "'"));
+  }
+
+  // Advances past a DATE, DATETIME or TIME token starting at pos_.
+  absl::StatusOr<TokenType> ConsumeDateOrTime() {
+    if (CharAt(pos_ + 1) == 'T') {
+      size_t time_length = MatchTimeFormat(pos_ + 2);
+      if (time_length > 0) {
+        pos_ += 2 + time_length;
+        return kTime;
+      }
+    }
+
+    size_t date_length = MatchDateFormat(pos_ + 1);
+    if (date_length == 0) {
+      return InvalidArgumentError(absl::StrCat(
+          "Syntax error at position ", pos_, ": malformed date or time"));
+    }
+    pos_ += 1 + date_length;
+
+    if (CharAt(pos_) != 'T') {
+      return kDate;
+    }
+    ++pos_;
+    size_t time_length = MatchTimeFormat(pos_);
+    if (time_length > 0) {
+      pos_ += time_length;
+      pos_ += MatchTimeZoneOffsetFormat(pos_);
+    }
+    return kDateTime;
+  }
+
+  const absl::string_view input_;
+  size_t pos_ = 0;
+};
+
+// Binding strength of the binary and polarity operators, from loosest to
+// tightest, in the order of the alternatives of the FhirPath.g4 expression
+// rule. Member invocation and indexing bind tighter than all of these.
+enum Precedence {
+  kNoPrecedence = 0,
+  kImpliesPrecedence,
+  kOrPrecedence,
+  kAndPrecedence,
+  kMembershipPrecedence,
+  kEqualityPrecedence,
+  kInequalityPrecedence,
+  kUnionPrecedence,
+  kTypePrecedence,
+  kAdditivePrecedence,
+  kMultiplicativePrecedence,
+  kPolarityPrecedence,
+};
+
+// Returns the precedence of the token as a binary operator, or kNoPrecedence
+// if it is not one.
+Precedence BinaryPrecedence(const Token& token) {
+  if (token.type != kSymbol) {
+    return kNoPrecedence;
+  }
+
+  const absl::string_view op = token.text;
+  if (op == "*" || op == "/" || op == "div" || op == "mod") {
+    return kMultiplicativePrecedence;
+  }
+  if (op == "+" || op == "-" || op == "&") {
+    return kAdditivePrecedence;
+  }
+  if (op == "is" || op == "as") {
+    return kTypePrecedence;
+  }
+  if (op == "|") {
+    return kUnionPrecedence;
+  }
+  if (op == "<=" || op == "<" || op == ">" || op == ">=") {
+    return kInequalityPrecedence;
+  }
+  if (op == "=" || op == "~" || op == "!=" || op == "!~") {
+    return kEqualityPrecedence;
+  }
+  if (op == "in" || op == "contains") {
+    return kMembershipPrecedence;
+  }
+  if (op == "and") {
+    return kAndPrecedence;
+  }
+  if (op == "or" || op == "xor") {
+    return kOrPrecedence;
+  }
+  if (op == "implies") {
+    return kImpliesPrecedence;
+  }
+  return kNoPrecedence;
+}
+
+// Strips the backticks from a delimited identifier.
+std::string IdentifierName(const Token& token) {
+  if (token.type == kDelimitedIdentifier) {
+    return std::string(token.text.substr(1, token.text.size() - 2));
+  }
+  return std::string(token.text);
+}
+
+// Limits the nesting of sub-expressions so malicious or malformed input
+// cannot exhaust the stack.
+constexpr int kMaxNestingDepth = 256;
+
+class Parser {
+ public:
+  explicit Parser(std::vector<Token> tokens) : tokens_(std::move(tokens)) {}
+
+  absl::StatusOr<std::unique_ptr<AstNode>> Parse() {
+    FHIR_ASSIGN_OR_RETURN(std::unique_ptr<AstNode> root,
+                          ParseExpression(kNoPrecedence));
+    if (Peek().type != kEndOfInput) {
+      return SyntaxError("extraneous input");
+    }
+    return root;
+  }
+
+ private:
+  const Token& Peek(size_t ahead = 0) const {
+    // The final token is always kEndOfInput.
+    return tokens_[std::min(pos_ + ahead, tokens_.size() - 1)];
+  }
+
+  bool PeekSymbol(absl::string_view symbol, size_t ahead = 0) const {
+    const Token& token = Peek(ahead);
+    return token.type == kSymbol && token.text == symbol;
+  }
+
+  // Returns true if the token is allowed by the identifier rule.
+  bool IsIdentifier(const Token& token) const {
+    return token.type == kIdentifier || token.type == kDelimitedIdentifier ||
+           (token.type == kSymbol &&
+            (token.text == "as" || token.text == "contains" ||
+             token.text == "in" || token.text == "is"));
+  }
+
+  absl::Status SyntaxError(absl::string_view message) const {
+    const Token& token = Peek();
+    return InvalidArgumentError(absl::StrCat(
+        "Syntax error at position ", token.position, ": ", message, " ",
+        token.type == kEndOfInput ? "at end of expression"
+                                  : absl::StrCat("'", token.text, "'")));
+  }
+
+  absl::Status Expect(absl::string_view symbol) {
+    if (!PeekSymbol(symbol)) {
+      return SyntaxError(absl::StrCat("expected '", symbol, "' but found"));
+    }
+    ++pos_;
+    return absl::OkStatus();
+  }
+
+  static std::unique_ptr<AstNode> MakeNode(AstNode::Kind kind) {
+    return absl::make_unique<AstNode>(kind);
+  }
+
+  // Parses an expression whose binary operators all bind at least as tightly
+  // as min_precedence.
+  absl::StatusOr<std::unique_ptr<AstNode>> ParseExpression(
+      Precedence min_precedence) {
+    if (++depth_ > kMaxNestingDepth) {
+      return SyntaxError("expression nested too deeply near");
+    }
+
+    FHIR_ASSIGN_OR_RETURN(std::unique_ptr<AstNode> left, ParsePrefix());
+
+    while (true) {
+      if (PeekSymbol(".")) {
+        ++pos_;
+        auto node = MakeNode(AstNode::kInvocationExpression);
+        node->children.push_back(std::move(left));
+        FHIR_ASSIGN_OR_RETURN(std::unique_ptr<AstNode> invocation,
+                              ParseInvocation());
+        node->children.push_back(std::move(invocation));
+        left = std::move(node);
+        continue;
+      }
+
+      if (PeekSymbol("[")) {
+        ++pos_;
+        auto node = MakeNode(AstNode::kIndexerExpression);
+        node->children.push_back(std::move(left));
+        FHIR_ASSIGN_OR_RETURN(std::unique_ptr<AstNode> index,
+                              ParseExpression(kNoPrecedence));
+        node->children.push_back(std::move(index));
+        FHIR_RETURN_IF_ERROR(Expect("]"));
+        left = std::move(node);
+        continue;
+      }
+
+      const Token& op = Peek();
+      const Precedence precedence = BinaryPrecedence(op);
+      if (precedence == kNoPrecedence || precedence < min_precedence) {
+        break;
+      }
+      ++pos_;
+
+      if (precedence == kTypePrecedence) {
+        auto node = MakeNode(AstNode::kTypeExpression);
+        node->op = std::string(op.text);
+        FHIR_ASSIGN_OR_RETURN(node->name, ParseQualifiedIdentifier());
+        node->children.push_back(std::move(left));
+        left = std::move(node);
+        continue;
+      }
+
+      // All binary operators are left associative, so the right operand may
+      // only contain operators that bind more tightly.
+      auto node = MakeNode(AstNode::kBinaryExpression);
+      node->op = std::string(op.text);
+      node->children.push_back(std::move(left));
+      FHIR_ASSIGN_OR_RETURN(
+          std::unique_ptr<AstNode> right,
+          ParseExpression(static_cast<Precedence>(precedence + 1)));
+      node->children.push_back(std::move(right));
+      left = std::move(node);
+    }
+
+    --depth_;
+    return left;
+  }
+
+  absl::StatusOr<std::unique_ptr<AstNode>> ParsePrefix() {
+    if (PeekSymbol("+") || PeekSymbol("-")) {
+      auto node = MakeNode(AstNode::kPolarityExpression);
+      node->op = std::string(Peek().text);
+      ++pos_;
+      FHIR_ASSIGN_OR_RETURN(std::unique_ptr<AstNode> operand,
+                            ParseExpression(kPolarityPrecedence));
+      node->children.push_back(std::move(operand));
+      return node;
+    }
+
+    return ParseTerm();
+  }
+
+  absl::StatusOr<std::unique_ptr<AstNode>> ParseTerm() {
+    const Token& token = Peek();
+    switch (token.type) {
+      case kString:
+        return ParseLiteral(AstNode::kStringLiteral);
+      case kDate:
+        return ParseLiteral(AstNode::kDateLiteral);
+      case kDateTime:
+        return ParseLiteral(AstNode::kDateTimeLiteral);
+      case kTime:
+        return ParseLiteral(AstNode::kTimeLiteral);
+      case kNumber: {
+        const Token& unit = Peek(1);
+        if (unit.type == kString ||
+            (unit.type == kSymbol && IsDateTimePrecision(unit.text))) {
+          auto node = ParseLiteral(AstNode::kQuantityLiteral);
+          node->name = std::string(unit.text);
+          ++pos_;
+          return node;
+        }
+        return ParseLiteral(AstNode::kNumberLiteral);
+      }
+      case kIdentifier:
+      case kDelimitedIdentifier:
+        return ParseInvocation();
+      case kSymbol:
+        break;
+      case kEndOfInput:
+        return SyntaxError("unexpected input");
+    }
+
+    if (token.text == "(") {
+      ++pos_;
+      FHIR_ASSIGN_OR_RETURN(std::unique_ptr<AstNode> expression,
+                            ParseExpression(kNoPrecedence));
+      FHIR_RETURN_IF_ERROR(Expect(")"));
+      return expression;
+    }
+
+    if (token.text == "{") {
+      auto node = MakeNode(AstNode::kNullLiteral);
+      node->text = "{}";
+      ++pos_;
+      FHIR_RETURN_IF_ERROR(Expect("}"));
+      return node;
+    }
+
+    if (token.text == "true" || token.text == "false") {
+      return ParseLiteral(AstNode::kBooleanLiteral);
+    }
+
+    if (token.text == "%") {
+      ++pos_;
+      const Token& name = Peek();
+      if (!IsIdentifier(name) && name.type != kString) {
+        return SyntaxError("expected external constant name but found");
+      }
+      auto node = MakeNode(AstNode::kExternalConstant);
+      node->name = name.type == kString
+                       ? std::string(name.text.substr(1, name.text.size() - 2))
+                       : IdentifierName(name);
+      ++pos_;
+      return node;
+    }
+
+    return ParseInvocation();
+  }
+
+  std::unique_ptr<AstNode> ParseLiteral(AstNode::Kind kind) {
+    auto node = MakeNode(kind);
+    node->text = std::string(Peek().text);
+    ++pos_;
+    return node;
+  }
+
+  absl::StatusOr<std::unique_ptr<AstNode>> ParseInvocation() {
+    const Token& token = Peek();
+    if (PeekSymbol("$this")) {
+      ++pos_;
+      return MakeNode(AstNode::kThisInvocation);
+    }
+    if (PeekSymbol("$index")) {
+      ++pos_;
+      return MakeNode(AstNode::kIndexInvocation);
+    }
+    if (PeekSymbol("$total")) {
+      ++pos_;
+      return MakeNode(AstNode::kTotalInvocation);
+    }
+    if (!IsIdentifier(token)) {
+      return SyntaxError("unexpected input");
+    }
+
+    const std::string name = IdentifierName(token);
+    ++pos_;
+    if (!PeekSymbol("(")) {
+      auto node = MakeNode(AstNode::kMemberInvocation);
+      node->name = name;
+      return node;
+    }
+    ++pos_;
+
+    auto node = MakeNode(AstNode::kFunctionInvocation);
+    node->name = name;
+    while (!PeekSymbol(")")) {
+      if (!node->children.empty()) {
+        FHIR_RETURN_IF_ERROR(Expect(","));
+      }
+      FHIR_ASSIGN_OR_RETURN(std::unique_ptr<AstNode> param,
+                            ParseExpression(kNoPrecedence));
+      node->children.push_back(std::move(param));
+    }
+    ++pos_;
+    return node;
+  }
+
+  // Parses a typeSpecifier, returning its dot-separated identifiers.
+  absl::StatusOr<std::string> ParseQualifiedIdentifier() {
+    if (!IsIdentifier(Peek())) {
+      return SyntaxError("expected type specifier but found");
+    }
+    std::string name = IdentifierName(Peek());
+    ++pos_;
+
+    // As in the generated parser, the loop over the qualifier is greedy, so
+    // "a is B.c" tests for type "B.c" rather than invoking "c" on the result.
+    while (PeekSymbol(".") && IsIdentifier(Peek(1))) {
+      absl::StrAppend(&name, ".", IdentifierName(Peek(1)));
+      pos_ += 2;
+    }
+    return name;
+  }
+
+  const std::vector<Token> tokens_;
+  size_t pos_ = 0;
+  int depth_ = 0;
+};
+
+void AppendDebugString(const AstNode& node, std::string* out) {
+  auto append_children = [&node, out]() {
+    for (const std::unique_ptr<AstNode>& child : node.children) {
+      out->push_back(' ');
+      AppendDebugString(*child, out);
+    }
+    out->push_back(')');
+  };
+
+  switch (node.kind) {
+    case AstNode::kInvocationExpression:
+      out->append("(.");
+      append_children();
+      return;
+    case AstNode::kIndexerExpression:
+      out->append("([]");
+      append_children();
+      return;
+    case AstNode::kPolarityExpression:
+    case AstNode::kBinaryExpression:
+      absl::StrAppend(out, "(", node.op);
+      append_children();
+      return;
+    case AstNode::kTypeExpression:
+      absl::StrAppend(out, "(", node.op, " ");
+      AppendDebugString(*node.children[0], out);
+      absl::StrAppend(out, " ", node.name, ")");
+      return;
+    case AstNode::kMemberInvocation:
+      absl::StrAppend(out, "(member ", node.name, ")");
+      return;
+    case AstNode::kFunctionInvocation:
+      absl::StrAppend(out, "(function ", node.name);
+      append_children();
+      return;
+    case AstNode::kThisInvocation:
+      out->append("$this");
+      return;
+    case AstNode::kIndexInvocation:
+      out->append("$index");
+      return;
+    case AstNode::kTotalInvocation:
+      out->append("$total");
+      return;
+    case AstNode::kNullLiteral:
+      out->append("(null)");
+      return;
+    case AstNode::kBooleanLiteral:
+      absl::StrAppend(out, "(boolean ", node.text, ")");
+      return;
+    case AstNode::kStringLiteral:
+      absl::StrAppend(out, "(string ", node.text, ")");
+      return;
+    case AstNode::kNumberLiteral:
+      absl::StrAppend(out, "(number ", node.text, ")");
+      return;
+    case AstNode::kDateLiteral:
+      absl::StrAppend(out, "(date ", node.text, ")");
+      return;
+    case AstNode::kDateTimeLiteral:
+      absl::StrAppend(out, "(datetime ", node.text, ")");
+      return;
+    case AstNode::kTimeLiteral:
+      absl::StrAppend(out, "(time ", node.text, ")");
+      return;
+    case AstNode::kQuantityLiteral:
+      absl::StrAppend(out, "(quantity ", node.text, " ", node.name, ")");
+      return;
+    case AstNode::kExternalConstant:
+      absl::StrAppend(out, "(% ", node.name, ")");
+      return;
+  }
+}
+
+}  // namespace
+
+std::string AstNode::DebugString() const {
+  std::string result;
+  AppendDebugString(*this, &result);
+  return result;
+}
+
+absl::StatusOr<std::unique_ptr<AstNode>> ParseFhirPath(
+    absl::string_view fhir_path) {
+  FHIR_ASSIGN_OR_RETURN(std::vector<Token> tokens,
+                        Lexer(fhir_path).Tokenize());
+  return Parser(std::move(tokens)).Parse();
+}
+
+}  // namespace internal
+}  // namespace fhir_path
+}  // namespace fhir
+}  // namespace google
@@ -0,0 +1,108 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GOOGLE_FHIR_FHIR_PATH_FHIR_PATH_PARSER_H_
+#define GOOGLE_FHIR_FHIR_PATH_FHIR_PATH_PARSER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "google/fhir/status/statusor.h"
+
+namespace google {
+namespace fhir {
+namespace fhir_path {
+namespace internal {
+
+// A node of the syntax tree of a FHIRPath expression. Each kind of node
+// corresponds to a labeled alternative of the FhirPath.g4 grammar.
+struct AstNode {
+  enum Kind {
+    // expression '.' invocation. Children are the expression and invocation.
+    kInvocationExpression,
+    // expression '[' expression ']'. Children are the collection and index.
+    kIndexerExpression,
+    // ('+' | '-') expression. The single child is the operand.
+    kPolarityExpression,
+    // Any of the binary operator expressions (multiplicative, additive, union,
+    // inequality, equality, membership, and, or, implies). Children are the
+    // left and right operands.
+    kBinaryExpression,
+    // expression ('is' | 'as') typeSpecifier. The single child is the operand
+    // and name holds the type specifier.
+    kTypeExpression,
+
+    kMemberInvocation,
+    // Children are the function parameters.
+    kFunctionInvocation,
+    kThisInvocation,
+    kIndexInvocation,
+    kTotalInvocation,
+
+    kNullLiteral,
+    kBooleanLiteral,
+    kStringLiteral,
+    kNumberLiteral,
+    kDateLiteral,
+    kDateTimeLiteral,
+    kTimeLiteral,
+    // The text holds the number and name holds the unit, if any.
+    kQuantityLiteral,
+
+    kExternalConstant,
+  };
+
+  explicit AstNode(Kind kind) : kind(kind) {}
+
+  // Returns an S-expression rendering of the tree rooted at this node. Two
+  // trees are identical if and only if their renderings are equal.
+  std::string DebugString() const;
+
+  const Kind kind;
+
+  // The operator of polarity, binary and type expressions, e.g. "+" or "and".
+  std::string op;
+
+  // The name of a member, function or external constant, the type specifier
+  // of a type expression or the unit of a quantity. Delimited identifiers
+  // appear without their surrounding backticks.
+  std::string name;
+
+  // The source text of a literal, e.g. "'foo'" or "@2020-01-01T". For
+  // quantities this is the number only.
+  std::string text;
+
+  std::vector<std::unique_ptr<AstNode>> children;
+};
+
+// Parses a FHIRPath expression according to the FhirPath.g4 grammar.
+//
+// This is a hand-written recursive-descent parser, using precedence climbing
+// for the binary operators. It produces the same trees as the ANTLR generated
+// parser (see antlr_fhir_path_parser.h) without that parser's adaptive
+// prediction and per-node allocations, which dominated compilation time.
+//
+// Returns an InvalidArgumentError if the expression is not syntactically
+// valid.
+absl::StatusOr<std::unique_ptr<AstNode>> ParseFhirPath(
+    absl::string_view fhir_path);
+
+}  // namespace internal
+}  // namespace fhir_path
+}  // namespace fhir
+}  // namespace google
+
+#endif  // GOOGLE_FHIR_FHIR_PATH_FHIR_PATH_PARSER_H_
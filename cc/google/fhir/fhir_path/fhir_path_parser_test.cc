@@ -0,0 +1,165 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "google/fhir/fhir_path/fhir_path_parser.h"
+
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "google/fhir/fhir_path/antlr_fhir_path_parser.h"
+
+namespace google {
+namespace fhir {
+namespace fhir_path {
+namespace internal {
+namespace {
+
+std::string Parse(const std::string& fhir_path) {
+  absl::StatusOr<std::unique_ptr<AstNode>> result = ParseFhirPath(fhir_path);
+  return result.ok() ? result.value()->DebugString()
+                     : result.status().ToString();
+}
+
+TEST(FhirPathParserTest, MatchesAntlrParser) {
+  const std::vector<std::string> expressions = {
+      // Invocations and indexers.
+      "name",
+      "name.given",
+      "Patient.name.given[0]",
+      "(name | address)[1].use",
+      "$this",
+      "$this.given",
+      "`weird name`.`div`",
+      "as.contains.in.is",
+      "trueValue.false",
+      // Functions.
+      "name.exists()",
+      "name.given.where($this = 'x').exists()",
+      "iif(active, name, address)",
+      "5.toString()",
+      "contains('a')",
+      "x.ofType(FHIR.Patient)",
+      "x.is(Patient)",
+      // Operator precedence and associativity.
+      "-1 + 2 * 3",
+      "-a.b",
+      "+a - -b",
+      "a - b - c",
+      "a div b mod c * d / e",
+      "a & b + c",
+      "a | b | c = d and e or f implies g",
+      "a implies b implies c",
+      "a xor b or c",
+      "a < b <= c > d >= e",
+      "a = b != c ~ d !~ e",
+      "a in b contains c",
+      "x is FHIR.Patient.name",
+      "a as B | c",
+      "a is B = true",
+      // Literals and external constants.
+      "{}",
+      "true and false",
+      "'a\\'b' & 'c\\\\d'",
+      "1.5 + 2",
+      "5 'mg'",
+      "5 days",
+      "10 millisecond",
+      "@2014",
+      "@2014-01",
+      "@2014-01-25",
+      "@2014T",
+      "@2014-01-25T14:30",
+      "@2014-01-25T14:30:14.559+07:00",
+      "@2014-01-25T14:30:14Z",
+      "@T12:30",
+      "@T12:30:59.123",
+      "%ucum",
+      "%`vs-foo`",
+      "%'ext-bar'",
+      "%context.name",
+      // Comments and whitespace.
+      "a /* comment */ + b // trailing",
+      "  a\n.\tb  ",
+      // Constraints in the style of the FHIR core definitions.
+      "name.exists() or telecom.exists() or address.exists() or "
+      "identifier.exists()",
+      "contact.all(name.exists() or telecom.exists() or address.exists())",
+      "reference.startsWith('#').not() or "
+      "(reference.substring(1).trace('url') in %rootResource.contained.id)",
+      "hasValue() or (children().count() > id.count())",
+      "(start.hasValue().not() or end.hasValue().not()) or (start <= end)",
+      "value.empty() or code!=component.code",
+      "where(type='composition').count() = 1 implies "
+      "entry.first().resource.is(Composition)",
+      "descendants().where($this is Reference).all(reference.exists())",
+  };
+
+  for (const std::string& expression : expressions) {
+    absl::StatusOr<std::unique_ptr<AstNode>> antlr =
+        ParseFhirPathWithAntlr(expression);
+    ASSERT_TRUE(antlr.ok()) << expression << ": " << antlr.status();
+    EXPECT_EQ(Parse(expression), antlr.value()->DebugString()) << expression;
+  }
+}
+
+TEST(FhirPathParserTest, DebugString) {
+  EXPECT_EQ(Parse("-1 + 2 * 3"),
+            "(+ (- (number 1)) (* (number 2) (number 3)))");
+  EXPECT_EQ(Parse("name.where($this = 'x')"),
+            "(. (member name) (function where (= $this (string 'x'))))");
+  EXPECT_EQ(Parse("x is FHIR.Patient"), "(is (member x) FHIR.Patient)");
+  EXPECT_EQ(Parse("5 'mg'"), "(quantity 5 'mg')");
+}
+
+TEST(FhirPathParserTest, SyntaxErrors) {
+  const std::vector<std::string> expressions = {
+      "",
+      "expression->not->valid",
+      "foo(",
+      "foo(a,)",
+      "1 2",
+      "a.",
+      "a[1",
+      "(a",
+      "a +",
+      "'unterminated",
+      "a is",
+      "%",
+      "{",
+      "a.5",
+  };
+
+  for (const std::string& expression : expressions) {
+    EXPECT_EQ(ParseFhirPath(expression).status().code(),
+              absl::StatusCode::kInvalidArgument)
+        << expression;
+    EXPECT_EQ(ParseFhirPathWithAntlr(expression).status().code(),
+              absl::StatusCode::kInvalidArgument)
+        << expression;
+  }
+}
+
+TEST(FhirPathParserTest, DeepNesting) {
+  std::string expression = std::string(10000, '(') + "a";
+  EXPECT_EQ(ParseFhirPath(expression).status().code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace fhir_path
+}  // namespace fhir
+}  // namespace google
@@ -27,6 +27,7 @@
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "absl/time/civil_time.h"
 #include "absl/time/time.h"
@@ -85,9 +86,12 @@ namespace {
 
 using ::absl::StatusCode;
 using ::google::protobuf::Message;
+using ::testing::ElementsAre;
 using ::testing::ElementsAreArray;
 using ::testing::Eq;
+using ::testing::HasSubstr;
 using ::testing::StrEq;
+using ::testing::UnorderedElementsAre;
 using ::testing::UnorderedElementsAreArray;
 using testutil::EqualsProto;
 
@@ -324,7 +328,142 @@ TYPED_TEST(FhirPathTest, TestMalformed) {
   auto expr = TestFixture::Compile(TypeParam::Encounter::descriptor(),
                                    "expression->not->valid");
 
-  EXPECT_THAT(expr, HasStatusCode(StatusCode::kInternal));
+  EXPECT_THAT(expr, HasStatusCode(StatusCode::kInvalidArgument));
+}
+
+TYPED_TEST(FhirPathTest, TestCompileCached) {
+  auto test_encounter = ValidEncounter<typename TypeParam::Encounter>();
+  const auto* primitive_handler = TypeParam::PrimitiveHandler::GetInstance();
+
+  CompiledExpression::CacheStats before = CompiledExpression::GetCacheStats();
+  FHIR_ASSERT_OK_AND_ASSIGN(
+      CompiledExpression first,
+      CompiledExpression::CompileCached(test_encounter.GetDescriptor(),
+                                        primitive_handler, "status.exists()"));
+  FHIR_ASSERT_OK_AND_ASSIGN(
+      CompiledExpression second,
+      CompiledExpression::CompileCached(test_encounter.GetDescriptor(),
+                                        primitive_handler, "status.exists()"));
+  CompiledExpression::CacheStats after = CompiledExpression::GetCacheStats();
+
+  EXPECT_EQ(after.hits + after.misses, before.hits + before.misses + 2);
+  EXPECT_GE(after.hits, before.hits + 1);
+  EXPECT_GE(after.size, 1);
+  EXPECT_THAT(first.Evaluate(test_encounter), EvalsToTrue());
+  EXPECT_THAT(second.Evaluate(test_encounter), EvalsToTrue());
+
+  // Errors are cached as well.
+  EXPECT_THAT(
+      CompiledExpression::CompileCached(test_encounter.GetDescriptor(),
+                                        primitive_handler, "expression->not"),
+      HasStatusCode(StatusCode::kInvalidArgument));
+  EXPECT_THAT(
+      CompiledExpression::CompileCached(test_encounter.GetDescriptor(),
+                                        primitive_handler, "expression->not"),
+      HasStatusCode(StatusCode::kInvalidArgument));
+}
+
+TYPED_TEST(FhirPathTest, TestProfile) {
+  auto test_encounter = ValidEncounter<typename TypeParam::Encounter>();
+  FHIR_ASSERT_OK_AND_ASSIGN(
+      CompiledExpression expression,
+      TestFixture::Compile(test_encounter.GetDescriptor(),
+                           "statusHistory.where(status = 'arrived').exists()"));
+
+  ExpressionProfile profile;
+  EXPECT_THAT(expression.Evaluate(test_encounter, {}, &profile),
+              EvalsToTrue());
+  EXPECT_THAT(expression.Evaluate(test_encounter, {}, &profile),
+              EvalsToTrue());
+
+  std::vector<std::string> labels;
+  for (const NodeProfile& node : profile.nodes()) {
+    labels.push_back(node.label);
+  }
+  EXPECT_THAT(labels, ElementsAreArray({".exists()", ".where()",
+                                        "statusHistory", "=", "status",
+                                        "'arrived'"}));
+
+  const std::vector<NodeProfile>& nodes = profile.nodes();
+  EXPECT_THAT(nodes[0].children, ElementsAreArray({1}));
+  EXPECT_THAT(nodes[1].children, ElementsAreArray({2, 3}));
+  EXPECT_EQ(nodes[0].invocations, 2);
+  EXPECT_EQ(nodes[0].output_size, 2);
+  EXPECT_GE(nodes[0].temporaries, 2);
+  EXPECT_EQ(nodes[2].output_size, 2);
+  EXPECT_EQ(nodes[2].return_type,
+            test_encounter.GetDescriptor()
+                ->FindFieldByName("status_history")
+                ->message_type());
+  EXPECT_EQ(nodes[3].invocations, 2);
+
+  EXPECT_THAT(profile.Explain(),
+              HasSubstr("  .where() -> " +
+                        nodes[2].return_type->full_name() +
+                        ": calls=2 in=4 out=2"));
+
+  // A profile only records evaluations of a single expression.
+  FHIR_ASSERT_OK_AND_ASSIGN(
+      CompiledExpression other,
+      TestFixture::Compile(test_encounter.GetDescriptor(), "status"));
+  EXPECT_THAT(other.Evaluate(test_encounter, {}, &profile),
+              HasStatusCode(StatusCode::kInvalidArgument));
+}
+
+TYPED_TEST(FhirPathTest, TestParameters) {
+  auto test_encounter = ValidEncounter<typename TypeParam::Encounter>();
+  const auto* primitive_handler = TypeParam::PrimitiveHandler::GetInstance();
+
+  FHIR_ASSERT_OK_AND_ASSIGN(
+      CompiledExpression expression,
+      CompiledExpression::Compile(
+          test_encounter.GetDescriptor(), primitive_handler, "id = %id",
+          {{"id", primitive_handler->StringDescriptor()}}));
+
+  std::unique_ptr<Message> matching_id(primitive_handler->NewString("123"));
+  std::unique_ptr<Message> other_id(primitive_handler->NewString("456"));
+  std::unique_ptr<Message> integer(primitive_handler->NewInteger(123));
+
+  EXPECT_THAT(
+      expression.Evaluate(test_encounter, {{"id", {matching_id.get()}}}),
+      EvalsToTrue());
+  EXPECT_THAT(expression.Evaluate(test_encounter, {{"id", {other_id.get()}}}),
+              EvalsToFalse());
+  EXPECT_THAT(expression.Evaluate(test_encounter, {{"id", {}}}),
+              EvalsToEmpty());
+
+  // Parameters must be bound to a value of the declared type.
+  EXPECT_THAT(expression.Evaluate(test_encounter),
+              HasStatusCode(StatusCode::kInvalidArgument));
+  EXPECT_THAT(expression.Evaluate(test_encounter, {{"id", {integer.get()}}}),
+              HasStatusCode(StatusCode::kInvalidArgument));
+
+  // Parameters are bound within the criteria of functions like where().
+  FHIR_ASSERT_OK_AND_ASSIGN(
+      CompiledExpression criteria,
+      CompiledExpression::Compile(
+          test_encounter.GetDescriptor(), primitive_handler,
+          "statusHistory.where(status = %status).exists()",
+          {{"status", primitive_handler->StringDescriptor()}}));
+  std::unique_ptr<Message> arrived(primitive_handler->NewString("arrived"));
+  std::unique_ptr<Message> finished(primitive_handler->NewString("finished"));
+  EXPECT_THAT(
+      criteria.Evaluate(test_encounter, {{"status", {arrived.get()}}}),
+      EvalsToTrue());
+  EXPECT_THAT(
+      criteria.Evaluate(test_encounter, {{"status", {finished.get()}}}),
+      EvalsToFalse());
+
+  // Only declared parameters may be referenced, and they may not shadow the
+  // predefined constants.
+  EXPECT_THAT(CompiledExpression::Compile(test_encounter.GetDescriptor(),
+                                          primitive_handler, "id = %other",
+                                          {{"id", nullptr}}),
+              HasStatusCode(StatusCode::kNotFound));
+  EXPECT_THAT(CompiledExpression::Compile(test_encounter.GetDescriptor(),
+                                          primitive_handler, "%context",
+                                          {{"context", nullptr}}),
+              HasStatusCode(StatusCode::kInvalidArgument));
 }
 
 TYPED_TEST(FhirPathTest, TestGetDirectChild) {
@@ -524,6 +663,161 @@ TYPED_TEST(FhirPathTest, TestFunctionDescendantsOnEmptyCollection) {
   EXPECT_THAT(TestFixture::Evaluate("{}.descendants()"), EvalsToEmpty());
 }
 
+TYPED_TEST(FhirPathTest, TestFunctionDescendantsOfType) {
+  auto structure_definition =
+      ParseFromString<typename TypeParam::StructureDefinition>(R"proto(
+        name { value: "foo" }
+        context_invariant { value: "bar" }
+        snapshot { element { label { value: "snapshot" } } }
+        differential { element { label { value: "differential" } } }
+      )proto");
+
+  EXPECT_THAT(
+      TestFixture::Evaluate(structure_definition,
+                            "descendants().ofType(ElementDefinition)")
+          .value()
+          .GetMessages(),
+      ElementsAreArray(
+          {EqualsProto(structure_definition.snapshot().element(0)),
+           EqualsProto(structure_definition.differential().element(0))}));
+
+  EXPECT_THAT(
+      TestFixture::Evaluate(structure_definition,
+                            "descendants().where($this is ElementDefinition)")
+          .value()
+          .GetMessages(),
+      ElementsAreArray(
+          {EqualsProto(structure_definition.snapshot().element(0)),
+           EqualsProto(structure_definition.differential().element(0))}));
+
+  EXPECT_THAT(
+      TestFixture::Evaluate(structure_definition,
+                            "descendants().ofType(string)")
+          .value()
+          .GetMessages(),
+      UnorderedElementsAreArray(
+          {EqualsProto(structure_definition.name()),
+           EqualsProto(structure_definition.context_invariant(0)),
+           EqualsProto(structure_definition.snapshot().element(0).label()),
+           EqualsProto(
+               structure_definition.differential().element(0).label())}));
+
+  EXPECT_THAT(TestFixture::Evaluate(structure_definition,
+                                    "descendants().ofType(Patient)"),
+              EvalsToEmpty());
+}
+
+TYPED_TEST(FhirPathTest, TestFunctionDescendantsOfTypeInContainedResources) {
+  auto bundle = ParseFromString<typename TypeParam::Bundle>(
+      R"proto(entry: {
+                resource: {
+                  patient: { deceased: { boolean: { value: true } } }
+                }
+              }
+              entry: {
+                resource: {
+                  bundle: {
+                    entry: {
+                      resource: {
+                        patient: { deceased: { boolean: { value: false } } }
+                      }
+                    }
+                  }
+                }
+              })proto");
+
+  EXPECT_THAT(
+      TestFixture::Evaluate(bundle, "descendants().ofType(Patient)")
+          .value()
+          .GetMessages(),
+      ElementsAreArray({EqualsProto(bundle.entry(0).resource().patient()),
+                        EqualsProto(bundle.entry(1)
+                                        .resource()
+                                        .bundle()
+                                        .entry(0)
+                                        .resource()
+                                        .patient())}));
+
+  EXPECT_THAT(
+      TestFixture::Evaluate(bundle,
+                            "descendants().ofType(Patient).deceased.count()"),
+      EvalsToInteger(2));
+}
+
+TEST(FhirPathTest, TestFunctionDescendantsOfTypeInAny) {
+  auto contained = ParseFromString<r4::core::ContainedResource>(
+      "observation { value: { string_value: { value: 'bar' } } } ");
+  auto patient = ParseFromString<r4::core::Patient>(
+      "deceased: { boolean: { value: true } }");
+  patient.add_contained()->PackFrom(contained);
+
+  EXPECT_THAT(
+      FhirPathTest<R4CoreTestEnv>::Evaluate(
+          patient, "descendants().ofType(Observation)")
+          .value()
+          .GetMessages(),
+      ElementsAreArray({EqualsProto(contained.observation())}));
+}
+
+TYPED_TEST(FhirPathTest, TestFunctionDescendantsWhere) {
+  auto structure_definition =
+      ParseFromString<typename TypeParam::StructureDefinition>(R"proto(
+        name { value: "foo" }
+        context_invariant { value: "bar" }
+        snapshot { element { label { value: "snapshot" } } }
+        differential { element { label { value: "differential" } } }
+      )proto");
+
+  EXPECT_THAT(
+      TestFixture::Evaluate(structure_definition,
+                            "descendants().where(label = 'differential')")
+          .value()
+          .GetMessages(),
+      ElementsAreArray(
+          {EqualsProto(structure_definition.differential().element(0))}));
+}
+
+TYPED_TEST(FhirPathTest, TestFunctionRepeat) {
+  auto bundle = ParseFromString<typename TypeParam::Bundle>(
+      R"proto(entry: {
+                resource: {
+                  patient: { deceased: { boolean: { value: true } } }
+                }
+              }
+              entry: {
+                resource: {
+                  bundle: {
+                    entry: {
+                      resource: {
+                        observation: {
+                          value: { string_value: { value: "bar" } }
+                        }
+                      }
+                    }
+                  }
+                }
+              })proto");
+
+  EXPECT_THAT(
+      TestFixture::Evaluate(bundle, "repeat(entry.resource)")
+          .value()
+          .GetMessages(),
+      UnorderedElementsAreArray(
+          {EqualsProto(bundle.entry(0).resource().patient()),
+           EqualsProto(bundle.entry(1).resource().bundle()),
+           EqualsProto(bundle.entry(1)
+                           .resource()
+                           .bundle()
+                           .entry(0)
+                           .resource()
+                           .observation())}));
+
+  EXPECT_THAT(TestFixture::Evaluate("{}.repeat(children())"), EvalsToEmpty());
+  EXPECT_THAT(TestFixture::Evaluate("true.repeat($this)"), EvalsToTrue());
+  EXPECT_THAT(TestFixture::Evaluate("repeat()"),
+              HasStatusCode(StatusCode::kInvalidArgument));
+}
+
 TYPED_TEST(FhirPathTest, TestFunctionContains) {
   // Wrong number and/or types of arguments.
   EXPECT_THAT(TestFixture::Evaluate("'foo'.contains()"),
@@ -1300,6 +1594,98 @@ TYPED_TEST(FhirPathTest, TestIsDistinct) {
               EvalsToFalse());
 }
 
+TYPED_TEST(FhirPathTest, TestDistinctObjects) {
+  auto test_observation = ValidObservation<typename TypeParam::Observation>();
+
+  EXPECT_THAT(
+      TestFixture::Evaluate(test_observation,
+                            "code.coding.combine(code.coding).isDistinct()"),
+      EvalsToFalse());
+
+  EvaluationResult evaluation_result =
+      TestFixture::Evaluate(test_observation,
+                            "code.coding.combine(code.coding).distinct()")
+          .value();
+  EXPECT_THAT(
+      evaluation_result.GetMessages(),
+      ElementsAreArray({EqualsProto(test_observation.code().coding(0))}));
+}
+
+TYPED_TEST(FhirPathTest, TestDistinctPreservesOrder) {
+  // Unlike a union, combine() keeps the duplicates for distinct() to remove.
+  const std::string duplicates =
+      "2.combine(1).combine(2).combine(3).combine(1)";
+  EXPECT_THAT(TestFixture::Evaluate(absl::StrCat(duplicates, ".count()")),
+              EvalsToInteger(5));
+  EvaluationResult evaluation_result =
+      TestFixture::Evaluate(absl::StrCat(duplicates, ".distinct()")).value();
+
+  auto integer_1_proto =
+      ParseFromString<typename TypeParam::Integer>("value: 1");
+  auto integer_2_proto =
+      ParseFromString<typename TypeParam::Integer>("value: 2");
+  auto integer_3_proto =
+      ParseFromString<typename TypeParam::Integer>("value: 3");
+  EXPECT_THAT(evaluation_result.GetMessages(),
+              ElementsAreArray({EqualsProto(integer_2_proto),
+                                EqualsProto(integer_1_proto),
+                                EqualsProto(integer_3_proto)}));
+}
+
+TYPED_TEST(FhirPathTest, TestUnionDeduplicationAcrossTypes) {
+  auto test_encounter = ValidEncounter<typename TypeParam::Encounter>();
+
+  // The status code and the string literal have equal JSON representations
+  // and are therefore the same element of the union.
+  EvaluationResult evaluation_result =
+      TestFixture::Evaluate(test_encounter, "status | 'triaged'").value();
+  EXPECT_THAT(evaluation_result.GetMessages(),
+              ElementsAreArray({EqualsProto(test_encounter.status())}));
+}
+
+TYPED_TEST(FhirPathTest, TestSubsetOf) {
+  EXPECT_THAT(TestFixture::Evaluate("{}.subsetOf({})"), EvalsToTrue());
+  EXPECT_THAT(TestFixture::Evaluate("{}.subsetOf(true)"), EvalsToTrue());
+  EXPECT_THAT(TestFixture::Evaluate("true.subsetOf({})"), EvalsToFalse());
+  EXPECT_THAT(TestFixture::Evaluate("true.subsetOf(true | false)"),
+              EvalsToTrue());
+  EXPECT_THAT(TestFixture::Evaluate("(1 | 2).subsetOf(1 | 2 | 3)"),
+              EvalsToTrue());
+  EXPECT_THAT(TestFixture::Evaluate("(1 | 4).subsetOf(1 | 2 | 3)"),
+              EvalsToFalse());
+}
+
+TYPED_TEST(FhirPathTest, TestSupersetOf) {
+  EXPECT_THAT(TestFixture::Evaluate("{}.supersetOf({})"), EvalsToTrue());
+  EXPECT_THAT(TestFixture::Evaluate("true.supersetOf({})"), EvalsToTrue());
+  EXPECT_THAT(TestFixture::Evaluate("{}.supersetOf(true)"), EvalsToFalse());
+  EXPECT_THAT(TestFixture::Evaluate("(1 | 2 | 3).supersetOf(3 | 1)"),
+              EvalsToTrue());
+  EXPECT_THAT(TestFixture::Evaluate("(1 | 2 | 3).supersetOf(1 | 4)"),
+              EvalsToFalse());
+}
+
+TYPED_TEST(FhirPathTest, TestExclude) {
+  EXPECT_THAT(TestFixture::Evaluate("{}.exclude({})"), EvalsToEmpty());
+  EXPECT_THAT(TestFixture::Evaluate("true.exclude({})"), EvalsToTrue());
+  EXPECT_THAT(TestFixture::Evaluate("true.exclude(true)"), EvalsToEmpty());
+  EXPECT_THAT(TestFixture::Evaluate("(true | false).exclude(false)"),
+              EvalsToTrue());
+
+  // Duplicates and order within the input collection are preserved.
+  auto integer_1_proto =
+      ParseFromString<typename TypeParam::Integer>("value: 1");
+  auto integer_3_proto =
+      ParseFromString<typename TypeParam::Integer>("value: 3");
+  EvaluationResult evaluation_result =
+      TestFixture::Evaluate("(3).combine(1).combine(2).combine(3).exclude(2)")
+          .value();
+  EXPECT_THAT(evaluation_result.GetMessages(),
+              ElementsAreArray({EqualsProto(integer_3_proto),
+                                EqualsProto(integer_1_proto),
+                                EqualsProto(integer_3_proto)}));
+}
+
 TYPED_TEST(FhirPathTest, TestIndexer) {
   EXPECT_THAT(TestFixture::Evaluate("true[0]"), EvalsToTrue());
   EXPECT_THAT(TestFixture::Evaluate("true[1]"), EvalsToEmpty());
@@ -2364,6 +2750,300 @@ TYPED_TEST(FhirPathTest, ResourceReference) {
                    EqualsProto(bundle)}));
 }
 
+// Resolves every reference to the same resource, counting the calls.
+class FixedReferenceResolver : public ReferenceResolver {
+ public:
+  explicit FixedReferenceResolver(const Message* resource)
+      : resource_(resource) {}
+
+  const Message* Resolve(absl::string_view reference) const override {
+    calls_++;
+    return resource_;
+  }
+
+  int calls() const { return calls_; }
+
+ private:
+  const Message* resource_;
+  mutable int calls_ = 0;
+};
+
+TYPED_TEST(FhirPathTest, ResolveInBundle) {
+  auto bundle = ParseFromString<typename TypeParam::Bundle>(
+      R"proto(entry: {
+                full_url: { value: "urn:uuid:5a8e4b4c" }
+                resource: {
+                  patient: {
+                    id: { value: "123" }
+                    deceased: { boolean: { value: true } }
+                  }
+                }
+              }
+              entry: {
+                resource: {
+                  observation: {
+                    subject: { patient_id: { value: "123" } }
+                    value: { string_value: { value: "foo" } }
+                  }
+                }
+              }
+              entry: {
+                resource: {
+                  observation: {
+                    subject: { uri: { value: "urn:uuid:5a8e4b4c" } }
+                    value: { string_value: { value: "bar" } }
+                  }
+                }
+              }
+              entry: {
+                resource: {
+                  observation: {
+                    subject: {
+                      patient_id: {
+                        value: "123"
+                        history: { value: "1" }
+                      }
+                    }
+                  }
+                }
+              }
+              entry: {
+                resource: {
+                  observation: {
+                    subject: { patient_id: { value: "456" } }
+                  }
+                }
+              })proto");
+
+  for (int i = 1; i < 4; ++i) {
+    EXPECT_THAT(
+        TestFixture::Evaluate(
+            bundle, absl::StrCat("entry[", i, "].resource.subject.resolve()"))
+            .value()
+            .GetMessages(),
+        ElementsAreArray({EqualsProto(bundle.entry(0).resource().patient())}));
+  }
+
+  EXPECT_THAT(
+      TestFixture::Evaluate(bundle, "entry[4].resource.subject.resolve()"),
+      EvalsToEmpty());
+  EXPECT_THAT(
+      TestFixture::Evaluate(
+          bundle, "entry.resource.subject.resolve().ofType(Patient).count()"),
+      EvalsToInteger(3));
+
+  // Without a Bundle at the root, references are only resolved by an explicit
+  // resolver.
+  const auto& observation = bundle.entry(1).resource().observation();
+  FHIR_ASSERT_OK_AND_ASSIGN(
+      CompiledExpression expression,
+      TestFixture::Compile(observation.GetDescriptor(),
+                           "subject.resolve().deceased"));
+  EXPECT_THAT(expression.Evaluate(observation), EvalsToEmpty());
+
+  BundleReferenceResolver resolver(bundle);
+  EXPECT_THAT(expression.Evaluate(observation, {}, resolver), EvalsToTrue());
+  EXPECT_THAT(
+      expression.Evaluate(bundle.entry(2).resource().observation(), {},
+                          resolver),
+      EvalsToTrue());
+
+  // The resolver is used within the criteria of functions like where().
+  FHIR_ASSERT_OK_AND_ASSIGN(
+      CompiledExpression criteria,
+      TestFixture::Compile(observation.GetDescriptor(),
+                           "subject.where(resolve().deceased).exists()"));
+  EXPECT_THAT(criteria.Evaluate(observation), EvalsToFalse());
+  EXPECT_THAT(criteria.Evaluate(observation, {}, resolver), EvalsToTrue());
+
+  FixedReferenceResolver fixed_resolver(&bundle.entry(0).resource().patient());
+  EXPECT_THAT(criteria.Evaluate(bundle.entry(4).resource().observation(), {},
+                                fixed_resolver),
+              EvalsToTrue());
+  EXPECT_EQ(fixed_resolver.calls(), 1);
+}
+
+TYPED_TEST(FhirPathTest, EvaluateBatchInBundles) {
+  // Each Bundle's references resolve to its own Patient.
+  std::vector<typename TypeParam::Bundle> bundles(10);
+  std::vector<const Message*> messages;
+  for (int i = 0; i < bundles.size(); i++) {
+    bundles[i] = ParseFromString<typename TypeParam::Bundle>(absl::StrCat(
+        R"proto(entry: {
+                  resource: {
+                    patient: {
+                      id: { value: "123" }
+                      deceased: { boolean: { value: )proto",
+        i % 2 == 0 ? "true" : "false", R"proto( } }
+                    }
+                  }
+                }
+                entry: {
+                  resource: {
+                    observation: {
+                      subject: { patient_id: { value: "123" } }
+                    }
+                  }
+                })proto"));
+    messages.push_back(&bundles[i]);
+  }
+
+  FHIR_ASSERT_OK_AND_ASSIGN(
+      CompiledExpression deceased,
+      TestFixture::Compile(
+          TypeParam::Bundle::descriptor(),
+          "entry.resource.ofType(Observation).subject"
+          ".where(resolve().exists()).resolve().deceased"));
+  for (int num_threads : {1, 4}) {
+    BatchOptions options;
+    options.num_threads = num_threads;
+    ResultColumn<bool> column;
+    deceased.EvaluateBatch(messages, &column, options);
+    ASSERT_EQ(column.size(), messages.size());
+    EXPECT_EQ(column.error_count, 0);
+    for (int i = 0; i < messages.size(); i++) {
+      SCOPED_TRACE(i);
+      EXPECT_FALSE(column.IsNull(i));
+      EXPECT_EQ(column.values[i], i % 2 == 0);
+    }
+  }
+}
+
+TYPED_TEST(FhirPathTest, ReadSet) {
+  const ::google::protobuf::Descriptor* descriptor =
+      TypeParam::Encounter::descriptor();
+  FHIR_ASSERT_OK_AND_ASSIGN(
+      CompiledExpression expression,
+      TestFixture::Compile(descriptor,
+                           "status = 'finished' and "
+                           "period.where(start.exists()).end.exists()"));
+  EXPECT_FALSE(expression.read_set().IsUnbounded());
+  EXPECT_THAT(expression.read_set().paths(),
+              ElementsAre("period.end", "period.start", "status"));
+  EXPECT_TRUE(expression.read_set().IsAffectedBy("period"));
+  EXPECT_TRUE(expression.read_set().IsAffectedBy("period.start.value_us"));
+  EXPECT_TRUE(expression.read_set().IsAffectedBy(""));
+  EXPECT_FALSE(expression.read_set().IsAffectedBy("period.id"));
+  EXPECT_FALSE(expression.read_set().IsAffectedBy("id"));
+  EXPECT_FALSE(expression.read_set().IsAffectedBy(
+      std::vector<std::string>({"id", "period.extension"})));
+
+  // Reading the whole context covers every field.
+  FHIR_ASSERT_OK_AND_ASSIGN(
+      CompiledExpression children,
+      TestFixture::Compile(descriptor, "children().count() > id.count()"));
+  EXPECT_THAT(children.read_set().paths(), ElementsAre(""));
+  EXPECT_TRUE(children.read_set().IsAffectedBy("period.id"));
+
+  FHIR_ASSERT_OK_AND_ASSIGN(
+      CompiledExpression resource,
+      TestFixture::Compile(descriptor, "%resource.id.exists()"));
+  EXPECT_TRUE(resource.read_set().IsUnbounded());
+  EXPECT_TRUE(resource.read_set().IsAffectedBy("period"));
+
+  // The results of select() depend on its input as a whole.
+  FHIR_ASSERT_OK_AND_ASSIGN(
+      CompiledExpression select,
+      TestFixture::Compile(descriptor, "statusHistory.select(true).count()"));
+  EXPECT_THAT(select.read_set().paths(), ElementsAre("status_history"));
+  EXPECT_TRUE(select.read_set().IsAffectedBy("status_history"));
+
+  FHIR_ASSERT_OK_AND_ASSIGN(CompiledExpression literal,
+                            TestFixture::Compile(descriptor, "1 + 1"));
+  EXPECT_THAT(literal.read_set().paths(), ElementsAre());
+  EXPECT_FALSE(literal.read_set().IsAffectedBy(""));
+}
+
+TYPED_TEST(FhirPathTest, ChangedFieldPaths) {
+  auto before = ValidEncounter<typename TypeParam::Encounter>();
+  auto after = before;
+  EXPECT_THAT(ChangedFieldPaths(before, after), ElementsAre());
+
+  after.mutable_id()->set_value("456");
+  after.mutable_period()->mutable_end()->set_value_us(1556750153000);
+  after.clear_status();
+  EXPECT_THAT(ChangedFieldPaths(before, after),
+              UnorderedElementsAre("id.value", "period.end", "status"));
+}
+
+TYPED_TEST(FhirPathTest, EvaluateBatch) {
+  const auto valid_encounter = ValidEncounter<typename TypeParam::Encounter>();
+  std::vector<typename TypeParam::Encounter> encounters(100);
+  std::vector<const Message*> messages;
+  for (int i = 0; i < encounters.size(); i++) {
+    if (i % 3 != 0) {
+      encounters[i] = valid_encounter;
+      encounters[i].mutable_id()->set_value(absl::StrCat(i));
+    }
+    if (i % 5 == 0) {
+      *encounters[i].add_status_history() = valid_encounter.status_history(0);
+      *encounters[i].add_status_history() = valid_encounter.status_history(0);
+    }
+    messages.push_back(&encounters[i]);
+  }
+
+  for (int num_threads : {1, 4}) {
+    BatchOptions options;
+    options.num_threads = num_threads;
+
+    FHIR_ASSERT_OK_AND_ASSIGN(
+        CompiledExpression exists,
+        TestFixture::Compile(TypeParam::Encounter::descriptor(),
+                             "period.exists()"));
+    ResultColumn<bool> exists_column;
+    exists.EvaluateBatch(messages, &exists_column, options);
+    ASSERT_EQ(exists_column.size(), messages.size());
+    EXPECT_EQ(exists_column.error_count, 0);
+
+    FHIR_ASSERT_OK_AND_ASSIGN(
+        CompiledExpression count,
+        TestFixture::Compile(TypeParam::Encounter::descriptor(),
+                             "statusHistory.count()"));
+    ResultColumn<int32_t> count_column;
+    count.EvaluateBatch(messages, &count_column, options);
+
+    // Every third encounter has no id.
+    FHIR_ASSERT_OK_AND_ASSIGN(
+        CompiledExpression id,
+        TestFixture::Compile(TypeParam::Encounter::descriptor(), "id"));
+    ResultColumn<std::string> id_column;
+    id.EvaluateBatch(messages, &id_column, options);
+    EXPECT_EQ(id_column.error_count, 0);
+
+    FHIR_ASSERT_OK_AND_ASSIGN(
+        CompiledExpression status,
+        TestFixture::Compile(TypeParam::Encounter::descriptor(),
+                             "statusHistory.status"));
+    // Multiple statuses cannot be converted to a single string.
+    ResultColumn<std::string> status_column;
+    status.EvaluateBatch(messages, &status_column, options);
+
+    int expected_errors = 0;
+    for (int i = 0; i < messages.size(); i++) {
+      SCOPED_TRACE(i);
+      EXPECT_FALSE(exists_column.IsNull(i));
+      EXPECT_EQ(exists_column.values[i], i % 3 != 0);
+
+      EXPECT_FALSE(count_column.IsNull(i));
+      EXPECT_EQ(count_column.values[i],
+                (i % 3 != 0 ? 1 : 0) + (i % 5 == 0 ? 2 : 0));
+
+      EXPECT_EQ(id_column.IsNull(i), i % 3 == 0);
+      EXPECT_EQ(id_column.values[i], i % 3 != 0 ? absl::StrCat(i) : "");
+
+      if (i % 5 == 0) {
+        EXPECT_TRUE(status_column.IsNull(i));
+        expected_errors++;
+      } else if (i % 3 != 0) {
+        EXPECT_FALSE(status_column.IsNull(i));
+        EXPECT_EQ(status_column.values[i], "arrived");
+      }
+    }
+    EXPECT_EQ(status_column.error_count, expected_errors);
+    EXPECT_FALSE(status_column.first_error.ok());
+  }
+}
+
 }  // namespace
 
 }  // namespace fhir_path
@@ -14,10 +14,14 @@
 
 #include "google/fhir/fhir_path/fhir_path_validation.h"
 
+#include <iterator>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include "google/protobuf/descriptor.h"
 #include "google/protobuf/util/message_differencer.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
 #include "absl/strings/match.h"
@@ -25,6 +29,8 @@
 #include "absl/types/optional.h"
 #include "google/fhir/annotations.h"
 #include "google/fhir/fhir_path/fhir_path.h"
+#include "google/fhir/fhir_path/native_constraint_registry.h"
+#include "google/fhir/parallel.h"
 #include "google/fhir/proto_util.h"
 #include "google/fhir/status/statusor.h"
 #include "proto/annotations.pb.h"
@@ -59,6 +65,34 @@ std::vector<ValidationResult> ValidationResults::Results() const {
 
 FhirPathValidator::~FhirPathValidator() {}
 
+FhirPathValidator::MessageConstraints* FhirPathValidator::GetConstraints(
+    const Descriptor* descriptor) {
+  // Cached constraints are never modified or removed, so concurrent
+  // validations only contend for the mutex when loading new message types.
+  {
+    absl::ReaderMutexLock lock(&mutex_);
+    auto iter = constraints_cache_.find(descriptor->full_name());
+    if (iter != constraints_cache_.end()) {
+      return iter->second.get();
+    }
+  }
+
+  // ConstraintsFor may recursively build constraints so
+  // we lock the mutex here to ensure thread safety.
+  absl::MutexLock lock(&mutex_);
+  return ConstraintsFor(descriptor);
+}
+
+void FhirPathValidator::LoadConstraints(const Descriptor* descriptor) {
+  GetConstraints(descriptor);
+}
+
+bool FhirPathValidator::HasLoadedConstraints(const Descriptor* descriptor) {
+  absl::ReaderMutexLock lock(&mutex_);
+  return constraints_cache_.find(descriptor->full_name()) !=
+         constraints_cache_.end();
+}
+
 // Build the constraints for the given message type and
 // add it to the constraints cache.
 FhirPathValidator::MessageConstraints* FhirPathValidator::ConstraintsFor(
@@ -87,12 +121,13 @@ FhirPathValidator::MessageConstraints* FhirPathValidator::ConstraintsFor(
         const std::string& fhir_path =
             field->options().GetExtension(proto::fhir_path_constraint, j);
 
-        auto constraint = CompiledExpression::Compile(
+        auto constraint = CompiledExpression::CompileCached(
             field_type, primitive_handler_, fhir_path);
 
         if (constraint.ok()) {
-          constraints->field_expressions.push_back(
-              std::make_pair(field, constraint.value()));
+          constraints->field_expressions.push_back(std::make_pair(
+              field, Constraint{constraint.value(),
+                                NativeConstraintFor(field_type, fhir_path)}));
         } else {
           LOG(WARNING) << "Ignoring field constraint on " << descriptor->name()
                        << "." << field_type->name() << " (" << fhir_path
@@ -135,6 +170,14 @@ FhirPathValidator::MessageConstraints* FhirPathValidator::ConstraintsFor(
   return constraints_local;
 }
 
+absl::optional<NativeConstraint> FhirPathValidator::NativeConstraintFor(
+    const Descriptor* descriptor, absl::string_view fhir_path) const {
+  if (!use_native_constraints_) {
+    return absl::nullopt;
+  }
+  return FindNativeConstraint(descriptor, fhir_path);
+}
+
 // Build the message constraints for the given message type and
 // add it to the constraints cache.
 void FhirPathValidator::AddMessageConstraints(const Descriptor* descriptor,
@@ -145,11 +188,11 @@ void FhirPathValidator::AddMessageConstraints(const Descriptor* descriptor,
   for (int i = 0; i < ext_size; ++i) {
     const std::string& fhir_path = descriptor->options().GetExtension(
         proto::fhir_path_message_constraint, i);
-    auto constraint =
-        CompiledExpression::Compile(descriptor, primitive_handler_, fhir_path);
+    auto constraint = CompiledExpression::CompileCached(
+        descriptor, primitive_handler_, fhir_path);
     if (constraint.ok()) {
-      CompiledExpression expression = constraint.value();
-      constraints->message_expressions.push_back(expression);
+      constraints->message_expressions.push_back(Constraint{
+          constraint.value(), NativeConstraintFor(descriptor, fhir_path)});
     } else {
       LOG(WARNING) << "Ignoring message constraint on " << descriptor->name()
                    << " (" << fhir_path << "). "
@@ -162,19 +205,102 @@ void FhirPathValidator::AddMessageConstraints(const Descriptor* descriptor,
   }
 }
 
-// Validates that the given message satisfies the given FHIRPath expression.
-ValidationResult ValidateConstraint(
+struct FhirPathValidator::Revalidation {
+  const std::vector<std::string>& changed_paths;
+
+  // The previous results of evaluating each constraint on each node, keyed by
+  // the node path and the constraint, in reverse order of evaluation.
+  absl::flat_hash_map<std::pair<std::string, std::string>,
+                      std::vector<const ValidationResult*>>
+      previous_results;
+};
+
+namespace {
+
+// Returns the path of the given field within the field at the given path.
+std::string FieldPath(absl::string_view parent, const FieldDescriptor* field) {
+  return parent.empty() ? field->name()
+                        : absl::StrCat(parent, ".", field->name());
+}
+
+// Returns true if changing the fields at changed_paths may change the result of
+// an expression with the given read set evaluated on the field at field_path.
+bool IsAffected(const ReadSet& read_set, absl::string_view field_path,
+                const std::vector<std::string>& changed_paths) {
+  if (read_set.IsUnbounded()) {
+    return !changed_paths.empty();
+  }
+
+  for (const std::string& changed_path : changed_paths) {
+    // The field the expression is evaluated on was replaced.
+    if (internal::IsWithinPath(field_path, changed_path)) {
+      return true;
+    }
+    if (!internal::IsWithinPath(changed_path, field_path)) {
+      continue;
+    }
+    absl::string_view relative_path = changed_path;
+    if (!field_path.empty()) {
+      relative_path.remove_prefix(field_path.size() + 1);
+    }
+    if (read_set.IsAffectedBy(relative_path)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+// Validates that the given message satisfies the given FHIRPath expression,
+// using its native implementation when there is one that applies.
+ValidationResult EvaluateConstraint(
     const absl::string_view constraint_parent_path,
     const absl::string_view node_parent_path,
     const internal::WorkspaceMessage& message,
-    const CompiledExpression& expression) {
-  absl::StatusOr<EvaluationResult> expr_result = expression.Evaluate(message);
+    const ReferenceResolver& reference_resolver,
+    const CompiledExpression& expression,
+    const absl::optional<NativeConstraint>& native) {
+  if (native.has_value() && native->AppliesTo(*message.Message())) {
+    return ValidationResult(std::string(constraint_parent_path),
+                            std::string(node_parent_path),
+                            expression.fhir_path(),
+                            native->function(*message.Message()));
+  }
+
+  static const ParameterBindings* no_bindings = new ParameterBindings();
+  absl::StatusOr<EvaluationResult> expr_result =
+      expression.Evaluate(message, *no_bindings, reference_resolver);
   return ValidationResult(std::string(constraint_parent_path),
                           std::string(node_parent_path), expression.fhir_path(),
                           expr_result.ok() ? expr_result.value().GetBoolean()
                                            : expr_result.status());
 }
 
+ValidationResult FhirPathValidator::ValidateConstraint(
+    absl::string_view constraint_path, absl::string_view node_path,
+    absl::string_view field_path, const internal::WorkspaceMessage& message,
+    const ReferenceResolver& reference_resolver, const Constraint& constraint,
+    Revalidation* revalidation) {
+  if (revalidation != nullptr) {
+    auto previous = revalidation->previous_results.find(std::make_pair(
+        std::string(node_path), constraint.expression.fhir_path()));
+    if (previous != revalidation->previous_results.end() &&
+        !previous->second.empty()) {
+      const ValidationResult* previous_result = previous->second.back();
+      previous->second.pop_back();
+      if (!IsAffected(constraint.expression.read_set(), field_path,
+                      revalidation->changed_paths)) {
+        return *previous_result;
+      }
+    }
+  }
+
+  return EvaluateConstraint(constraint_path, node_path, message,
+                            reference_resolver, constraint.expression,
+                            constraint.native);
+}
+
 std::string PathTerm(const Message& message, const FieldDescriptor* field) {
   return IsContainedResource(message) ||
                  IsChoiceTypeContainer(message.GetDescriptor())
@@ -182,59 +308,85 @@ std::string PathTerm(const Message& message, const FieldDescriptor* field) {
              : field->json_name();
 }
 
-void FhirPathValidator::Validate(absl::string_view constraint_path,
-                                 absl::string_view node_path,
-                                 const internal::WorkspaceMessage& message,
-                                 std::vector<ValidationResult>* results) {
-  // ConstraintsFor may recursively build constraints so
-  // we lock the mutex here to ensure thread safety.
-  mutex_.Lock();
-  MessageConstraints* constraints =
-      ConstraintsFor(message.Message()->GetDescriptor());
-  mutex_.Unlock();
-
-  // Validate the constraints attached to the message root.
-  for (const CompiledExpression& expr : constraints->message_expressions) {
-    results->push_back(
-        ValidateConstraint(constraint_path, node_path, message, expr));
-  }
+void FhirPathValidator::ForEachChild(
+    absl::string_view constraint_path, absl::string_view node_path,
+    absl::string_view field_path, const internal::WorkspaceMessage& message,
+    const MessageConstraints& constraints,
+    const std::function<void(ChildNode child)>& fn) {
+  const Message& proto = *message.Message();
 
-  // Validate the constraints attached to the message's fields.
-  for (const auto& expression : constraints->field_expressions) {
+  // The constraints attached to the message's fields.
+  for (const auto& expression : constraints.field_expressions) {
     const FieldDescriptor* field = expression.first;
-    const CompiledExpression& expr = expression.second;
-    const std::string path_term = PathTerm(*message.Message(), field);
-    const Message& proto = *message.Message();
+    const std::string path_term = PathTerm(proto, field);
+    const std::string child_field_path = FieldPath(field_path, field);
 
     for (int i = 0; i < PotentiallyRepeatedFieldSize(proto, field); i++) {
       const Message& child = GetPotentiallyRepeatedMessage(proto, field, i);
 
-      results->push_back(ValidateConstraint(
-          absl::StrCat(constraint_path, ".", path_term),
-          field->is_repeated()
-              ? absl::StrCat(node_path, ".", path_term, "[", i, "]")
-              : absl::StrCat(node_path, ".", path_term),
-          internal::WorkspaceMessage(message, &child), expr));
+      fn(ChildNode{absl::StrCat(constraint_path, ".", path_term),
+                   field->is_repeated()
+                       ? absl::StrCat(node_path, ".", path_term, "[", i, "]")
+                       : absl::StrCat(node_path, ".", path_term),
+                   child_field_path,
+                   internal::WorkspaceMessage(message, &child),
+                   &expression.second});
     }
   }
 
-  // Recursively validate constraints for nested messages that have them.
-  for (const FieldDescriptor* field : constraints->nested_with_constraints) {
-    const std::string path_term = PathTerm(*message.Message(), field);
-    const Message& proto = *message.Message();
+  // Nested messages that have constraints.
+  for (const FieldDescriptor* field : constraints.nested_with_constraints) {
+    const std::string path_term = PathTerm(proto, field);
+    const std::string child_field_path = FieldPath(field_path, field);
 
     for (int i = 0; i < PotentiallyRepeatedFieldSize(proto, field); i++) {
       const Message& child = GetPotentiallyRepeatedMessage(proto, field, i);
 
-      Validate(absl::StrCat(constraint_path, ".", path_term),
-               field->is_repeated()
-                   ? absl::StrCat(node_path, ".", path_term, "[", i, "]")
-                   : absl::StrCat(node_path, ".", path_term),
-               internal::WorkspaceMessage(message, &child), results);
+      fn(ChildNode{absl::StrCat(constraint_path, ".", path_term),
+                   field->is_repeated()
+                       ? absl::StrCat(node_path, ".", path_term, "[", i, "]")
+                       : absl::StrCat(node_path, ".", path_term),
+                   child_field_path,
+                   internal::WorkspaceMessage(message, &child), nullptr});
     }
   }
 }
 
+void FhirPathValidator::Validate(absl::string_view constraint_path,
+                                 absl::string_view node_path,
+                                 absl::string_view field_path,
+                                 const internal::WorkspaceMessage& message,
+                                 const ReferenceResolver& reference_resolver,
+                                 Revalidation* revalidation,
+                                 std::vector<ValidationResult>* results) {
+  MessageConstraints* constraints =
+      GetConstraints(message.Message()->GetDescriptor());
+
+  // Validate the constraints attached to the message root.
+  for (const Constraint& constraint : constraints->message_expressions) {
+    results->push_back(ValidateConstraint(constraint_path, node_path,
+                                          field_path, message,
+                                          reference_resolver, constraint,
+                                          revalidation));
+  }
+
+  // Validate the constraints attached to the message's fields and
+  // recursively validate constraints for nested messages that have them.
+  ForEachChild(constraint_path, node_path, field_path, message, *constraints,
+               [&](ChildNode child) {
+                 if (child.constraint != nullptr) {
+                   results->push_back(ValidateConstraint(
+                       child.constraint_path, child.node_path,
+                       child.field_path, child.message, reference_resolver,
+                       *child.constraint, revalidation));
+                 } else {
+                   Validate(child.constraint_path, child.node_path,
+                            child.field_path, child.message,
+                            reference_resolver, revalidation, results);
+                 }
+               });
+}
+
 absl::Status ValidationResults::LegacyValidationResult() const {
   if (IsValid(&ValidationResults::RelaxedValidationFn)) {
     return absl::OkStatus();
@@ -252,12 +404,104 @@ absl::Status ValidationResults::LegacyValidationResult() const {
 
 ValidationResults FhirPathValidator::Validate(
     const ::google::protobuf::Message& message) {
+  // References are resolved within the message, if it is a Bundle, which is
+  // indexed at most once for all of its constraints.
+  BundleReferenceResolver reference_resolver(message);
+  std::vector<ValidationResult> results;
+  Validate(message.GetDescriptor()->name(), message.GetDescriptor()->name(),
+           "", internal::WorkspaceMessage(&message), reference_resolver,
+           nullptr, &results);
+  return ValidationResults(results);
+}
+
+ValidationResults FhirPathValidator::Validate(const Message& message,
+                                              const BatchOptions& options) {
+  BundleReferenceResolver reference_resolver(message);
+  const std::string root_path = message.GetDescriptor()->name();
+  const internal::WorkspaceMessage root(&message);
+  MessageConstraints* constraints = GetConstraints(message.GetDescriptor());
+
+  std::vector<ValidationResult> results;
+  for (const Constraint& constraint : constraints->message_expressions) {
+    results.push_back(ValidateConstraint(root_path, root_path, "", root,
+                                         reference_resolver, constraint,
+                                         nullptr));
+  }
+
+  // The children are validated independently of each other into results of
+  // their own, which are then concatenated in the order of the sequential
+  // validation.
+  std::vector<ChildNode> children;
+  ForEachChild(root_path, root_path, "", root, *constraints,
+               [&](ChildNode child) { children.push_back(std::move(child)); });
+  std::vector<std::vector<ValidationResult>> child_results(children.size());
+  ParallelForEach(children.size(), options.num_threads, [&](size_t index) {
+    const ChildNode& child = children[index];
+    if (child.constraint != nullptr) {
+      child_results[index].push_back(ValidateConstraint(
+          child.constraint_path, child.node_path, child.field_path,
+          child.message, reference_resolver, *child.constraint, nullptr));
+    } else {
+      Validate(child.constraint_path, child.node_path, child.field_path,
+               child.message, reference_resolver, nullptr,
+               &child_results[index]);
+    }
+  });
+
+  for (std::vector<ValidationResult>& child_result : child_results) {
+    std::move(child_result.begin(), child_result.end(),
+              std::back_inserter(results));
+  }
+  return ValidationResults(std::move(results));
+}
+
+std::vector<ValidationResults> FhirPathValidator::ValidateAll(
+    absl::Span<const Message* const> messages, const BatchOptions& options) {
+  std::vector<std::vector<ValidationResult>> message_results(messages.size());
+  ParallelForEach(messages.size(), options.num_threads, [&](size_t index) {
+    const Message& message = *messages[index];
+    BundleReferenceResolver reference_resolver(message);
+    Validate(message.GetDescriptor()->name(), message.GetDescriptor()->name(),
+             "", internal::WorkspaceMessage(&message), reference_resolver,
+             nullptr, &message_results[index]);
+  });
+
+  std::vector<ValidationResults> results;
+  results.reserve(messages.size());
+  for (std::vector<ValidationResult>& message_result : message_results) {
+    results.emplace_back(std::move(message_result));
+  }
+  return results;
+}
+
+ValidationResults FhirPathValidator::Revalidate(
+    const Message& message, const ValidationResults& previous,
+    const std::vector<std::string>& changed_paths) {
+  const std::vector<ValidationResult> previous_results = previous.Results();
+  Revalidation revalidation{changed_paths, {}};
+  for (auto result = previous_results.rbegin();
+       result != previous_results.rend(); ++result) {
+    revalidation
+        .previous_results[std::make_pair(result->NodePath(),
+                                         result->Constraint())]
+        .push_back(&*result);
+  }
+
+  BundleReferenceResolver reference_resolver(message);
   std::vector<ValidationResult> results;
   Validate(message.GetDescriptor()->name(), message.GetDescriptor()->name(),
-           internal::WorkspaceMessage(&message), &results);
+           "", internal::WorkspaceMessage(&message), reference_resolver,
+           &revalidation, &results);
   return ValidationResults(results);
 }
 
+ValidationResults ValidateMessage(const PrimitiveHandler* primitive_handler,
+                                  const ::google::protobuf::Message& message) {
+  // Constraints are compiled with CompiledExpression::CompileCached, so a
+  // short-lived validator does not recompile expressions seen before.
+  return FhirPathValidator(primitive_handler).Validate(message);
+}
+
 }  // namespace fhir_path
 }  // namespace fhir
 }  // namespace google
@@ -16,12 +16,18 @@
 #define GOOGLE_FHIR_FHIR_PATH_FHIR_PATH_VALIDATION_H_
 
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "google/protobuf/message.h"
 #include "absl/base/macros.h"
+#include "absl/base/thread_annotations.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
 #include "google/fhir/annotations.h"
 #include "google/fhir/fhir_path/fhir_path.h"
+#include "google/fhir/fhir_path/native_constraint_registry.h"
 #include "google/fhir/primitive_handler.h"
 #include "google/fhir/status/statusor.h"
 
@@ -97,7 +103,7 @@ class ValidationResults {
   static bool RelaxedValidationFn(const ValidationResult& result);
 
   explicit ValidationResults(std::vector<ValidationResult> results)
-      : results_(results) {}
+      : results_(std::move(results)) {}
 
   // Returns true if all FHIRPath constraints on the particular resource satisfy
   // the provided validation function.
@@ -124,25 +130,76 @@ class ValidationResults {
 // constraint expressions as it encounters them, so users are encouraged
 // to create a single instance of this for the lifetime of the process.
 // This class is thread safe.
+//
+// Constraints with a native implementation (see native_constraint_registry.h)
+// are evaluated with it rather than with the FHIRPath interpreter.
 class FhirPathValidator {
  public:
-  FhirPathValidator(const PrimitiveHandler* primitive_handler)
-      : primitive_handler_(primitive_handler) {}
+  // If use_native_constraints is false, every constraint is evaluated with the
+  // FHIRPath interpreter, even those with a registered native implementation.
+  FhirPathValidator(const PrimitiveHandler* primitive_handler,
+                    bool use_native_constraints = true)
+      : primitive_handler_(primitive_handler),
+        use_native_constraints_(use_native_constraints) {}
   virtual ~FhirPathValidator();
 
   ABSL_MUST_USE_RESULT
   ValidationResults Validate(const ::google::protobuf::Message& message);
 
+  // Like Validate, but validates the children of the message, e.g. the
+  // entries of a Bundle, on up to options.num_threads threads. The results
+  // are the same and in the same order as those of Validate.
+  ABSL_MUST_USE_RESULT
+  ValidationResults Validate(const ::google::protobuf::Message& message,
+                             const BatchOptions& options);
+
+  // Validates each of the given messages independently of the others, on up to
+  // options.num_threads threads. Returns the results of each message in the
+  // order of the messages.
+  ABSL_MUST_USE_RESULT
+  std::vector<ValidationResults> ValidateAll(
+      absl::Span<const ::google::protobuf::Message* const> messages,
+      const BatchOptions& options = BatchOptions());
+
+  // Validates an updated version of a message given the results of validating
+  // the previous version, re-evaluating only the constraints whose read set
+  // (see CompiledExpression::read_set) is affected by the changes. The
+  // results of the other constraints are copied from the previous results.
+  //
+  // changed_paths holds the paths of the fields that changed, in the format
+  // of google.protobuf.FieldMask paths; see ChangedFieldPaths to compute them
+  // from the two versions of the message.
+  ABSL_MUST_USE_RESULT
+  ValidationResults Revalidate(const ::google::protobuf::Message& message,
+                               const ValidationResults& previous,
+                               const std::vector<std::string>& changed_paths);
+
+  // Compiles and caches the constraints of the given message type and of the
+  // message types it contains, without validating a message, so that later
+  // validations of these types only read the cache.
+  void LoadConstraints(const ::google::protobuf::Descriptor* descriptor);
+
+  // Returns true if the constraints of the given message type are cached,
+  // whether by LoadConstraints or by an earlier validation.
+  bool HasLoadedConstraints(const ::google::protobuf::Descriptor* descriptor);
+
  private:
+  // A compiled FHIRPath constraint along with its native implementation, if
+  // one has been registered.
+  struct Constraint {
+    CompiledExpression expression;
+    absl::optional<NativeConstraint> native;
+  };
+
   // A cache of constraints for a given message definition
   struct MessageConstraints {
     // FHIRPath constraints at the "root" FHIR element, which is just the
     // protobuf message.
-    std::vector<CompiledExpression> message_expressions;
+    std::vector<Constraint> message_expressions;
 
     // FHIRPath constraints on fields
     std::vector<
-        std::pair<const ::google::protobuf::FieldDescriptor*, const CompiledExpression>>
+        std::pair<const ::google::protobuf::FieldDescriptor*, const Constraint>>
         field_expressions;
 
     // Nested messages that have constraints, so the evaluation logic
@@ -150,23 +207,70 @@ class FhirPathValidator {
     std::vector<const ::google::protobuf::FieldDescriptor*> nested_with_constraints;
   };
 
+  // Returns the constraints for the given descriptor, loading them if they
+  // are not cached yet.
+  MessageConstraints* GetConstraints(const ::google::protobuf::Descriptor* descriptor);
+
   // Loads constraints for the given descriptor.
-  MessageConstraints* ConstraintsFor(const ::google::protobuf::Descriptor* descriptor);
+  MessageConstraints* ConstraintsFor(const ::google::protobuf::Descriptor* descriptor)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Returns the native implementation of the constraint fhir_path on the
+  // given message type, or absl::nullopt if there is none or native
+  // constraints are disabled.
+  absl::optional<NativeConstraint> NativeConstraintFor(
+      const ::google::protobuf::Descriptor* descriptor,
+      absl::string_view fhir_path) const;
 
   // Adds message-level constraints
   void AddMessageConstraints(const ::google::protobuf::Descriptor* descriptor,
                              MessageConstraints* constraints);
 
+  // The previous results and changed fields of a call to Revalidate.
+  struct Revalidation;
+
+  // A child of a message being validated, along with the constraint to
+  // evaluate on it, or nullptr if the child is to be validated recursively.
+  struct ChildNode {
+    std::string constraint_path;
+    std::string node_path;
+    std::string field_path;
+    internal::WorkspaceMessage message;
+    const Constraint* constraint;
+  };
+
+  // Calls fn for each child of the message that has constraints, in the order
+  // in which Validate evaluates them.
+  static void ForEachChild(absl::string_view constraint_path,
+                           absl::string_view node_path,
+                           absl::string_view field_path,
+                           const internal::WorkspaceMessage& message,
+                           const MessageConstraints& constraints,
+                           const std::function<void(ChildNode child)>& fn);
+
   // Recursively called validation method that aggregates results into the
-  // provided vector.
+  // provided vector. field_path is the path of the message's field from the
+  // root of the validation, in the format of ReadSet::paths().
   void Validate(absl::string_view constraint_path, absl::string_view node_path,
+                absl::string_view field_path,
                 const internal::WorkspaceMessage& message,
+                const ReferenceResolver& reference_resolver,
+                Revalidation* revalidation,
                 std::vector<ValidationResult>* results);
 
+  // Validates the constraint on the given message, or returns its previous
+  // result if revalidating and no changed field affects it.
+  static ValidationResult ValidateConstraint(
+      absl::string_view constraint_path, absl::string_view node_path,
+      absl::string_view field_path, const internal::WorkspaceMessage& message,
+      const ReferenceResolver& reference_resolver,
+      const Constraint& constraint, Revalidation* revalidation);
+
   const PrimitiveHandler* primitive_handler_;
+  const bool use_native_constraints_;
   absl::Mutex mutex_;
   std::unordered_map<std::string, std::unique_ptr<MessageConstraints>>
-      constraints_cache_;
+      constraints_cache_ ABSL_GUARDED_BY(mutex_);
 };
 
 // Validates the fhir_path_constraint annotations on the given message.
@@ -17,14 +17,18 @@
 #include <ostream>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "google/protobuf/message.h"
 #include "google/protobuf/text_format.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "google/fhir/fhir_path/native_constraint_registry.h"
 #include "google/fhir/fhir_path/r4_fhir_path_validation.h"
 #include "google/fhir/fhir_path/stu3_fhir_path_validation.h"
+#include "google/fhir/r4/primitive_handler.h"
 #include "google/fhir/status/statusor.h"
 #include "google/fhir/testutil/fhir_test_env.h"
 #include "proto/r4/core/datatypes.pb.h"
@@ -65,6 +69,8 @@ namespace {
 
 using ::testing::AllOf;
 using ::testing::Contains;
+using ::testing::ElementsAre;
+using ::testing::ElementsAreArray;
 using ::testing::Eq;
 using ::testing::IsSupersetOf;
 using ::testing::Property;
@@ -188,6 +194,78 @@ TYPED_TEST(FhirPathValidationTest, ConstraintViolationResultPaths) {
                           StrEq("Bundle.entry[0]")))}));
 }
 
+// Returns the node path, constraint and outcome of each result, in order.
+std::vector<std::string> ResultSummaries(const ValidationResults& results) {
+  std::vector<std::string> summaries;
+  for (const ValidationResult& result : results.Results()) {
+    summaries.push_back(absl::StrCat(
+        result.NodePath(), " ", result.Constraint(), " ",
+        result.EvaluationResult().ok()
+            ? (result.EvaluationResult().value() ? "true" : "false")
+            : result.EvaluationResult().status().ToString()));
+  }
+  return summaries;
+}
+
+TYPED_TEST(FhirPathValidationTest, ParallelValidationMatchesSequential) {
+  auto bundle = ParseFromString<typename TypeParam::Bundle>(
+      R"proto(entry: {
+                resource: {
+                  organization: { telecom: { use: { value: HOME } } }
+                }
+              }
+              entry: {}
+              entry: {
+                resource: {
+                  organization: { telecom: { use: { value: WORK } } }
+                }
+              }
+              entry: {
+                resource: {
+                  organization: {
+                    telecom: { use: { value: WORK } }
+                    telecom: { use: { value: HOME } }
+                  }
+                }
+              })proto");
+
+  typename TypeParam::FhirPathValidator validator;
+  ValidationResults sequential = validator.Validate(bundle);
+  for (int num_threads : {1, 2, 8}) {
+    BatchOptions options;
+    options.num_threads = num_threads;
+    EXPECT_THAT(ResultSummaries(validator.Validate(bundle, options)),
+                ElementsAreArray(ResultSummaries(sequential)));
+  }
+}
+
+TYPED_TEST(FhirPathValidationTest, ValidateAll) {
+  auto valid = ParseFromString<typename TypeParam::Organization>(
+      R"proto(
+        name: { value: 'myorg' }
+        telecom: { use: { value: WORK } }
+      )proto");
+  auto invalid = ParseFromString<typename TypeParam::Organization>(
+      R"proto(
+        name: { value: 'myorg' }
+        telecom: { use: { value: HOME } }
+      )proto");
+
+  BatchOptions options;
+  options.num_threads = 2;
+  std::vector<ValidationResults> results =
+      typename TypeParam::FhirPathValidator().ValidateAll(
+          {&valid, &invalid, &valid}, options);
+
+  ASSERT_EQ(results.size(), 3);
+  EXPECT_TRUE(results[0].IsValid());
+  EXPECT_FALSE(results[1].IsValid());
+  EXPECT_TRUE(results[2].IsValid());
+  EXPECT_THAT(
+      ResultSummaries(results[1]),
+      ElementsAreArray(ResultSummaries(TestFixture::Validate(invalid))));
+}
+
 TYPED_TEST(FhirPathValidationTest, ConstraintSatisfied) {
   auto observation = ValidObservation<typename TypeParam::Observation>();
 
@@ -272,6 +350,54 @@ TEST(FhirPathValidationTest, MessageLevelConstraintViolated) {
       r4::FhirPathValidator().Validate(end_before_start_period).IsValid());
 }
 
+TEST(FhirPathValidationTest, ValidateMessage) {
+  auto end_before_start_period = ParseFromString<r4::core::Period>(R"proto(
+    start: { value_us: 1556750153000000 timezone: "America/Los_Angeles" }
+    end: { value_us: 1556750000000000 timezone: "America/Los_Angeles" }
+  )proto");
+
+  // The second call reuses the constraints compiled by the first.
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_FALSE(ValidateMessage(r4::R4PrimitiveHandler::GetInstance(),
+                                 end_before_start_period)
+                     .IsValid());
+  }
+}
+
+int native_contains_constraint_calls = 0;
+
+bool NativeContainsConstraint(const ::google::protobuf::Message& message) {
+  ++native_contains_constraint_calls;
+  const auto& contains =
+      static_cast<const stu3::proto::ValueSet::Expansion::Contains&>(message);
+  return contains.has_code() || contains.has_display();
+}
+
+TEST(FhirPathValidationTest, NativeConstraint) {
+  ASSERT_TRUE(RegisterNativeConstraint(
+      stu3::proto::ValueSet::Expansion::Contains::default_instance(),
+      "code.exists() or display.exists()", &NativeContainsConstraint));
+
+  auto value_set = ValidValueSet<stu3::proto::ValueSet>();
+  value_set.mutable_name()->set_value("Placeholder");
+  value_set.mutable_expansion()->add_contains();
+  value_set.mutable_expansion()->add_contains()->mutable_display()->set_value(
+      "Placeholder value");
+
+  ValidationResults results = stu3::FhirPathValidator().Validate(value_set);
+  EXPECT_EQ(native_contains_constraint_calls, 2);
+  EXPECT_FALSE(results.IsValid());
+  EXPECT_THAT(
+      results.Results(),
+      Contains(AllOf(
+          Property(&ValidationResult::Constraint,
+                   StrEq("code.exists() or display.exists()")),
+          Property(&ValidationResult::NodePath,
+                   StrEq("ValueSet.expansion.contains[0]")),
+          ResultOf([](auto x) { return x.EvaluationResult().value(); },
+                   Eq(false)))));
+}
+
 TYPED_TEST(FhirPathValidationTest, NestedMessageLevelConstraint) {
   auto start_with_no_end_encounter =
       ParseFromString<typename TypeParam::Encounter>(R"proto(
@@ -299,6 +425,35 @@ TEST(FhirPathValidationTest, NestedMessageLevelConstraintViolated) {
       r4::FhirPathValidator().Validate(end_before_start_encounter).IsValid());
 }
 
+TEST(FhirPathValidationTest, RevalidateReusesUnaffectedResults) {
+  auto encounter = ParseFromString<r4::core::Encounter>(R"proto(
+    status { value: TRIAGED }
+    id { value: "123" }
+    period {
+      start: { value_us: 1556750153000000 timezone: "America/Los_Angeles" }
+      end: { value_us: 1556750000000000 timezone: "America/Los_Angeles" }
+    }
+  )proto");
+
+  r4::FhirPathValidator validator;
+  ValidationResults results = validator.Validate(encounter);
+  EXPECT_FALSE(results.IsValid());
+
+  r4::core::Encounter updated = encounter;
+  updated.mutable_period()->clear_end();
+  std::vector<std::string> changed_paths =
+      ChangedFieldPaths(encounter, updated);
+  EXPECT_THAT(changed_paths, ElementsAre("period.end"));
+  EXPECT_TRUE(
+      validator.Revalidate(updated, results, changed_paths).IsValid());
+
+  // Results of constraints that do not read the changed fields are reused,
+  // even if they are stale.
+  EXPECT_FALSE(validator.Revalidate(updated, results, {"status"}).IsValid());
+  EXPECT_EQ(validator.Revalidate(updated, results, {"status"}).Results().size(),
+            results.Results().size());
+}
+
 // TODO: Templatize tests to work with both STU3 and R4
 TEST(FhirPathValidationTest, ProfiledEmptyExtension) {
   r4::uscore::USCorePatientProfile patient =
@@ -0,0 +1,75 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "google/fhir/fhir_path/native_constraint_registry.h"
+
+#include <string>
+#include <utility>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+
+namespace google {
+namespace fhir {
+namespace fhir_path {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::Message;
+
+namespace {
+
+using ConstraintKey = std::pair<const Descriptor*, std::string>;
+
+struct Registry {
+  absl::Mutex mutex;
+  absl::flat_hash_map<ConstraintKey, NativeConstraint> constraints
+      ABSL_GUARDED_BY(mutex);
+};
+
+// Registrations happen during static initialization, so the registry is
+// created on first use and never destroyed.
+Registry& GetRegistry() {
+  static Registry* registry = new Registry();
+  return *registry;
+}
+
+}  // namespace
+
+bool RegisterNativeConstraint(const Message& prototype,
+                              absl::string_view fhir_path,
+                              NativeConstraint::Function function) {
+  Registry& registry = GetRegistry();
+  absl::MutexLock lock(&registry.mutex);
+  registry.constraints.emplace(
+      ConstraintKey(prototype.GetDescriptor(), std::string(fhir_path)),
+      NativeConstraint{prototype.GetReflection(), function});
+  return true;
+}
+
+absl::optional<NativeConstraint> FindNativeConstraint(
+    const Descriptor* descriptor, absl::string_view fhir_path) {
+  Registry& registry = GetRegistry();
+  absl::MutexLock lock(&registry.mutex);
+  auto iter = registry.constraints.find(
+      ConstraintKey(descriptor, std::string(fhir_path)));
+  if (iter == registry.constraints.end()) {
+    return absl::nullopt;
+  }
+  return iter->second;
+}
+
+}  // namespace fhir_path
+}  // namespace fhir
+}  // namespace google
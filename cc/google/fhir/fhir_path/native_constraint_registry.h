@@ -0,0 +1,66 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GOOGLE_FHIR_FHIR_PATH_NATIVE_CONSTRAINT_REGISTRY_H_
+#define GOOGLE_FHIR_FHIR_PATH_NATIVE_CONSTRAINT_REGISTRY_H_
+
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/message.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+
+namespace google {
+namespace fhir {
+namespace fhir_path {
+
+// A FHIRPath constraint that has been translated ahead of time into C++ that
+// uses the generated accessors of a message class (see
+// fhir_path_constraint_generator.h).
+struct NativeConstraint {
+  // Returns true if the constraint is satisfied by the given message, which
+  // must be an instance of the generated class the function was registered
+  // for.
+  using Function = bool (*)(const ::google::protobuf::Message&);
+
+  // Returns true if the function can be applied to the given message. This is
+  // not the case for messages of the same type that are not instances of the
+  // generated class, e.g. DynamicMessages.
+  bool AppliesTo(const ::google::protobuf::Message& message) const {
+    return message.GetReflection() == reflection;
+  }
+
+  const ::google::protobuf::Reflection* reflection;
+  Function function;
+};
+
+// Registers the native implementation of the FHIRPath constraint fhir_path on
+// messages of the prototype's type. Only the first registration of a given
+// constraint takes effect.
+//
+// Returns true so that generated code may register constraints from the
+// initializers of namespace scope variables.
+bool RegisterNativeConstraint(const ::google::protobuf::Message& prototype,
+                              absl::string_view fhir_path,
+                              NativeConstraint::Function function);
+
+// Returns the native implementation of the FHIRPath constraint fhir_path on
+// messages of the given type or absl::nullopt if none has been registered.
+absl::optional<NativeConstraint> FindNativeConstraint(
+    const ::google::protobuf::Descriptor* descriptor, absl::string_view fhir_path);
+
+}  // namespace fhir_path
+}  // namespace fhir
+}  // namespace google
+
+#endif  // GOOGLE_FHIR_FHIR_PATH_NATIVE_CONSTRAINT_REGISTRY_H_
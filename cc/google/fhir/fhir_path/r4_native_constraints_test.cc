@@ -0,0 +1,184 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Checks the constraints generated into r4_native_constraints, which this test
+// links, against the FHIRPath interpreter.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/message.h"
+#include "google/protobuf/text_format.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "google/fhir/fhir_path/fhir_path_validation.h"
+#include "google/fhir/fhir_path/native_constraint_registry.h"
+#include "google/fhir/r4/primitive_handler.h"
+#include "proto/r4/core/resources/bundle_and_contained_resource.pb.h"
+#include "proto/r4/core/resources/patient.pb.h"
+
+namespace google {
+namespace fhir {
+namespace fhir_path {
+namespace {
+
+using ::google::protobuf::Message;
+using ::testing::AllOf;
+using ::testing::Contains;
+using ::testing::Eq;
+using ::testing::Property;
+using ::testing::ResultOf;
+using ::testing::StrEq;
+
+constexpr char kContactConstraint[] =
+    "name.exists() or telecom.exists() or address.exists() or "
+    "organization.exists()";
+constexpr char kContactPointConstraint[] = "value.empty() or system.exists()";
+constexpr char kAttachmentConstraint[] =
+    "data.empty() or contentType.exists()";
+
+r4::core::Patient ParsePatient(const std::string& text) {
+  r4::core::Patient patient;
+  EXPECT_TRUE(::google::protobuf::TextFormat::ParseFromString(text, &patient));
+  return patient;
+}
+
+r4::core::Patient ValidPatient() {
+  return ParsePatient(R"proto(
+    id { value: "1" }
+    contact { name { family { value: "Doe" } } }
+    telecom {
+      system { value: PHONE }
+      value { value: "555-0100" }
+    }
+    photo {
+      content_type { value: "image/png" }
+      data { value: "AAAA" }
+    }
+  )proto");
+}
+
+r4::core::Patient InvalidPatient() {
+  return ParsePatient(R"proto(
+    id { value: "2" }
+    contact { gender { value: FEMALE } }
+    telecom { value { value: "555-0100" } }
+    photo { data { value: "AAAA" } }
+  )proto");
+}
+
+// Validates the message with the native constraints and with the interpreter
+// alone, expects the same results from both and returns them.
+ValidationResults ValidateBothWays(const Message& message) {
+  FhirPathValidator native_validator(r4::R4PrimitiveHandler::GetInstance());
+  FhirPathValidator interpreted_validator(
+      r4::R4PrimitiveHandler::GetInstance(),
+      /*use_native_constraints=*/false);
+  ValidationResults results = native_validator.Validate(message);
+  const std::vector<ValidationResult> native = results.Results();
+  const std::vector<ValidationResult> interpreted =
+      interpreted_validator.Validate(message).Results();
+
+  EXPECT_EQ(native.size(), interpreted.size());
+  for (size_t i = 0; i < std::min(native.size(), interpreted.size()); i++) {
+    SCOPED_TRACE(interpreted[i].Constraint());
+    EXPECT_EQ(native[i].ConstraintPath(), interpreted[i].ConstraintPath());
+    EXPECT_EQ(native[i].NodePath(), interpreted[i].NodePath());
+    EXPECT_EQ(native[i].Constraint(), interpreted[i].Constraint());
+    EXPECT_EQ(native[i].EvaluationResult().ok(),
+              interpreted[i].EvaluationResult().ok());
+    if (native[i].EvaluationResult().ok() &&
+        interpreted[i].EvaluationResult().ok()) {
+      EXPECT_EQ(native[i].EvaluationResult().value(),
+                interpreted[i].EvaluationResult().value());
+    }
+  }
+  return results;
+}
+
+::testing::Matcher<ValidationResult> Evaluated(const std::string& node_path,
+                                               const std::string& constraint,
+                                               bool value) {
+  return AllOf(
+      Property(&ValidationResult::NodePath, StrEq(node_path)),
+      Property(&ValidationResult::Constraint, StrEq(constraint)),
+      ResultOf(
+          [](const ValidationResult& result) {
+            return result.EvaluationResult().ok() &&
+                   result.EvaluationResult().value();
+          },
+          Eq(value)));
+}
+
+TEST(R4NativeConstraintsTest, Registered) {
+  EXPECT_TRUE(FindNativeConstraint(r4::core::Patient::Contact::descriptor(),
+                                   kContactConstraint)
+                  .has_value());
+  EXPECT_TRUE(FindNativeConstraint(r4::core::ContactPoint::descriptor(),
+                                   kContactPointConstraint)
+                  .has_value());
+  EXPECT_TRUE(FindNativeConstraint(r4::core::Attachment::descriptor(),
+                                   kAttachmentConstraint)
+                  .has_value());
+}
+
+TEST(R4NativeConstraintsTest, ValidResource) {
+  ValidationResults results = ValidateBothWays(ValidPatient());
+
+  EXPECT_TRUE(results.IsValid());
+  EXPECT_THAT(results.Results(),
+              Contains(Evaluated("Patient.contact[0]", kContactConstraint,
+                                 true)));
+  EXPECT_THAT(results.Results(),
+              Contains(Evaluated("Patient.telecom[0]", kContactPointConstraint,
+                                 true)));
+  EXPECT_THAT(results.Results(),
+              Contains(Evaluated("Patient.photo[0]", kAttachmentConstraint,
+                                 true)));
+}
+
+TEST(R4NativeConstraintsTest, InvalidResource) {
+  ValidationResults results = ValidateBothWays(InvalidPatient());
+
+  EXPECT_FALSE(results.IsValid());
+  EXPECT_THAT(results.Results(),
+              Contains(Evaluated("Patient.contact[0]", kContactConstraint,
+                                 false)));
+  EXPECT_THAT(results.Results(),
+              Contains(Evaluated("Patient.telecom[0]", kContactPointConstraint,
+                                 false)));
+  EXPECT_THAT(results.Results(),
+              Contains(Evaluated("Patient.photo[0]", kAttachmentConstraint,
+                                 false)));
+}
+
+TEST(R4NativeConstraintsTest, Bundle) {
+  r4::core::Bundle bundle;
+  *bundle.add_entry()->mutable_resource()->mutable_patient() = ValidPatient();
+  *bundle.add_entry()->mutable_resource()->mutable_patient() =
+      InvalidPatient();
+
+  ValidationResults results = ValidateBothWays(bundle);
+
+  EXPECT_FALSE(results.IsValid());
+  EXPECT_THAT(results.Results(),
+              Contains(Property(&ValidationResult::Constraint,
+                                StrEq(kContactConstraint))));
+}
+
+}  // namespace
+}  // namespace fhir_path
+}  // namespace fhir
+}  // namespace google
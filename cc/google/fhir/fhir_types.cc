@@ -30,10 +30,9 @@ bool IsType(const std::string& url, const Descriptor* descriptor) {
 }
 
 bool IsProfileOf(const std::string& url, const Descriptor* descriptor) {
-  for (int i = 0;
-       i < descriptor->options().ExtensionSize(proto::fhir_profile_base); i++) {
-    if (descriptor->options().GetExtension(proto::fhir_profile_base, i) ==
-        url) {
+  for (const std::string& profile_base :
+       GetDescriptorTraits(descriptor).profile_bases) {
+    if (profile_base == url) {
       return true;
     }
   }
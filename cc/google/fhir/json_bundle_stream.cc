@@ -0,0 +1,355 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "google/fhir/json_bundle_stream.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/descriptor.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
+#include "google/fhir/status/status.h"
+#include "google/fhir/status/statusor.h"
+
+namespace google {
+namespace fhir {
+
+using ::absl::InvalidArgumentError;
+using ::google::protobuf::FieldDescriptor;
+using ::google::protobuf::Message;
+using ::google::protobuf::Reflection;
+
+namespace {
+
+// The amount of input read at a time.
+constexpr size_t kChunkSize = 64 * 1024;
+
+bool IsJsonWhitespace(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+}  // namespace
+
+JsonBundleReader::JsonBundleReader(const Parser* parser, std::istream* input,
+                                   Message* bundle,
+                                   absl::TimeZone default_timezone,
+                                   bool validate)
+    : parser_(parser),
+      input_(input),
+      bundle_(bundle),
+      default_timezone_(default_timezone),
+      validate_(validate) {}
+
+bool JsonBundleReader::Fill() {
+  // Drops the consumed part of the buffer, so that it holds at most one value
+  // and a chunk of input at a time.
+  buffer_.erase(0, pos_);
+  pos_ = 0;
+
+  const size_t size = buffer_.size();
+  buffer_.resize(size + kChunkSize);
+  input_->read(&buffer_[size], kChunkSize);
+  buffer_.resize(size + input_->gcount());
+  return buffer_.size() > size;
+}
+
+absl::StatusOr<char> JsonBundleReader::Peek() {
+  while (true) {
+    while (pos_ < buffer_.size() && IsJsonWhitespace(buffer_[pos_])) {
+      pos_++;
+    }
+    if (pos_ < buffer_.size()) {
+      return buffer_[pos_];
+    }
+    if (!Fill()) {
+      return InvalidArgumentError("Unexpected end of JSON Bundle");
+    }
+  }
+}
+
+absl::Status JsonBundleReader::Expect(char c) {
+  FHIR_ASSIGN_OR_RETURN(const char next, Peek());
+  if (next != c) {
+    return InvalidArgumentError(absl::StrCat("Expected '", std::string(1, c),
+                                             "' in JSON Bundle but found '",
+                                             std::string(1, next), "'"));
+  }
+  pos_++;
+  return absl::OkStatus();
+}
+
+absl::StatusOr<absl::string_view> JsonBundleReader::ReadValue() {
+  FHIR_RETURN_IF_ERROR(Peek().status());
+  // The value starts at pos_, which Fill keeps in the buffer as more of the
+  // input is read, so that the value is scanned only once.
+  size_t scanned = 0;
+  int depth = 0;
+  bool in_string = false;
+  bool escaped = false;
+  while (true) {
+    if (pos_ + scanned == buffer_.size() && !Fill()) {
+      return InvalidArgumentError("Unexpected end of JSON Bundle");
+    }
+    const char c = buffer_[pos_ + scanned];
+    if (in_string) {
+      if (escaped) {
+        escaped = false;
+      } else if (c == '\\') {
+        escaped = true;
+      } else if (c == '"') {
+        in_string = false;
+        if (depth == 0) {
+          scanned++;
+          break;
+        }
+      }
+    } else if (c == '"') {
+      in_string = true;
+    } else if (c == '{' || c == '[') {
+      depth++;
+    } else if (c == '}' || c == ']') {
+      if (depth == 0) {
+        // The end of the object or array containing a literal.
+        break;
+      }
+      depth--;
+      if (depth == 0) {
+        scanned++;
+        break;
+      }
+    } else if (depth == 0 && (c == ',' || c == ':' || IsJsonWhitespace(c))) {
+      break;
+    }
+    scanned++;
+  }
+
+  if (scanned == 0) {
+    return InvalidArgumentError("Expected a JSON value in Bundle");
+  }
+  const absl::string_view value =
+      absl::string_view(buffer_).substr(pos_, scanned);
+  pos_ += scanned;
+  return value;
+}
+
+absl::Status JsonBundleReader::MergeBundleFields(bool validate) {
+  bundle_->Clear();
+  merged_fields_ = true;
+  return parser_->MergeJsonFhirStringIntoProto(
+      absl::StrCat("{", bundle_fields_, "}"), bundle_, default_timezone_,
+      validate);
+}
+
+absl::Status JsonBundleReader::ExpectEnd() {
+  do {
+    while (pos_ < buffer_.size() && IsJsonWhitespace(buffer_[pos_])) {
+      pos_++;
+    }
+    if (pos_ < buffer_.size()) {
+      return InvalidArgumentError("Unexpected data after JSON Bundle");
+    }
+  } while (Fill());
+  return absl::OkStatus();
+}
+
+absl::StatusOr<bool> JsonBundleReader::Next(Message* entry) {
+  const FieldDescriptor* entry_field =
+      bundle_->GetDescriptor()->FindFieldByName("entry");
+  if (entry_field == nullptr ||
+      entry->GetDescriptor() != entry_field->message_type()) {
+    return InvalidArgumentError(
+        absl::StrCat("Cannot read ", entry->GetDescriptor()->full_name(),
+                     " from ", bundle_->GetDescriptor()->full_name()));
+  }
+
+  while (true) {
+    switch (state_) {
+      case State::kStart:
+        FHIR_RETURN_IF_ERROR(Expect('{'));
+        state_ = State::kFields;
+        break;
+
+      case State::kFields: {
+        FHIR_ASSIGN_OR_RETURN(const char next, Peek());
+        if (next == '}') {
+          pos_++;
+          FHIR_RETURN_IF_ERROR(ExpectEnd());
+          state_ = State::kDone;
+          FHIR_RETURN_IF_ERROR(MergeBundleFields(validate_));
+          return false;
+        }
+        if (fields_read_ > 0) {
+          FHIR_RETURN_IF_ERROR(Expect(','));
+        }
+        fields_read_++;
+        FHIR_ASSIGN_OR_RETURN(const absl::string_view key_value, ReadValue());
+        // Copied, since reading on may move the buffer.
+        const std::string key(key_value);
+        FHIR_RETURN_IF_ERROR(Expect(':'));
+        if (key == "\"entry\"") {
+          FHIR_RETURN_IF_ERROR(Expect('['));
+          state_ = State::kEntries;
+          entries_read_ = 0;
+          if (!merged_fields_) {
+            // The Bundle is only validated once all of its fields are known.
+            FHIR_RETURN_IF_ERROR(MergeBundleFields(false));
+          }
+          break;
+        }
+        FHIR_ASSIGN_OR_RETURN(const absl::string_view value, ReadValue());
+        absl::StrAppend(&bundle_fields_, bundle_fields_.empty() ? "" : ",", key,
+                        ":", value);
+        break;
+      }
+
+      case State::kEntries: {
+        FHIR_ASSIGN_OR_RETURN(const char next, Peek());
+        if (next == ']') {
+          pos_++;
+          state_ = State::kFields;
+          break;
+        }
+        if (entries_read_ > 0) {
+          FHIR_RETURN_IF_ERROR(Expect(','));
+        }
+        entries_read_++;
+        FHIR_ASSIGN_OR_RETURN(const absl::string_view json, ReadValue());
+        entry->Clear();
+        FHIR_RETURN_IF_ERROR(parser_->MergeJsonFhirStringIntoProto(
+            json, entry, default_timezone_, validate_));
+        return true;
+      }
+
+      case State::kDone:
+        return false;
+    }
+  }
+}
+
+JsonBundleWriter::JsonBundleWriter(const Printer* printer,
+                                   std::ostream* output)
+    : printer_(printer), output_(output) {}
+
+absl::Status JsonBundleWriter::CheckOutput() const {
+  if (!output_->good()) {
+    return absl::InternalError("Failed writing JSON Bundle");
+  }
+  return absl::OkStatus();
+}
+
+absl::Status JsonBundleWriter::Begin(const Message& bundle) {
+  if (begun_) {
+    return absl::FailedPreconditionError("JSON Bundle already begun");
+  }
+  const FieldDescriptor* entry_field =
+      bundle.GetDescriptor()->FindFieldByName("entry");
+  if (entry_field == nullptr || !entry_field->is_repeated()) {
+    return InvalidArgumentError(
+        absl::StrCat("Not a Bundle: ", bundle.GetDescriptor()->full_name()));
+  }
+
+  // Entries are written separately. The printer writes fields in the order of
+  // their numbers, so the fields numbered after the entries follow them.
+  const Reflection* reflection = bundle.GetReflection();
+  const int entry_count = reflection->FieldSize(bundle, entry_field);
+  const std::unique_ptr<Message> fields = absl::WrapUnique(bundle.New());
+  fields->CopyFrom(bundle);
+  reflection->ClearField(fields.get(), entry_field);
+  const std::unique_ptr<Message> leading_fields =
+      absl::WrapUnique(fields->New());
+  leading_fields->CopyFrom(*fields);
+  std::vector<const FieldDescriptor*> set_fields;
+  reflection->ListFields(*leading_fields, &set_fields);
+  for (const FieldDescriptor* field : set_fields) {
+    if (field->number() > entry_field->number()) {
+      reflection->ClearField(leading_fields.get(), field);
+    }
+  }
+
+  FHIR_ASSIGN_OR_RETURN(const std::string json,
+                        printer_->PrintFhirToJsonString(*fields));
+  FHIR_ASSIGN_OR_RETURN(const std::string leading_json,
+                        printer_->PrintFhirToJsonString(*leading_fields));
+  // Leaves the object open for the entries.
+  const absl::string_view open =
+      absl::StripSuffix(absl::StripTrailingAsciiWhitespace(leading_json), "}");
+  if (open.size() == leading_json.size() || open.empty()) {
+    return absl::InternalError(
+        absl::StrCat("Unexpected JSON for Bundle: ", leading_json));
+  }
+  if (json != leading_json) {
+    // The JSON of all fields is that of the leading ones followed by the
+    // members of the trailing ones.
+    absl::string_view trailing = json;
+    if (!absl::ConsumePrefix(&trailing, open) ||
+        !absl::ConsumePrefix(&trailing, ",") ||
+        !absl::ConsumeSuffix(&trailing, "}")) {
+      return absl::InternalError(
+          absl::StrCat("Unexpected JSON for Bundle: ", json));
+    }
+    trailing_fields_ = std::string(trailing);
+  }
+  *output_ << open;
+  has_fields_ = open.size() > 1;
+  begun_ = true;
+
+  for (int i = 0; i < entry_count; i++) {
+    FHIR_RETURN_IF_ERROR(
+        WriteEntry(reflection->GetRepeatedMessage(bundle, entry_field, i)));
+  }
+  return CheckOutput();
+}
+
+absl::Status JsonBundleWriter::WriteEntry(const Message& entry) {
+  if (!begun_ || finished_) {
+    return absl::FailedPreconditionError(
+        "JSON Bundle entries must be written between Begin and Finish");
+  }
+  FHIR_ASSIGN_OR_RETURN(const std::string json,
+                        printer_->PrintFhirToJsonString(entry));
+  if (entries_ == 0) {
+    *output_ << (has_fields_ ? "," : "") << "\"entry\":[";
+  } else {
+    *output_ << ",";
+  }
+  *output_ << json;
+  entries_++;
+  return CheckOutput();
+}
+
+absl::Status JsonBundleWriter::Finish() {
+  if (!begun_ || finished_) {
+    return absl::FailedPreconditionError(
+        "JSON Bundle must be finished once, after Begin");
+  }
+  if (entries_ > 0) {
+    *output_ << "]";
+  }
+  if (!trailing_fields_.empty()) {
+    *output_ << (has_fields_ || entries_ > 0 ? "," : "") << trailing_fields_;
+  }
+  *output_ << "}";
+  finished_ = true;
+  return CheckOutput();
+}
+
+}  // namespace fhir
+}  // namespace google
@@ -0,0 +1,163 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GOOGLE_FHIR_JSON_BUNDLE_STREAM_H_
+#define GOOGLE_FHIR_JSON_BUNDLE_STREAM_H_
+
+#include <stddef.h>
+
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+
+#include "google/protobuf/message.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "google/fhir/json_format.h"
+
+namespace google {
+namespace fhir {
+
+// Reads the entries of a FHIR JSON Bundle from a stream one at a time, so that
+// only the current entry, rather than the whole Bundle and its JSON, is held in
+// memory. Example:
+//
+//   r4::core::Bundle bundle;
+//   JsonBundleReader reader(&parser, &input, &bundle, default_timezone);
+//   r4::core::Bundle::Entry entry;
+//   while (true) {
+//     FHIR_ASSIGN_OR_RETURN(bool has_entry, reader.Next(&entry));
+//     if (!has_entry) break;
+//     ...
+//   }
+//
+// The fields of the Bundle other than its entries are merged into the given
+// bundle, which must be of the Bundle type to read and must outlive the
+// reader: those that precede the entries in the JSON are merged by the time
+// the first entry is returned, and all of them once Next returns false. Only
+// then is the Bundle itself validated, if requested. Entries are validated as
+// they are read.
+class JsonBundleReader {
+ public:
+  JsonBundleReader(const Parser* parser, std::istream* input,
+                   ::google::protobuf::Message* bundle,
+                   absl::TimeZone default_timezone, bool validate = true);
+
+  JsonBundleReader(const JsonBundleReader&) = delete;
+  JsonBundleReader& operator=(const JsonBundleReader&) = delete;
+
+  // Clears entry, which must be of the Bundle's Entry type, and parses the
+  // next entry of the Bundle into it. Returns false once there are no more
+  // entries.
+  absl::StatusOr<bool> Next(::google::protobuf::Message* entry);
+
+ private:
+  enum class State { kStart, kFields, kEntries, kDone };
+
+  // Reads more of the input into the buffer. Returns false at the end of the
+  // input.
+  bool Fill();
+
+  // Returns the next character that is not whitespace, without consuming it,
+  // or InvalidArgument at the end of the input.
+  absl::StatusOr<char> Peek();
+
+  // Consumes the given character, which must be the next one that is not
+  // whitespace.
+  absl::Status Expect(char c);
+
+  // Consumes the next JSON value, which must be complete, and returns its
+  // text, which is only valid until more of the input is read.
+  absl::StatusOr<absl::string_view> ReadValue();
+
+  // Merges the fields of the Bundle read so far into bundle_.
+  absl::Status MergeBundleFields(bool validate);
+
+  // Checks that nothing but whitespace follows the Bundle in the input.
+  absl::Status ExpectEnd();
+
+  const Parser* parser_;
+  std::istream* input_;
+  ::google::protobuf::Message* bundle_;
+  const absl::TimeZone default_timezone_;
+  const bool validate_;
+
+  State state_ = State::kStart;
+  // The fields of the Bundle other than its entries, as the members of a JSON
+  // object without the braces.
+  std::string bundle_fields_;
+  bool merged_fields_ = false;
+  // The number of fields of the Bundle, and of entries of the current array of
+  // entries, read so far.
+  int fields_read_ = 0;
+  int entries_read_ = 0;
+
+  // The part of the input read but not yet consumed starts at buffer_[pos_].
+  std::string buffer_;
+  size_t pos_ = 0;
+};
+
+// Writes a FHIR JSON Bundle to a stream one entry at a time, without holding
+// all of its entries in memory. The output is a single line of JSON, as with
+// Printer::PrintFhirToJsonString. Example:
+//
+//   JsonBundleWriter writer(&printer, &output);
+//   FHIR_RETURN_IF_ERROR(writer.Begin(bundle_without_entries));
+//   for (...) {
+//     FHIR_RETURN_IF_ERROR(writer.WriteEntry(entry));
+//   }
+//   FHIR_RETURN_IF_ERROR(writer.Finish());
+class JsonBundleWriter {
+ public:
+  JsonBundleWriter(const Printer* printer, std::ostream* output);
+
+  JsonBundleWriter(const JsonBundleWriter&) = delete;
+  JsonBundleWriter& operator=(const JsonBundleWriter&) = delete;
+
+  // Writes the fields of the Bundle that precede its entries, in the order of
+  // Printer::PrintFhirToJsonString; those that follow them, e.g. signature,
+  // are written by Finish. Any entries it has are written along with those
+  // given to WriteEntry.
+  absl::Status Begin(const ::google::protobuf::Message& bundle);
+
+  // Writes an entry of the Bundle's Entry type.
+  absl::Status WriteEntry(const ::google::protobuf::Message& entry);
+
+  // Writes the fields of the Bundle that follow its entries, and completes the
+  // Bundle.
+  absl::Status Finish();
+
+ private:
+  absl::Status CheckOutput() const;
+
+  const Printer* printer_;
+  std::ostream* output_;
+  bool begun_ = false;
+  bool finished_ = false;
+  // Whether the Bundle has fields other than its entries.
+  bool has_fields_ = false;
+  // The members of the Bundle's JSON object that follow its entries.
+  std::string trailing_fields_;
+  size_t entries_ = 0;
+};
+
+}  // namespace fhir
+}  // namespace google
+
+#endif  // GOOGLE_FHIR_JSON_BUNDLE_STREAM_H_
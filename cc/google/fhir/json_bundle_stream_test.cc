@@ -0,0 +1,223 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "google/fhir/json_bundle_stream.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "google/fhir/json_format.h"
+#include "google/fhir/r4/primitive_handler.h"
+#include "google/fhir/testutil/proto_matchers.h"
+#include "proto/r4/core/resources/bundle_and_contained_resource.pb.h"
+
+namespace google {
+namespace fhir {
+
+namespace {
+
+using ::google::fhir::r4::core::Bundle;
+using ::google::fhir::testutil::EqualsProto;
+
+const Parser& GetParser() {
+  static const Parser* parser =
+      new Parser(r4::R4PrimitiveHandler::GetInstance());
+  return *parser;
+}
+
+const Printer& GetPrinter() {
+  static const Printer* printer =
+      new Printer(r4::R4PrimitiveHandler::GetInstance());
+  return *printer;
+}
+
+Bundle ParseBundle(const std::string& json) {
+  Bundle bundle;
+  EXPECT_TRUE(GetParser()
+                  .MergeJsonFhirStringIntoProto(json, &bundle,
+                                                absl::UTCTimeZone(), true)
+                  .ok());
+  return bundle;
+}
+
+// Reads all entries of the JSON Bundle, which are expected to be valid.
+Bundle ReadBundle(const std::string& json) {
+  std::istringstream input(json);
+  Bundle bundle;
+  JsonBundleReader reader(&GetParser(), &input, &bundle, absl::UTCTimeZone());
+  std::vector<Bundle::Entry> entries;
+  Bundle::Entry entry;
+  while (true) {
+    absl::StatusOr<bool> has_entry = reader.Next(&entry);
+    EXPECT_TRUE(has_entry.ok()) << has_entry.status();
+    if (!has_entry.ok() || !*has_entry) break;
+    entries.push_back(entry);
+  }
+  for (const Bundle::Entry& read : entries) {
+    *bundle.add_entry() = read;
+  }
+  return bundle;
+}
+
+// A Bundle with an entry larger than the chunks the reader reads at a time.
+std::string LargeBundleJson() {
+  return absl::StrCat(
+      R"json({
+  "resourceType": "Bundle",
+  "id": "large",
+  "type": "collection",
+  "entry": [
+    {"resource": {"resourceType": "Patient", "id": "1"}},
+    {"resource": {"resourceType": "Patient", "id": "2",
+                  "name": [{"family": ")json",
+      std::string(100000, 'x'), R"json(\"}\\"}]}},
+    {"fullUrl": "Observation/3",
+     "resource": {"resourceType": "Observation", "id": "3",
+                  "status": "final", "code": {"text": "]}"}}}
+  ],
+  "total": 3
+})json");
+}
+
+TEST(JsonBundleReaderTest, ReadsEntriesAndFields) {
+  const std::string json = LargeBundleJson();
+  EXPECT_THAT(ReadBundle(json), EqualsProto(ParseBundle(json)));
+}
+
+TEST(JsonBundleReaderTest, MergesFieldsBeforeFirstEntry) {
+  std::istringstream input(R"json({
+    "resourceType": "Bundle", "type": "collection",
+    "entry": [{"resource": {"resourceType": "Patient", "id": "1"}}],
+    "id": "after"
+  })json");
+  Bundle bundle;
+  JsonBundleReader reader(&GetParser(), &input, &bundle, absl::UTCTimeZone());
+  Bundle::Entry entry;
+
+  ASSERT_TRUE(reader.Next(&entry).value());
+  EXPECT_EQ(entry.resource().patient().id().value(), "1");
+  EXPECT_EQ(bundle.type().value(), r4::core::BundleTypeCode::COLLECTION);
+  EXPECT_FALSE(bundle.has_id());
+
+  EXPECT_FALSE(reader.Next(&entry).value());
+  EXPECT_EQ(bundle.id().value(), "after");
+  EXPECT_EQ(bundle.entry_size(), 0);
+  EXPECT_FALSE(reader.Next(&entry).value());
+}
+
+TEST(JsonBundleReaderTest, RejectsMalformedBundles) {
+  for (const std::string& json :
+       {std::string(R"json({"resourceType": "Bundle", "entry": [{}, )json"),
+        std::string(R"json({"resourceType": "Bundle" "type": "batch"})json"),
+        std::string(R"json([{"resourceType": "Bundle"}])json"),
+        std::string(R"json({"resourceType": "Bundle"} {})json")}) {
+    std::istringstream input(json);
+    Bundle bundle;
+    JsonBundleReader reader(&GetParser(), &input, &bundle,
+                            absl::UTCTimeZone(), false);
+    Bundle::Entry entry;
+    absl::StatusOr<bool> has_entry = reader.Next(&entry);
+    while (has_entry.ok() && *has_entry) {
+      has_entry = reader.Next(&entry);
+    }
+    EXPECT_EQ(has_entry.status().code(), absl::StatusCode::kInvalidArgument)
+        << json;
+  }
+}
+
+TEST(JsonBundleWriterTest, RoundTrips) {
+  const Bundle bundle = ParseBundle(LargeBundleJson());
+  Bundle fields = bundle;
+  fields.clear_entry();
+
+  std::ostringstream output;
+  JsonBundleWriter writer(&GetPrinter(), &output);
+  ASSERT_TRUE(writer.Begin(fields).ok());
+  for (const Bundle::Entry& entry : bundle.entry()) {
+    ASSERT_TRUE(writer.WriteEntry(entry).ok());
+  }
+  ASSERT_TRUE(writer.Finish().ok());
+
+  EXPECT_EQ(output.str(), GetPrinter().PrintFhirToJsonString(bundle).value());
+  EXPECT_THAT(ReadBundle(output.str()), EqualsProto(bundle));
+}
+
+TEST(JsonBundleWriterTest, WritesFieldsAfterEntriesInFinish) {
+  const Bundle bundle = ParseBundle(R"json({
+    "resourceType": "Bundle",
+    "type": "collection",
+    "entry": [{"resource": {"resourceType": "Patient", "id": "1"}}],
+    "signature": {
+      "type": [{"system": "urn:iso-astm:E1762-95:2013",
+                "code": "1.2.840.10065.1.12.1.1"}],
+      "when": "2020-01-01T00:00:00Z",
+      "who": {"reference": "Patient/1"}
+    }
+  })json");
+  ASSERT_TRUE(bundle.has_signature());
+
+  for (bool entries_in_begin : {false, true}) {
+    Bundle fields = bundle;
+    if (!entries_in_begin) {
+      fields.clear_entry();
+    }
+    std::ostringstream output;
+    JsonBundleWriter writer(&GetPrinter(), &output);
+    ASSERT_TRUE(writer.Begin(fields).ok());
+    if (!entries_in_begin) {
+      for (const Bundle::Entry& entry : bundle.entry()) {
+        ASSERT_TRUE(writer.WriteEntry(entry).ok());
+      }
+    }
+    ASSERT_TRUE(writer.Finish().ok());
+
+    EXPECT_EQ(output.str(),
+              GetPrinter().PrintFhirToJsonString(bundle).value());
+    EXPECT_THAT(ReadBundle(output.str()), EqualsProto(bundle));
+  }
+
+  // Without entries, the fields are written as they would be printed.
+  Bundle fields = bundle;
+  fields.clear_entry();
+  std::ostringstream output;
+  JsonBundleWriter writer(&GetPrinter(), &output);
+  ASSERT_TRUE(writer.Begin(fields).ok());
+  ASSERT_TRUE(writer.Finish().ok());
+  EXPECT_EQ(output.str(), GetPrinter().PrintFhirToJsonString(fields).value());
+}
+
+TEST(JsonBundleWriterTest, WritesEntriesOfBegin) {
+  const Bundle bundle = ParseBundle(LargeBundleJson());
+  std::ostringstream output;
+  JsonBundleWriter writer(&GetPrinter(), &output);
+  ASSERT_TRUE(writer.Begin(bundle).ok());
+  ASSERT_TRUE(writer.Finish().ok());
+  EXPECT_THAT(ParseBundle(output.str()), EqualsProto(bundle));
+
+  EXPECT_EQ(writer.WriteEntry(bundle.entry(0)).code(),
+            absl::StatusCode::kFailedPrecondition);
+}
+
+}  // namespace
+
+}  // namespace fhir
+}  // namespace google
@@ -17,12 +17,15 @@
 #ifndef GOOGLE_FHIR_JSON_FORMAT_H_
 #define GOOGLE_FHIR_JSON_FORMAT_H_
 
+#include <memory>
 #include <string>
 
 #include "google/protobuf/message.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/cord.h"
 #include "absl/strings/match.h"
+#include "absl/strings/string_view.h"
 #include "absl/time/time.h"
 #include "google/fhir/annotations.h"
 #include "google/fhir/primitive_handler.h"
@@ -42,11 +45,32 @@ class Parser {
   // Takes a default timezone for timelike data that does not specify timezone.
   // For reading JSON into a new resource, it is recommended to use
   // JsonFhirStringToProto or JsonFhirStringToProtoWithoutValidating.
-  ::absl::Status MergeJsonFhirStringIntoProto(const std::string& raw_json,
+  // The JSON is parsed in place, without copying it unless it has decimals,
+  // which are quoted first so that their precision is kept.
+  ::absl::Status MergeJsonFhirStringIntoProto(absl::string_view raw_json,
                                               google::protobuf::Message* target,
                                               absl::TimeZone default_timezone,
                                               const bool validate) const;
 
+  // As above, for JSON held in a Cord, e.g. a network buffer. A Cord of a
+  // single chunk is parsed in place; others are flattened into one copy.
+  ::absl::Status MergeJsonFhirStringIntoProto(const absl::Cord& raw_json,
+                                              google::protobuf::Message* target,
+                                              absl::TimeZone default_timezone,
+                                              const bool validate) const;
+
+  // As MergeJsonFhirStringIntoProto, for a Bundle, with the entries of its
+  // "entry" array parsed concurrently on up to num_threads threads, including
+  // the calling thread. A pre-pass finds the entries without parsing them,
+  // and they are added to the Bundle in order. If any entry fails to parse,
+  // the error for the earliest one is returned, and the Bundle is left
+  // partially merged. Profiled Bundles are parsed on the calling thread alone.
+  ::absl::Status MergeJsonFhirBundleIntoProto(absl::string_view raw_json,
+                                              google::protobuf::Message* bundle,
+                                              absl::TimeZone default_timezone,
+                                              const bool validate,
+                                              int num_threads) const;
+
   // Given a template for a FHIR resource type, creates a resource proto of that
   // type and merges a std::string of raw FHIR json into it.
   // Returns a status error if the JSON string was not a valid resource
@@ -54,7 +78,7 @@ class Parser {
   // timezone for timelike data that does not specify timezone.
   template <typename R>
   ::absl::StatusOr<R> JsonFhirStringToProto(
-      const std::string& raw_json,
+      absl::string_view raw_json,
       const absl::TimeZone default_timezone) const {
     R resource;
     FHIR_RETURN_IF_ERROR(MergeJsonFhirStringIntoProto(raw_json, &resource,
@@ -69,7 +93,7 @@ class Parser {
   // Takes a default timezone for timelike data that does not specify timezone.
   template <typename R>
   ::absl::StatusOr<R> JsonFhirStringToProtoWithoutValidating(
-      const std::string& raw_json,
+      absl::string_view raw_json,
       const absl::TimeZone default_timezone) const {
     R resource;
     FHIR_RETURN_IF_ERROR(MergeJsonFhirStringIntoProto(raw_json, &resource,
@@ -77,10 +101,48 @@ class Parser {
     return resource;
   }
 
+  // Merges a resource of any type into the field of a ContainedResource that
+  // matches its "resourceType", which is found without parsing the rest of the
+  // JSON. Useful for streams that mix resource types, such as Bulk Data
+  // exports, which would otherwise have to be split by type first.
+  ::absl::Status MergeJsonFhirStringIntoContainedResource(
+      absl::string_view raw_json,
+      google::protobuf::Message* contained_resource,
+      absl::TimeZone default_timezone, const bool validate) const;
+
+  // Creates a ContainedResource of the given type, and merges a resource of
+  // any type into it. Returns a status error if the JSON string was not a
+  // valid resource of the type named by its "resourceType".
+  template <typename ContainedResourceLike>
+  ::absl::StatusOr<ContainedResourceLike> JsonFhirStringToContainedResource(
+      absl::string_view raw_json,
+      const absl::TimeZone default_timezone) const {
+    ContainedResourceLike contained_resource;
+    FHIR_RETURN_IF_ERROR(MergeJsonFhirStringIntoContainedResource(
+        raw_json, &contained_resource, default_timezone, true));
+    return contained_resource;
+  }
+
+  // Creates a resource proto of the type named by the "resourceType" of the
+  // JSON, out of the resources of the ContainedResource of this parser's FHIR
+  // version, and merges the JSON into it. The type of the result can be
+  // checked through its descriptor.
+  ::absl::StatusOr<std::unique_ptr<google::protobuf::Message>>
+  JsonFhirStringToResource(absl::string_view raw_json,
+                           absl::TimeZone default_timezone,
+                           const bool validate) const;
+
  private:
   const PrimitiveHandler* primitive_handler_;
 };
 
+// Returns the "resourceType" of a JSON object, e.g. "Patient", without parsing
+// the rest of the object. Members before it are skipped over without being
+// interpreted. Returns InvalidArgument if the JSON is not an object with a
+// string resourceType.
+::absl::StatusOr<absl::string_view> PeekResourceType(
+    absl::string_view raw_json);
+
 class Printer {
  public:
   explicit Printer(const PrimitiveHandler* primitive_handler)
@@ -112,6 +174,11 @@ class Printer {
   const PrimitiveHandler* primitive_handler_;
 };
 
+// Builds the lookup tables the parser keeps for the given message type, which
+// are otherwise built the first time a message of that type is parsed. See
+// warm_up.h.
+void WarmUpJsonParser(const ::google::protobuf::Descriptor* descriptor);
+
 }  // namespace fhir
 }  // namespace google
 
@@ -16,10 +16,15 @@
 
 #include <ctype.h>
 
+#include <atomic>
+#include <functional>
 #include <iosfwd>
+#include <limits>
 #include <memory>
+#include <string>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "google/protobuf/any.pb.h"
 #include "google/protobuf/descriptor.h"
@@ -27,12 +32,20 @@
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/cord.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
 #include "google/fhir/annotations.h"
 #include "google/fhir/core_resource_registry.h"
+#include "google/fhir/descriptor_cache.h"
 #include "google/fhir/extensions.h"
 #include "google/fhir/json_format.h"
+#include "google/fhir/json_string.h"
+#include "google/fhir/parallel.h"
 #include "google/fhir/primitive_wrapper.h"
 #include "google/fhir/proto_util.h"
 #include "google/fhir/r4/profiles.h"
@@ -43,7 +56,6 @@
 #include "google/fhir/util.h"
 #include "proto/annotations.pb.h"
 #include "include/json/json.h"
-#include "re2/re2.h"
 
 namespace google {
 namespace fhir {
@@ -60,6 +72,7 @@ using ::google::protobuf::Descriptor;
 using ::google::protobuf::FieldDescriptor;
 using ::google::protobuf::Message;
 using ::google::protobuf::Reflection;
+using ::google::protobuf::RepeatedPtrField;
 
 namespace internal {
 
@@ -121,47 +134,41 @@ const std::unordered_map<std::string, const FieldDescriptor*>& GetFieldMap(
       }
     }
   }
+  // Another thread may have built the map meanwhile, and callers may already
+  // hold a reference to it, so the first map stored is kept.
   absl::MutexLock lock(&memos_mutex);
-  (*memos)[memo_key] = std::move(field_map);
-  return *(*memos)[memo_key];
+  return *memos->try_emplace(memo_key, std::move(field_map)).first->second;
 }
 
-typedef std::unordered_map<std::string, const FieldDescriptor*> FieldMap;
-
 // Builds a map from ContainedResource field type to FieldDescriptor for that
 // field.
-std::unique_ptr<FieldMap> BuildResourceTypeMap(const Descriptor* descriptor) {
-  auto map = absl::make_unique<FieldMap>();
+absl::flat_hash_map<std::string, const FieldDescriptor*> BuildResourceTypeMap(
+    const Descriptor* descriptor) {
+  absl::flat_hash_map<std::string, const FieldDescriptor*> map;
   for (int i = 0; i < descriptor->field_count(); i++) {
     const FieldDescriptor* field = descriptor->field(i);
-    (*map)[field->message_type()->name()] = field;
+    map[field->message_type()->name()] = field;
   }
   return map;
 }
 
 absl::StatusOr<const FieldDescriptor*> GetContainedResourceField(
     const Descriptor* contained_resource_desc,
-    const std::string& resource_type) {
-  static std::unordered_map<std::string, std::unique_ptr<FieldMap>>*
-      field_table =
-          new std::unordered_map<std::string, std::unique_ptr<FieldMap>>;
-
-  const std::string& contained_resource_name =
-      contained_resource_desc->full_name();
-  auto field_table_iter = field_table->find(contained_resource_name);
-  const FieldDescriptor* field;
-  if (field_table_iter == field_table->end()) {
-    auto field_map = BuildResourceTypeMap(contained_resource_desc);
-    field = (*field_map)[resource_type];
-    (*field_table)[contained_resource_name] = std::move(field_map);
-  } else {
-    field = (*field_table_iter->second)[resource_type];
-  }
-  if (!field) {
-    return InvalidArgumentError(absl::StrCat(
-        "No field on ", contained_resource_name, " with type ", resource_type));
+    absl::string_view resource_type) {
+  static auto* field_table =
+      new DescriptorCache<Descriptor,
+                          absl::flat_hash_map<std::string,
+                                              const FieldDescriptor*>>(
+          &BuildResourceTypeMap);
+
+  const auto& field_map = field_table->Get(contained_resource_desc);
+  auto field_iter = field_map.find(resource_type);
+  if (field_iter == field_map.end()) {
+    return InvalidArgumentError(
+        absl::StrCat("No field on ", contained_resource_desc->full_name(),
+                     " with type ", resource_type));
   }
-  return field;
+  return field_iter->second;
 }
 
 class Parser {
@@ -422,10 +429,11 @@ class Parser {
   const absl::TimeZone default_timezone_;
 };
 
-absl::StatusOr<Json::Value> ParseJsonValue(const std::string& raw_json) {
+absl::StatusOr<Json::Value> ParseJsonValue(absl::string_view raw_json) {
   Json::Reader reader;
   Json::Value value;
-  if (!reader.parse(raw_json, value)) {
+  if (!reader.parse(raw_json.data(), raw_json.data() + raw_json.size(),
+                    value)) {
     return InvalidArgumentError(
         absl::StrCat("Failed parsing raw json: ", raw_json));
   }
@@ -434,45 +442,104 @@ absl::StatusOr<Json::Value> ParseJsonValue(const std::string& raw_json) {
 
 }  // namespace internal
 
+void WarmUpJsonParser(const Descriptor* descriptor) {
+  internal::GetFieldMap(descriptor);
+  if (IsContainedResource(descriptor) && descriptor->field_count() > 0) {
+    // Builds the map from resource types to the fields of the descriptor.
+    internal::GetContainedResourceField(
+        descriptor, descriptor->field(0)->message_type()->name())
+        .status()
+        .IgnoreError();
+  }
+}
+
+namespace {
+
+// Copies raw_json into quoted, adding quotes around the numbers with a
+// fraction or exponent, or too many digits for a 64-bit integer, that are
+// values of object members.
+//
+// FHIR JSON format stores decimals as unquoted rational numbers.  This is
+// problematic, because their representation could change when they are
+// parsed into C++ doubles.  Quoting them ensures that they are parsed as
+// strings instead, so that decimals never go through a double. Returns false,
+// leaving quoted empty, if there are no such numbers, so that the common case
+// of JSON without decimals is parsed without a copy.
+bool QuoteDecimals(absl::string_view raw_json, std::string* quoted) {
+  // The end of the part of raw_json that has been copied to quoted.
+  size_t copied = 0;
+  // Whether the last token outside of strings was a colon.
+  bool member_value = false;
+  for (size_t i = 0; i < raw_json.size(); i++) {
+    const char c = raw_json[i];
+    if (c == '"') {
+      for (i++; i < raw_json.size() && raw_json[i] != '"'; i++) {
+        if (raw_json[i] == '\\') {
+          i++;
+        }
+      }
+    } else if (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
+      continue;
+    } else if (c == ':') {
+      member_value = true;
+      continue;
+    } else if (member_value &&
+               (c == '-' || c == '.' || absl::ascii_isdigit(c))) {
+      size_t end = i;
+      bool decimal = false;
+      for (; end < raw_json.size(); end++) {
+        const char number_char = raw_json[end];
+        if (number_char == '.' || number_char == 'e' || number_char == 'E') {
+          decimal = true;
+        } else if (!absl::ascii_isdigit(number_char) && number_char != '-' &&
+                   number_char != '+') {
+          break;
+        }
+      }
+      // Shorter integers are read exactly, as 64-bit integers.
+      if (decimal || end - i > 18) {
+        if (copied == 0) {
+          quoted->reserve(raw_json.size() + 64);
+        }
+        absl::StrAppend(quoted, raw_json.substr(copied, i - copied), "\"",
+                        raw_json.substr(i, end - i), "\"");
+        copied = end;
+      }
+      i = end - 1;
+    }
+    member_value = false;
+  }
+  if (copied == 0) {
+    return false;
+  }
+  absl::StrAppend(quoted, raw_json.substr(copied));
+  return true;
+}
+
+}  // namespace
+
 absl::Status Parser::MergeJsonFhirStringIntoProto(
-    const std::string& raw_json, Message* target,
+    absl::string_view raw_json, Message* target,
     const absl::TimeZone default_timezone, const bool validate) const {
-  std::string mutable_raw_json = raw_json;
-  // FHIR JSON format stores decimals as unquoted rational numbers.  This is
-  // problematic, because their representation could change when they are
-  // parsed into C++ doubles.  To avoid this, add quotes around any decimal
-  // fields to ensure that they are parsed as strings.  Note that any field
-  // that is already in quotes will not match this regex, and thus be ignored.
-  //
-  // This regex is three capture groups:
-  // 1: a un-escaped double-quote followed by a colon and arbitrary whitespace,
-  //    to ensure this is a field value (and not inside a string).
-  // 2: a decimal
-  // 3: any field-ending token.
-  // TODO: Try to do this in a single pass, with a uglier regex.
-  //                   Alternatively, see if we can find a better json parser
-  //                   that doesn't use c++ decimals to back decimal fields.
-  static const LazyRE2 kDecimalKeyValuePattern{
-      "(?m)([^\\\\]\"\\s*:\\s*)(-?\\d*\\.\\d*?)([\\s,\\}\\]$])"};
-  RE2::GlobalReplace(&mutable_raw_json, *kDecimalKeyValuePattern,
-                     "\\1\"\\2\"\\3");
-
-  static const LazyRE2 kScientificNotationPattern{
-      "(?m)([^\\\\]\"\\s*:\\s*)(-?\\d*(\\.\\d*)?[eE][+-]?[0-9]+)([\\s,\\}\\]$]"
-      ")"};
-  RE2::GlobalReplace(&mutable_raw_json, *kScientificNotationPattern,
-                     "\\1\"\\2\"\\4");
-
+  // The JSON reader copies strings as they are, so their encoding is checked
+  // up front, in one pass over the input.
+  if (!IsValidUtf8(raw_json)) {
+    return InvalidArgumentError("Invalid UTF-8 in JSON input");
+  }
   Json::Value value;
 
   // TODO: Decide if we want to support value-only JSON
   if (IsDecimal(*target) && raw_json != "null") {
-    // Similar to above, if this is a standalone decimal, parse it as a string
-    // to avoid changing representation due to precision.
-    FHIR_ASSIGN_OR_RETURN(value, internal::ParseJsonValue(absl::StrCat(
-                                     "\"", mutable_raw_json, "\"")));
+    // Similar to QuoteDecimals, if this is a standalone decimal, parse it as a
+    // string to avoid changing representation due to precision.
+    FHIR_ASSIGN_OR_RETURN(
+        value, internal::ParseJsonValue(absl::StrCat("\"", raw_json, "\"")));
   } else {
-    FHIR_ASSIGN_OR_RETURN(value, internal::ParseJsonValue(mutable_raw_json));
+    std::string quoted;
+    const absl::string_view json = QuoteDecimals(raw_json, &quoted)
+                                       ? absl::string_view(quoted)
+                                       : raw_json;
+    FHIR_ASSIGN_OR_RETURN(value, internal::ParseJsonValue(json));
   }
 
   internal::Parser parser{primitive_handler_, default_timezone};
@@ -507,5 +574,304 @@ absl::Status Parser::MergeJsonFhirStringIntoProto(
   return absl::OkStatus();
 }
 
+absl::Status Parser::MergeJsonFhirStringIntoProto(
+    const absl::Cord& raw_json, Message* target,
+    const absl::TimeZone default_timezone, const bool validate) const {
+  // The JSON reader needs contiguous input.
+  absl::optional<absl::string_view> flat = raw_json.TryFlat();
+  if (flat.has_value()) {
+    return MergeJsonFhirStringIntoProto(*flat, target, default_timezone,
+                                        validate);
+  }
+  return MergeJsonFhirStringIntoProto(std::string(raw_json), target,
+                                      default_timezone, validate);
+}
+
+absl::Status Parser::MergeJsonFhirStringIntoContainedResource(
+    absl::string_view raw_json, Message* contained_resource,
+    const absl::TimeZone default_timezone, const bool validate) const {
+  FHIR_ASSIGN_OR_RETURN(const absl::string_view resource_type,
+                        PeekResourceType(raw_json));
+  FHIR_ASSIGN_OR_RETURN(
+      const FieldDescriptor* resource_field,
+      internal::GetContainedResourceField(contained_resource->GetDescriptor(),
+                                          resource_type));
+  return MergeJsonFhirStringIntoProto(
+      raw_json,
+      contained_resource->GetReflection()->MutableMessage(contained_resource,
+                                                          resource_field),
+      default_timezone, validate);
+}
+
+absl::StatusOr<std::unique_ptr<Message>> Parser::JsonFhirStringToResource(
+    absl::string_view raw_json, const absl::TimeZone default_timezone,
+    const bool validate) const {
+  FHIR_ASSIGN_OR_RETURN(const absl::string_view resource_type,
+                        PeekResourceType(raw_json));
+  const std::unique_ptr<Message> contained_resource =
+      absl::WrapUnique(primitive_handler_->NewContainedResource());
+  FHIR_ASSIGN_OR_RETURN(
+      const FieldDescriptor* resource_field,
+      internal::GetContainedResourceField(contained_resource->GetDescriptor(),
+                                          resource_type));
+  std::unique_ptr<Message> resource =
+      absl::WrapUnique(contained_resource->GetReflection()
+                           ->GetMessageFactory()
+                           ->GetPrototype(resource_field->message_type())
+                           ->New());
+  FHIR_RETURN_IF_ERROR(MergeJsonFhirStringIntoProto(
+      raw_json, resource.get(), default_timezone, validate));
+  return resource;
+}
+
+namespace {
+
+size_t SkipJsonWhitespace(absl::string_view json, size_t pos) {
+  while (pos < json.size() && (json[pos] == ' ' || json[pos] == '\n' ||
+                               json[pos] == '\r' || json[pos] == '\t')) {
+    pos++;
+  }
+  return pos;
+}
+
+// Scans the string starting at json[*pos], which must be a quote, and returns
+// its raw contents, with any escapes left as they are. Leaves pos after the
+// closing quote.
+absl::StatusOr<absl::string_view> ScanJsonString(absl::string_view json,
+                                                 size_t* pos) {
+  if (*pos >= json.size() || json[*pos] != '"') {
+    return InvalidArgumentError(
+        absl::StrCat("Expected a JSON string at offset ", *pos));
+  }
+  const size_t begin = *pos + 1;
+  for (size_t i = begin; i < json.size(); i++) {
+    if (json[i] == '\\') {
+      i++;
+    } else if (json[i] == '"') {
+      *pos = i + 1;
+      return json.substr(begin, i - begin);
+    }
+  }
+  return InvalidArgumentError("Unterminated JSON string");
+}
+
+// Skips over the JSON value starting at json[*pos] without interpreting it.
+absl::Status SkipJsonValue(absl::string_view json, size_t* pos) {
+  int depth = 0;
+  while (*pos < json.size()) {
+    const char c = json[*pos];
+    if (c == '"') {
+      FHIR_RETURN_IF_ERROR(ScanJsonString(json, pos).status());
+    } else if (c == '{' || c == '[') {
+      depth++;
+      (*pos)++;
+    } else if (c == '}' || c == ']') {
+      if (depth == 0) {
+        // The end of the object containing a literal value.
+        return absl::OkStatus();
+      }
+      depth--;
+      (*pos)++;
+    } else if (c == ',' && depth == 0) {
+      return absl::OkStatus();
+    } else {
+      (*pos)++;
+    }
+    if (depth == 0 && (c == '"' || c == '}' || c == ']')) {
+      return absl::OkStatus();
+    }
+  }
+  return InvalidArgumentError("Unexpected end of JSON");
+}
+
+// Calls fn(key, pos) for each member of the JSON object in json, with *pos at
+// the start of the member's value, which fn must leave *pos after. Stops
+// early, returning OK, once fn sets *done. Otherwise sets *end, if given, to
+// the offset after the closing brace.
+absl::Status ForEachJsonMember(
+    absl::string_view json,
+    const std::function<absl::Status(absl::string_view key, size_t* pos,
+                                     bool* done)>& fn,
+    size_t* end = nullptr) {
+  size_t pos = SkipJsonWhitespace(json, 0);
+  if (pos >= json.size() || json[pos] != '{') {
+    return InvalidArgumentError("Expected a JSON object for a FHIR resource");
+  }
+  pos = SkipJsonWhitespace(json, pos + 1);
+  while (pos < json.size() && json[pos] != '}') {
+    FHIR_ASSIGN_OR_RETURN(const absl::string_view key,
+                          ScanJsonString(json, &pos));
+    pos = SkipJsonWhitespace(json, pos);
+    if (pos >= json.size() || json[pos] != ':') {
+      return InvalidArgumentError(
+          absl::StrCat("Expected ':' at offset ", pos));
+    }
+    pos = SkipJsonWhitespace(json, pos + 1);
+    bool done = false;
+    FHIR_RETURN_IF_ERROR(fn(key, &pos, &done));
+    if (done) {
+      return absl::OkStatus();
+    }
+    pos = SkipJsonWhitespace(json, pos);
+    if (pos < json.size() && json[pos] == ',') {
+      pos = SkipJsonWhitespace(json, pos + 1);
+    } else if (pos >= json.size() || json[pos] != '}') {
+      return InvalidArgumentError(
+          absl::StrCat("Expected ',' or '}' at offset ", pos));
+    }
+  }
+  if (pos >= json.size()) {
+    return InvalidArgumentError("Unexpected end of JSON");
+  }
+  if (end != nullptr) {
+    *end = pos + 1;
+  }
+  return absl::OkStatus();
+}
+
+// Appends the raw elements of the JSON array starting at json[*pos], which
+// must be a '[', to elements, and leaves pos after the array.
+absl::Status ScanJsonArray(absl::string_view json, size_t* pos,
+                           std::vector<absl::string_view>* elements) {
+  *pos = SkipJsonWhitespace(json, *pos + 1);
+  if (*pos < json.size() && json[*pos] == ']') {
+    (*pos)++;
+    return absl::OkStatus();
+  }
+  while (true) {
+    const size_t begin = *pos;
+    FHIR_RETURN_IF_ERROR(SkipJsonValue(json, pos));
+    elements->push_back(json.substr(begin, *pos - begin));
+    *pos = SkipJsonWhitespace(json, *pos);
+    if (*pos < json.size() && json[*pos] == ',') {
+      *pos = SkipJsonWhitespace(json, *pos + 1);
+    } else if (*pos < json.size() && json[*pos] == ']') {
+      (*pos)++;
+      return absl::OkStatus();
+    } else {
+      return InvalidArgumentError(
+          absl::StrCat("Expected ',' or ']' at offset ", *pos));
+    }
+  }
+}
+
+}  // namespace
+
+absl::StatusOr<absl::string_view> PeekResourceType(absl::string_view raw_json) {
+  absl::optional<absl::string_view> resource_type;
+  FHIR_RETURN_IF_ERROR(ForEachJsonMember(
+      raw_json,
+      [&](absl::string_view key, size_t* pos, bool* done) -> absl::Status {
+        if (key != "resourceType") {
+          return SkipJsonValue(raw_json, pos);
+        }
+        FHIR_ASSIGN_OR_RETURN(resource_type, ScanJsonString(raw_json, pos));
+        *done = true;
+        return absl::OkStatus();
+      }));
+  if (!resource_type.has_value()) {
+    return InvalidArgumentError("No resourceType in JSON object");
+  }
+  return *resource_type;
+}
+
+absl::Status Parser::MergeJsonFhirBundleIntoProto(
+    absl::string_view raw_json, Message* bundle,
+    const absl::TimeZone default_timezone, const bool validate,
+    const int num_threads) const {
+  const FieldDescriptor* entry_field =
+      bundle->GetDescriptor()->FindFieldByName("entry");
+  if (num_threads <= 1 || entry_field == nullptr ||
+      !entry_field->is_repeated() || IsProfile(bundle->GetDescriptor())) {
+    return MergeJsonFhirStringIntoProto(raw_json, bundle, default_timezone,
+                                        validate);
+  }
+
+  // A pre-pass finds the entries by skipping over them without parsing them,
+  // and copies the other members of the Bundle, which are few and small.
+  // As when parsing sequentially, the last of duplicate keys wins; an "entry"
+  // that is not an array is left for the sequential parser to reject.
+  std::vector<absl::string_view> entries;
+  absl::optional<absl::string_view> other_entry;
+  std::string fields = "{";
+  size_t end = 0;
+  FHIR_RETURN_IF_ERROR(ForEachJsonMember(
+      raw_json,
+      [&](absl::string_view key, size_t* pos, bool* done) -> absl::Status {
+        if (key == "entry") {
+          entries.clear();
+          other_entry.reset();
+          if (*pos < raw_json.size() && raw_json[*pos] == '[') {
+            return ScanJsonArray(raw_json, pos, &entries);
+          }
+        }
+        const size_t value_begin = *pos;
+        FHIR_RETURN_IF_ERROR(SkipJsonValue(raw_json, pos));
+        const absl::string_view value =
+            raw_json.substr(value_begin, *pos - value_begin);
+        if (key == "entry") {
+          other_entry = value;
+        } else {
+          absl::StrAppend(&fields, fields.size() > 1 ? "," : "", "\"", key,
+                          "\":", value);
+        }
+        return absl::OkStatus();
+      },
+      &end));
+  if (SkipJsonWhitespace(raw_json, end) != raw_json.size()) {
+    return InvalidArgumentError(
+        absl::StrCat("Unexpected data after the Bundle at offset ", end));
+  }
+  if (other_entry.has_value()) {
+    absl::StrAppend(&fields, fields.size() > 1 ? "," : "", "\"entry\":",
+                    *other_entry);
+  }
+  fields.push_back('}');
+  FHIR_RETURN_IF_ERROR(
+      MergeJsonFhirStringIntoProto(fields, bundle, default_timezone, false));
+
+  // The entries are added up front, in order, so that each thread parses into
+  // its own.
+  const Reflection* reflection = bundle->GetReflection();
+  RepeatedPtrField<Message>* entry_messages =
+      reflection->MutableRepeatedPtrField<Message>(bundle, entry_field);
+  const int first_entry = entry_messages->size();
+  entry_messages->Reserve(first_entry + entries.size());
+  for (size_t i = 0; i < entries.size(); i++) {
+    reflection->AddMessage(bundle, entry_field);
+  }
+
+  std::vector<absl::Status> statuses(entries.size());
+  // Entries after the first one that failed are skipped.
+  std::atomic<size_t> first_failed(std::numeric_limits<size_t>::max());
+  ParallelForEach(entries.size(), num_threads, [&](size_t i) {
+    if (i > first_failed.load(std::memory_order_relaxed)) {
+      return;
+    }
+    const absl::Status status = MergeJsonFhirStringIntoProto(
+        entries[i], entry_messages->Mutable(first_entry + i), default_timezone,
+        false);
+    if (status.ok()) {
+      return;
+    }
+    statuses[i] =
+        absl::Status(status.code(),
+                     absl::StrCat("Bundle entry ", i, ": ", status.message()));
+    size_t failed = first_failed.load();
+    while (i < failed && !first_failed.compare_exchange_weak(failed, i)) {
+    }
+  });
+  for (const absl::Status& status : statuses) {
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  if (validate) {
+    return ValidateResource(*bundle, primitive_handler_);
+  }
+  return absl::OkStatus();
+}
+
 }  // namespace fhir
 }  // namespace google
@@ -34,6 +34,7 @@
 #include "google/fhir/extensions.h"
 #include "google/fhir/fhir_types.h"
 #include "google/fhir/json_format.h"
+#include "google/fhir/json_string.h"
 #include "google/fhir/primitive_handler.h"
 #include "google/fhir/primitive_wrapper.h"
 #include "google/fhir/proto_util.h"
@@ -269,7 +270,7 @@ class Printer {
       std::string scratch;
       FHIR_ASSIGN_OR_RETURN(const std::string& reference_value,
                             GetPrimitiveStringValue(proto, &scratch));
-      absl::StrAppend(&output_, "\"", reference_value, "\"");
+      AppendJsonString(reference_value, &output_);
       return absl::OkStatus();
     }
     FHIR_ASSIGN_OR_RETURN(const JsonPrimitive json_primitive,
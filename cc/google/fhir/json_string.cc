@@ -0,0 +1,189 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "google/fhir/json_string.h"
+
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace google {
+namespace fhir {
+
+namespace {
+
+constexpr char kHexDigits[] = "0123456789abcdef";
+
+bool IsContinuation(uint8_t c) { return (c & 0xc0) == 0x80; }
+
+// Returns the length of the valid UTF-8 sequence at the start of the size
+// bytes at s, which start with a non-ASCII byte, or 0 if there is none.
+size_t Utf8SequenceLength(const uint8_t* s, size_t size) {
+  const uint8_t c = s[0];
+  if (c >= 0xc2 && c <= 0xdf) {
+    return size >= 2 && IsContinuation(s[1]) ? 2 : 0;
+  }
+  if (c >= 0xe0 && c <= 0xef) {
+    if (size < 3 || !IsContinuation(s[2])) {
+      return 0;
+    }
+    // Excludes overlong encodings and surrogates.
+    const uint8_t lower = c == 0xe0 ? 0xa0 : 0x80;
+    const uint8_t upper = c == 0xed ? 0x9f : 0xbf;
+    return s[1] >= lower && s[1] <= upper ? 3 : 0;
+  }
+  if (c >= 0xf0 && c <= 0xf4) {
+    if (size < 4 || !IsContinuation(s[2]) || !IsContinuation(s[3])) {
+      return 0;
+    }
+    // Excludes overlong encodings and code points beyond U+10FFFF.
+    const uint8_t lower = c == 0xf0 ? 0x90 : 0x80;
+    const uint8_t upper = c == 0xf4 ? 0x8f : 0xbf;
+    return s[1] >= lower && s[1] <= upper ? 4 : 0;
+  }
+  return 0;
+}
+
+// Whether c must be escaped in a JSON string or is not ASCII.
+bool IsSpecial(uint8_t c) {
+  return c < 0x20 || c == '"' || c == '\\' || c >= 0x80;
+}
+
+#if defined(__SSE2__)
+
+// Returns a bit for each of the 16 bytes at s for which IsSpecial is true.
+int SpecialMask(const uint8_t* s) {
+  const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+  // As a signed comparison, bytes of 0x80 and over are less than 0x20 too.
+  const __m128i special = _mm_or_si128(
+      _mm_cmplt_epi8(in, _mm_set1_epi8(0x20)),
+      _mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('"')),
+                   _mm_cmpeq_epi8(in, _mm_set1_epi8('\\'))));
+  return _mm_movemask_epi8(special);
+}
+
+#endif
+
+// Returns the index of the first byte from i on for which IsSpecial is true,
+// or size if there is none.
+size_t FindSpecial(const uint8_t* s, size_t size, size_t i) {
+#if defined(__SSE2__)
+  for (; size - i >= 16; i += 16) {
+    const int mask = SpecialMask(s + i);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+  while (i < size && !IsSpecial(s[i])) {
+    i++;
+  }
+  return i;
+}
+
+void AppendEscaped(uint8_t c, std::string* output) {
+  switch (c) {
+    case '"':
+      output->append("\\\"");
+      return;
+    case '\\':
+      output->append("\\\\");
+      return;
+    case '\b':
+      output->append("\\b");
+      return;
+    case '\f':
+      output->append("\\f");
+      return;
+    case '\n':
+      output->append("\\n");
+      return;
+    case '\r':
+      output->append("\\r");
+      return;
+    case '\t':
+      output->append("\\t");
+      return;
+  }
+  if (c < 0x20) {
+    const char escaped[] = {'\\', 'u', '0', '0', kHexDigits[c >> 4],
+                            kHexDigits[c & 0xf]};
+    output->append(escaped, sizeof(escaped));
+  } else {
+    output->append("\\ufffd");
+  }
+}
+
+}  // namespace
+
+void AppendJsonString(absl::string_view value, std::string* output) {
+  const uint8_t* const s = reinterpret_cast<const uint8_t*>(value.data());
+  const size_t size = value.size();
+  output->reserve(output->size() + size + 2);
+  output->push_back('"');
+
+  // The end of the part of value that has been appended to output.
+  size_t copied = 0;
+  size_t i = 0;
+  while ((i = FindSpecial(s, size, i)) < size) {
+    if (s[i] >= 0x80) {
+      const size_t length = Utf8SequenceLength(s + i, size - i);
+      if (length > 0) {
+        i += length;
+        continue;
+      }
+    }
+    output->append(value.data() + copied, i - copied);
+    AppendEscaped(s[i], output);
+    copied = ++i;
+  }
+  output->append(value.data() + copied, size - copied);
+  output->push_back('"');
+}
+
+bool IsValidUtf8(absl::string_view text) {
+  const uint8_t* const s = reinterpret_cast<const uint8_t*>(text.data());
+  const size_t size = text.size();
+  size_t i = 0;
+  while (i < size) {
+#if defined(__SSE2__)
+    // Skips blocks that are all ASCII.
+    while (size - i >= 16 &&
+           _mm_movemask_epi8(_mm_loadu_si128(
+               reinterpret_cast<const __m128i*>(s + i))) == 0) {
+      i += 16;
+    }
+    if (i == size) {
+      break;
+    }
+#endif
+    if (s[i] < 0x80) {
+      i++;
+      continue;
+    }
+    const size_t length = Utf8SequenceLength(s + i, size - i);
+    if (length == 0) {
+      return false;
+    }
+    i += length;
+  }
+  return true;
+}
+
+}  // namespace fhir
+}  // namespace google
@@ -0,0 +1,45 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GOOGLE_FHIR_JSON_STRING_H_
+#define GOOGLE_FHIR_JSON_STRING_H_
+
+#include <string>
+
+#include "absl/strings/string_view.h"
+
+namespace google {
+namespace fhir {
+
+// Escaping and validation of the text of JSON strings, which for narrative
+// and other free text make up most of a resource. With SSE2, text is scanned
+// 16 bytes at a time, and runs of ASCII that need no escaping are copied
+// whole; the output is the same without it.
+
+// Appends value to output as a quoted JSON string. Quotes, backslashes and
+// control characters are escaped, and valid UTF-8 is copied as is, as the
+// FHIR JSON format is UTF-8. Each byte that is not part of a valid UTF-8
+// sequence is replaced with an escaped U+FFFD replacement character.
+void AppendJsonString(absl::string_view value, std::string* output);
+
+// Returns whether text is valid UTF-8, without overlong encodings, surrogates
+// or code points beyond U+10FFFF.
+bool IsValidUtf8(absl::string_view text);
+
+}  // namespace fhir
+}  // namespace google
+
+#endif  // GOOGLE_FHIR_JSON_STRING_H_
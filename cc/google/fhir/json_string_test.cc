@@ -0,0 +1,89 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "google/fhir/json_string.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace google {
+namespace fhir {
+
+namespace {
+
+std::string ToJson(absl::string_view value) {
+  std::string output;
+  AppendJsonString(value, &output);
+  return output;
+}
+
+TEST(AppendJsonStringTest, EscapesSpecialCharacters) {
+  EXPECT_EQ(ToJson(""), "\"\"");
+  EXPECT_EQ(ToJson("plain text"), "\"plain text\"");
+  EXPECT_EQ(ToJson("a\"b\\c/d"), "\"a\\\"b\\\\c/d\"");
+  EXPECT_EQ(ToJson("\b\f\n\r\t"), "\"\\b\\f\\n\\r\\t\"");
+  EXPECT_EQ(ToJson(std::string("\x01\x1f\x7f\0", 4)),
+            "\"\\u0001\\u001f\x7f\\u0000\"");
+
+  std::string output = "prefix";
+  AppendJsonString("x", &output);
+  EXPECT_EQ(output, "prefix\"x\"");
+}
+
+TEST(AppendJsonStringTest, EscapesWithinLongText) {
+  const std::string run(37, 'x');
+  EXPECT_EQ(ToJson(run + "\"" + run + "\n" + run),
+            "\"" + run + "\\\"" + run + "\\n" + run + "\"");
+  EXPECT_EQ(ToJson("<div xmlns=\"http://www.w3.org/1999/xhtml\">text</div>"),
+            "\"<div xmlns=\\\"http://www.w3.org/1999/xhtml\\\">text</div>\"");
+}
+
+TEST(AppendJsonStringTest, CopiesUtf8) {
+  const std::string text =
+      "caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80 and more text after it";
+  EXPECT_EQ(ToJson(text), "\"" + text + "\"");
+}
+
+TEST(AppendJsonStringTest, ReplacesInvalidUtf8) {
+  EXPECT_EQ(ToJson("a\xff" "b"), "\"a\\ufffdb\"");
+  EXPECT_EQ(ToJson("a\xc3"), "\"a\\ufffd\"");
+  EXPECT_EQ(ToJson("\xed\xa0\x80"), "\"\\ufffd\\ufffd\\ufffd\"");
+  EXPECT_EQ(ToJson("\xc0\xaf"), "\"\\ufffd\\ufffd\"");
+}
+
+TEST(IsValidUtf8Test, AcceptsValidText) {
+  EXPECT_TRUE(IsValidUtf8(""));
+  EXPECT_TRUE(IsValidUtf8("plain ASCII text that spans several blocks"));
+  EXPECT_TRUE(IsValidUtf8("\xc2\x80 \xdf\xbf \xe0\xa0\x80 \xef\xbf\xbf"));
+  EXPECT_TRUE(IsValidUtf8("\xf0\x90\x80\x80 \xf4\x8f\xbf\xbf"));
+  EXPECT_TRUE(IsValidUtf8(std::string(40, 'a') + "\xe2\x82\xac"));
+}
+
+TEST(IsValidUtf8Test, RejectsInvalidText) {
+  for (const char* text :
+       {"\x80", "\xc3", "\xc0\xaf", "\xc1\xbf", "\xe0\x80\xaf", "\xed\xa0\x80",
+        "\xf0\x80\x80\xaf", "\xf4\x90\x80\x80", "\xf5\x80\x80\x80", "\xff",
+        "\xe2\x82"}) {
+    EXPECT_FALSE(IsValidUtf8(text)) << text;
+    EXPECT_FALSE(IsValidUtf8(std::string(40, 'a') + text)) << text;
+  }
+}
+
+}  // namespace
+
+}  // namespace fhir
+}  // namespace google
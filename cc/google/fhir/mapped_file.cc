@@ -0,0 +1,237 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "google/fhir/mapped_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "google/fhir/ndjson.h"
+#include "google/fhir/parallel.h"
+#include "google/fhir/status/status.h"
+#include "google/fhir/status/statusor.h"
+
+namespace google {
+namespace fhir {
+
+namespace {
+
+absl::Status FileError(absl::string_view operation, const std::string& path) {
+  const std::string message =
+      absl::StrCat("Failed to ", operation, " ", path, ": ", strerror(errno));
+  return errno == ENOENT ? absl::NotFoundError(message)
+                         : absl::InternalError(message);
+}
+
+// Splits the contents into chunks of at least chunk_size bytes, each ending
+// just after a newline, except for the last one.
+std::vector<absl::string_view> SplitAtNewlines(absl::string_view contents,
+                                               size_t chunk_size) {
+  chunk_size = std::max<size_t>(chunk_size, 1);
+  std::vector<absl::string_view> chunks;
+  while (!contents.empty()) {
+    size_t end = contents.size();
+    if (contents.size() > chunk_size) {
+      const size_t newline = contents.find('\n', chunk_size - 1);
+      if (newline != absl::string_view::npos) {
+        end = newline + 1;
+      }
+    }
+    chunks.push_back(contents.substr(0, end));
+    contents.remove_prefix(end);
+  }
+  return chunks;
+}
+
+// Consumes the varint at the start of input into value. Returns false if
+// input does not start with a complete varint of at most 64 bits.
+bool ConsumeVarint(absl::string_view* input, uint64_t* value) {
+  *value = 0;
+  for (size_t i = 0; i < input->size() && i < 10; i++) {
+    const uint8_t byte = static_cast<uint8_t>((*input)[i]);
+    *value |= static_cast<uint64_t>(byte & 0x7f) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      input->remove_prefix(i + 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Consumes the delimited record at the start of input into record.
+bool ConsumeDelimited(absl::string_view* input, absl::string_view* record) {
+  uint64_t size;
+  if (!ConsumeVarint(input, &size) || size > input->size()) {
+    return false;
+  }
+  *record = input->substr(0, size);
+  input->remove_prefix(size);
+  return true;
+}
+
+// Splits the contents into chunks of whole delimited records, of at least
+// chunk_size bytes except for the last one.
+absl::StatusOr<std::vector<absl::string_view>> SplitDelimited(
+    absl::string_view contents, size_t chunk_size) {
+  std::vector<absl::string_view> chunks;
+  absl::string_view rest = contents;
+  const char* chunk_begin = rest.data();
+  while (!rest.empty()) {
+    const size_t offset = rest.data() - contents.data();
+    absl::string_view record;
+    if (!ConsumeDelimited(&rest, &record)) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Truncated record at offset ", offset));
+    }
+    const size_t size = rest.data() - chunk_begin;
+    if (size >= chunk_size || rest.empty()) {
+      chunks.emplace_back(chunk_begin, size);
+      chunk_begin = rest.data();
+    }
+  }
+  return chunks;
+}
+
+// Calls for_each_record for each chunk on num_threads threads, which in turn
+// calls visit for each record of the chunk in order until visit returns
+// false. Returns the error of fn for the earliest record it failed for.
+absl::Status ProcessChunks(
+    absl::string_view contents, const std::vector<absl::string_view>& chunks,
+    int num_threads,
+    const std::function<
+        void(absl::string_view chunk,
+             const std::function<bool(absl::string_view record)>& visit)>&
+        for_each_record,
+    const std::function<absl::Status(absl::string_view record)>& fn) {
+  std::vector<absl::Status> statuses(chunks.size());
+  // Chunks after the first one that failed are skipped. Those before it are
+  // still processed, since they may hold earlier failures.
+  std::atomic<size_t> first_failed(std::numeric_limits<size_t>::max());
+
+  ParallelForEach(chunks.size(), num_threads, [&](size_t chunk) {
+    for_each_record(chunks[chunk], [&](absl::string_view record) {
+      if (chunk > first_failed.load(std::memory_order_relaxed)) {
+        return false;
+      }
+      const absl::Status status = fn(record);
+      if (status.ok()) {
+        return true;
+      }
+      statuses[chunk] = absl::Status(
+          status.code(),
+          absl::StrCat("Record at offset ", record.data() - contents.data(),
+                       ": ", status.message()));
+      size_t failed = first_failed.load();
+      while (chunk < failed &&
+             !first_failed.compare_exchange_weak(failed, chunk)) {
+      }
+      return false;
+    });
+  });
+
+  for (const absl::Status& status : statuses) {
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::StatusOr<std::unique_ptr<MappedFile>> MappedFile::Open(
+    const std::string& path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return FileError("open", path);
+  }
+  struct stat stat_buffer;
+  if (fstat(fd, &stat_buffer) != 0) {
+    const absl::Status status = FileError("stat", path);
+    close(fd);
+    return status;
+  }
+
+  const size_t size = stat_buffer.st_size;
+  void* data = nullptr;
+  // Empty files cannot be mapped.
+  if (size > 0) {
+    data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      const absl::Status status = FileError("map", path);
+      close(fd);
+      return status;
+    }
+  }
+  // The mapping outlives the file descriptor.
+  close(fd);
+  return absl::WrapUnique(new MappedFile(data, size));
+}
+
+MappedFile::~MappedFile() {
+  if (size_ > 0) {
+    munmap(data_, size_);
+  }
+}
+
+absl::Status ForEachNdjsonRecord(
+    absl::string_view contents, const RecordFileOptions& options,
+    const std::function<absl::Status(absl::string_view record)>& fn) {
+  return ProcessChunks(
+      contents, SplitAtNewlines(contents, options.chunk_size),
+      options.num_threads,
+      [](absl::string_view chunk,
+         const std::function<bool(absl::string_view record)>& visit) {
+        NdjsonReader reader(chunk);
+        absl::string_view record;
+        while (reader.Next(&record) && visit(record)) {
+        }
+      },
+      fn);
+}
+
+absl::Status ForEachDelimitedRecord(
+    absl::string_view contents, const RecordFileOptions& options,
+    const std::function<absl::Status(absl::string_view record)>& fn) {
+  // Framing the records is cheap next to parsing them, and finds truncated
+  // files before any records are processed.
+  FHIR_ASSIGN_OR_RETURN(const std::vector<absl::string_view> chunks,
+                        SplitDelimited(contents, options.chunk_size));
+  return ProcessChunks(
+      contents, chunks, options.num_threads,
+      [](absl::string_view chunk,
+         const std::function<bool(absl::string_view record)>& visit) {
+        absl::string_view record;
+        while (ConsumeDelimited(&chunk, &record) && visit(record)) {
+        }
+      },
+      fn);
+}
+
+}  // namespace fhir
+}  // namespace google
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GOOGLE_FHIR_MAPPED_FILE_H_
+#define GOOGLE_FHIR_MAPPED_FILE_H_
+
+#include <stddef.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+
+namespace google {
+namespace fhir {
+
+// A file mapped read-only into memory, so that its records can be parsed from
+// string_views into the mapping rather than from copies of the file. Files
+// that are already in the page cache are then read without any copying.
+class MappedFile {
+ public:
+  static absl::StatusOr<std::unique_ptr<MappedFile>> Open(
+      const std::string& path);
+
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // The contents of the file, valid for the lifetime of this MappedFile.
+  absl::string_view contents() const {
+    return absl::string_view(static_cast<const char*>(data_), size_);
+  }
+
+ private:
+  MappedFile(void* data, size_t size) : data_(data), size_(size) {}
+
+  void* const data_;
+  const size_t size_;
+};
+
+struct RecordFileOptions {
+  // The number of threads, including the calling thread, that records are
+  // processed on.
+  int num_threads = 1;
+
+  // The approximate number of bytes of records handed to a thread at a time.
+  // Records are processed in order within each chunk.
+  size_t chunk_size = 4 << 20;
+};
+
+// Calls fn for each record of the NDJSON contents, e.g. of a MappedFile. The
+// contents are split into chunks at newlines, and the records of the chunks
+// are framed with NdjsonReader and processed concurrently on
+// options.num_threads threads, so fn must be thread safe. Records must be on a
+// single line each.
+//
+// Once fn fails for a record, the remaining records are skipped, and the
+// error for the earliest such record is returned along with its offset
+// within the contents.
+absl::Status ForEachNdjsonRecord(
+    absl::string_view contents, const RecordFileOptions& options,
+    const std::function<absl::Status(absl::string_view record)>& fn);
+
+// As ForEachNdjsonRecord, for contents of binary protos each preceded by its
+// size as a varint, as written by SerializeDelimitedToOstream. Returns
+// InvalidArgument, without processing any records, if a record is truncated.
+absl::Status ForEachDelimitedRecord(
+    absl::string_view contents, const RecordFileOptions& options,
+    const std::function<absl::Status(absl::string_view record)>& fn);
+
+}  // namespace fhir
+}  // namespace google
+
+#endif  // GOOGLE_FHIR_MAPPED_FILE_H_
@@ -0,0 +1,153 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "google/fhir/mapped_file.h"
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+
+namespace google {
+namespace fhir {
+
+namespace {
+
+using ::testing::ElementsAreArray;
+using ::testing::IsEmpty;
+
+std::string WriteFile(const std::string& name, const std::string& contents) {
+  const std::string path = absl::StrCat(testing::TempDir(), "/", name);
+  std::ofstream output(path, std::ios::binary);
+  output << contents;
+  return path;
+}
+
+// Returns the records of the contents processed on several threads, in order.
+std::vector<std::string> CollectRecords(
+    absl::string_view contents,
+    absl::Status (*for_each)(
+        absl::string_view, const RecordFileOptions&,
+        const std::function<absl::Status(absl::string_view)>&)) {
+  RecordFileOptions options;
+  options.num_threads = 4;
+  options.chunk_size = 16;
+  absl::Mutex mutex;
+  std::vector<std::pair<const char*, std::string>> records;
+  const absl::Status status =
+      for_each(contents, options, [&](absl::string_view record) {
+        absl::MutexLock lock(&mutex);
+        records.emplace_back(record.data(), std::string(record));
+        return absl::OkStatus();
+      });
+  EXPECT_TRUE(status.ok()) << status;
+  std::sort(records.begin(), records.end());
+  std::vector<std::string> strings;
+  for (const auto& record : records) {
+    strings.push_back(record.second);
+  }
+  return strings;
+}
+
+TEST(MappedFileTest, MapsContents) {
+  const std::string contents = "{\"a\":1}\n{\"b\":2}\n";
+  absl::StatusOr<std::unique_ptr<MappedFile>> file =
+      MappedFile::Open(WriteFile("contents.ndjson", contents));
+  ASSERT_TRUE(file.ok()) << file.status();
+  EXPECT_EQ((*file)->contents(), contents);
+
+  file = MappedFile::Open(WriteFile("empty.ndjson", ""));
+  ASSERT_TRUE(file.ok()) << file.status();
+  EXPECT_THAT((*file)->contents(), IsEmpty());
+
+  EXPECT_EQ(MappedFile::Open(absl::StrCat(testing::TempDir(), "/missing"))
+                .status()
+                .code(),
+            absl::StatusCode::kNotFound);
+}
+
+TEST(ForEachNdjsonRecordTest, ProcessesAllRecords) {
+  std::vector<std::string> lines;
+  std::string contents;
+  for (int i = 0; i < 200; i++) {
+    lines.push_back(absl::StrCat("{\"id\":\"", std::string(i % 40, 'x'), i,
+                                 "\"}"));
+    absl::StrAppend(&contents, lines.back(), i % 3 == 0 ? "\r\n\n" : "\n");
+  }
+  contents.pop_back();
+  EXPECT_THAT(CollectRecords(contents, &ForEachNdjsonRecord),
+              ElementsAreArray(lines));
+}
+
+TEST(ForEachNdjsonRecordTest, ReturnsEarliestError) {
+  std::string contents;
+  for (int i = 0; i < 100; i++) {
+    absl::StrAppend(&contents, i, "\n");
+  }
+  RecordFileOptions options;
+  options.num_threads = 4;
+  options.chunk_size = 8;
+  const absl::Status status =
+      ForEachNdjsonRecord(contents, options, [](absl::string_view record) {
+        return record.size() == 2 && record[1] == '7'
+                   ? absl::InvalidArgumentError(record)
+                   : absl::OkStatus();
+      });
+  EXPECT_EQ(status, absl::InvalidArgumentError("Record at offset 41: 17"));
+}
+
+TEST(ForEachDelimitedRecordTest, ProcessesAllRecords) {
+  std::vector<std::string> records;
+  std::string contents;
+  for (int size : {0, 1, 127, 128, 300, 5, 20000}) {
+    records.push_back(std::string(size, 'a' + records.size()));
+    // The size as a varint.
+    for (int rest = size; true; rest >>= 7) {
+      if (rest < 0x80) {
+        contents.push_back(static_cast<char>(rest));
+        break;
+      }
+      contents.push_back(static_cast<char>((rest & 0x7f) | 0x80));
+    }
+    contents += records.back();
+  }
+  EXPECT_THAT(CollectRecords(contents, &ForEachDelimitedRecord),
+              ElementsAreArray(records));
+
+  int processed = 0;
+  EXPECT_EQ(ForEachDelimitedRecord(contents.substr(0, contents.size() - 1),
+                                   RecordFileOptions(),
+                                   [&](absl::string_view) {
+                                     processed++;
+                                     return absl::OkStatus();
+                                   }),
+            absl::InvalidArgumentError("Truncated record at offset 569"));
+  EXPECT_EQ(processed, 0);
+}
+
+}  // namespace
+
+}  // namespace fhir
+}  // namespace google
@@ -0,0 +1,267 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "google/fhir/ndjson.h"
+
+#include <string.h>
+
+#include <vector>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace google {
+namespace fhir {
+
+namespace {
+
+constexpr size_t kBlockSize = 64;
+
+// The bits of the characters of interest in a block of 64 bytes, where bit i
+// stands for byte i.
+struct BlockMasks {
+  uint64_t newline = 0;
+  uint64_t quote = 0;
+  uint64_t backslash = 0;
+  // "{" and "[".
+  uint64_t open = 0;
+  // "}" and "]".
+  uint64_t close = 0;
+};
+
+#if defined(__SSE2__)
+
+uint64_t MatchMask(const __m128i (&chunks)[4], char c) {
+  const __m128i needle = _mm_set1_epi8(c);
+  uint64_t mask = 0;
+  for (int i = 0; i < 4; i++) {
+    const uint32_t bits = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(chunks[i], needle)));
+    mask |= static_cast<uint64_t>(bits) << (16 * i);
+  }
+  return mask;
+}
+
+BlockMasks ClassifyBlock(const char* block, bool multi_line_records) {
+  __m128i chunks[4];
+  for (int i = 0; i < 4; i++) {
+    chunks[i] =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i));
+  }
+  BlockMasks masks;
+  masks.newline = MatchMask(chunks, '\n');
+  if (multi_line_records) {
+    masks.quote = MatchMask(chunks, '"');
+    masks.backslash = MatchMask(chunks, '\\');
+    // "[" and "]" differ from "{" and "}" only in bit 0x20, and no other
+    // characters become brackets when it is set.
+    __m128i folded[4];
+    for (int i = 0; i < 4; i++) {
+      folded[i] = _mm_or_si128(chunks[i], _mm_set1_epi8(0x20));
+    }
+    masks.open = MatchMask(folded, '{');
+    masks.close = MatchMask(folded, '}');
+  }
+  return masks;
+}
+
+#else
+
+BlockMasks ClassifyBlock(const char* block, bool multi_line_records) {
+  BlockMasks masks;
+  for (size_t i = 0; i < kBlockSize; i++) {
+    const uint64_t bit = uint64_t{1} << i;
+    switch (block[i]) {
+      case '\n':
+        masks.newline |= bit;
+        break;
+      case '"':
+        masks.quote |= bit;
+        break;
+      case '\\':
+        masks.backslash |= bit;
+        break;
+      case '{':
+      case '[':
+        masks.open |= bit;
+        break;
+      case '}':
+      case ']':
+        masks.close |= bit;
+        break;
+    }
+  }
+  if (!multi_line_records) {
+    masks = BlockMasks{masks.newline};
+  }
+  return masks;
+}
+
+#endif
+
+// Returns the bits of the characters that are escaped by a backslash, given
+// the bits of the backslashes of a block. A run of backslashes escapes every
+// other character from its start, so runs starting on odd and even bits are
+// told apart with an addition that carries across each run. carry is set if
+// the first character of the next block is escaped.
+uint64_t FindEscaped(uint64_t backslash, uint64_t* carry) {
+  constexpr uint64_t kEvenBits = 0x5555555555555555ULL;
+  backslash &= ~*carry;
+  const uint64_t follows_escape = (backslash << 1) | *carry;
+  const uint64_t odd_starts = backslash & ~kEvenBits & ~follows_escape;
+  const uint64_t even_runs = odd_starts + backslash;
+  *carry = even_runs < odd_starts ? 1 : 0;
+  return (kEvenBits ^ (even_runs << 1)) & follows_escape;
+}
+
+// Returns the bits from each unescaped quote up to the next one, exclusive,
+// i.e. the opening quote and the contents of each string.
+uint64_t PrefixXor(uint64_t bits) {
+  bits ^= bits << 1;
+  bits ^= bits << 2;
+  bits ^= bits << 4;
+  bits ^= bits << 8;
+  bits ^= bits << 16;
+  bits ^= bits << 32;
+  return bits;
+}
+
+int CountTrailingZeros(uint64_t bits) {
+#if defined(__GNUC__)
+  return __builtin_ctzll(bits);
+#else
+  int count = 0;
+  while ((bits & 1) == 0) {
+    bits >>= 1;
+    count++;
+  }
+  return count;
+#endif
+}
+
+}  // namespace
+
+NdjsonReader::NdjsonReader(absl::string_view input,
+                           const NdjsonOptions& options)
+    : input_(input), options_(options) {}
+
+void NdjsonReader::ScanBlock() {
+  const char* block = input_.data() + block_begin_;
+  // The last partial block is padded with spaces, which are never structural.
+  char padded[kBlockSize];
+  if (input_.size() - block_begin_ < kBlockSize) {
+    memset(padded, ' ', kBlockSize);
+    memcpy(padded, block, input_.size() - block_begin_);
+    block = padded;
+  }
+
+  const BlockMasks masks = ClassifyBlock(block, options_.multi_line_records);
+  if (!options_.multi_line_records) {
+    structural_ = masks.newline;
+    return;
+  }
+
+  const uint64_t quote =
+      masks.quote & ~FindEscaped(masks.backslash, &escaped_carry_);
+  const uint64_t in_string = PrefixXor(quote) ^ in_string_carry_;
+  // All ones if the block ends within a string, all zeros otherwise.
+  in_string_carry_ =
+      static_cast<uint64_t>(static_cast<int64_t>(in_string) >> 63);
+  structural_ = (masks.newline | masks.open | masks.close) & ~in_string;
+}
+
+bool NdjsonReader::Next(absl::string_view* record) {
+  while (block_begin_ < input_.size()) {
+    if (!scanned_) {
+      ScanBlock();
+      scanned_ = true;
+    }
+    while (structural_ != 0) {
+      const size_t index = block_begin_ + CountTrailingZeros(structural_);
+      structural_ &= structural_ - 1;
+      switch (input_[index]) {
+        case '\n': {
+          if (depth_ > 0) {
+            break;
+          }
+          const absl::string_view line = absl::StripAsciiWhitespace(
+              input_.substr(record_begin_, index - record_begin_));
+          record_begin_ = index + 1;
+          if (!line.empty()) {
+            record_offset_ = line.data() - input_.data();
+            *record = line;
+            return true;
+          }
+          break;
+        }
+        case '{':
+        case '[':
+          depth_++;
+          break;
+        default:
+          if (depth_ == 0) {
+            if (status_.ok()) {
+              status_ = absl::InvalidArgumentError(absl::StrCat(
+                  "Unbalanced '", input_.substr(index, 1),
+                  "' in JSON record at offset ", index));
+            }
+          } else {
+            depth_--;
+          }
+          break;
+      }
+    }
+    block_begin_ += kBlockSize;
+    scanned_ = false;
+  }
+
+  // The last record need not end with a newline.
+  const absl::string_view rest =
+      absl::StripAsciiWhitespace(input_.substr(record_begin_));
+  record_begin_ = input_.size();
+  if (rest.empty()) {
+    return false;
+  }
+  record_offset_ = rest.data() - input_.data();
+  if ((depth_ > 0 || in_string_carry_ != 0) && status_.ok()) {
+    status_ = absl::InvalidArgumentError(
+        absl::StrCat("Unexpected end of input in JSON record at offset ",
+                     record_offset_));
+  }
+  *record = rest;
+  return true;
+}
+
+absl::StatusOr<std::vector<absl::string_view>> SplitNdjson(
+    absl::string_view input, const NdjsonOptions& options) {
+  NdjsonReader reader(input, options);
+  std::vector<absl::string_view> records;
+  absl::string_view record;
+  while (reader.Next(&record)) {
+    records.push_back(record);
+  }
+  if (!reader.status().ok()) {
+    return reader.status();
+  }
+  return records;
+}
+
+}  // namespace fhir
+}  // namespace google
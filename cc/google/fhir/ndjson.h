@@ -0,0 +1,111 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GOOGLE_FHIR_NDJSON_H_
+#define GOOGLE_FHIR_NDJSON_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+
+namespace google {
+namespace fhir {
+
+struct NdjsonOptions {
+  // If false, every line holds one record, as in NDJSON proper. If true, a
+  // record ends at the first newline outside of a JSON string once all of its
+  // objects and arrays are closed, so that pretty printed records may span
+  // several lines. Records must still be separated by a newline.
+  bool multi_line_records = false;
+};
+
+// Splits a buffer of newline delimited JSON into its records, without copying
+// them. The input is scanned 64 bytes at a time: each block is classified into
+// bitmasks of newlines, quotes, backslashes and brackets (with SSE2 where
+// available), from which the escaped quotes and the extent of strings are
+// derived with bitwise arithmetic, so that the cost per byte stays low and
+// does not depend on the length of the records.
+//
+// Records are returned with leading and trailing whitespace, including the
+// "\r" of "\r\n" line endings, removed. Blank lines are skipped. The input
+// must outlive the records. Example:
+//
+//   NdjsonReader reader(contents);
+//   absl::string_view record;
+//   while (reader.Next(&record)) {
+//     ...
+//   }
+//   FHIR_RETURN_IF_ERROR(reader.status());
+class NdjsonReader {
+ public:
+  explicit NdjsonReader(absl::string_view input,
+                        const NdjsonOptions& options = NdjsonOptions());
+
+  NdjsonReader(const NdjsonReader&) = delete;
+  NdjsonReader& operator=(const NdjsonReader&) = delete;
+
+  // Sets record to the next record and returns true, or returns false at the
+  // end of the input.
+  bool Next(absl::string_view* record);
+
+  // Returns the offset within the input of the last record returned by Next,
+  // for error messages.
+  size_t offset() const { return record_offset_; }
+
+  // Returns InvalidArgument if the input ended within a string, object or
+  // array of a multi-line record, or closed more objects and arrays than it
+  // opened. The records returned up to that point are still valid. Always OK
+  // for single line records, which are not inspected.
+  absl::Status status() const { return status_; }
+
+ private:
+  // Classifies the block starting at block_begin_ into structural_.
+  void ScanBlock();
+
+  const absl::string_view input_;
+  const NdjsonOptions options_;
+  absl::Status status_;
+
+  // The start of the record being framed, and of the last one returned.
+  size_t record_begin_ = 0;
+  size_t record_offset_ = 0;
+
+  // The start of the current 64 byte block, and the bits of its newlines and,
+  // for multi-line records, of its brackets outside of strings that have not
+  // been consumed yet.
+  size_t block_begin_ = 0;
+  uint64_t structural_ = 0;
+  bool scanned_ = false;
+
+  // State carried from one block to the next for multi-line records.
+  uint64_t escaped_carry_ = 0;
+  uint64_t in_string_carry_ = 0;
+  int depth_ = 0;
+};
+
+// Returns all records of the input. See NdjsonReader.
+absl::StatusOr<std::vector<absl::string_view>> SplitNdjson(
+    absl::string_view input, const NdjsonOptions& options = NdjsonOptions());
+
+}  // namespace fhir
+}  // namespace google
+
+#endif  // GOOGLE_FHIR_NDJSON_H_
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "google/fhir/ndjson.h"
+
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+
+namespace google {
+namespace fhir {
+
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+NdjsonOptions MultiLine() {
+  NdjsonOptions options;
+  options.multi_line_records = true;
+  return options;
+}
+
+TEST(NdjsonReaderTest, SplitsLines) {
+  const std::string input =
+      "{\"resourceType\":\"Patient\"}\r\n\n  \n{\"id\":\"1\"}\n  [1, 2]";
+  EXPECT_THAT(SplitNdjson(input).value(),
+              ElementsAre("{\"resourceType\":\"Patient\"}", "{\"id\":\"1\"}",
+                          "[1, 2]"));
+  EXPECT_THAT(SplitNdjson("").value(), IsEmpty());
+  EXPECT_THAT(SplitNdjson("\n \r\n").value(), IsEmpty());
+}
+
+TEST(NdjsonReaderTest, ReportsOffsets) {
+  const std::string input = "{\"a\":1}\n\n  {\"b\":2}\n";
+  NdjsonReader reader(input);
+  absl::string_view record;
+  ASSERT_TRUE(reader.Next(&record));
+  EXPECT_EQ(reader.offset(), 0);
+  ASSERT_TRUE(reader.Next(&record));
+  EXPECT_EQ(record, "{\"b\":2}");
+  EXPECT_EQ(reader.offset(), 11);
+  EXPECT_FALSE(reader.Next(&record));
+  EXPECT_TRUE(reader.status().ok());
+}
+
+TEST(NdjsonReaderTest, SplitsLongLinesAcrossBlocks) {
+  std::vector<std::string> lines;
+  std::string input;
+  for (int length : {1, 63, 64, 65, 127, 128, 1000}) {
+    lines.push_back(absl::StrCat("\"", std::string(length, 'x'), "\""));
+    absl::StrAppend(&input, lines.back(), "\n");
+  }
+  const std::vector<absl::string_view> records = SplitNdjson(input).value();
+  ASSERT_EQ(records.size(), lines.size());
+  for (size_t i = 0; i < lines.size(); i++) {
+    EXPECT_EQ(records[i], lines[i]);
+  }
+}
+
+TEST(NdjsonReaderTest, SplitsMultiLineRecords) {
+  const std::string input = R"json({
+  "resourceType": "Patient",
+  "name": [{"given": ["{", "]\"\\"]}],
+  "id": "1"
+}
+{"resourceType": "Encounter",
+ "text": "}\\\"\n{"}
+)json";
+  EXPECT_THAT(SplitNdjson(input, MultiLine()).value(),
+              ElementsAre(R"json({
+  "resourceType": "Patient",
+  "name": [{"given": ["{", "]\"\\"]}],
+  "id": "1"
+})json",
+                          R"json({"resourceType": "Encounter",
+ "text": "}\\\"\n{"})json"));
+}
+
+TEST(NdjsonReaderTest, TracksStringsAcrossBlocks) {
+  // Runs of backslashes and strings that end in the next block.
+  std::string input;
+  std::vector<std::string> records;
+  for (int backslashes = 0; backslashes < 70; backslashes++) {
+    records.push_back(absl::StrCat(
+        "{\"a\":\n\"", std::string(2 * backslashes, '\\'), "\\\"{[\"}"));
+    absl::StrAppend(&input, records.back(), "\n");
+  }
+  const std::vector<absl::string_view> split =
+      SplitNdjson(input, MultiLine()).value();
+  ASSERT_EQ(split.size(), records.size());
+  for (size_t i = 0; i < records.size(); i++) {
+    EXPECT_EQ(split[i], records[i]);
+  }
+}
+
+TEST(NdjsonReaderTest, RejectsIncompleteMultiLineRecords) {
+  EXPECT_EQ(SplitNdjson("{\"a\":1}\n{\"b\":\n", MultiLine()).status(),
+            absl::InvalidArgumentError(
+                "Unexpected end of input in JSON record at offset 8"));
+  EXPECT_EQ(SplitNdjson("{\"a\":\"}\n", MultiLine()).status(),
+            absl::InvalidArgumentError(
+                "Unexpected end of input in JSON record at offset 0"));
+  EXPECT_EQ(SplitNdjson("{\"a\":1}}\n", MultiLine()).status(),
+            absl::InvalidArgumentError(
+                "Unbalanced '}' in JSON record at offset 7"));
+
+  // Single line records are not inspected.
+  EXPECT_THAT(SplitNdjson("{\"b\":\n").value(), ElementsAre("{\"b\":"));
+}
+
+}  // namespace
+
+}  // namespace fhir
+}  // namespace google
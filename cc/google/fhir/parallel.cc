@@ -0,0 +1,60 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "google/fhir/parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>  // NOLINT
+#include <vector>
+
+namespace google {
+namespace fhir {
+
+void ParallelFor(size_t size, int num_threads,
+                 const std::function<void(size_t begin, size_t end)>& fn) {
+  if (size == 0) {
+    return;
+  }
+
+  const size_t num_shards =
+      std::min(size, static_cast<size_t>(std::max(num_threads, 1)));
+  std::vector<std::thread> threads;
+  threads.reserve(num_shards - 1);
+  for (size_t shard = 1; shard < num_shards; ++shard) {
+    threads.emplace_back(fn, size * shard / num_shards,
+                         size * (shard + 1) / num_shards);
+  }
+  fn(0, size / num_shards);
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+void ParallelForEach(size_t size, int num_threads,
+                     const std::function<void(size_t index)>& fn) {
+  std::atomic<size_t> next_index(0);
+  ParallelFor(std::min(size, static_cast<size_t>(std::max(num_threads, 1))),
+              num_threads, [&](size_t, size_t) {
+                for (size_t index = next_index++; index < size;
+                     index = next_index++) {
+                  fn(index);
+                }
+              });
+}
+
+}  // namespace fhir
+}  // namespace google
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GOOGLE_FHIR_PARALLEL_H_
+#define GOOGLE_FHIR_PARALLEL_H_
+
+#include <stddef.h>
+
+#include <functional>
+
+namespace google {
+namespace fhir {
+
+// Splits the range [0, size) into up to num_threads contiguous shards of
+// roughly equal size and calls fn(begin, end) for each shard, each on its own
+// thread. The calling thread processes the first shard and returns once all
+// shards have been processed. fn is called on the calling thread alone if
+// num_threads is 1 or less.
+//
+// Shards are processed concurrently, so fn must be thread safe.
+void ParallelFor(size_t size, int num_threads,
+                 const std::function<void(size_t begin, size_t end)>& fn);
+
+// Calls fn(index) for each index in [0, size) on up to num_threads threads,
+// including the calling thread. Unlike ParallelFor, indices are handed out one
+// at a time to whichever thread is free next, which balances the load when the
+// cost of fn varies widely between indices. Returns once all indices have been
+// processed. fn is called on the calling thread alone if num_threads is 1 or
+// less.
+//
+// Indices are processed concurrently, so fn must be thread safe.
+void ParallelForEach(size_t size, int num_threads,
+                     const std::function<void(size_t index)>& fn);
+
+}  // namespace fhir
+}  // namespace google
+
+#endif  // GOOGLE_FHIR_PARALLEL_H_
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "google/fhir/parallel.h"
+
+#include <atomic>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace google {
+namespace fhir {
+
+namespace {
+
+using ::testing::Each;
+using ::testing::Eq;
+
+TEST(ParallelForTest, ProcessesEveryIndexOnce) {
+  for (int num_threads : {0, 1, 3, 8}) {
+    std::vector<std::atomic<int>> calls(100);
+    ParallelFor(calls.size(), num_threads, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        calls[i]++;
+      }
+    });
+    for (const std::atomic<int>& count : calls) {
+      EXPECT_EQ(count.load(), 1);
+    }
+  }
+}
+
+TEST(ParallelForTest, MoreThreadsThanElements) {
+  std::atomic<int> shards(0);
+  std::vector<int> seen(2, 0);
+  ParallelFor(seen.size(), 16, [&](size_t begin, size_t end) {
+    shards++;
+    for (size_t i = begin; i < end; ++i) {
+      seen[i]++;
+    }
+  });
+  EXPECT_EQ(shards.load(), 2);
+  EXPECT_THAT(seen, Each(Eq(1)));
+}
+
+TEST(ParallelForTest, EmptyRange) {
+  bool called = false;
+  ParallelFor(0, 4, [&](size_t, size_t) { called = true; });
+  EXPECT_FALSE(called);
+}
+
+TEST(ParallelForEachTest, ProcessesEveryIndexOnce) {
+  for (int num_threads : {0, 1, 3, 8}) {
+    std::vector<std::atomic<int>> calls(100);
+    ParallelForEach(calls.size(), num_threads,
+                    [&](size_t index) { calls[index]++; });
+    for (const std::atomic<int>& count : calls) {
+      EXPECT_EQ(count.load(), 1);
+    }
+  }
+}
+
+TEST(ParallelForEachTest, EmptyRange) {
+  bool called = false;
+  ParallelForEach(0, 4, [&](size_t index) { called = true; });
+  EXPECT_FALSE(called);
+}
+
+}  // namespace
+
+}  // namespace fhir
+}  // namespace google
@@ -31,6 +31,7 @@
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
 #include "absl/strings/escaping.h"
 #include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
@@ -89,6 +90,33 @@ absl::StatusOr<bool> HasPrimitiveHasNoValue(const Message& message) {
       boolean_msg, boolean_msg.GetDescriptor()->FindFieldByName("value"));
 }
 
+bool IsPlainDecimal(absl::string_view input) {
+  // Matches -?(0|[1-9][0-9]*)(\.[0-9]+)?
+  size_t i = 0;
+  if (i < input.size() && input[i] == '-') {
+    i++;
+  }
+  const size_t integer_start = i;
+  while (i < input.size() && absl::ascii_isdigit(input[i])) {
+    i++;
+  }
+  if (i == integer_start ||
+      (input[integer_start] == '0' && i - integer_start > 1)) {
+    return false;
+  }
+  if (i == input.size()) {
+    return true;
+  }
+  if (input[i] != '.') {
+    return false;
+  }
+  const size_t fraction_start = ++i;
+  while (i < input.size() && absl::ascii_isdigit(input[i])) {
+    i++;
+  }
+  return i > fraction_start && i == input.size();
+}
+
 }  // namespace primitives_internal
 
 absl::Status BuildHasNoValueExtension(Message* extension) {
@@ -17,19 +17,24 @@
 #ifndef GOOGLE_FHIR_PRIMITIVE_WRAPPER_H_
 #define GOOGLE_FHIR_PRIMITIVE_WRAPPER_H_
 
+#include <charconv>
 #include <memory>
 #include <string>
+#include <utility>
 
 #include "google/protobuf/descriptor.h"
 #include "google/protobuf/message.h"
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
-#include "absl/strings/escaping.h"
+#include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_replace.h"
+#include "absl/strings/string_view.h"
 #include "absl/time/time.h"
+#include "google/fhir/base64.h"
 #include "google/fhir/codes.h"
 #include "google/fhir/extensions.h"
+#include "google/fhir/json_string.h"
 #include "google/fhir/status/status.h"
 #include "google/fhir/status/statusor.h"
 #include "proto/annotations.pb.h"
@@ -63,6 +68,11 @@ using ::google::protobuf::Reflection;
 // extension.
 absl::StatusOr<bool> HasPrimitiveHasNoValue(const Message& message);
 
+// Returns whether input is a decimal without an exponent, e.g. "-12.50",
+// which is valid in every FHIR version. Lets the common case of decimals be
+// validated without the value regex.
+bool IsPlainDecimal(absl::string_view input);
+
 static const char* kPrimitiveHasNoValueUrl =
     "https://g.co/fhir/StructureDefinition/primitiveHasNoValue";
 static const char* kBinarySeparatorStrideUrl =
@@ -183,17 +193,19 @@ class XhtmlWrapper : public SpecificWrapper<XhtmlLike> {
           "Cannot parse ", json.toStyledString(), " as ",
           XhtmlLike::descriptor()->full_name(), ": it is not a string value."));
     }
-    FHIR_RETURN_IF_ERROR(this->ValidateString(json.asString()));
+    std::string json_string = json.asString();
+    FHIR_RETURN_IF_ERROR(this->ValidateString(json_string));
     std::unique_ptr<XhtmlLike> wrapped = absl::make_unique<XhtmlLike>();
-    wrapped->set_value(json.asString());
+    wrapped->set_value(std::move(json_string));
     this->WrapAndManage(std::move(wrapped));
     return absl::OkStatus();
   }
 
  protected:
   absl::StatusOr<std::string> ToNonNullValueString() const override {
-    return absl::StatusOr<std::string>(
-        Json::valueToQuotedString(this->GetWrapped()->value().c_str()));
+    std::string json;
+    AppendJsonString(this->GetWrapped()->value(), &json);
+    return json;
   }
 };
 
@@ -289,7 +301,8 @@ class StringInputWrapper : public ExtensibleWrapper<T> {
   }
 
  protected:
-  virtual absl::Status ParseString(const std::string& json_string) = 0;
+  // Takes the string by value, so that wrappers can move it into their proto.
+  virtual absl::Status ParseString(std::string json_string) = 0;
 };
 
 // Template for wrappers that represent data as a string.
@@ -297,8 +310,9 @@ template <typename T>
 class StringTypeWrapper : public StringInputWrapper<T> {
  public:
   absl::StatusOr<std::string> ToNonNullValueString() const override {
-    return absl::StatusOr<std::string>(
-        Json::valueToQuotedString(this->GetWrapped()->value().c_str()));
+    std::string json;
+    AppendJsonString(this->GetWrapped()->value(), &json);
+    return json;
   }
 
   absl::Status ValidateTypeSpecific(
@@ -319,10 +333,10 @@ class StringTypeWrapper : public StringInputWrapper<T> {
   }
 
  protected:
-  absl::Status ParseString(const std::string& json_string) override {
+  absl::Status ParseString(std::string json_string) override {
     FHIR_RETURN_IF_ERROR(this->ValidateString(json_string));
     std::unique_ptr<T> wrapped = absl::make_unique<T>();
-    wrapped->set_value(json_string);
+    wrapped->set_value(std::move(json_string));
     this->WrapAndManage(std::move(wrapped));
     return absl::OkStatus();
   }
@@ -522,15 +536,27 @@ class IntegerTypeWrapper : public ExtensibleWrapper<T> {
           absl::StrCat("Cannot parse ", json.toStyledString(), " as Integer.",
                        json.isString() ? "  It is a quoted string." : ""));
     }
-    FHIR_RETURN_IF_ERROR(ValidateInteger(json.asInt()));
+    // The reader has already parsed the number, so it is only range checked,
+    // as asInt would throw for values beyond 32 bits.
+    if (!json.isInt()) {
+      return InvalidArgumentError(absl::StrCat("Cannot parse ",
+                                               json.toStyledString(),
+                                               " as Integer: out of range."));
+    }
+    const int value = json.asInt();
+    FHIR_RETURN_IF_ERROR(ValidateInteger(value));
     std::unique_ptr<T> wrapped = absl::make_unique<T>();
-    wrapped->set_value(json.asInt());
+    wrapped->set_value(value);
     this->WrapAndManage(std::move(wrapped));
     return absl::OkStatus();
   }
 
   absl::StatusOr<std::string> ToNonNullValueString() const override {
-    return absl::StrCat(this->GetWrapped()->value());
+    // Enough for any 32-bit integer and its sign.
+    char buffer[11];
+    const std::to_chars_result result = std::to_chars(
+        buffer, buffer + sizeof(buffer), this->GetWrapped()->value());
+    return std::string(buffer, result.ptr);
   }
 
  protected:
@@ -628,22 +654,19 @@ template <typename Base64BinaryType, typename SeparatorStrideExtensionType,
 class Base64BinaryWrapper : public StringInputWrapper<Base64BinaryType> {
  public:
   absl::StatusOr<std::string> ToNonNullValueString() const override {
-    std::string escaped;
-    absl::Base64Escape(this->GetWrapped()->value(), &escaped);
     std::vector<SeparatorStrideExtensionType> separator_extensions;
     FHIR_RETURN_IF_ERROR(extensions_lib::GetRepeatedFromExtension(
         this->GetWrapped()->extension(), &separator_extensions));
-    if (!separator_extensions.empty()) {
-      int stride = separator_extensions[0].stride().value();
-      std::string separator = separator_extensions[0].separator().value();
-
-      RE2::GlobalReplace(&escaped, absl::StrCat("(.{", stride, "})"),
-                         absl::StrCat("\\1", separator));
-      if (absl::EndsWith(escaped, separator)) {
-        escaped.erase(escaped.length() - separator.length());
-      }
+    std::string escaped = "\"";
+    if (separator_extensions.empty()) {
+      AppendBase64(this->GetWrapped()->value(), &escaped);
+    } else {
+      AppendBase64(this->GetWrapped()->value(), &escaped,
+                   separator_extensions[0].stride().value(),
+                   separator_extensions[0].separator().value());
     }
-    return absl::StrCat("\"", escaped, "\"");
+    escaped.push_back('"');
+    return escaped;
   }
 
   absl::StatusOr<std::unique_ptr<::google::protobuf::Message>> GetElement()
@@ -674,7 +697,7 @@ class Base64BinaryWrapper : public StringInputWrapper<Base64BinaryType> {
   }
 
  private:
-  absl::Status ParseString(const std::string& json_string) override {
+  absl::Status ParseString(std::string json_string) override {
     std::unique_ptr<Base64BinaryType> wrapped =
         absl::make_unique<Base64BinaryType>();
     size_t stride = json_string.find(' ');
@@ -694,10 +717,10 @@ class Base64BinaryWrapper : public StringInputWrapper<Base64BinaryType> {
     }
 
     std::string unescaped;
-    if (!absl::Base64Unescape(json_string, &unescaped)) {
+    if (!Base64Decode(json_string, &unescaped)) {
       return InvalidArgumentError("Encountered invalid base64 string.");
     }
-    wrapped->set_value(unescaped);
+    wrapped->set_value(std::move(unescaped));
     this->WrapAndManage(std::move(wrapped));
     return absl::OkStatus();
   }
@@ -749,7 +772,8 @@ template <typename DecimalType>
 class DecimalWrapper : public StringInputWrapper<DecimalType> {
  public:
   absl::StatusOr<std::string> ToNonNullValueString() const override {
-    return absl::StrCat(this->GetWrapped()->value());
+    // Decimals are kept as strings, and printed as they were parsed.
+    return this->GetWrapped()->value();
   }
 
  protected:
@@ -763,7 +787,7 @@ class DecimalWrapper : public StringInputWrapper<DecimalType> {
                                     "PrimitiveHasNoValueExtension."));
     }
     absl::Status string_validation =
-        this->ValidateString(this->GetWrapped()->value());
+        ValidateDecimal(this->GetWrapped()->value());
     return string_validation.ok()
                ? absl::OkStatus()
                : FailedPreconditionError(string_validation.message());
@@ -791,14 +815,20 @@ class DecimalWrapper : public StringInputWrapper<DecimalType> {
                      "have been escaped prior to parsing by JsonFormat."));
   }
 
-  absl::Status ParseString(const std::string& json_string) override {
-    FHIR_RETURN_IF_ERROR(this->ValidateString(json_string));
+  absl::Status ParseString(std::string json_string) override {
+    FHIR_RETURN_IF_ERROR(ValidateDecimal(json_string));
     // TODO: range check
     std::unique_ptr<DecimalType> wrapped = absl::make_unique<DecimalType>();
-    wrapped->set_value(json_string);
+    wrapped->set_value(std::move(json_string));
     this->WrapAndManage(std::move(wrapped));
     return absl::OkStatus();
   }
+
+  static absl::Status ValidateDecimal(const std::string& input) {
+    return IsPlainDecimal(input) ? absl::OkStatus()
+                                 : SpecificWrapper<DecimalType>::ValidateString(
+                                       input);
+  }
 };
 
 template <typename PositiveIntType>
@@ -868,7 +898,7 @@ class TimeWrapper : public StringInputWrapper<TimeLike> {
   }
 
  private:
-  absl::Status ParseString(const std::string& json_string) override {
+  absl::Status ParseString(std::string json_string) override {
     static LazyRE2 PATTERN{
         "([01][0-9]|2[0-3]):([0-5][0-9]):([0-5][0-9])(?:\\.([0-9]+))?"};
     int hours;
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "google/fhir/primitive_wrapper.h"
+
+#include "gtest/gtest.h"
+
+namespace google {
+namespace fhir {
+
+namespace {
+
+using ::google::fhir::primitives_internal::IsPlainDecimal;
+
+TEST(IsPlainDecimalTest, AcceptsPlainDecimals) {
+  for (const char* decimal :
+       {"0", "-0", "7", "-7", "0.0", "0.25", "-0.25", "10", "100.001",
+        "123456789012345678901234567890",
+        "3.141592653589793238462643383279"}) {
+    EXPECT_TRUE(IsPlainDecimal(decimal)) << decimal;
+  }
+}
+
+TEST(IsPlainDecimalTest, RejectsLeadingZerosAndPartialNumbers) {
+  for (const char* decimal :
+       {"", "-", "00", "01", "-01", "00.5", "1.", "-1.", ".5", "-.5", "+1",
+        "1.2.3", " 1", "1 ", "1,5", "0x1"}) {
+    EXPECT_FALSE(IsPlainDecimal(decimal)) << decimal;
+  }
+}
+
+TEST(IsPlainDecimalTest, RejectsExponents) {
+  // Exponents are left to the full validation of the decimal's regex.
+  for (const char* decimal :
+       {"1e3", "1E3", "1.5e3", "1.5E-3", "-2e+10", "0e0", "1e", "1.5e"}) {
+    EXPECT_FALSE(IsPlainDecimal(decimal)) << decimal;
+  }
+}
+
+}  // namespace
+
+}  // namespace fhir
+}  // namespace google
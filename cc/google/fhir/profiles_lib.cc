@@ -101,7 +101,12 @@ const unordered_map<std::string, const FieldDescriptor*>& GetExtensionMap(
   memos_mutex.ReaderUnlock();
 
   absl::MutexLock lock(&memos_mutex);
-  auto& extension_map = (*memos)[memo_key];
+  const auto emplaced = memos->try_emplace(memo_key);
+  auto& extension_map = emplaced.first->second;
+  if (!emplaced.second) {
+    // Another thread built the map meanwhile.
+    return extension_map;
+  }
   for (int i = 0; i < descriptor->field_count(); i++) {
     const FieldDescriptor* field = descriptor->field(i);
     if (HasInlinedExtensionUrl(field)) {
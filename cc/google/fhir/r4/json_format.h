@@ -17,6 +17,11 @@
 #ifndef GOOGLE_FHIR_R4_JSON_FORMAT_H_
 #define GOOGLE_FHIR_R4_JSON_FORMAT_H_
 
+#include <memory>
+#include <string>
+
+#include "absl/strings/cord.h"
+#include "absl/strings/string_view.h"
 #include "google/fhir/json_format.h"
 
 namespace google {
@@ -26,13 +31,23 @@ namespace r4 {
 // R4-only API for cc/json_format.h
 // See cc/json_format.h for documentation on these methods
 
-absl::Status MergeJsonFhirStringIntoProto(const std::string& raw_json,
+absl::Status MergeJsonFhirStringIntoProto(absl::string_view raw_json,
+                                          google::protobuf::Message* target,
+                                          absl::TimeZone default_timezone,
+                                          const bool validate);
+
+absl::Status MergeJsonFhirStringIntoProto(const absl::Cord& raw_json,
                                           google::protobuf::Message* target,
                                           absl::TimeZone default_timezone,
                                           const bool validate);
 
+absl::Status MergeJsonFhirBundleIntoProto(absl::string_view raw_json,
+                                          google::protobuf::Message* bundle,
+                                          absl::TimeZone default_timezone,
+                                          const bool validate, int num_threads);
+
 template <typename R>
-absl::StatusOr<R> JsonFhirStringToProto(const std::string& raw_json,
+absl::StatusOr<R> JsonFhirStringToProto(absl::string_view raw_json,
                                         const absl::TimeZone default_timezone) {
   R resource;
   FHIR_RETURN_IF_ERROR(MergeJsonFhirStringIntoProto(raw_json, &resource,
@@ -42,13 +57,32 @@ absl::StatusOr<R> JsonFhirStringToProto(const std::string& raw_json,
 
 template <typename R>
 absl::StatusOr<R> JsonFhirStringToProtoWithoutValidating(
-    const std::string& raw_json, const absl::TimeZone default_timezone) {
+    absl::string_view raw_json, const absl::TimeZone default_timezone) {
   R resource;
   FHIR_RETURN_IF_ERROR(MergeJsonFhirStringIntoProto(raw_json, &resource,
                                                     default_timezone, false));
   return resource;
 }
 
+absl::Status MergeJsonFhirStringIntoContainedResource(
+    absl::string_view raw_json,
+    google::protobuf::Message* contained_resource,
+    absl::TimeZone default_timezone, const bool validate);
+
+template <typename ContainedResourceLike>
+absl::StatusOr<ContainedResourceLike> JsonFhirStringToContainedResource(
+    absl::string_view raw_json, const absl::TimeZone default_timezone) {
+  ContainedResourceLike contained_resource;
+  FHIR_RETURN_IF_ERROR(MergeJsonFhirStringIntoContainedResource(
+      raw_json, &contained_resource, default_timezone, true));
+  return contained_resource;
+}
+
+absl::StatusOr<std::unique_ptr<google::protobuf::Message>>
+JsonFhirStringToResource(absl::string_view raw_json,
+                         const absl::TimeZone default_timezone,
+                         const bool validate);
+
 absl::StatusOr<std::string> PrintFhirPrimitive(
     const ::google::protobuf::Message& message);
 
@@ -16,12 +16,16 @@
 
 #include "google/fhir/r4/json_format.h"
 
+#include <memory>
 #include <unordered_set>
 
 #include "google/protobuf/text_format.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
 #include "google/fhir/proto_util.h"
 #include "google/fhir/r4/primitive_handler.h"
 #include "google/fhir/r4/profiles.h"
@@ -189,6 +193,7 @@ namespace r4 {
 namespace {
 
 using namespace google::fhir::r4::core;  // NOLINT
+using ::google::fhir::testutil::EqualsProto;
 
 static const char* const kTimeZoneString = "Australia/Sydney";
 
@@ -387,6 +392,162 @@ TEST(JsonFormatR4Test, PrintForAnalyticsWithContained) {
   }
 }
 
+TEST(JsonFormatR4Test, PeekResourceType) {
+  EXPECT_EQ(PeekResourceType(R"json({"resourceType": "Patient"})json").value(),
+            "Patient");
+  EXPECT_EQ(PeekResourceType(R"json( {
+    "id": "a,}\"{",
+    "meta": {"tag": [{"code": "}"}, {}], "versionId": 1},
+    "active": true, "resourceType" : "Patient", "gender": "other"})json")
+                .value(),
+            "Patient");
+  EXPECT_FALSE(PeekResourceType(R"json({"id": "1"})json").ok());
+  EXPECT_FALSE(PeekResourceType(R"json(["Patient"])json").ok());
+  EXPECT_FALSE(PeekResourceType(R"json({"resourceType": 1})json").ok());
+}
+
+TEST(JsonFormatR4Test, ParseMixedResourceTypes) {
+  absl::TimeZone tz;
+  absl::LoadTimeZone(kTimeZoneString, &tz);
+  const std::string patient_json =
+      R"json({"resourceType": "Patient", "id": "1", "active": true})json";
+  const std::string observation_json = R"json({
+    "id": "2", "status": "final", "code": {"text": "Weight"},
+    "resourceType": "Observation"})json";
+
+  const ContainedResource patient =
+      JsonFhirStringToContainedResource<ContainedResource>(patient_json, tz)
+          .value();
+  EXPECT_EQ(patient.patient().id().value(), "1");
+  EXPECT_TRUE(patient.patient().active().value());
+  const ContainedResource observation =
+      JsonFhirStringToContainedResource<ContainedResource>(observation_json,
+                                                           tz)
+          .value();
+  EXPECT_EQ(observation.observation().code().text().value(), "Weight");
+
+  const std::unique_ptr<::google::protobuf::Message> resource =
+      JsonFhirStringToResource(observation_json, tz, true).value();
+  ASSERT_EQ(resource->GetDescriptor(), Observation::descriptor());
+  EXPECT_THAT(*resource, EqualsProto(observation.observation()));
+
+  EXPECT_FALSE(JsonFhirStringToResource(
+                   R"json({"resourceType": "NotAResource"})json", tz, true)
+                   .ok());
+}
+
+TEST(JsonFormatR4Test, ParseStringViewAndCord) {
+  absl::TimeZone tz;
+  absl::LoadTimeZone(kTimeZoneString, &tz);
+  const std::string observation_json = R"json({
+    "resourceType": "Observation", "status": "final",
+    "code": {"text": "\": 1.5, not a decimal"},
+    "valueQuantity": {"value": 1.50},
+    "referenceRange": [{"low": {"value": -1E2}, "high": {"value": 10}}]})json";
+  const Observation observation =
+      JsonFhirStringToProto<Observation>(observation_json, tz).value();
+  EXPECT_EQ(observation.code().text().value(), "\": 1.5, not a decimal");
+  EXPECT_EQ(observation.value().quantity().value().value(), "1.50");
+  EXPECT_EQ(observation.reference_range(0).low().value().value(), "-1E2");
+  EXPECT_EQ(observation.reference_range(0).high().value().value(), "10");
+
+  // A view into a larger buffer, which is not null terminated.
+  const std::string buffer = absl::StrCat(observation_json, "{}");
+  Observation from_view;
+  ASSERT_TRUE(MergeJsonFhirStringIntoProto(
+                  absl::string_view(buffer).substr(0, observation_json.size()),
+                  &from_view, tz, true)
+                  .ok());
+  EXPECT_THAT(from_view, EqualsProto(observation));
+
+  // A Cord of several chunks.
+  absl::Cord cord;
+  cord.Append(std::string(1000, ' '));
+  cord.Append(observation_json);
+  cord.Append(std::string(1000, '\n'));
+  Observation from_cord;
+  ASSERT_TRUE(MergeJsonFhirStringIntoProto(cord, &from_cord, tz, true).ok());
+  EXPECT_THAT(from_cord, EqualsProto(observation));
+}
+
+TEST(JsonFormatR4Test, PrintAndParseUtf8Strings) {
+  absl::TimeZone tz;
+  absl::LoadTimeZone(kTimeZoneString, &tz);
+  Observation observation;
+  observation.mutable_status()->set_value(ObservationStatusCode::FINAL);
+  observation.mutable_code()->mutable_text()->set_value(
+      "caf\xc3\xa9 \"quoted\"\n\x01");
+  const std::string json = PrintFhirToJsonString(observation).value();
+  EXPECT_NE(json.find(R"("caf)"
+                      "\xc3\xa9"
+                      R"( \"quoted\"\n\u0001")"),
+            std::string::npos)
+      << json;
+  EXPECT_THAT(JsonFhirStringToProto<Observation>(json, tz).value(),
+              EqualsProto(observation));
+
+  EXPECT_EQ(JsonFhirStringToProto<Observation>(
+                R"({"resourceType": "Observation", "status": "final",
+                    "code": {"text": "caf)"
+                "\xe9"
+                R"("}})",
+                tz)
+                .status()
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(JsonFormatR4Test, MergeBundleWithParallelEntries) {
+  absl::TimeZone tz;
+  absl::LoadTimeZone(kTimeZoneString, &tz);
+  for (const char* name :
+       {"Bundle-bundle-example", "Bundle-bundle-transaction",
+        "Bundle-bundle-response", "Bundle-101"}) {
+    const std::string json = ReadFile(absl::StrCat(
+        "spec/hl7.fhir.r4.examples/4.0.1/package/", name, ".json"));
+    Bundle expected;
+    ASSERT_TRUE(MergeJsonFhirStringIntoProto(json, &expected, tz, false).ok())
+        << name;
+    Bundle bundle;
+    const absl::Status status =
+        MergeJsonFhirBundleIntoProto(json, &bundle, tz, false, 4);
+    ASSERT_TRUE(status.ok()) << name << ": " << status;
+    EXPECT_THAT(bundle, EqualsProto(expected)) << name;
+  }
+
+  // As when parsing sequentially, the last of duplicate entry arrays wins.
+  const std::string duplicates =
+      R"json({"resourceType": "Bundle", "entry": [
+                {"fullUrl": "a"}, {"fullUrl": "b"}],
+              "type": "collection", "entry": [{"fullUrl": "c"}]})json";
+  Bundle expected;
+  ASSERT_TRUE(
+      MergeJsonFhirStringIntoProto(duplicates, &expected, tz, false).ok());
+  Bundle bundle;
+  EXPECT_TRUE(
+      MergeJsonFhirBundleIntoProto(duplicates, &bundle, tz, false, 4).ok());
+  EXPECT_THAT(bundle, EqualsProto(expected));
+  ASSERT_EQ(bundle.entry_size(), 1);
+  EXPECT_EQ(bundle.entry(0).full_url().value(), "c");
+  EXPECT_EQ(bundle.type().value(), BundleTypeCode::COLLECTION);
+
+  // Data after the Bundle is rejected.
+  bundle.Clear();
+  EXPECT_EQ(MergeJsonFhirBundleIntoProto(
+                R"json({"resourceType": "Bundle", "entry": []} {})json",
+                &bundle, tz, false, 4)
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+
+  const absl::Status status = MergeJsonFhirBundleIntoProto(
+      R"json({"resourceType": "Bundle", "type": "collection",
+              "entry": [{"fullUrl": "a"}, {"fullUrl": 1}, {"bad": 2}]})json",
+      &bundle, tz, false, 4);
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_TRUE(absl::StartsWith(status.message(), "Bundle entry 1: "))
+      << status;
+}
+
 TEST(JsonFormatR4Test, TestAccount) {
   std::vector<std::string> files{"Account-ewg", "Account-example"};
   TestPair<Account>(files);
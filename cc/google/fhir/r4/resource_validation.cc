@@ -33,6 +33,13 @@ absl::Status ValidateResourceWithFhirPath(const ::google::protobuf::Message& res
       resource, R4PrimitiveHandler::GetInstance(), GetFhirPathValidator());
 }
 
+absl::Status ValidateResourceWithFhirPath(const ::google::protobuf::Message& resource,
+                                          int num_threads) {
+  return ValidateResourceWithFhirPath(
+      resource, R4PrimitiveHandler::GetInstance(), GetFhirPathValidator(),
+      num_threads);
+}
+
 }  // namespace r4
 }  // namespace fhir
 }  // namespace google
@@ -89,6 +89,26 @@ TEST(ResourceValidationTest, EmptyOneof) {
 
 TEST(BundleValidationTest, Valid) { ValidTest<Bundle>("bundle_valid"); }
 
+TEST(BundleValidationTest, ParallelMatchesSequential) {
+  Bundle bundle =
+      ReadProto<Bundle>("testdata/r4/validation/bundle_valid.prototxt");
+  EXPECT_TRUE(ValidateResourceWithFhirPath(bundle, 4).ok());
+
+  // The first invalid entry in order of the entries determines the error.
+  for (const std::string& name :
+       {"observation_invalid_fhirpath_violation",
+        "observation_invalid_missing_required"}) {
+    *bundle.add_entry()->mutable_resource()->mutable_observation() =
+        ReadProto<Observation>(
+            absl::StrCat("testdata/r4/validation/", name, ".prototxt"));
+  }
+  for (int num_threads : {1, 2, 4}) {
+    EXPECT_EQ(ValidateResourceWithFhirPath(bundle, num_threads),
+              ValidateResourceWithFhirPath(bundle));
+  }
+  EXPECT_FALSE(ValidateResourceWithFhirPath(bundle, 4).ok());
+}
+
 TEST(EncounterValidationTest, Valid) {
   ValidTest<Encounter>("encounter_valid");
 }
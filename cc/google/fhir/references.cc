@@ -16,6 +16,15 @@
 
 #include "google/fhir/references.h"
 
+#include <memory>
+#include <string>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
+#include "google/fhir/descriptor_cache.h"
 #include "google/fhir/util.h"
 
 namespace google {
@@ -62,7 +71,7 @@ absl::StatusOr<std::string> ReferenceProtoToString(
     return absl::StrCat("#", fragment_value);
   }
 
-  static const google::protobuf::OneofDescriptor* oneof =
+  const google::protobuf::OneofDescriptor* oneof =
       descriptor->FindOneofByName("reference");
   const ::google::protobuf::FieldDescriptor* reference_field =
       reflection->GetOneofFieldDescriptor(reference, oneof);
@@ -83,8 +92,9 @@ absl::StatusOr<std::string> ReferenceProtoToString(
       prefix.push_back(c);
     }
   }
-  static LazyRE2 re = {"Id$"};
-  RE2::Replace(&prefix, *re, "");
+  if (absl::EndsWith(prefix, "Id")) {
+    prefix.resize(prefix.size() - 2);
+  }
 
   const ::google::protobuf::Message& id =
       reflection->GetMessage(reference, reference_field);
@@ -103,34 +113,156 @@ absl::StatusOr<std::string> ReferenceProtoToString(
   return reference_string;
 }
 
+namespace {
+
+// The fields of a Reference message type, looked up once per type.
+struct ReferenceFields {
+  const FieldDescriptor* uri = nullptr;
+  // The value field of uri, if it is a string primitive.
+  const FieldDescriptor* uri_value = nullptr;
+  const FieldDescriptor* fragment = nullptr;
+  // The typed reference id field for each resource type, e.g. "Patient" ->
+  // patient_id.
+  absl::flat_hash_map<std::string, const FieldDescriptor*> typed_ids;
+};
+
+ReferenceFields FindReferenceFields(const Descriptor* descriptor) {
+  ReferenceFields fields;
+  fields.uri = descriptor->FindFieldByName("uri");
+  fields.fragment = descriptor->FindFieldByName("fragment");
+  if (fields.uri != nullptr && fields.uri->message_type() != nullptr) {
+    const FieldDescriptor* value =
+        fields.uri->message_type()->FindFieldByName("value");
+    if (value != nullptr && !value->is_repeated() &&
+        value->type() == FieldDescriptor::Type::TYPE_STRING) {
+      fields.uri_value = value;
+    }
+  }
+
+  for (int i = 0; i < descriptor->field_count(); i++) {
+    const FieldDescriptor* field = descriptor->field(i);
+    absl::string_view stem = field->name();
+    if (field->message_type() == nullptr ||
+        !absl::ConsumeSuffix(&stem, "_id")) {
+      continue;
+    }
+    // Only resource types that GetReferenceFieldForResource maps to the field
+    // are added, e.g. "MedicationRequest" for medication_request_id.
+    std::string resource_type;
+    bool start = true;
+    for (const char c : stem) {
+      if (c == '_') {
+        start = true;
+      } else {
+        resource_type.push_back(start ? absl::ascii_toupper(c) : c);
+        start = false;
+      }
+    }
+    if (ToSnakeCase(resource_type) == stem) {
+      fields.typed_ids.emplace(std::move(resource_type), field);
+    }
+  }
+  return fields;
+}
+
+const ReferenceFields& GetReferenceFields(const Descriptor* descriptor) {
+  static auto* cache =
+      new DescriptorCache<Descriptor, ReferenceFields>(&FindReferenceFields);
+  return cache->Get(descriptor);
+}
+
+bool IsResourceTypeChar(char c) { return absl::ascii_isalnum(c) || c == '_'; }
+
+bool IsIdChar(char c) { return absl::ascii_isalnum(c) || c == '.' || c == '-'; }
+
+// Returns the number of leading characters of input for which is_valid holds.
+size_t ScanWhile(absl::string_view input, bool (*is_valid)(char)) {
+  size_t length = 0;
+  while (length < input.size() && is_valid(input[length])) {
+    length++;
+  }
+  return length;
+}
+
+// Consumes an id of 1 to 64 characters from the front of input.
+bool ConsumeId(absl::string_view* input, absl::string_view* id) {
+  const size_t length = ScanWhile(*input, &IsIdChar);
+  if (length == 0 || length > 64) {
+    return false;
+  }
+  *id = input->substr(0, length);
+  input->remove_prefix(length);
+  return true;
+}
+
+// Parses a relative reference of the form <type>/<id>[/_history/<version>],
+// where <type> is made of [0-9A-Za-z_] and <id> and <version> are made of 1 to
+// 64 characters of [A-Za-z0-9.-]. The components are views into uri.
+bool ParseRelativeReference(absl::string_view uri,
+                            absl::string_view* resource_type,
+                            absl::string_view* resource_id,
+                            absl::string_view* version) {
+  const size_t type_length = ScanWhile(uri, &IsResourceTypeChar);
+  if (type_length == 0) {
+    return false;
+  }
+  *resource_type = uri.substr(0, type_length);
+  uri.remove_prefix(type_length);
+  if (!absl::ConsumePrefix(&uri, "/") || !ConsumeId(&uri, resource_id)) {
+    return false;
+  }
+  *version = absl::string_view();
+  if (uri.empty()) {
+    return true;
+  }
+  return absl::ConsumePrefix(&uri, "/_history/") && ConsumeId(&uri, version) &&
+         uri.empty();
+}
+
+// Returns true for references of the form #<id>.
+bool IsFragmentReference(absl::string_view uri) {
+  absl::string_view id;
+  return absl::ConsumePrefix(&uri, "#") && ConsumeId(&uri, &id) && uri.empty();
+}
+
+// Returns true for absolute urls; we're permissive about various schemes.
+bool IsUrlReference(absl::string_view uri) {
+  return (absl::ConsumePrefix(&uri, "http:") ||
+          absl::ConsumePrefix(&uri, "https:") ||
+          absl::ConsumePrefix(&uri, "urn:")) &&
+         uri.find('\n') == absl::string_view::npos;
+}
+
+}  // namespace
+
 // Splits relative references into their components, for example, "Patient/ABCD"
 // will result in the patientId field getting the value "ABCD".
 absl::Status SplitIfRelativeReference(Message* reference) {
-  const Descriptor* descriptor = reference->GetDescriptor();
   const Reflection* reflection = reference->GetReflection();
+  const ReferenceFields& fields =
+      GetReferenceFields(reference->GetDescriptor());
 
-  const FieldDescriptor* uri_field = descriptor->FindFieldByName("uri");
-  const FieldDescriptor* fragment_field =
-      descriptor->FindFieldByName("fragment");
-  if (!reflection->HasField(*reference, uri_field)) {
+  if (!reflection->HasField(*reference, fields.uri)) {
     // There is no uri to split
     return absl::OkStatus();
   }
 
-  const Message& uri = reflection->GetMessage(*reference, uri_field);
+  const Message& uri = reflection->GetMessage(*reference, fields.uri);
+  if (fields.uri_value == nullptr) {
+    return InvalidArgumentError(
+        absl::StrCat("Not a valid String-type primitive: ",
+                     uri.GetDescriptor()->full_name()));
+  }
 
   std::string uri_scratch;
-  FHIR_ASSIGN_OR_RETURN(const std::string& uri_string,
-                        GetPrimitiveStringValue(uri, &uri_scratch));
-
-  static const LazyRE2 kInternalReferenceRegex{
-      "([0-9A-Za-z_]+)/([A-Za-z0-9.-]{1,64})(?:/_history/"
-      "([A-Za-z0-9.-]{1,64}))?"};
-  std::string resource_type;
-  std::string resource_id;
-  std::string version;
-  if (RE2::FullMatch(uri_string, *kInternalReferenceRegex, &resource_type,
-                     &resource_id, &version)) {
+  const std::string& uri_string = uri.GetReflection()->GetStringReference(
+      uri, fields.uri_value, &uri_scratch);
+
+  absl::string_view resource_type;
+  absl::string_view resource_id;
+  absl::string_view version;
+  if (ParseRelativeReference(uri_string, &resource_type, &resource_id,
+                             &version)) {
     FHIR_ASSIGN_OR_RETURN(
         const FieldDescriptor* reference_id_field,
         internal::GetReferenceFieldForResource(*reference, resource_type));
@@ -144,8 +276,6 @@ absl::Status SplitIfRelativeReference(Message* reference) {
                              ->New());
     FHIR_RETURN_IF_ERROR(internal::PopulateTypedReferenceId(
         resource_id, version, reference_id.get()));
-    const Message& uri = reflection->GetMessage(*reference, uri_field);
-    reference_id->GetTypeName();
     FHIR_RETURN_IF_ERROR(CopyCommonField(uri, reference_id.get(), "id"));
     FHIR_RETURN_IF_ERROR(CopyCommonField(uri, reference_id.get(), "extension"));
     reflection->SetAllocatedMessage(reference, reference_id.release(),
@@ -153,28 +283,25 @@ absl::Status SplitIfRelativeReference(Message* reference) {
     return absl::OkStatus();
   }
 
-  static const LazyRE2 kFragmentReferenceRegex{"#[A-Za-z0-9.-]{1,64}"};
-  if (RE2::FullMatch(uri_string, *kFragmentReferenceRegex)) {
+  if (IsFragmentReference(uri_string)) {
     // Note that we make the fragment off of the reference before adding it,
     // since adding the fragment would destroy the uri field, since they are in
     // the same oneof.  This way allows us to copy fields from uri to fragment
     // without an extra copy.
     std::unique_ptr<Message> fragment =
         absl::WrapUnique(reflection->GetMessageFactory()
-                             ->GetPrototype(fragment_field->message_type())
+                             ->GetPrototype(fields.fragment->message_type())
                              ->New());
-    FHIR_RETURN_IF_ERROR(
-        SetPrimitiveStringValue(fragment.get(), uri_string.substr(1)));
+    FHIR_RETURN_IF_ERROR(SetPrimitiveStringValue(
+        fragment.get(), absl::string_view(uri_string).substr(1)));
     FHIR_RETURN_IF_ERROR(CopyCommonField(uri, fragment.get(), "id"));
     FHIR_RETURN_IF_ERROR(CopyCommonField(uri, fragment.get(), "extension"));
     reflection->SetAllocatedMessage(reference, fragment.release(),
-                                    fragment_field);
+                                    fields.fragment);
     return absl::OkStatus();
   }
 
-  // We're permissive about various full url schemes.
-  static LazyRE2 kUrlReference = {"(http|https|urn):.*"};
-  if (RE2::FullMatch(uri_string, *kUrlReference)) {
+  if (IsUrlReference(uri_string)) {
     // There's no way to rewrite the URI, but it's valid as is.
     return absl::OkStatus();
   }
@@ -184,8 +311,8 @@ absl::Status SplitIfRelativeReference(Message* reference) {
 
 namespace internal {
 
-absl::Status PopulateTypedReferenceId(const std::string& resource_id,
-                                      const std::string& version,
+absl::Status PopulateTypedReferenceId(absl::string_view resource_id,
+                                      absl::string_view version,
                                       Message* reference_id) {
   FHIR_RETURN_IF_ERROR(SetPrimitiveStringValue(reference_id, resource_id));
   if (!version.empty()) {
@@ -206,7 +333,13 @@ absl::Status PopulateTypedReferenceId(const std::string& resource_id,
 }
 
 absl::StatusOr<const FieldDescriptor*> GetReferenceFieldForResource(
-    const Message& reference, const std::string& resource_type) {
+    const Message& reference, absl::string_view resource_type) {
+  const ReferenceFields& fields = GetReferenceFields(reference.GetDescriptor());
+  auto iter = fields.typed_ids.find(resource_type);
+  if (iter != fields.typed_ids.end()) {
+    return iter->second;
+  }
+
   const std::string field_name =
       absl::StrCat(ToSnakeCase(resource_type), "_id");
   const FieldDescriptor* field =
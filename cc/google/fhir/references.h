@@ -20,6 +20,7 @@
 #include <string>
 
 #include "google/protobuf/message.h"
+#include "absl/strings/string_view.h"
 #include "absl/strings/strip.h"
 #include "google/fhir/status/statusor.h"
 #include "google/fhir/type_macros.h"
@@ -31,11 +32,11 @@ namespace fhir {
 
 namespace internal {
 
-absl::Status PopulateTypedReferenceId(const std::string& resource_id,
-                                      const std::string& version,
+absl::Status PopulateTypedReferenceId(absl::string_view resource_id,
+                                      absl::string_view version,
                                       ::google::protobuf::Message* reference_id);
 absl::StatusOr<const ::google::protobuf::FieldDescriptor*> GetReferenceFieldForResource(
-    const ::google::protobuf::Message& reference, const std::string& resource_type);
+    const ::google::protobuf::Message& reference, absl::string_view resource_type);
 
 }  // namespace internal
 
@@ -17,6 +17,7 @@
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
 #include "absl/time/time.h"
 #include "google/fhir/testutil/proto_matchers.h"
 #include "proto/stu3/codes.pb.h"
@@ -73,6 +74,46 @@ TEST(GetResourceIdFromReferenceTest, ReferenceDoesNotMatch) {
                               "resource of type `Encounter`"));
 }
 
+TEST(ReferenceStringToProtoTest, RelativeReference) {
+  Reference r;
+  FHIR_CHECK_OK(ReferenceStringToProto("MedicationRequest/ab.C-1", &r));
+  EXPECT_EQ(r.medication_request_id().value(), "ab.C-1");
+  EXPECT_FALSE(r.medication_request_id().has_history());
+
+  FHIR_CHECK_OK(ReferenceStringToProto("Patient/123/_history/4", &r));
+  EXPECT_EQ(r.patient_id().value(), "123");
+  EXPECT_EQ(r.patient_id().history().value(), "4");
+}
+
+TEST(ReferenceStringToProtoTest, FragmentAndUrl) {
+  Reference r;
+  FHIR_CHECK_OK(ReferenceStringToProto("#contained-1", &r));
+  EXPECT_EQ(r.fragment().value(), "contained-1");
+
+  FHIR_CHECK_OK(
+      ReferenceStringToProto("http://example.com/fhir/Patient/123", &r));
+  EXPECT_EQ(r.uri().value(), "http://example.com/fhir/Patient/123");
+
+  FHIR_CHECK_OK(ReferenceStringToProto("urn:uuid:1234", &r));
+  EXPECT_EQ(r.uri().value(), "urn:uuid:1234");
+}
+
+TEST(ReferenceStringToProtoTest, InvalidReferences) {
+  Reference r;
+  for (const std::string& reference :
+       {std::string("Patient"), std::string("Patient/"),
+        std::string("Patient/123/"), std::string("Patient/123/_history/"),
+        std::string("Patient/a b"), std::string("#"),
+        std::string("ftp://example.com"), std::string("http:a\nb"),
+        absl::StrCat("Patient/", std::string(65, 'a'))}) {
+    EXPECT_FALSE(ReferenceStringToProto(reference, &r).ok()) << reference;
+  }
+  EXPECT_EQ(ReferenceStringToProto("NotAResource/123", &r),
+            ::absl::InvalidArgumentError(
+                "Resource type NotAResource is not valid for a reference "
+                "(field not_a_resource_id does not exist)."));
+}
+
 }  // namespace
 }  // namespace fhir
 }  // namespace google
@@ -14,6 +14,8 @@
 
 #include "google/fhir/resource_validation.h"
 
+#include <vector>
+
 #include "google/protobuf/any.pb.h"
 #include "google/protobuf/descriptor.pb.h"
 #include "google/protobuf/descriptor.h"
@@ -21,6 +23,7 @@
 #include "absl/strings/str_cat.h"
 #include "google/fhir/annotations.h"
 #include "google/fhir/fhir_types.h"
+#include "google/fhir/parallel.h"
 #include "google/fhir/primitive_handler.h"
 #include "google/fhir/proto_util.h"
 #include "google/fhir/status/status.h"
@@ -42,11 +45,16 @@ namespace {
 
 absl::Status CheckField(const Message& message, const FieldDescriptor* field,
                         const std::string& field_name,
-                        const PrimitiveHandler* primitive_handler);
-
-absl::Status ValidateFhirConstraints(
-    const Message& message, const std::string& base_name,
-    const PrimitiveHandler* primitive_handler) {
+                        const PrimitiveHandler* primitive_handler,
+                        int num_threads);
+
+// Validates the message and its fields recursively. The elements of the
+// message's own repeated fields are validated on up to num_threads threads;
+// those of nested messages are validated sequentially.
+absl::Status ValidateFhirConstraints(const Message& message,
+                                     const std::string& base_name,
+                                     const PrimitiveHandler* primitive_handler,
+                                     int num_threads = 1) {
   if (IsPrimitive(message.GetDescriptor())) {
     return primitive_handler->ValidatePrimitive(message).ok()
                ? absl::OkStatus()
@@ -67,8 +75,8 @@ absl::Status ValidateFhirConstraints(
     const FieldDescriptor* field = descriptor->field(i);
     const std::string& field_name =
         absl::StrCat(base_name, ".", field->json_name());
-    FHIR_RETURN_IF_ERROR(
-        CheckField(message, field, field_name, primitive_handler));
+    FHIR_RETURN_IF_ERROR(CheckField(message, field, field_name,
+                                    primitive_handler, num_threads));
   }
   // Also verify that oneof fields are set.
   // Note that optional choice-types should have the containing message unset -
@@ -88,7 +96,8 @@ absl::Status ValidateFhirConstraints(
 // Check if a required field is missing.
 absl::Status CheckField(const Message& message, const FieldDescriptor* field,
                         const std::string& field_name,
-                        const PrimitiveHandler* primitive_handler) {
+                        const PrimitiveHandler* primitive_handler,
+                        int num_threads) {
   if (field->options().HasExtension(validation_requirement) &&
       field->options().GetExtension(validation_requirement) ==
           ::google::fhir::proto::REQUIRED_BY_FHIR) {
@@ -104,6 +113,23 @@ absl::Status CheckField(const Message& message, const FieldDescriptor* field,
                              status.message(), "-at-", field_name));
   }
 
+  if (field->cpp_type() == ::google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE &&
+      field->is_repeated() && num_threads > 1) {
+    // Elements are validated independently, and the first error in order of
+    // the elements is returned, as when validating them sequentially.
+    std::vector<absl::Status> statuses(
+        PotentiallyRepeatedFieldSize(message, field));
+    ParallelForEach(statuses.size(), num_threads, [&](size_t index) {
+      statuses[index] = ValidateFhirConstraints(
+          GetPotentiallyRepeatedMessage(message, field, index), field_name,
+          primitive_handler);
+    });
+    for (const absl::Status& status : statuses) {
+      FHIR_RETURN_IF_ERROR(status);
+    }
+    return absl::OkStatus();
+  }
+
   if (field->cpp_type() == ::google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
     for (int i = 0; i < PotentiallyRepeatedFieldSize(message, field); i++) {
       const auto& submessage = GetPotentiallyRepeatedMessage(message, field, i);
@@ -134,5 +160,24 @@ absl::Status ValidateResource(const Message& resource,
                                  primitive_handler);
 }
 
+absl::Status ValidateResource(const Message& resource,
+                              const PrimitiveHandler* primitive_handler,
+                              int num_threads) {
+  return ValidateFhirConstraints(resource, resource.GetDescriptor()->name(),
+                                 primitive_handler, num_threads);
+}
+
+absl::Status ValidateResourceWithFhirPath(
+    const Message& resource, const PrimitiveHandler* primitive_handler,
+    fhir_path::FhirPathValidator* message_validator, int num_threads) {
+  FHIR_RETURN_IF_ERROR(ValidateFhirConstraints(
+      resource, resource.GetDescriptor()->name(), primitive_handler,
+      num_threads));
+  fhir_path::BatchOptions options;
+  options.num_threads = num_threads;
+  return message_validator->Validate(resource, options)
+      .LegacyValidationResult();
+}
+
 }  // namespace fhir
 }  // namespace google
@@ -39,6 +39,21 @@ namespace fhir {
     const PrimitiveHandler* primitive_handler,
     fhir_path::FhirPathValidator* message_validator);
 
+// Like ValidateResource, but validates the elements of the resource's repeated
+// fields, e.g. the entries of a Bundle, on up to num_threads threads. Returns
+// the same status as ValidateResource.
+::absl::Status ValidateResource(const ::google::protobuf::Message& resource,
+                                const PrimitiveHandler* primitive_handler,
+                                int num_threads);
+
+// Like ValidateResourceWithFhirPath, but validates the elements of the
+// resource's repeated fields on up to num_threads threads. Returns the same
+// status as ValidateResourceWithFhirPath.
+::absl::Status ValidateResourceWithFhirPath(
+    const ::google::protobuf::Message& resource,
+    const PrimitiveHandler* primitive_handler,
+    fhir_path::FhirPathValidator* message_validator, int num_threads);
+
 }  // namespace fhir
 }  // namespace google
 
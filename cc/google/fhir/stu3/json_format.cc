@@ -37,7 +37,7 @@ const Printer* GetPrinter() {
 
 }  // namespace
 
-absl::Status MergeJsonFhirStringIntoProto(const std::string& raw_json,
+absl::Status MergeJsonFhirStringIntoProto(absl::string_view raw_json,
                                           google::protobuf::Message* target,
                                           absl::TimeZone default_timezone,
                                           const bool validate) {
@@ -45,6 +45,39 @@ absl::Status MergeJsonFhirStringIntoProto(const std::string& raw_json,
                                                    default_timezone, validate);
 }
 
+absl::Status MergeJsonFhirStringIntoProto(const absl::Cord& raw_json,
+                                          google::protobuf::Message* target,
+                                          absl::TimeZone default_timezone,
+                                          const bool validate) {
+  return GetParser()->MergeJsonFhirStringIntoProto(raw_json, target,
+                                                   default_timezone, validate);
+}
+
+absl::Status MergeJsonFhirBundleIntoProto(absl::string_view raw_json,
+                                          google::protobuf::Message* bundle,
+                                          absl::TimeZone default_timezone,
+                                          const bool validate,
+                                          int num_threads) {
+  return GetParser()->MergeJsonFhirBundleIntoProto(
+      raw_json, bundle, default_timezone, validate, num_threads);
+}
+
+absl::Status MergeJsonFhirStringIntoContainedResource(
+    absl::string_view raw_json,
+    google::protobuf::Message* contained_resource,
+    absl::TimeZone default_timezone, const bool validate) {
+  return GetParser()->MergeJsonFhirStringIntoContainedResource(
+      raw_json, contained_resource, default_timezone, validate);
+}
+
+absl::StatusOr<std::unique_ptr<google::protobuf::Message>>
+JsonFhirStringToResource(absl::string_view raw_json,
+                         const absl::TimeZone default_timezone,
+                         const bool validate) {
+  return GetParser()->JsonFhirStringToResource(raw_json, default_timezone,
+                                               validate);
+}
+
 absl::StatusOr<std::string> PrintFhirPrimitive(
     const ::google::protobuf::Message& message) {
   return GetPrinter()->PrintFhirPrimitive(message);
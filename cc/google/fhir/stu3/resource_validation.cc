@@ -33,6 +33,13 @@ absl::Status ValidateResourceWithFhirPath(const ::google::protobuf::Message& res
       resource, Stu3PrimitiveHandler::GetInstance(), GetFhirPathValidator());
 }
 
+absl::Status ValidateResourceWithFhirPath(const ::google::protobuf::Message& resource,
+                                          int num_threads) {
+  return ValidateResourceWithFhirPath(
+      resource, Stu3PrimitiveHandler::GetInstance(), GetFhirPathValidator(),
+      num_threads);
+}
+
 }  // namespace stu3
 }  // namespace fhir
 }  // namespace google
@@ -28,6 +28,12 @@ namespace stu3 {
 
 ::absl::Status ValidateResourceWithFhirPath(const ::google::protobuf::Message& resource);
 
+// Like ValidateResourceWithFhirPath, but validates the elements of the
+// resource's repeated fields, e.g. the entries of a Bundle, on up to
+// num_threads threads.
+::absl::Status ValidateResourceWithFhirPath(const ::google::protobuf::Message& resource,
+                                            int num_threads);
+
 }  // namespace stu3
 }  // namespace fhir
 }  // namespace google
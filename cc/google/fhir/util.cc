@@ -24,6 +24,7 @@
 #include "google/protobuf/reflection.h"
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
+#include "absl/strings/match.h"
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/time/time.h"
@@ -105,7 +106,7 @@ bool ResourceHasId(const Message& message) {
 }
 
 absl::Status SetPrimitiveStringValue(::google::protobuf::Message* primitive,
-                                     const std::string& value) {
+                                     absl::string_view value) {
   const FieldDescriptor* value_field =
       primitive->GetDescriptor()->FindFieldByName("value");
   if (!value_field || value_field->is_repeated() ||
@@ -114,7 +115,8 @@ absl::Status SetPrimitiveStringValue(::google::protobuf::Message* primitive,
         absl::StrCat("Not a valid String-type primitive: ",
                      primitive->GetDescriptor()->full_name()));
   }
-  primitive->GetReflection()->SetString(primitive, value_field, value);
+  primitive->GetReflection()->SetString(primitive, value_field,
+                                        std::string(value));
   return absl::OkStatus();
 }
 
@@ -148,6 +150,110 @@ absl::StatusOr<std::string> GetPrimitiveStringValue(
   return result;
 }
 
+absl::string_view BundleIndex::ResourceType(const Descriptor* descriptor) {
+  static constexpr absl::string_view kCorePrefix =
+      "http://hl7.org/fhir/StructureDefinition/";
+  for (const std::string& profile_base :
+       GetDescriptorTraits(descriptor).profile_bases) {
+    if (absl::StartsWith(profile_base, kCorePrefix)) {
+      return absl::string_view(profile_base).substr(kCorePrefix.size());
+    }
+  }
+  return descriptor->name();
+}
+
+BundleIndex::BundleIndex(const Message& bundle) {
+  const FieldDescriptor* entry_field =
+      bundle.GetDescriptor()->FindFieldByName("entry");
+  if (entry_field == nullptr || !entry_field->is_repeated() ||
+      entry_field->message_type() == nullptr) {
+    return;
+  }
+  const Descriptor* entry_descriptor = entry_field->message_type();
+  const FieldDescriptor* resource_field =
+      entry_descriptor->FindFieldByName("resource");
+  const FieldDescriptor* full_url_field =
+      entry_descriptor->FindFieldByName("full_url");
+  if (resource_field == nullptr || resource_field->message_type() == nullptr) {
+    return;
+  }
+  const ::google::protobuf::OneofDescriptor* resource_oneof =
+      resource_field->message_type()->FindOneofByName("oneof_resource");
+  if (resource_oneof == nullptr) {
+    return;
+  }
+
+  const ::google::protobuf::Reflection* reflection = bundle.GetReflection();
+  const int entry_count = reflection->FieldSize(bundle, entry_field);
+  by_full_url_.reserve(entry_count);
+  std::string scratch;
+  for (int i = 0; i < entry_count; i++) {
+    const Message& entry =
+        reflection->GetRepeatedMessage(bundle, entry_field, i);
+    const ::google::protobuf::Reflection* entry_reflection = entry.GetReflection();
+    if (!entry_reflection->HasField(entry, resource_field)) {
+      continue;
+    }
+    const Message& contained =
+        entry_reflection->GetMessage(entry, resource_field);
+    const FieldDescriptor* field =
+        contained.GetReflection()->GetOneofFieldDescriptor(contained,
+                                                           resource_oneof);
+    if (field == nullptr) {
+      continue;
+    }
+    const Message* resource =
+        &contained.GetReflection()->GetMessage(contained, field);
+
+    TypeIndex& type_index =
+        by_type_[ResourceType(resource->GetDescriptor())];
+    type_index.resources.push_back(resource);
+    size_++;
+    absl::StatusOr<std::string> id = GetResourceId(*resource);
+    if (id.ok() && !id.value().empty()) {
+      type_index.by_id.emplace(std::move(id).value(), resource);
+    }
+
+    if (full_url_field != nullptr &&
+        entry_reflection->HasField(entry, full_url_field)) {
+      absl::StatusOr<std::string> full_url = GetPrimitiveStringValue(
+          entry_reflection->GetMessage(entry, full_url_field), &scratch);
+      if (full_url.ok() && !full_url.value().empty()) {
+        by_full_url_.emplace(std::move(full_url).value(), resource);
+      }
+    }
+  }
+}
+
+const Message* BundleIndex::Find(absl::string_view reference) const {
+  auto full_url = by_full_url_.find(reference);
+  if (full_url != by_full_url_.end()) {
+    return full_url->second;
+  }
+
+  const size_t slash = reference.find('/');
+  if (slash == absl::string_view::npos) {
+    return nullptr;
+  }
+  absl::string_view id = reference.substr(slash + 1);
+  const size_t history = id.find("/_history/");
+  if (history != absl::string_view::npos) {
+    id = id.substr(0, history);
+  }
+  return Find(reference.substr(0, slash), id);
+}
+
+const Message* BundleIndex::Find(absl::string_view resource_type,
+                                 absl::string_view id) const {
+  auto type_index = by_type_.find(resource_type);
+  if (type_index == by_type_.end()) {
+    return nullptr;
+  }
+  auto resource = type_index->second.by_id.find(id);
+  return resource == type_index->second.by_id.end() ? nullptr
+                                                    : resource->second;
+}
+
 std::string ToSnakeCase(absl::string_view input) {
   bool was_not_underscore = false;  // Initialize to false for case 1 (below)
   bool was_not_cap = false;
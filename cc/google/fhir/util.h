@@ -23,7 +23,7 @@
 #include <string>
 #include <type_traits>
 #include <utility>
-
+#include <vector>
 
 #include "google/protobuf/any.pb.h"
 #include "google/protobuf/descriptor.pb.h"
@@ -31,6 +31,7 @@
 #include "google/protobuf/message.h"
 #include "google/protobuf/reflection.h"
 #include "absl/base/macros.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/status/status.h"
 #include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
@@ -201,7 +202,7 @@ GetResourceExtensionsFromBundleEntry(const EntryLike& entry) {
 }
 
 absl::Status SetPrimitiveStringValue(::google::protobuf::Message* primitive,
-                                     const std::string& value);
+                                     absl::string_view value);
 absl::StatusOr<std::string> GetPrimitiveStringValue(
     const ::google::protobuf::Message& primitive, std::string* scratch);
 absl::StatusOr<std::string> GetPrimitiveStringValue(
@@ -209,6 +210,9 @@ absl::StatusOr<std::string> GetPrimitiveStringValue(
     std::string* scratch);
 
 // Finds a resource of a templatized type within a bundle, by reference id.
+// This scans the entries of the bundle, which is cheaper than indexing them for
+// a single lookup; callers that look up several resources of the same bundle
+// should build a BundleIndex and use the overload that takes it.
 template <typename R, typename BundleLike, typename ReferenceIdLike>
 absl::Status GetResourceByReferenceId(const BundleLike& bundle,
                                       const ReferenceIdLike& reference_id,
@@ -248,9 +252,93 @@ absl::Status GetResourceByReferenceId(const BundleLike& bundle,
     }
   }
 
-  return ::absl::NotFoundError(absl::StrCat(
-      "No matching resource in bundle.\nReference:", reference_id.value(),
-      "\nBundle:\n", bundle.DebugString()));
+  return ::absl::NotFoundError(
+      absl::StrCat("No ", R::descriptor()->name(), " with id ",
+                   reference_id.value(), " in bundle."));
+}
+
+// An index of the resources of a Bundle, by the fullUrl of their entry (which
+// includes "urn:uuid:..." urls) and by their type and id. Building the index
+// takes a single pass over the entries; lookups are constant time, which keeps
+// resolving every reference of a large Bundle linear in its size.
+//
+// Works with the Bundle of any FHIR version or profile. Resources are indexed
+// by their core FHIR type, so a profiled Patient is found as "Patient". If
+// several entries share a key, the first one wins. The Bundle must outlive the
+// index and must not be modified while the index is in use. The index is
+// immutable once built, so it may be shared between threads.
+class BundleIndex {
+ public:
+  explicit BundleIndex(const ::google::protobuf::Message& bundle);
+
+  BundleIndex(const BundleIndex&) = delete;
+  BundleIndex& operator=(const BundleIndex&) = delete;
+
+  // Returns the resource a reference string points to, or nullptr if it is not
+  // in the Bundle. The reference may be a fullUrl, e.g. "urn:uuid:...", or a
+  // relative reference, e.g. "Patient/123". Version specific references, e.g.
+  // "Patient/123/_history/2", resolve to the resource of the same type and id.
+  const ::google::protobuf::Message* Find(absl::string_view reference) const;
+
+  // Returns the resource with the given type name, e.g. "Patient", and id, or
+  // nullptr if it is not in the Bundle.
+  const ::google::protobuf::Message* Find(absl::string_view resource_type,
+                                absl::string_view id) const;
+
+  // Returns the resource of type R with the given id, or NotFound.
+  template <typename R>
+  absl::StatusOr<const R*> Get(absl::string_view id) const {
+    const ::google::protobuf::Message* resource =
+        Find(ResourceType(R::descriptor()), id);
+    if (resource == nullptr || resource->GetDescriptor() != R::descriptor()) {
+      return ::absl::NotFoundError(absl::StrCat(
+          "No ", R::descriptor()->name(), " with id ", id, " in bundle."));
+    }
+    return dynamic_cast<const R*>(resource);
+  }
+
+  // Returns all resources of type R, in the order of their entries.
+  template <typename R>
+  std::vector<const R*> GetAll() const {
+    std::vector<const R*> result;
+    auto iter = by_type_.find(ResourceType(R::descriptor()));
+    if (iter != by_type_.end()) {
+      for (const ::google::protobuf::Message* resource : iter->second.resources) {
+        if (resource->GetDescriptor() == R::descriptor()) {
+          result.push_back(dynamic_cast<const R*>(resource));
+        }
+      }
+    }
+    return result;
+  }
+
+  // Returns the number of indexed resources.
+  size_t size() const { return size_; }
+
+ private:
+  // Returns the name of the core FHIR resource type of the descriptor, e.g.
+  // "Patient" for Patient and for the profiles of Patient.
+  static absl::string_view ResourceType(
+      const ::google::protobuf::Descriptor* descriptor);
+
+  struct TypeIndex {
+    std::vector<const ::google::protobuf::Message*> resources;
+    absl::flat_hash_map<std::string, const ::google::protobuf::Message*> by_id;
+  };
+
+  absl::flat_hash_map<std::string, TypeIndex> by_type_;
+  absl::flat_hash_map<std::string, const ::google::protobuf::Message*> by_full_url_;
+  size_t size_ = 0;
+};
+
+// Finds a resource of a templatized type within an indexed bundle, by
+// reference id.
+template <typename R, typename ReferenceIdLike>
+absl::Status GetResourceByReferenceId(const BundleIndex& index,
+                                      const ReferenceIdLike& reference_id,
+                                      const R** output) {
+  FHIR_ASSIGN_OR_RETURN(*output, index.Get<R>(reference_id.value()));
+  return absl::OkStatus();
 }
 
 template <typename ContainedResourceLike>
@@ -191,6 +191,103 @@ TEST(GetPatient, StatusOr) {
   EXPECT_EQ(GetPatient(bundle).value()->id().value(), "5");
 }
 
+Bundle IndexedBundle() {
+  Bundle bundle;
+  Bundle::Entry* patient_entry = bundle.add_entry();
+  patient_entry->mutable_full_url()->set_value(
+      "urn:uuid:c757873d-ec9a-4326-a141-556f43239520");
+  patient_entry->mutable_resource()->mutable_patient()->mutable_id()->set_value(
+      "5");
+  bundle.add_entry()
+      ->mutable_resource()
+      ->mutable_encounter()
+      ->mutable_id()
+      ->set_value("6");
+  bundle.add_entry()
+      ->mutable_resource()
+      ->mutable_encounter()
+      ->mutable_id()
+      ->set_value("7");
+  return bundle;
+}
+
+TEST(BundleIndex, Find) {
+  const Bundle bundle = IndexedBundle();
+  const BundleIndex index(bundle);
+
+  EXPECT_EQ(index.size(), 3);
+  const Message* patient = &bundle.entry(0).resource().patient();
+  EXPECT_EQ(index.Find("urn:uuid:c757873d-ec9a-4326-a141-556f43239520"),
+            patient);
+  EXPECT_EQ(index.Find("Patient/5"), patient);
+  EXPECT_EQ(index.Find("Patient/5/_history/2"), patient);
+  EXPECT_EQ(index.Find("Patient", "5"), patient);
+  EXPECT_EQ(index.Find("Encounter/7"), &bundle.entry(2).resource().encounter());
+  EXPECT_EQ(index.Find("Encounter/5"), nullptr);
+  EXPECT_EQ(index.Find("Patient"), nullptr);
+  EXPECT_EQ(index.Find("urn:uuid:unknown"), nullptr);
+}
+
+TEST(BundleIndex, TypedAccessors) {
+  const Bundle bundle = IndexedBundle();
+  const BundleIndex index(bundle);
+
+  EXPECT_EQ(index.Get<Patient>("5").value(),
+            &bundle.entry(0).resource().patient());
+  EXPECT_EQ(index.Get<Patient>("6").status(),
+            ::absl::NotFoundError("No Patient with id 6 in bundle."));
+  EXPECT_EQ(index.GetAll<Encounter>().size(), 2);
+  EXPECT_TRUE(index.GetAll<AllergyIntolerance>().empty());
+
+  Reference reference;
+  reference.mutable_encounter_id()->set_value("6");
+  const Encounter* encounter = nullptr;
+  FHIR_ASSERT_OK(
+      GetResourceByReferenceId(index, reference.encounter_id(), &encounter));
+  EXPECT_EQ(encounter, &bundle.entry(1).resource().encounter());
+}
+
+TEST(BundleIndex, ProfiledBundle) {
+  r4::testing::Bundle bundle;
+  bundle.add_entry()
+      ->mutable_resource()
+      ->mutable_test_patient()
+      ->mutable_id()
+      ->set_value("5");
+  bundle.add_entry()
+      ->mutable_resource()
+      ->mutable_test_encounter()
+      ->mutable_id()
+      ->set_value("6");
+  const BundleIndex index(bundle);
+
+  const Message* patient = &bundle.entry(0).resource().test_patient();
+  EXPECT_EQ(index.size(), 2);
+  EXPECT_EQ(index.Find("Patient/5"), patient);
+  EXPECT_EQ(index.Find("Patient", "5"), patient);
+  EXPECT_EQ(index.Find("Encounter/6"),
+            &bundle.entry(1).resource().test_encounter());
+  EXPECT_EQ(index.Find("TestPatient/5"), nullptr);
+  EXPECT_EQ(index.Get<r4::testing::TestPatient>("5").value(), patient);
+  EXPECT_EQ(index.GetAll<r4::testing::TestEncounter>().size(), 1);
+
+  r4::core::Reference reference;
+  reference.mutable_patient_id()->set_value("5");
+  const r4::testing::TestPatient* test_patient = nullptr;
+  FHIR_ASSERT_OK(
+      GetResourceByReferenceId(index, reference.patient_id(), &test_patient));
+  EXPECT_EQ(test_patient, patient);
+}
+
+TEST(GetResourceByReferenceId, NotFound) {
+  const Bundle bundle = IndexedBundle();
+  Reference reference;
+  reference.mutable_patient_id()->set_value("6");
+  const Patient* patient = nullptr;
+  EXPECT_EQ(GetResourceByReferenceId(bundle, reference.patient_id(), &patient),
+            ::absl::NotFoundError("No Patient with id 6 in bundle."));
+}
+
 TEST(GetTypedContainedResource, Valid) {
   ContainedResource contained;
   contained.mutable_allergy_intolerance()->mutable_id()->set_value("47");
@@ -0,0 +1,217 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "google/fhir/warm_up.h"
+
+#include <string>
+#include <vector>
+
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/message.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "google/fhir/annotations.h"
+#include "google/fhir/codes.h"
+#include "google/fhir/fhir_path/fhir_path.h"
+#include "google/fhir/fhir_path/r4_fhir_path_validation.h"
+#include "google/fhir/fhir_path/stu3_fhir_path_validation.h"
+#include "google/fhir/json_format.h"
+#include "google/fhir/parallel.h"
+#include "google/fhir/profiles_lib.h"
+#include "google/fhir/r4/primitive_handler.h"
+#include "google/fhir/stu3/primitive_handler.h"
+#include "proto/r4/core/resources/bundle_and_contained_resource.pb.h"
+#include "proto/stu3/resources.pb.h"
+
+namespace google {
+namespace fhir {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::EnumDescriptor;
+using ::google::protobuf::FieldDescriptor;
+using ::google::protobuf::Message;
+
+namespace {
+
+// The message and enum types reachable from the fields of a message type.
+struct ReachableTypes {
+  std::vector<const Descriptor*> messages;
+  std::vector<const EnumDescriptor*> enums;
+};
+
+ReachableTypes FindReachableTypes(const Descriptor* root) {
+  ReachableTypes types;
+  absl::flat_hash_set<const Descriptor*> seen_messages = {root};
+  absl::flat_hash_set<const EnumDescriptor*> seen_enums;
+  types.messages.push_back(root);
+  for (size_t i = 0; i < types.messages.size(); i++) {
+    const Descriptor* descriptor = types.messages[i];
+    for (int j = 0; j < descriptor->field_count(); j++) {
+      const FieldDescriptor* field = descriptor->field(j);
+      if (field->message_type() != nullptr &&
+          seen_messages.insert(field->message_type()).second) {
+        types.messages.push_back(field->message_type());
+      } else if (field->enum_type() != nullptr &&
+                 seen_enums.insert(field->enum_type()).second) {
+        types.enums.push_back(field->enum_type());
+      }
+    }
+  }
+  return types;
+}
+
+// Calls fn for each of the given types on up to num_threads threads, and adds
+// the time this took to the report.
+template <typename T, typename Function>
+void RunStage(absl::string_view name, const std::vector<T>& types,
+              int num_threads, const Function& fn, WarmUpReport* report) {
+  const absl::Time start = absl::Now();
+  ParallelForEach(types.size(), num_threads,
+                  [&](size_t index) { fn(types[index]); });
+  report->stages.push_back(
+      WarmUpReport::Stage{std::string(name),
+                          static_cast<int64_t>(types.size()),
+                          absl::Now() - start});
+}
+
+// Compiles the FHIRPath constraints annotated on the message type and its
+// fields, as FhirPathValidator does when it first sees the type.
+void CompileConstraints(const Descriptor* descriptor,
+                        const PrimitiveHandler* primitive_handler) {
+  const int message_constraints = descriptor->options().ExtensionSize(
+      proto::fhir_path_message_constraint);
+  for (int i = 0; i < message_constraints; i++) {
+    fhir_path::CompiledExpression::CompileCached(
+        descriptor, primitive_handler,
+        descriptor->options().GetExtension(
+            proto::fhir_path_message_constraint, i))
+        .status()
+        .IgnoreError();
+  }
+
+  for (int i = 0; i < descriptor->field_count(); i++) {
+    const FieldDescriptor* field = descriptor->field(i);
+    if (field->message_type() == nullptr) {
+      continue;
+    }
+    const int field_constraints =
+        field->options().ExtensionSize(proto::fhir_path_constraint);
+    for (int j = 0; j < field_constraints; j++) {
+      fhir_path::CompiledExpression::CompileCached(
+          field->message_type(), primitive_handler,
+          field->options().GetExtension(proto::fhir_path_constraint, j))
+          .status()
+          .IgnoreError();
+    }
+  }
+}
+
+}  // namespace
+
+WarmUpReport WarmUp(const Descriptor* root,
+                    const PrimitiveHandler* primitive_handler,
+                    fhir_path::FhirPathValidator* message_validator,
+                    const WarmUpOptions& options) {
+  WarmUpReport report;
+  const ReachableTypes types = FindReachableTypes(root);
+
+  RunStage(
+      "descriptors", types.messages, options.num_threads,
+      [](const Descriptor* descriptor) { GetDescriptorTraits(descriptor); },
+      &report);
+
+  RunStage(
+      "json_parser", types.messages, options.num_threads,
+      [](const Descriptor* descriptor) {
+        WarmUpJsonParser(descriptor);
+        if (IsProfile(descriptor)) {
+          profiles_internal::GetExtensionMap(descriptor);
+        }
+      },
+      &report);
+
+  RunStage(
+      "codes", types.enums, options.num_threads,
+      [](const EnumDescriptor* enum_type) {
+        for (int i = 0; i < enum_type->value_count(); i++) {
+          CodeStringToEnumValue(EnumValueToCodeString(enum_type->value(i)),
+                                enum_type)
+              .status()
+              .IgnoreError();
+        }
+      },
+      &report);
+
+  std::vector<const Descriptor*> primitives;
+  for (const Descriptor* descriptor : types.messages) {
+    if (IsPrimitive(descriptor)) {
+      primitives.push_back(descriptor);
+    }
+  }
+  RunStage(
+      "primitives", primitives, options.num_threads,
+      [primitive_handler](const Descriptor* descriptor) {
+        // Validating a primitive compiles the regex for its values.
+        const Message* prototype =
+            ::google::protobuf::MessageFactory::generated_factory()->GetPrototype(
+                descriptor);
+        if (prototype != nullptr) {
+          primitive_handler->ValidatePrimitive(*prototype).IgnoreError();
+        }
+      },
+      &report);
+
+  if (options.fhir_path_constraints) {
+    const absl::Time start = absl::Now();
+    ParallelForEach(types.messages.size(), options.num_threads,
+                    [&](size_t index) {
+                      CompileConstraints(types.messages[index],
+                                         primitive_handler);
+                    });
+
+    // Loads the now compiled constraints into the validator's own cache.
+    message_validator->LoadConstraints(root);
+    report.stages.push_back(WarmUpReport::Stage{
+        "fhir_path", static_cast<int64_t>(types.messages.size()),
+        absl::Now() - start});
+  }
+
+  return report;
+}
+
+absl::StatusOr<WarmUpReport> WarmUp(proto::FhirVersion version,
+                                    const WarmUpOptions& options) {
+  switch (version) {
+    case proto::STU3:
+      return WarmUp(stu3::proto::ContainedResource::descriptor(),
+                    stu3::Stu3PrimitiveHandler::GetInstance(),
+                    stu3::GetFhirPathValidator(), options);
+    case proto::R4:
+      return WarmUp(r4::core::ContainedResource::descriptor(),
+                    r4::R4PrimitiveHandler::GetInstance(),
+                    r4::GetFhirPathValidator(), options);
+    default:
+      return absl::InvalidArgumentError(
+          absl::StrCat("Unsupported FHIR version for WarmUp: ",
+                       proto::FhirVersion_Name(version)));
+  }
+}
+
+}  // namespace fhir
+}  // namespace google
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GOOGLE_FHIR_WARM_UP_H_
+#define GOOGLE_FHIR_WARM_UP_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "google/protobuf/descriptor.h"
+#include "absl/status/statusor.h"
+#include "absl/time/time.h"
+#include "google/fhir/fhir_path/fhir_path_validation.h"
+#include "google/fhir/primitive_handler.h"
+#include "proto/annotations.pb.h"
+
+namespace google {
+namespace fhir {
+
+struct WarmUpOptions {
+  // The number of threads each stage is split across. The calling thread does
+  // all of the work if this is 1 or less.
+  int num_threads = 1;
+
+  // Whether to compile the FHIRPath constraints of every type, which is by far
+  // the most expensive stage.
+  bool fhir_path_constraints = true;
+};
+
+// The time taken by each stage of a call to WarmUp.
+struct WarmUpReport {
+  struct Stage {
+    std::string name;
+    // The number of message or enum types the stage processed.
+    int64_t types;
+    absl::Duration duration;
+  };
+
+  std::vector<Stage> stages;
+};
+
+// Eagerly fills the per-type caches that are otherwise filled the first time
+// a type is parsed, printed or validated, for every message type reachable
+// from the fields of the given root (usually a ContainedResource):
+//   - "descriptors": the annotations of each type (see GetDescriptorTraits)
+//   - "json_parser": the JSON field name maps of the parser, and the profiled
+//     extension maps of profiles
+//   - "codes": the code string to enum value memos of every code type
+//   - "primitives": the value regexes of the primitive types
+//   - "fhir_path": the compiled FHIRPath constraints of message_validator,
+//     unless disabled in the options
+// message_validator must use primitive_handler. Calling this at startup keeps
+// the first requests of a process from paying for these. It may be called
+// concurrently with other work, and more than once.
+WarmUpReport WarmUp(const ::google::protobuf::Descriptor* root,
+                    const PrimitiveHandler* primitive_handler,
+                    fhir_path::FhirPathValidator* message_validator,
+                    const WarmUpOptions& options = WarmUpOptions());
+
+// Warms up the caches for all resources of the given FHIR version, using the
+// version's default primitive handler and FHIRPath validator. Returns
+// InvalidArgument for unsupported versions.
+absl::StatusOr<WarmUpReport> WarmUp(
+    proto::FhirVersion version, const WarmUpOptions& options = WarmUpOptions());
+
+}  // namespace fhir
+}  // namespace google
+
+#endif  // GOOGLE_FHIR_WARM_UP_H_
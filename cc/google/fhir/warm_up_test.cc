@@ -0,0 +1,92 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "google/fhir/warm_up.h"
+
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "google/fhir/fhir_path/fhir_path_validation.h"
+#include "google/fhir/r4/primitive_handler.h"
+#include "proto/annotations.pb.h"
+#include "proto/r4/core/resources/bundle_and_contained_resource.pb.h"
+#include "proto/r4/core/resources/observation.pb.h"
+#include "proto/r4/core/resources/patient.pb.h"
+
+namespace google {
+namespace fhir {
+
+namespace {
+
+using ::testing::ElementsAre;
+
+std::vector<std::string> StageNames(const WarmUpReport& report) {
+  std::vector<std::string> names;
+  for (const WarmUpReport::Stage& stage : report.stages) {
+    names.push_back(stage.name);
+  }
+  return names;
+}
+
+TEST(WarmUpTest, ReportsEachStage) {
+  WarmUpOptions options;
+  options.num_threads = 4;
+  absl::StatusOr<WarmUpReport> report = WarmUp(proto::R4, options);
+  ASSERT_TRUE(report.ok()) << report.status();
+
+  EXPECT_THAT(StageNames(*report),
+              ElementsAre("descriptors", "json_parser", "codes", "primitives",
+                          "fhir_path"));
+  for (const WarmUpReport::Stage& stage : report->stages) {
+    EXPECT_GT(stage.types, 0) << stage.name;
+  }
+}
+
+TEST(WarmUpTest, SkipsFhirPathConstraints) {
+  WarmUpOptions options;
+  options.fhir_path_constraints = false;
+  absl::StatusOr<WarmUpReport> report = WarmUp(proto::STU3, options);
+  ASSERT_TRUE(report.ok()) << report.status();
+
+  EXPECT_THAT(StageNames(*report), ElementsAre("descriptors", "json_parser",
+                                               "codes", "primitives"));
+}
+
+TEST(WarmUpTest, LoadsFhirPathConstraints) {
+  fhir_path::FhirPathValidator validator(r4::R4PrimitiveHandler::GetInstance());
+  ASSERT_FALSE(validator.HasLoadedConstraints(
+      r4::core::ContainedResource::descriptor()));
+
+  WarmUp(r4::core::ContainedResource::descriptor(),
+         r4::R4PrimitiveHandler::GetInstance(), &validator);
+
+  EXPECT_TRUE(validator.HasLoadedConstraints(
+      r4::core::ContainedResource::descriptor()));
+  EXPECT_TRUE(validator.HasLoadedConstraints(r4::core::Patient::descriptor()));
+  EXPECT_TRUE(
+      validator.HasLoadedConstraints(r4::core::Observation::descriptor()));
+}
+
+TEST(WarmUpTest, UnsupportedVersion) {
+  EXPECT_FALSE(WarmUp(proto::DSTU2).ok());
+}
+
+}  // namespace
+
+}  // namespace fhir
+}  // namespace google